@@ -29,6 +29,8 @@
 #include "string_util.h"
 #include "log.h"
 #include "minmax.h"
+#include "metrics.h"
+#include <stdio.h>
 #include <time.h>
 
 
@@ -97,6 +99,12 @@ struct _Cache {
 	int		 nr_collide;
 	size_t		 nr_entries;
 #endif
+
+	// Exported metrics (see Cache_SetName)
+	Metrics_Id	 m_hit;
+	Metrics_Id	 m_miss;
+	Metrics_Id	 m_expired;
+	Metrics_Id	 m_evicted;
 };
 
 
@@ -154,6 +162,7 @@ cache_get (Cache* cache, const char* key, bool* hit)
 				    "CACHE_COLLIDE (old='%s', new='%s')",
 				    ce->key, key);
 			cache->nr_collide++;
+			Metrics_Add (cache->m_evicted, 1);
 			talloc_free (ce->key);
 		} else {
 			cache->nr_entries++;
@@ -207,6 +216,7 @@ cache_expire_entries (Cache* cache, time_t const now)
 				talloc_free (ce->key);
 				ce->key = NULL;
 				cache->nr_entries--;
+				Metrics_Add (cache->m_evicted, 1);
 			}
 	
 		}
@@ -229,6 +239,7 @@ cache_expire_entries (Cache* cache, time_t const now)
 							(ce->key, ce->data);
 					ce->data = NULL;
 					talloc_free (ce);
+					Metrics_Add (cache->m_evicted, 1);
 				}
 			}
 		}
@@ -266,10 +277,12 @@ Cache_Get (Cache* cache, const char* key)
 		if (cache->max_age == 0 || now <= ce->rip) {
 			Log_Printf (LOG_DEBUG, "CACHE_HIT (key='%s')", key);
 			cache->nr_hit++;
+			Metrics_Add (cache->m_hit, 1);
 		} else {
 			Log_Printf (LOG_DEBUG, "CACHE_EXPIRED (key='%s')",
 				    key);
 			cache->nr_expired++;
+			Metrics_Add (cache->m_expired, 1);
 			if (cache->free_expired_data)
 				cache->free_expired_data (ce->key, ce->data);
 			ce->rip  = now + cache->max_age;
@@ -277,6 +290,7 @@ Cache_Get (Cache* cache, const char* key)
 		}
 	} else {
 		Log_Printf (LOG_DEBUG, "CACHE_NEW (key='%s')", key);
+		Metrics_Add (cache->m_miss, 1);
 		ce->rip  = now + cache->max_age;
 		ce->data = NULL;
 		cache_expire_entries (cache, now);
@@ -316,6 +330,41 @@ _Cache_PurgeExpiredEntries (Cache* cache)
 }
 
 
+/*****************************************************************************
+ * Cache_SetName
+ *****************************************************************************/
+void
+Cache_SetName (Cache* cache, const char* name)
+{
+	if (cache == NULL || name == NULL)
+		return; // ---------->
+
+	static const char* const LOOKUPS_HELP = 
+		"Number of cache lookups, by result";
+	char labels [128];
+	snprintf (labels, sizeof (labels), 
+		  "cache=\"%s\",result=\"hit\"", name);
+	cache->m_hit = Metrics_Register (METRICS_COUNTER, 
+					 "djmount_cache_lookups_total",
+					 LOOKUPS_HELP, labels);
+	snprintf (labels, sizeof (labels), 
+		  "cache=\"%s\",result=\"miss\"", name);
+	cache->m_miss = Metrics_Register (METRICS_COUNTER, 
+					  "djmount_cache_lookups_total",
+					  LOOKUPS_HELP, labels);
+	snprintf (labels, sizeof (labels), 
+		  "cache=\"%s\",result=\"expired\"", name);
+	cache->m_expired = Metrics_Register (METRICS_COUNTER, 
+					     "djmount_cache_lookups_total",
+					     LOOKUPS_HELP, labels);
+	snprintf (labels, sizeof (labels), "cache=\"%s\"", name);
+	cache->m_evicted = Metrics_Register 
+		(METRICS_COUNTER, "djmount_cache_evictions_total",
+		 "Number of cache entries removed (expired or replaced)", 
+		 labels);
+}
+
+
 /*****************************************************************************
  * Cache_GetStatusString
  *****************************************************************************/
@@ -401,6 +450,10 @@ Cache_Create (void* talloc_context, size_t size, time_t max_age,
 		.max_age 	   = max_age,
 		.next_clean	   = 0,
 		.free_expired_data = free_expired_data,
+		.m_hit		   = METRICS_NONE,
+		.m_miss		   = METRICS_NONE,
+		.m_expired	   = METRICS_NONE,
+		.m_evicted	   = METRICS_NONE,
 		// other data initialized to 0
 	};  
 #if CACHE_FIXED_SIZE
@@ -111,6 +111,14 @@ _Cache_PurgeExpiredEntries (Cache* cache);
 #endif
 
 
+/*****************************************************************************
+ * @brief Exports the statistics of the cache as metrics, labelled with
+ *	  a name (e.g. "browse") ; metrics are counted from this call.
+ *****************************************************************************/
+void
+Cache_SetName (Cache* cache, const char* name);
+
+
 /*****************************************************************************
  * @brief Returns a string describing the state of the cache.
  * 	  The returned string should be freed using "talloc_free".
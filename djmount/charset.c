@@ -29,6 +29,7 @@
 
 #include "log.h"
 #include "talloc_util.h"
+#include "string_util.h"
 #include <string.h>
 #include <stdbool.h>
 #include <errno.h>
@@ -44,6 +45,7 @@
 
 #ifdef HAVE_ICONV
 #	include <iconv.h>
+#	include <pthread.h>
 #	include <upnp/ithread.h>
 #else
 #	include "charset_internal.h"
@@ -57,9 +59,19 @@ static enum {
 
 } g_state = NOT_INITIALIZED;
 
+// True if ASCII strings are unchanged by the conversions (this is the
+// case for UTF-8 and all 8-bit charsets) : they are then not converted.
+static bool g_ascii_compatible = false;
+
 
 #ifdef HAVE_ICONV
 
+/*
+ * Each thread opens its own conversion descriptors on first use, so that
+ * conversions in the FUSE threads run in parallel without locking.
+ * The shared descriptor of each Converter, protected by its mutex, is 
+ * only used if a thread can't open its own.
+ */
 typedef struct _Converter {
 	iconv_t cd;
 	ithread_mutex_t mutex;
@@ -70,16 +82,25 @@ static Converter g_converters[] = {
 	[CHARSET_FROM_UTF8] = { .cd = (iconv_t) -1, .to_utf8 = false },
 };
 
+#define NB_DIRECTIONS	(sizeof(g_converters)/sizeof(g_converters[0]))
+
+typedef struct _ThreadDescriptors {
+	iconv_t cd [NB_DIRECTIONS];
+} ThreadDescriptors;
+
+static char		g_charset [128] = "";
+static pthread_key_t	g_thread_key;
+static bool		g_thread_key_created = false;
+
 #else
 
 typedef const struct _Converter {
-	size_t (*size) (const char* src);
 	int (*convert) (const char** inbuf, size_t* inbytesleft,
 			char** outbuf, size_t* outbytesleft);
 } Converter;
 static Converter g_converters[] = {
-	[CHARSET_TO_UTF8]   = { ascii2utf_size, ascii2utf },
-	[CHARSET_FROM_UTF8] = { utf2ascii_size, utf2ascii },
+	[CHARSET_TO_UTF8]   = { ascii2utf },
+	[CHARSET_FROM_UTF8] = { utf2ascii },
 };
 
 #endif
@@ -87,6 +108,108 @@ static Converter g_converters[] = {
 static const int NB_CONVERTERS =  sizeof(g_converters)/sizeof(g_converters[0]);
 
 
+#ifdef HAVE_ICONV
+
+/*****************************************************************************
+ * Per-thread descriptors
+ *****************************************************************************/
+static iconv_t
+OpenDescriptor (int dir)
+{
+	return (dir == CHARSET_TO_UTF8 ? iconv_open ("UTF-8", g_charset) 
+		: iconv_open (g_charset, "UTF-8"));
+}
+
+static void
+DestroyThreadDescriptors (void* data)
+{
+	ThreadDescriptors* const td = data;
+	if (td) {
+		size_t i;
+		for (i = 0; i < NB_DIRECTIONS; i++) {
+			if (td->cd[i] != (iconv_t) -1)
+				(void) iconv_close (td->cd[i]);
+		}
+		free (td);
+	}
+}
+
+static iconv_t
+GetThreadDescriptor (int dir)
+{
+	if (! g_thread_key_created)
+		return (iconv_t) -1; // ---------->
+	ThreadDescriptors* td = pthread_getspecific (g_thread_key);
+	if (td == NULL) {
+		// Use malloc : freed by the thread exit, outside talloc tree
+		td = malloc (sizeof (ThreadDescriptors));
+		if (td == NULL)
+			return (iconv_t) -1; // ---------->
+		size_t i;
+		for (i = 0; i < NB_DIRECTIONS; i++)
+			td->cd[i] = (iconv_t) -1;
+		if (pthread_setspecific (g_thread_key, td) != 0) {
+			free (td);
+			return (iconv_t) -1; // ---------->
+		}
+	}
+	if (td->cd[dir] == (iconv_t) -1)
+		td->cd[dir] = OpenDescriptor (dir);
+	return td->cd[dir];
+}
+
+/*
+ * Returns the descriptor to use for a conversion, and resets its state.
+ * Must be released with ReleaseDescriptor.
+ */
+static iconv_t
+AcquireDescriptor (Converter* const cvt, int dir)
+{
+	iconv_t cd = GetThreadDescriptor (dir);
+	if (cd == (iconv_t) -1) {
+		ithread_mutex_lock (&cvt->mutex);
+		cd = cvt->cd;
+	}
+	(void) iconv (cd, NULL, NULL, NULL, NULL);
+	return cd;
+}
+
+static void
+ReleaseDescriptor (Converter* const cvt, iconv_t cd)
+{
+	if (cd == cvt->cd)
+		ithread_mutex_unlock (&cvt->mutex);
+}
+
+#endif // HAVE_ICONV
+
+
+/*****************************************************************************
+ * CheckASCIICompatible
+ *	Returns true if all ASCII characters are unchanged by conversions.
+ *****************************************************************************/
+static bool
+CheckASCIICompatible (void)
+{
+	char ascii [128];
+	int i;
+	for (i = 1; i < 128; i++)
+		ascii[i-1] = i;
+	ascii[127] = NUL;
+
+	bool ok = true;
+	for (i = 0; i < NB_CONVERTERS && ok; i++) {
+		char* const res = Charset_ConvertString (i, ascii, NULL, 0, 
+							 NULL);
+		ok = (res && strcmp (res, ascii) == 0);
+		if (res != ascii)
+			talloc_free (res);
+	}
+	return ok;
+}
+
+
+
 
 
 /*****************************************************************************
@@ -185,20 +308,22 @@ Charset_Initialize (const char* charset)
 	
 #ifdef HAVE_ICONV
 	if (!utf8) {
+		strncpy (g_charset, charset, sizeof (g_charset) - 1);
+		g_charset [sizeof (g_charset) - 1] = NUL;
 		int i;
 		for (i = 0; i < NB_CONVERTERS; i++) {
 			Converter* const cvt = g_converters + i;
-			if (i == CHARSET_TO_UTF8)
-				cvt->cd = iconv_open ("UTF-8", charset);
-			else if ( i == CHARSET_FROM_UTF8)
-				cvt->cd = iconv_open (charset, "UTF-8");
-			else
-				rc = ENOSYS;
+			cvt->cd = OpenDescriptor (i);
 			if (cvt->cd == (iconv_t) -1)
 				rc = errno;
 			if (rc == 0) 
 				ithread_mutex_init (&cvt->mutex, NULL);
 		}
+		if (rc == 0)
+			g_thread_key_created = (pthread_key_create 
+						(&g_thread_key, 
+						 DestroyThreadDescriptors) 
+						== 0);
 	}
 #else
 	if (init_charset (charset) == 0)
@@ -214,6 +339,12 @@ Charset_Initialize (const char* charset)
 			    "Charset : successfully initialised charset='%s'",
 			    NN(charset));
 		g_state = (utf8 ? INITIALIZED_UTF8 : INITIALIZED_NOT_UTF8);
+		if (! utf8) {
+			g_ascii_compatible = CheckASCIICompatible();
+			Log_Printf (LOG_DEBUG, "Charset : ASCII %s", 
+				    (g_ascii_compatible ? "compatible" 
+				     : "not compatible"));
+		}
 	}
 	return rc;
 }
@@ -235,13 +366,19 @@ Charset_IsConverting()
  *	character sequences internally.
  *	Returns 0 if ok, or E2BIG if insufficient output space.
  *****************************************************************************/
+#ifdef HAVE_ICONV
+typedef iconv_t Descriptor;
+#else
+typedef void*	Descriptor;
+#endif
+
 static int
-convert (Converter* const cvt,
+convert (Converter* const cvt, Descriptor const cd,
 	 const char** const inbuf, size_t* const inbytesleft,
 	 char** const outbuf, size_t* const outbytesleft)
 {
 #ifdef HAVE_ICONV
-	if (iconv (cvt->cd, (ICONV_CONST char**) inbuf, inbytesleft, 
+	if (iconv (cd, (ICONV_CONST char**) inbuf, inbytesleft, 
 		   outbuf, outbytesleft) != (size_t) -1) 
 		return 0; // ---------->
 	if (errno != EILSEQ && errno != EINVAL) 
@@ -265,7 +402,7 @@ convert (Converter* const cvt,
 		const char ERROR_CHAR = '?';
 		const char* ibuf = &ERROR_CHAR;
 		size_t ileft = 1;
-		if (iconv (cvt->cd, (ICONV_CONST char**) &ibuf, &ileft, 
+		if (iconv (cd, (ICONV_CONST char**) &ibuf, &ileft, 
 			   outbuf, outbytesleft) == (size_t) -1 || ileft > 0) {
 			if (errno == E2BIG || *outbytesleft < 1)
 				return E2BIG; // ---------->
@@ -311,13 +448,17 @@ Charset_ConvertString (Charset_Direction dir, const char* const str,
 
 	if (dir < 0 || dir >= NB_CONVERTERS)
 		return NULL; // ----------> 
+	// Fast path : most names are pure ASCII
+	if (g_ascii_compatible && String_IsASCII (str))
+		return (char*) str; // ---------->
 	Converter* const cvt = g_converters + dir;
 
 	char* result = NULL;
 
 #ifdef HAVE_ICONV
-	ithread_mutex_lock (&cvt->mutex);
-	(void) iconv (cvt->cd, NULL, NULL, NULL, NULL);
+	iconv_t const cd = AcquireDescriptor (cvt, dir);
+#else
+	Descriptor const cd = NULL;
 #endif
 
 
@@ -329,9 +470,14 @@ Charset_ConvertString (Charset_Direction dir, const char* const str,
 #else
 	size_t inbytesleft = strlen(str) + 1; // convert _including_ final '\0'
 	const size_t extra = 0; // no need for extra bytes after conversion
-	const size_t needed_size = cvt->size (str); // exact size
-	if (bufsize < needed_size) 
-		buffer = NULL; // don't bother trying buffer if too small
+	/*
+	 * Conversions from UTF-8 never make the string longer.
+	 * Conversions to UTF-8 at most triple its length, but mostly 
+	 * keep it : try the initial buffer anyway, and grow the result
+	 * in the conversion loop if needed (no separate sizing pass).
+	 */
+	const size_t needed_size = (cvt->convert == ascii2utf ? 
+				    inbytesleft * 2 : inbytesleft);
 #endif
 	result = buffer;
 	if (buffer == NULL) {
@@ -344,7 +490,7 @@ Charset_ConvertString (Charset_Direction dir, const char* const str,
 	size_t outbytesleft = bufsize;
 
 	while (inbytesleft > 0) {
-		int save_errno = convert (cvt,
+		int save_errno = convert (cvt, cd,
 					  &inbuf, &inbytesleft,
 					  &outbuf, &outbytesleft);
 		if (save_errno != 0 && save_errno != E2BIG) {
@@ -379,7 +525,7 @@ Charset_ConvertString (Charset_Direction dir, const char* const str,
 	
 #ifdef HAVE_ICONV
 	// Flush iconv conversion
-	(void) iconv (cvt->cd, NULL, NULL, &outbuf, &outbytesleft);
+	(void) iconv (cd, NULL, NULL, &outbuf, &outbytesleft);
 
 	/* Terminate string.
 	 * Note: not all charsets can be nul-terminated with a single nul byte.
@@ -403,7 +549,7 @@ Charset_ConvertString (Charset_Direction dir, const char* const str,
 	}
 FAIL:
 #ifdef HAVE_ICONV
-	ithread_mutex_unlock (&cvt->mutex);
+	ReleaseDescriptor (cvt, cd);
 #endif
 	return result;
 }
@@ -423,11 +569,14 @@ Charset_PrintString (Charset_Direction dir, const char* const str,
 
 	if (dir < 0 || dir >= NB_CONVERTERS)
 		return EOF; // ----------> 
+	if (g_ascii_compatible && String_IsASCII (str))
+		return fputs (str, stream); // ---------->
 	Converter* const cvt = g_converters + dir;
 
 #ifdef HAVE_ICONV
-	ithread_mutex_lock (&cvt->mutex);
-	(void) iconv (cvt->cd, NULL, NULL, NULL, NULL);
+	iconv_t const cd = AcquireDescriptor (cvt, dir);
+#else
+	Descriptor const cd = NULL;
 #endif
 	int rc = 0;
 
@@ -441,7 +590,7 @@ Charset_PrintString (Charset_Direction dir, const char* const str,
 	while (inbytesleft > 0) {
 		char* outbuf = buffer.bytes;
 		size_t outbytesleft = sizeof(buffer.bytes);
-		int save_errno = convert (cvt,
+		int save_errno = convert (cvt, cd,
 					  &inbuf, &inbytesleft,
 					  &outbuf, &outbytesleft);
 		if (outbuf > buffer.bytes) {
@@ -462,7 +611,7 @@ Charset_PrintString (Charset_Direction dir, const char* const str,
 		// Flush iconv conversion
 		char* outbuf = buffer.bytes;
 		size_t outbytesleft = sizeof(buffer.bytes);
-		(void) iconv (cvt->cd, NULL, NULL, &outbuf, &outbytesleft);
+		(void) iconv (cd, NULL, NULL, &outbuf, &outbytesleft);
 		if (outbuf > buffer.bytes) {
 			rc = fwrite (buffer.bytes, outbuf - buffer.bytes, 1, 
 				     stream);
@@ -470,7 +619,7 @@ Charset_PrintString (Charset_Direction dir, const char* const str,
 				rc = EOF;
 		}
 	}
-	ithread_mutex_unlock (&cvt->mutex);
+	ReleaseDescriptor (cvt, cd);
 #endif
 	return rc;
 }
@@ -487,6 +636,13 @@ Charset_Finish()
 	
 	int rc = 0;
 #ifdef HAVE_ICONV
+	if (g_thread_key_created) {
+		// Descriptors of other threads are closed when they exit
+		DestroyThreadDescriptors (pthread_getspecific (g_thread_key));
+		(void) pthread_setspecific (g_thread_key, NULL);
+		(void) pthread_key_delete (g_thread_key);
+		g_thread_key_created = false;
+	}
 	int i;
 	for (i = 0; i < NB_CONVERTERS; i++) {
 		Converter* const cvt = g_converters + i;
@@ -499,6 +655,7 @@ Charset_Finish()
 	(void) init_charset ("");
 #endif
 	g_state = NOT_INITIALIZED;
+	g_ascii_compatible = false;
 	return rc;
 }
 
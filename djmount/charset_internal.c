@@ -1317,42 +1317,40 @@ static int
 no_conv (const char** const inbuf, size_t* const inbytesleft,
 	 char** const outbuf, size_t* const outbytesleft)
 {
-	const char* src = *inbuf;
-	char* dest = *outbuf;
-	while (*inbytesleft > 0 && *outbytesleft > 0) {
-		*(dest++) = *(src++);
-		(*outbytesleft)--;
-		(*inbytesleft)--;
-	}
-	*outbuf = dest;
-	*inbuf  = src;
-	return 0;
+	const size_t n = (*inbytesleft < *outbytesleft ? *inbytesleft 
+			  : *outbytesleft);
+	memcpy (*outbuf, *inbuf, n);
+	*outbuf += n;
+	*inbuf  += n;
+	(*outbytesleft) -= n;
+	(*inbytesleft)  -= n;
+	return (*inbytesleft > 0 ? E2BIG : 0);
 }
 
 
-size_t utf2ascii_size (const char* src) 
+/*
+ * ASCII characters are unchanged by all conversions : copy the leading
+ * run of them 8 bytes at a time (file names are mostly ASCII).
+ * Returns the number of bytes copied.
+ */
+#define HIGHS	UINT64_C(0x8080808080808080)
+
+static size_t
+copy_ascii_run (const unsigned char* const src, size_t const inbytesleft,
+		char* const dest, size_t const outbytesleft)
 {
-	size_t size = 0;
-	if (src) {
-		if (u2c_table == NULL) {
-			// no conversion
-			size = strlen (src);
-		} else {
-			/*
-			 * Convert UTF-8 to selected charset : result string
-			 * will be at most of the same length because 
-			 * choosen charset are all 8-bits.
-			 */
-			while (*src) {
-				unsigned char c = (unsigned char) *(src++);
-				// Skip all continuation bytes
-				if ( ( c & 0xc0) != 0x80 ) 
-					size++;
-			}
-		}
-		size += 1; // Add space for final '\0'
+	const size_t max = (inbytesleft < outbytesleft ? inbytesleft 
+			    : outbytesleft);
+	size_t n = 0;
+	while (n + sizeof (uint64_t) <= max) {
+		uint64_t w;
+		memcpy (&w, src + n, sizeof (w));
+		if (w & HIGHS)
+			break; // ---------->
+		memcpy (dest + n, &w, sizeof (w));
+		n += sizeof (w);
 	}
-	return size;
+	return n;
 }
 
 
@@ -1371,6 +1369,17 @@ utf2ascii (const char** const inbuf, size_t* const inbytesleft,
 	const unsigned char* src = (const unsigned char*) (*inbuf);
 	char* dest = *outbuf;
 	while (*inbytesleft > 0 && *outbytesleft > 0) {
+		if (*src <= 0x7f) {
+			size_t const n = copy_ascii_run (src, *inbytesleft,
+							 dest, *outbytesleft);
+			if (n > 0) {
+				src += n;
+				dest += n;
+				(*inbytesleft) -= n;
+				(*outbytesleft) -= n;
+				continue; // ---------->
+			}
+		}
 		unsigned char const c = (unsigned char) *src;
 		uint16_t s = 0x0;
 		bool s_ok = false;
@@ -1413,33 +1422,6 @@ utf2ascii (const char** const inbuf, size_t* const inbytesleft,
 }
 
 
-size_t ascii2utf_size (const char* src) 
-{
-	size_t size = 0;
-	if (src) {
-		if (c2u_table == NULL) {
-			// No conversion
-			size = strlen (src);
-		} else {
-			/*
-			 * Convert selected charset to UTF-8 : in theory, 
-			 * the result string could be as long as 6 times 
-			 * the original length. However the choosen 8-bits 
-			 * charsets are all in the BMP (values between U+0000
-			 * and U+FFFF) so this gives at most a 3-bytes 
-			 * UTF-8 character.
-			 */
-			while (*src) {
-				unsigned char c = (unsigned char) *(src++);
-				size += ((c <= 0x7f) ? 1 : 3);
-			}
-		}
-		size += 1; // Add space for final '\0'
-	}
-	return size;
-}
-
-
 int
 ascii2utf (const char** const inbuf, size_t* const inbytesleft,
 	   char** const outbuf, size_t* const outbytesleft)
@@ -1455,6 +1437,17 @@ ascii2utf (const char** const inbuf, size_t* const inbytesleft,
 	const unsigned char* src = (const unsigned char*) (*inbuf);
 	char* dest = *outbuf;
 	while (*inbytesleft > 0 && *outbytesleft > 0) {
+		if (*src <= 0x7f) {
+			size_t const n = copy_ascii_run (src, *inbytesleft,
+							 dest, *outbytesleft);
+			if (n > 0) {
+				src += n;
+				dest += n;
+				(*inbytesleft) -= n;
+				(*outbytesleft) -= n;
+				continue; // ---------->
+			}
+		}
 		uint16_t s = c2u_table[*src]; 
 		int count;
 		if (s <= 0x7f)
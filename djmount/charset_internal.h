@@ -24,11 +24,9 @@
 
 int init_charset (const char *name);
 
-size_t utf2ascii_size (const char* src);
 int utf2ascii (const char** inbuf, size_t* inbytesleft,
 	       char** outbuf, size_t* outbytesleft);
 
-size_t ascii2utf_size (const char* src);
 int ascii2utf (const char** inbuf, size_t* inbytesleft,
 	       char** outbuf, size_t* outbytesleft);
 
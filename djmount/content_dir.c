@@ -33,6 +33,11 @@
 #include <upnp/upnp.h>
 #include "service_p.h"
 #include "cache.h"
+#include "string_pool.h"
+#include "worker_pool.h"
+#include "io_sched.h"
+#include "trace.h"
+#include "metrics.h"
 #include "log.h"
 
 
@@ -42,7 +47,7 @@
  *****************************************************************************/
 
 // Cache timeout, in seconds
-#define CACHE_TIMEOUT	60
+#define CACHE_TIMEOUT	CONTENT_DIR_CACHE_TIMEOUT
 
 // Number of cached entries. Set to zero to deactivate caching.
 #define CACHE_SIZE	1024
@@ -52,6 +57,10 @@
 // if contain lot of objects).
 #define MAX_CONTENT_LENGTH	(1024 * 1024) 
 
+// Number of threads processing the answers to asynchronous requests
+// (for all the ContentDirectory services).
+#define ASYNC_NB_THREADS	4
+
 
 
 /******************************************************************************
@@ -117,6 +126,80 @@ int_to_string (void* result_context, intmax_t val)
 }
 
 
+/******************************************************************************
+ * ParseResult
+ *
+ *	Parse the DIDL-Lite "Result" of a Browse or Search action, and
+ *	append the objects found to "objects".
+ *
+ *****************************************************************************/
+static int
+ParseResult (void* result_context,
+	     StringPool* strings,
+	     const char* objectId, 
+	     const char* criteria,
+	     const char* resstr,
+	     Count* nb_returned,
+	     PtrArray* objects)
+{
+	int rc = UPNP_E_SUCCESS;
+	Trace_Span span;
+	Trace_Begin (&span, "cds.parse", objectId);
+	IXML_Document* const subdoc = 
+		ixmlParseBuffer (discard_const_p (char, resstr));
+	if (subdoc == NULL) {
+		Log_Printf (LOG_ERROR, "BrowseOrSearchAction ObjectId=%s : "
+			    "can't parse 'Result'=%s", objectId, resstr);
+		rc = UPNP_E_BAD_RESPONSE;
+	} else {
+		IXML_NodeList* containers = ixmlDocument_getElementsByTagName
+			(subdoc, "container"); 
+		ContentDir_Count const nb_containers = 
+			ixmlNodeList_length (containers);
+		IXML_NodeList* items =
+			ixmlDocument_getElementsByTagName (subdoc, "item"); 
+		ContentDir_Count const nb_items = ixmlNodeList_length (items);
+		if (nb_containers + nb_items != *nb_returned) {
+			Log_Printf (LOG_ERROR, 
+				    "BrowseOrSearchAction ObjectId=%s "
+				    "got %d containers + %d items, "
+				    "expected %d", objectId, 
+				    (int) nb_containers, (int) nb_items,
+				    (int) *nb_returned);
+			*nb_returned = nb_containers + nb_items;
+		}
+		if (criteria == CRITERIA_BROWSE_METADATA && *nb_returned != 1){
+			Log_Printf (LOG_ERROR, "ContentDir_Browse Metadata : "
+				    "not 1 result exactly ! Id=%s", 
+				    NN(objectId));
+		}
+
+		ContentDir_Count i; 
+		for (i = 0; i < *nb_returned; i++) {
+			bool const is_container = (i < nb_containers);
+			IXML_Element* const elem = (IXML_Element*) 
+				ixmlNodeList_item
+				(is_container ? containers : items, 
+				 is_container ? i : i - nb_containers);
+			DIDLObject* o = DIDLObject_Create (result_context,
+							   strings, elem,
+							   is_container);
+			if (o) {
+				PtrArray_Append (objects, o);
+			}
+		}
+		
+		if (containers)
+			ixmlNodeList_free (containers);
+		if (items)
+			ixmlNodeList_free (items);
+		ixmlDocument_free (subdoc);
+	}
+	Trace_End (&span);
+	return rc;
+}
+
+
 /******************************************************************************
  * BrowseAction
  *****************************************************************************/
@@ -138,7 +221,7 @@ BrowseOrSearchAction (ContentDir* cds,
 	}
 	
 	// Create a working context for temporary allocations
-	void* tmp_ctx = talloc_new (NULL);
+	void* tmp_ctx = talloc_new_tmp (NULL, TALLOC_TMP_POOL_SIZE);
 	
 	const bool browse = is_browse (criteria);
 	IXML_Document* doc = NULL;
@@ -182,56 +265,9 @@ BrowseOrSearchAction (ContentDir* cds,
 		goto cleanup; // ---------->
 	}
 
-	IXML_Document* const subdoc = 
-		ixmlParseBuffer (discard_const_p (char, resstr));
-	if (subdoc == NULL) {
-		Log_Printf (LOG_ERROR, "BrowseOrSearchAction ObjectId=%s : "
-			    "can't parse 'Result'=%s", objectId, resstr);
-		rc = UPNP_E_BAD_RESPONSE;
-	} else {
-		IXML_NodeList* containers = ixmlDocument_getElementsByTagName
-			(subdoc, "container"); 
-		ContentDir_Count const nb_containers = 
-			ixmlNodeList_length (containers);
-		IXML_NodeList* items =
-			ixmlDocument_getElementsByTagName (subdoc, "item"); 
-		ContentDir_Count const nb_items = ixmlNodeList_length (items);
-		if (nb_containers + nb_items != *nb_returned) {
-			Log_Printf (LOG_ERROR, 
-				    "BrowseOrSearchAction ObjectId=%s "
-				    "got %d containers + %d items, "
-				    "expected %d", objectId, 
-				    (int) nb_containers, (int) nb_items,
-				    (int) *nb_returned);
-			*nb_returned = nb_containers + nb_items;
-		}
-		if (criteria == CRITERIA_BROWSE_METADATA && *nb_returned != 1){
-			Log_Printf (LOG_ERROR, "ContentDir_Browse Metadata : "
-				    "not 1 result exactly ! Id=%s", 
-				    NN(objectId));
-		}
+	rc = ParseResult (result_context, cds->strings, objectId, criteria,
+			  resstr, nb_returned, objects);
 
-		ContentDir_Count i; 
-		for (i = 0; i < *nb_returned; i++) {
-			bool const is_container = (i < nb_containers);
-			IXML_Element* const elem = (IXML_Element*) 
-				ixmlNodeList_item
-				(is_container ? containers : items, 
-				 is_container ? i : i - nb_containers);
-			DIDLObject* o = DIDLObject_Create (result_context, 
-							   elem, is_container);
-			if (o) {
-				PtrArray_Append (objects, o);
-			}
-		}
-		
-		if (containers)
-			ixmlNodeList_free (containers);
-		if (items)
-			ixmlNodeList_free (items);
-		ixmlDocument_free (subdoc);
-	}
-	
  cleanup:
 	
 	ixmlDocument_free (doc);
@@ -249,13 +285,10 @@ BrowseOrSearchAction (ContentDir* cds,
 
 
 /******************************************************************************
- * BrowseOrSearchAll
+ * CreateChildren
  *****************************************************************************/
 static ContentDir_Children*
-BrowseOrSearchAll (ContentDir* cds,
-		   void* result_context, 
-		   const char* objectId, 
-		   const char* const criteria)
+CreateChildren (void* result_context)
 {
 	ContentDir_Children* result = talloc (result_context, 
 					      ContentDir_Children);
@@ -263,8 +296,10 @@ BrowseOrSearchAll (ContentDir* cds,
 		return NULL; // ---------->
 
 	PtrArray* objects = PtrArray_Create (result);
-	if (objects == NULL) 
-		goto FAIL; // ---------->
+	if (objects == NULL) {
+		talloc_free (result);
+		return NULL; // ---------->
+	}
 
 	*result = (ContentDir_Children) {
 		.objects = objects
@@ -279,6 +314,23 @@ BrowseOrSearchAll (ContentDir* cds,
 #endif
 
         talloc_set_destructor (result, DestroyChildren);
+	return result;
+}
+
+
+/******************************************************************************
+ * BrowseOrSearchAll
+ *****************************************************************************/
+static ContentDir_Children*
+BrowseOrSearchAll (ContentDir* cds,
+		   void* result_context, 
+		   const char* objectId, 
+		   const char* const criteria)
+{
+	ContentDir_Children* const result = CreateChildren (result_context);
+	if (result == NULL)
+		return NULL; // ---------->
+	PtrArray* const objects = result->objects;
 
 	// Request all objects
 	Count nb_matched  = 0;
@@ -376,6 +428,25 @@ DestroyResult (BrowseResult* const br)
 }
 
 
+/******************************************************************************
+ * MakeCacheKey
+ *
+ *	Returns the cache key of a request. "buffer" shall be at least
+ *	strlen(objectId) + strlen(criteria) + 2 bytes long.
+ *
+ *****************************************************************************/
+static const char*
+MakeCacheKey (char* buffer, const char* objectId, const char* criteria)
+{
+	if (criteria == CRITERIA_BROWSE_CHILDREN)
+		return objectId; // ---------->
+
+	// criteria == "BrowseMetadata" or Search criteria
+	sprintf (buffer, "%s\t%s", objectId, criteria);
+	return buffer;
+}
+
+
 /******************************************************************************
  * BrowseOrSearchWithCache
  *****************************************************************************/
@@ -390,6 +461,8 @@ BrowseOrSearchWithCache (ContentDir* cds, void* result_context,
 	if (br == NULL)
 		return NULL; // ---------->
 	*br = (BrowseResult) { .cds = cds };
+	Trace_Span span;
+	Trace_Begin (&span, "cds.browse", objectId);
 
 	if (cds->cache == NULL) {
 		/*
@@ -400,17 +473,18 @@ BrowseOrSearchWithCache (ContentDir* cds, void* result_context,
 		/*
 		 * Lookup and/or update cache 
 		 */   
+		METRICS_STATIC_ID (wait_id, METRICS_HISTOGRAM, 
+				   "djmount_lock_wait_seconds", 
+				   "Time spent waiting for locks", 
+				   "lock=\"browse_cache\"");
+		Trace_Span wait;
+		Trace_Begin (&wait, "cds.cache_lock", NULL);
 		ithread_mutex_lock (&cds->cache_mutex);
+		Metrics_Observe (wait_id, Trace_End (&wait));
 
 		char key_buffer [strlen(objectId) + strlen(criteria) + 2 ];
-		const char* key;
-		if (criteria == CRITERIA_BROWSE_CHILDREN) {
-			key = objectId;
-		} else {
-			// criteria == "BrowseMetadata" or Search criteria
-			sprintf (key_buffer, "%s\t%s", objectId, criteria);
-			key = key_buffer;
-		}
+		const char* const key = MakeCacheKey (key_buffer, 
+						      objectId, criteria);
 
 		Children** cp = (Children**) Cache_Get (cds->cache, key);
 		if (cp) {
@@ -436,6 +510,7 @@ BrowseOrSearchWithCache (ContentDir* cds, void* result_context,
 		
 		ithread_mutex_unlock (&cds->cache_mutex);
 	}
+	Trace_End (&span);
 
 	if (br->children == NULL) {
 		talloc_free (br);
@@ -507,6 +582,451 @@ ContentDir_Search (ContentDir* cds, void* result_context,
 }
 
 
+/*****************************************************************************
+ * Asynchronous requests
+ *
+ *	The actions are sent with UpnpSendActionAsync, from the threads
+ *	of a worker pool once a background control slot is available 
+ *	(see IOSched_AcquireControl) ; the answers are copied in the UPnP
+ *	callback, then parsed (and the callback of the caller is called) 
+ *	in the worker pool.
+ *	Each request points to its ContentDir until the ContentDir is
+ *	destroyed : "g_async_mutex" protects this pointer, and the list of
+ *	requests of each ContentDir.
+ *****************************************************************************/
+
+typedef struct _AsyncRequest {
+	ContentDir*			cds; // NULL once detached
+	bool				sent;
+	ContentDir*			sending; // pinned until sent
+	IOSched_Slot*			slot;
+	char*				objectId;
+	const char*			criteria;
+	ContentDir_BrowseCallback	callback;
+	void*				cookie;
+	Children*			children;
+	Count				nb_matched;
+	int				nb_retry;
+
+	// Answer to the last action sent
+	int				rc;
+	char*				result;
+	Count				nb_returned;
+
+	// Final result, if found in the cache
+	BrowseResult*			cached;
+} AsyncRequest;
+
+static ithread_mutex_t	g_async_mutex;
+static ithread_cond_t	g_async_cond;
+static WorkerPool*	g_async_pool = NULL;
+
+
+static void
+AsyncJob (void* arg);
+
+static void
+SendJob (void* arg);
+
+
+/*****************************************************************************
+ * SubmitAsync
+ *****************************************************************************/
+static void
+SubmitAsync (AsyncRequest* req)
+{
+	if (WorkerPool_Submit (g_async_pool, AsyncJob, req) != 0) {
+		Log_Printf (LOG_ERROR, "ContentDir can't queue answer "
+			    "ObjectId='%s'", NN(req->objectId));
+		talloc_free (req);
+	}
+}
+
+
+/*****************************************************************************
+ * QueueSend
+ *
+ *	Queue the sending of a request of "cds" (which is kept until sent).
+ *	g_async_mutex must be locked.
+ *****************************************************************************/
+static int
+QueueSend (AsyncRequest* req, ContentDir* cds)
+{
+	req->sending = cds;
+	cds->async_busy++;
+	const int rc = WorkerPool_Submit (g_async_pool, SendJob, req);
+	if (rc != 0) {
+		req->sending = NULL;
+		cds->async_busy--;
+		req->rc = UPNP_E_OUTOF_MEMORY;
+		return UPNP_E_OUTOF_MEMORY; // ---------->
+	}
+	return UPNP_E_SUCCESS;
+}
+
+
+/*****************************************************************************
+ * ActionComplete
+ *
+ *	UPnP callback : copy the answer, which is freed by the SDK on return.
+ *****************************************************************************/
+static int
+ActionComplete (Upnp_EventType event_type, void* event, void* cookie)
+{
+	AsyncRequest* const req = (AsyncRequest*) cookie;
+	if (event_type != UPNP_CONTROL_ACTION_COMPLETE || req == NULL)
+		return 0; // ---------->
+
+	const struct Upnp_Action_Complete* const e = 
+		(const struct Upnp_Action_Complete*) event;
+	req->rc = e->ErrCode;
+	req->nb_returned = 0;
+	if (req->rc == UPNP_E_SUCCESS && e->ActionResult == NULL)
+		req->rc = UPNP_E_BAD_RESPONSE;
+	if (req->rc != UPNP_E_SUCCESS) {
+		Log_Printf (LOG_ERROR, "ContentDir async action ObjectId='%s' "
+			    ": error %d", NN(req->objectId), req->rc);
+	} else {
+		IXML_Node* const node = XML_D2N (e->ActionResult);
+		const char* s = XMLUtil_FindFirstElementValue 
+			(node, "TotalMatches", true, true);
+		STRING_TO_INT (s, req->nb_matched, 0);
+		s = XMLUtil_FindFirstElementValue 
+			(node, "NumberReturned", true, true);
+		STRING_TO_INT (s, req->nb_returned, 0);
+		s = XMLUtil_FindFirstElementValue
+			(node, "Result", true, true);
+		req->result = (s ? talloc_strdup (req, s) : NULL);
+		if (req->result == NULL) {
+			Log_Printf (LOG_ERROR, "ContentDir async action "
+				    "ObjectId='%s' : can't get 'Result'",
+				    NN(req->objectId));
+			req->rc = UPNP_E_BAD_RESPONSE;
+		}
+	}
+	IOSched_Release (req->slot);
+	req->slot = NULL;
+	SubmitAsync (req);
+	return 0;
+}
+
+
+/*****************************************************************************
+ * SendAsync
+ *
+ *	Request the objects not received yet.
+ *****************************************************************************/
+static int
+SendAsync (AsyncRequest* req, ContentDir* cds)
+{
+	const Count nb_objects = PtrArray_GetSize (req->children->objects);
+	const bool browse = is_browse (req->criteria);
+	const int rc = Service_SendActionAsyncVa
+		(OBJECT_SUPER_CAST(cds), ActionComplete, req,
+		 (browse ? "Browse" : "Search"),
+		 (browse ? "ObjectID" : "ContainerID"),		req->objectId,
+		 (browse ? "BrowseFlag" : "SearchCriteria"),	req->criteria,
+		 "Filter", 	      "*",
+		 "StartingIndex",     int_to_string (req, nb_objects),
+		 "RequestedCount",    int_to_string 
+		 (req, (nb_objects > 0 ? req->nb_matched - nb_objects : 0)),
+		 "SortCriteria",      "",
+		 NULL, 		      NULL);
+	if (rc != UPNP_E_SUCCESS)
+		req->rc = rc;
+	return rc;
+}
+
+
+/*****************************************************************************
+ * SendJob
+ *
+ *	Send a request, once the device accepts one more control request :
+ *	these requests are not waited for by a user, hence background.
+ *****************************************************************************/
+static void
+SendJob (void* arg)
+{
+	AsyncRequest* const req = (AsyncRequest*) arg;
+	ContentDir* const cds = req->sending;
+
+	IOSched_Slot* slot = NULL;
+	(void) IOSched_AcquireControl (OBJECT_SUPER_CAST(cds)->controlURL,
+				       IO_SCHED_BACKGROUND, cds, true, &slot);
+
+	ithread_mutex_lock (&g_async_mutex);
+	req->sending = NULL;
+	req->slot = slot;
+	int rc = UPNP_E_CANCELED;
+	if (req->cds == NULL) 
+		req->rc = rc;
+	else 
+		rc = SendAsync (req, cds);
+	if (rc != UPNP_E_SUCCESS) {
+		// No answer will come
+		IOSched_Release (req->slot);
+		req->slot = NULL;
+		SubmitAsync (req);
+	}
+	if (--(cds->async_busy) == 0)
+		ithread_cond_broadcast (&g_async_cond);
+	ithread_mutex_unlock (&g_async_mutex);
+}
+
+
+/*****************************************************************************
+ * PumpAsync
+ *
+ *	Send the queued requests of a ContentDir, up to the maximum number
+ *	of active requests. g_async_mutex must be locked.
+ *****************************************************************************/
+static void
+PumpAsync (ContentDir* cds)
+{
+	size_t i = 0;
+	while (cds->async_active < CONTENT_DIR_ASYNC_MAX_ACTIVE &&
+	       i < PtrArray_GetSize (cds->async_requests)) {
+		AsyncRequest* const req = 
+			PtrArray_GetElementAt (cds->async_requests, i);
+		if (req->sent) {
+			i++;
+		} else if (QueueSend (req, cds) == UPNP_E_SUCCESS) {
+			req->sent = true;
+			cds->async_active++;
+			i++;
+		} else {
+			(void) PtrArray_RemoveAt (cds->async_requests, i);
+			req->cds = NULL;
+			SubmitAsync (req);
+		}
+	}
+}
+
+
+/*****************************************************************************
+ * FinishAsync
+ *
+ *	Returns the final result of a request (NULL if error).
+ *****************************************************************************/
+static BrowseResult*
+FinishAsync (AsyncRequest* req, ContentDir* cds)
+{
+	BrowseResult* const br = talloc (req, BrowseResult);
+	if (br == NULL)
+		return NULL; // ---------->
+	*br = (BrowseResult) { .cds = cds };
+
+	if (cds && cds->cache) {
+		ithread_mutex_lock (&cds->cache_mutex);
+		char key_buffer [strlen (req->objectId) + 
+				 strlen (req->criteria) + 2 ];
+		const char* const key = MakeCacheKey 
+			(key_buffer, req->objectId, req->criteria);
+		Children** cp = (Children**) Cache_Get (cds->cache, key);
+		// Do not replace a result cached in the meantime
+		if (cp && *cp == NULL) {
+			*cp = talloc_steal (cds->cache, req->children);
+			br->children = *cp;
+			talloc_increase_ref_count (br->children);    
+			talloc_set_destructor (br, DestroyResult);
+		}
+		ithread_mutex_unlock (&cds->cache_mutex);
+	}
+	if (br->children == NULL)
+		br->children = talloc_steal (br, req->children);
+	req->children = NULL;
+	return br;
+}
+
+
+/*****************************************************************************
+ * AsyncJob
+ *****************************************************************************/
+static void
+AsyncJob (void* arg)
+{
+	AsyncRequest* const req = (AsyncRequest*) arg;
+	int rc = req->rc;
+	const BrowseResult* br = req->cached;
+
+	// Keep the ContentDir (and its string pool) until the result is 
+	// cached
+	ithread_mutex_lock (&g_async_mutex);
+	ContentDir* const busy = req->cds;
+	if (busy)
+		busy->async_busy++;
+	ithread_mutex_unlock (&g_async_mutex);
+
+	if (br == NULL && req->result) {
+		rc = ParseResult (req->children->objects, 
+				  (busy ? busy->strings : NULL),
+				  req->objectId, req->criteria, req->result,
+				  &req->nb_returned, req->children->objects);
+		talloc_free (req->result);
+		req->result = NULL;
+	}
+
+	ithread_mutex_lock (&g_async_mutex);
+	ContentDir* const cds = req->cds;
+	if (cds && rc == UPNP_E_SUCCESS && 
+	    PtrArray_GetSize (req->children->objects) < req->nb_matched &&
+	    (req->nb_retry == 0 || req->nb_returned > 0) && 
+	    req->nb_retry < 2) {
+		// Request missing entries : see BrowseOrSearchAll
+		req->nb_retry++;
+		Log_Printf (LOG_WARNING, 
+			    "ContentDir async ObjectId=%s : "
+			    "got %d results, expected %d. Retry %d ...",
+			    req->objectId, 
+			    (int) PtrArray_GetSize (req->children->objects), 
+			    (int) req->nb_matched, req->nb_retry);
+		if (QueueSend (req, cds) == UPNP_E_SUCCESS) {
+			if (--(busy->async_busy) == 0)
+				ithread_cond_broadcast (&g_async_cond);
+			ithread_mutex_unlock (&g_async_mutex);
+			return; // ---------->
+		}
+	}
+	if (cds) {
+		size_t i;
+		for (i = 0; i < PtrArray_GetSize (cds->async_requests); i++) {
+			if (PtrArray_GetElementAt (cds->async_requests, i) 
+			    == req) {
+				(void) PtrArray_RemoveAt (cds->async_requests,
+							  i);
+				break; // ---------->
+			}
+		}
+		cds->async_active--;
+		PumpAsync (cds);
+	}
+	ithread_mutex_unlock (&g_async_mutex);
+
+	// An error on a retry only truncates the result
+	if (rc != UPNP_E_SUCCESS && req->nb_retry > 0)
+		rc = UPNP_E_SUCCESS;
+	if (br == NULL && rc == UPNP_E_SUCCESS) {
+		br = FinishAsync (req, cds);
+		if (br == NULL)
+			rc = UPNP_E_OUTOF_MEMORY;
+	}
+
+	if (busy) {
+		ithread_mutex_lock (&g_async_mutex);
+		if (--(busy->async_busy) == 0)
+			ithread_cond_broadcast (&g_async_cond);
+		ithread_mutex_unlock (&g_async_mutex);
+	}
+
+	req->callback (req->cookie, rc, (rc == UPNP_E_SUCCESS ? br : NULL));
+	talloc_free (req);
+}
+
+
+/*****************************************************************************
+ * BrowseOrSearchAsync
+ *****************************************************************************/
+static int
+BrowseOrSearchAsync (ContentDir* cds, const char* objectId, 
+		     const char* const criteria, 
+		     ContentDir_BrowseCallback callback, void* cookie)
+{
+	if (cds == NULL || objectId == NULL || criteria == NULL || 
+	    callback == NULL)
+		return UPNP_E_INVALID_PARAM; // ---------->
+	if (g_async_pool == NULL)
+		return UPNP_E_OUTOF_MEMORY; // ---------->
+
+	AsyncRequest* const req = talloc (NULL, AsyncRequest);
+	if (req == NULL)
+		return UPNP_E_OUTOF_MEMORY; // ---------->
+	*req = (AsyncRequest) {
+		.cds	  = cds,
+		.objectId = talloc_strdup (req, objectId),
+		// Keep the pointer values of the Browse criteria
+		.criteria = (is_browse (criteria) ? criteria 
+			     : talloc_strdup (req, criteria)),
+		.callback = callback,
+		.cookie	  = cookie,
+		.children = CreateChildren (req),
+		.rc	  = UPNP_E_SUCCESS,
+	};
+	if (req->objectId == NULL || req->criteria == NULL || 
+	    req->children == NULL) {
+		talloc_free (req);
+		return UPNP_E_OUTOF_MEMORY; // ---------->
+	}
+
+	if (cds->cache) {
+		ithread_mutex_lock (&cds->cache_mutex);
+		char key_buffer [strlen(objectId) + strlen(criteria) + 2 ];
+		const char* const key = MakeCacheKey (key_buffer, 
+						      objectId, criteria);
+		Children** cp = (Children**) Cache_Get (cds->cache, key);
+		if (cp && *cp) {
+			// cache hit : only the callback remains to be done
+			req->cached = talloc (req, BrowseResult);
+			if (req->cached) {
+				*req->cached = (BrowseResult) { 
+					.cds = cds, .children = *cp 
+				};
+				talloc_increase_ref_count (*cp);
+				talloc_set_destructor (req->cached, 
+						       DestroyResult);
+			}
+		}
+		ithread_mutex_unlock (&cds->cache_mutex);
+		if (req->cached) {
+			req->cds = NULL;
+			SubmitAsync (req);
+			return UPNP_E_SUCCESS; // ---------->
+		}
+	}
+
+	int rc = UPNP_E_SUCCESS;
+	ithread_mutex_lock (&g_async_mutex);
+	if (PtrArray_Append (cds->async_requests, req)) {
+		PumpAsync (cds);
+	} else {
+		talloc_free (req);
+		rc = UPNP_E_OUTOF_MEMORY;
+	}
+	ithread_mutex_unlock (&g_async_mutex);
+	return rc;
+}
+
+
+/*****************************************************************************
+ * ContentDir_BrowseAsync
+ *****************************************************************************/
+int
+ContentDir_BrowseAsync (ContentDir* cds, const char* objectId, 
+			ContentDir_BrowseFlag browse_flag,
+			ContentDir_BrowseCallback callback, void* cookie)
+{
+	return BrowseOrSearchAsync
+		(cds, objectId, 
+		 (browse_flag == CONTENT_DIR_BROWSE_METADATA) ? 
+		 CRITERIA_BROWSE_METADATA : CRITERIA_BROWSE_CHILDREN,
+		 callback, cookie);
+}
+
+
+/*****************************************************************************
+ * ContentDir_SearchAsync
+ *****************************************************************************/
+int
+ContentDir_SearchAsync (ContentDir* cds, const char* objectId, 
+			const char* criteria,
+			ContentDir_BrowseCallback callback, void* cookie)
+{
+	Log_Printf (LOG_DEBUG, "ContentDir_SearchAsync objectId='%s' "
+		    "criteria='%s'", NN(objectId), NN(criteria));
+	return BrowseOrSearchAsync (cds, objectId, criteria, 
+				    callback, cookie);
+}
+
+
 /*****************************************************************************
  * get_status_string
  *****************************************************************************/
@@ -527,10 +1047,19 @@ get_status_string (const Service* serv,
 	// Create a working context for temporary strings
 	void* const tmp_ctx = talloc_new (NULL);
 	
+	ithread_mutex_lock (&g_async_mutex);
+	tpr (&p, "%s+- Async Requests = %lu (active = %lu)\n", spacer,
+	     (unsigned long) PtrArray_GetSize (cds->async_requests),
+	     (unsigned long) cds->async_active);
+	ithread_mutex_unlock (&g_async_mutex);
 	tpr (&p, "%s+- Browse Cache\n", spacer);
 	tpr (&p, "%s", Cache_GetStatusString 
 	     (cds->cache, tmp_ctx, talloc_asprintf (tmp_ctx, "%s      ",
 						    spacer)));
+	tpr (&p, "%s+- Shared Strings\n", spacer);
+	tpr (&p, "%s", StringPool_GetStatusString 
+	     (cds->strings, tmp_ctx, talloc_asprintf (tmp_ctx, "%s      ",
+						      spacer)));
 	
 	// Delete all temporary strings
 	talloc_free (tmp_ctx);
@@ -552,9 +1081,30 @@ finalize (Object* obj)
 {
 	ContentDir* const cds = (ContentDir*) obj;
 
+	if (cds && cds->async_requests) {
+		// Detach the asynchronous requests, and cancel those 
+		// not sent yet
+		ithread_mutex_lock (&g_async_mutex);
+		AsyncRequest* req = NULL;
+		PTR_ARRAY_FOR_EACH_PTR (cds->async_requests, req) {
+			req->cds = NULL;
+			if (! req->sent) {
+				req->rc = UPNP_E_CANCELED;
+				SubmitAsync (req);
+			}
+		} PTR_ARRAY_FOR_EACH_PTR_END;
+		while (cds->async_busy > 0)
+			ithread_cond_wait (&g_async_cond, &g_async_mutex);
+		ithread_mutex_unlock (&g_async_mutex);
+	}
+
 	if (cds && cds->cache) {
 		ithread_mutex_destroy (&cds->cache_mutex);
 	}
+
+	// The cached objects might still use the pool after this
+	if (cds)
+		StringPool_Destroy (cds->strings);
 	
 	// Other "talloc'ed" fields will be deleted automatically : 
 	// nothing to do 
@@ -577,6 +1127,13 @@ init_class (ContentDir_Class* const isa)
 	// messages, because "Browse" answers can be very large 
 	// if contain lot of objects.
 	UpnpSetMaxContentLength (MAX_CONTENT_LENGTH);
+
+	// Shared by all the ContentDirectory services, for the
+	// lifetime of the program
+	ithread_mutex_init (&g_async_mutex, NULL);
+	ithread_cond_init (&g_async_cond, NULL);
+	g_async_pool = WorkerPool_Create (NULL, "ContentDir", 
+					  ASYNC_NB_THREADS);
 }
 
 OBJECT_INIT_CLASS(ContentDir, Service, init_class);
@@ -601,8 +1158,17 @@ ContentDir_Create (void* talloc_context,
 					    cache_free_expired_data);
 		if (self->cache == NULL)
 			goto error; // ---------->
+		Cache_SetName (self->cache, "browse");
 		ithread_mutex_init (&self->cache_mutex, NULL);
 	}
+
+	self->async_requests = PtrArray_Create (self);
+	if (self->async_requests == NULL)
+		goto error; // ---------->
+
+	self->strings = StringPool_Create (self);
+	if (self->strings == NULL)
+		goto error; // ---------->
 	
 	return self; // ---------->
 	
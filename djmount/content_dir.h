@@ -48,6 +48,9 @@ typedef uint_fast32_t ContentDir_Index;
 #define CONTENT_DIR_SERVICE_TYPE \
 	"urn:schemas-upnp-org:service:ContentDirectory:1"
 
+// Timeout of the cached Browse and Search results, in seconds : the 
+// content returned by the service might be this old.
+#define CONTENT_DIR_CACHE_TIMEOUT	60
 
 
 
@@ -159,6 +162,46 @@ ContentDir_Search (ContentDir* cds, void* result_context,
 		   const char* objectId, const char* criteria);
 
 
+/**
+ * Maximum number of asynchronous requests sent at the same time to a
+ * ContentDirectory service (the other requests are queued).
+ */
+#define CONTENT_DIR_ASYNC_MAX_ACTIVE	4
+
+/**
+ * Callback receiving the result of an asynchronous Browse or Search.
+ * It is called in a worker thread, without any lock held.
+ * "result" is NULL if error ("rc" gives the UPnP error code), else 
+ * it is freed when the callback returns, unless the callback takes it
+ * using "talloc_steal".
+ */
+typedef void (*ContentDir_BrowseCallback) 
+	(void* cookie, int rc, const ContentDir_BrowseResult* result);
+
+
+/**
+ * "Browse" Action (asynchronous call).
+ * The result comes from the cache, or from the device : many requests 
+ * can be in progress with the same device, sent as background control
+ * requests (see IOSched_AcquireControl).
+ * Return UPNP_E_SUCCESS if the request is queued (the callback will then
+ * be called exactly once), or an error code (the callback is not called).
+ */
+int
+ContentDir_BrowseAsync (ContentDir* cds, const char* objectId, 
+			ContentDir_BrowseFlag browse_flag,
+			ContentDir_BrowseCallback callback, void* cookie);
+
+
+/**
+ * "Search" Action (asynchronous call) : see ContentDir_BrowseAsync.
+ */
+int
+ContentDir_SearchAsync (ContentDir* cds, const char* objectId, 
+			const char* criteria,
+			ContentDir_BrowseCallback callback, void* cookie);
+
+
 
 #ifdef __cplusplus
 }; // extern "C"
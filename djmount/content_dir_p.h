@@ -47,6 +47,15 @@ OBJECT_DEFINE_STRUCT(ContentDir,
 		     
 		     struct _Cache*	cache;
 		     ithread_mutex_t  	cache_mutex;
+
+		     // Values shared by the DIDL-Lite objects of the device
+		     struct _StringPool* strings;
+
+		     // Asynchronous requests, in FIFO order (protected by
+		     // a mutex global to the class)
+		     PtrArray*		async_requests;
+		     size_t		async_active;
+		     size_t		async_busy;
 		     );
 
 
@@ -331,6 +331,17 @@ Device_GetDescDocTextCopy (const Device* dev, void* result_context)
 }
 
 
+/*****************************************************************************
+ * Device_GetUDNCopy
+ *****************************************************************************/
+char*
+Device_GetUDNCopy (const Device* dev, void* result_context)
+{
+	return ((dev && dev->udn) ? talloc_strdup (result_context, dev->udn) 
+		: NULL);
+}
+
+
 /*****************************************************************************
  * Device_SusbcribeAllEvents
  *****************************************************************************/
@@ -382,7 +393,7 @@ Device_GetServiceFrom (const Device* dev,
 			case FROM_CONTROL_URL:	
 				s = Service_GetControlURL (node->item); break;
 			case FROM_EVENT_URL:	
-				s = Service_GetControlURL (node->item); break;
+				s = Service_GetEventURL (node->item); break;
 			case FROM_SERVICE_TYPE:	
 				s = Service_GetServiceType (node->item); break;
 			}
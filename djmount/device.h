@@ -98,6 +98,14 @@ char*
 Device_GetDescDocTextCopy (const Device* dev, void* result_context);
 
 
+/** 
+ * @brief Returns a copy of the Unique Device Name (<UDN>) of the Device.
+ * 	  The returned string should be freed using "talloc_free".
+ */
+char*
+Device_GetUDNCopy (const Device* dev, void* result_context);
+
+
 /******************************************************************************
  * @fn	    Device_GetServiceFrom
  * @brief   returns the pointer to a given Service.
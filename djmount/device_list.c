@@ -34,8 +34,20 @@
 #include "log.h"
 #include "service.h"
 #include "talloc_util.h"
+#include "io_sched.h"
+#include "string_util.h"
+#include "worker_pool.h"
+#include "ptr_array.h"
+#include "xml_util.h"
+#include "trace.h"
+#include "metrics.h"
+#include "hash.h"	// import gnulib hash
 
 #include <stdbool.h>
+#include <time.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
 #include <upnp/upnp.h>
 #include <upnp/ithread.h>
 #include <upnp/upnptools.h>
@@ -50,6 +62,24 @@ static const unsigned int CHECK_SUBSCRIPTIONS_TIMEOUT = 10; // in seconds
 
 static UpnpClient_Handle g_ctrlpt_handle = -1;
 
+// File where the known devices are saved (NULL if none)
+static char* g_registry_file = NULL;
+
+/*
+ * The registry is saved by the timer thread, once no new device has 
+ * been added for REGISTRY_SAVE_DELAY, and at stop. 
+ * g_registry_mutex serialises the writers of the file.
+ */
+static ithread_mutex_t	g_registry_mutex;
+static volatile bool	g_registry_dirty = false;
+static volatile time_t	g_registry_changed = 0;
+
+#define REGISTRY_SAVE_DELAY	10	// seconds
+
+// Time given to the devices loaded from the registry to be discovered 
+// again, before being removed (in seconds)
+#define REGISTRY_GRACE_PERIOD	30
+
 
 static ithread_t g_timer_thread;
 
@@ -70,19 +100,228 @@ static ithread_mutex_t DeviceListMutex;
  */
 
 struct _DeviceNode {
-  char*    deviceId; // as reported by the discovery callback
-  Device*  d;
-  int      expires; 
+  char*       deviceId; // as reported by the discovery callback
+  const char* name;	// unique friendly name (talloc name of "d")
+  char*       descLocation;
+  Device*     d;
+  time_t      deadline;	// advertisement expiration (unless in g_expiry)
+  size_t      slot;	// index in g_expiry, or NO_SLOT
+  bool        unconfirmed; // loaded from the registry, not yet discovered
+  ListNode*   listnode;
 };
 typedef struct _DeviceNode DeviceNode;
 
 
-//
-// TBD XXX TBD
-// TBD to replace with Hash Table for better performances XXX
-// TBD XXX TBD
-//
-static LinkedList GlobalDeviceList;
+/*
+ * The list keeps the devices in discovery order (for listings) ;
+ * lookups go through the hash tables, indexed by name and by Id.
+ * Use InsertDeviceNode and RemoveDeviceNode to keep them consistent.
+ */
+static LinkedList  GlobalDeviceList;
+static Hash_table* g_devices_by_name = NULL;
+static Hash_table* g_devices_by_id   = NULL;
+
+// Initial number of entries in the hash tables (they grow if necessary)
+#define INITIAL_TABLE_SIZE	64
+
+
+/*
+ * Advertisement deadlines. The devices repeat their SSDP announcements
+ * (one per device, root device and service type, every few minutes) :
+ * all but the first one only extend the device deadline. 
+ * The deadlines are kept in this open-addressing table, indexed by the
+ * hash of the device Id, which the discovery callbacks update without
+ * locking DeviceListMutex. Slots are only added or removed with the 
+ * mutex locked, inside a sequence lock : a callback which sees the 
+ * sequence change takes the locked path instead.
+ */
+#define EXPIRY_TABLE_SIZE	1024	// power of 2
+#define NO_SLOT			((size_t) -1)
+#define FREE_KEY		0
+#define DELETED_KEY		1
+
+typedef struct _ExpirySlot {
+	volatile uint64_t key;	// String_Hash64 of the device Id
+	volatile time_t	  deadline;
+} ExpirySlot;
+
+static ExpirySlot	g_expiry [EXPIRY_TABLE_SIZE];
+static volatile unsigned g_expiry_seq = 0; // odd while table modified
+
+
+static uint64_t
+ExpiryKey (const char* deviceId)
+{
+	const uint64_t key = String_Hash64 (STRING_HASH64_INIT, deviceId);
+	return (key > DELETED_KEY ? key : key + 2);
+}
+
+// The device list must be locked
+static size_t
+ExpiryInsert (const char* deviceId, time_t deadline)
+{
+	const uint64_t key = ExpiryKey (deviceId);
+	size_t i = key % EXPIRY_TABLE_SIZE;
+	size_t n;
+	for (n = 0; n < EXPIRY_TABLE_SIZE; n++) {
+		if (g_expiry[i].key <= DELETED_KEY) {
+			g_expiry_seq++;
+			__sync_synchronize();
+			g_expiry[i].deadline = deadline;
+			g_expiry[i].key = key;
+			__sync_synchronize();
+			g_expiry_seq++;
+			return i; // ---------->
+		}
+		i = (i + 1) % EXPIRY_TABLE_SIZE;
+	}
+	return NO_SLOT; // table full : use DeviceNode deadline
+}
+
+// The device list must be locked
+static void
+ExpiryRemove (size_t slot)
+{
+	if (slot != NO_SLOT) {
+		g_expiry_seq++;
+		__sync_synchronize();
+		g_expiry[slot].key = DELETED_KEY;
+		__sync_synchronize();
+		g_expiry_seq++;
+	}
+}
+
+/*
+ * Lock-free : extend the deadline of a known device. Returns false if
+ * the device is unknown, or the table is being modified.
+ * (If its slot is reused meanwhile, another device can get this deadline
+ * once : it is then only removed at the next advertisement check).
+ */
+static bool
+ExpiryTouch (const char* deviceId, time_t deadline)
+{
+	const unsigned seq = g_expiry_seq;
+	__sync_synchronize();
+	if (seq & 1)
+		return false; // ---------->
+	const uint64_t key = ExpiryKey (deviceId);
+	size_t i = key % EXPIRY_TABLE_SIZE;
+	size_t n;
+	for (n = 0; n < EXPIRY_TABLE_SIZE; n++) {
+		const uint64_t k = g_expiry[i].key;
+		if (k == key) {
+			g_expiry[i].deadline = deadline;
+			__sync_synchronize();
+			return (g_expiry_seq == seq); // ---------->
+		}
+		if (k == FREE_KEY)
+			break; // ---------->
+		i = (i + 1) % EXPIRY_TABLE_SIZE;
+	}
+	return false;
+}
+
+// The device list must be locked
+static time_t
+GetDeadline (const DeviceNode* devnode)
+{
+	return (devnode->slot != NO_SLOT ? g_expiry[devnode->slot].deadline 
+		: devnode->deadline);
+}
+
+// The device list must be locked
+static void
+SetDeadline (DeviceNode* devnode, time_t deadline)
+{
+	if (devnode->slot != NO_SLOT)
+		g_expiry[devnode->slot].deadline = deadline;
+	else
+		devnode->deadline = deadline;
+}
+
+
+/*
+ * Devices rejected by the ":service:" SSDP target. Their advertisements
+ * are ignored until they expire, without locking DeviceListMutex nor
+ * downloading their description again. This direct-mapped table is 
+ * indexed by the hash of the device Id and description URL (a device
+ * which moves is checked again). Slots are only written with the mutex
+ * locked, inside a sequence lock, like the deadlines above.
+ */
+#define IGNORED_TABLE_SIZE	256	// power of 2
+
+typedef struct _IgnoredSlot {
+	volatile uint64_t key;
+	volatile time_t	  until;
+} IgnoredSlot;
+
+static IgnoredSlot	g_ignored [IGNORED_TABLE_SIZE];
+static volatile unsigned g_ignored_seq = 0; // odd while table modified
+
+
+static uint64_t
+IgnoredKey (const char* deviceId, const char* descLocation)
+{
+	return String_Hash64 (String_Hash64 (STRING_HASH64_INIT, deviceId),
+			      descLocation);
+}
+
+// The device list must be locked
+static void
+IgnoredInsert (const char* deviceId, const char* descLocation, 
+	       time_t until)
+{
+	const uint64_t key = IgnoredKey (deviceId, descLocation);
+	IgnoredSlot* const s = g_ignored + key % IGNORED_TABLE_SIZE;
+	g_ignored_seq++;
+	__sync_synchronize();
+	s->until = until;
+	s->key = key;
+	__sync_synchronize();
+	g_ignored_seq++;
+}
+
+// Lock-free
+static bool
+IsIgnored (const char* deviceId, const char* descLocation, time_t now)
+{
+	const unsigned seq = g_ignored_seq;
+	__sync_synchronize();
+	if (seq & 1)
+		return false; // ---------->
+	const uint64_t key = IgnoredKey (deviceId, descLocation);
+	const IgnoredSlot* const s = g_ignored + key % IGNORED_TABLE_SIZE;
+	const bool ignored = (s->key == key && now < s->until);
+	__sync_synchronize();
+	return (ignored && g_ignored_seq == seq);
+}
+
+
+static size_t
+name_hasher (const void* entry, size_t table_size)
+{
+  return String_Hash (((const DeviceNode*) entry)->name) % table_size;
+}
+
+static bool
+name_comparator (const void* e1, const void* e2)
+{
+  return (strcmp (((const DeviceNode*) e1)->name,
+		  ((const DeviceNode*) e2)->name) == 0);
+}
+
+static size_t
+id_hasher (const void* entry, size_t table_size)
+{
+  return String_Hash (((const DeviceNode*) entry)->deviceId) % table_size;
+}
+
+static bool
+id_comparator (const void* e1, const void* e2)
+{
+  return (strcmp (((const DeviceNode*) e1)->deviceId,
+		  ((const DeviceNode*) e2)->deviceId) == 0);
+}
 
 
 
@@ -125,42 +364,231 @@ NotifyUpdate (DeviceList_EventType type,
 static DeviceNode*
 GetDeviceNodeFromName (const char* name, bool log_error)
 {
-  if (name) {
-    ListNode* node;
-    for (node = ListHead (&GlobalDeviceList);
-	 node != 0;
-	 node = ListNext (&GlobalDeviceList, node)) {
-      DeviceNode* const devnode = node->item;
-      if (devnode && devnode->d && 
-	  strcmp (talloc_get_name (devnode->d), name) == 0)
-	return devnode; // ---------->
-    }
+  DeviceNode* devnode = NULL;
+  if (name && g_devices_by_name) {
+    const DeviceNode searched = { .name = name };
+    devnode = hash_lookup (g_devices_by_name, &searched);
   }
-  if (log_error)
+  if (devnode == NULL && log_error)
     Log_Printf (LOG_ERROR, "Error finding Device named %s", NN(name));
-  return 0;
+  return devnode;
 }
 
-static ListNode*
-GetDeviceListNodeFromId (const char* deviceId)
+static DeviceNode*
+GetDeviceNodeFromId (const char* deviceId)
 {
-  if (deviceId) {
-    ListNode* node;
-    for (node = ListHead (&GlobalDeviceList);
-	 node != 0;
-	 node = ListNext (&GlobalDeviceList, node)) {
-      DeviceNode* const devnode = node->item;
-      if (devnode && devnode->deviceId && 
-	  strcmp (devnode->deviceId, deviceId) == 0) 
-	return node; // ---------->
-    }
+  DeviceNode* devnode = NULL;
+  if (deviceId && g_devices_by_id) {
+    const DeviceNode searched = { .deviceId = (char*) deviceId };
+    devnode = hash_lookup (g_devices_by_id, &searched);
   }
-  return 0;
+  return devnode;
+}
+
+
+/*
+ * Indexes SID -> device Id and event URL -> device Id, for the GENA
+ * events. They are filled on the first search of each key, and checked 
+ * on each use ; the entries of a device are removed with the device, 
+ * and the old SID of a service when it changes.
+ * Unknown SIDs (e.g. events of an old subscription) are also kept a 
+ * short while, so that their events do not scan the whole list each
+ * time.
+ * Protected by DeviceListMutex.
+ */
+typedef struct _ServiceIndexEntry {
+	char*	key;
+	char*	deviceId; // NULL if unknown key
+	time_t	expires;  // of unknown key
+} ServiceIndexEntry;
+
+static Hash_table* g_services_by_sid	   = NULL;
+static Hash_table* g_services_by_event_url = NULL;
+static size_t	   g_nb_unknown_sids	   = 0;
+
+#define UNKNOWN_SID_DELAY	30	// seconds
+#define UNKNOWN_SID_MAX		64
+
+static size_t
+service_index_hasher (const void* entry, size_t table_size)
+{
+	return String_Hash (((const ServiceIndexEntry*) entry)->key) 
+		% table_size;
+}
+
+static bool
+service_index_comparator (const void* e1, const void* e2)
+{
+	return (strcmp (((const ServiceIndexEntry*) e1)->key,
+			((const ServiceIndexEntry*) e2)->key) == 0);
 }
 
+static void
+service_index_freer (void* entry)
+{
+	talloc_free (entry);
+}
+
+static Hash_table*
+GetServiceIndex (enum GetFrom from)
+{
+	switch (from) {
+	case FROM_SID:		return g_services_by_sid;
+	case FROM_EVENT_URL:	return g_services_by_event_url;
+	default:		return NULL;
+	}
+}
+
+static void
+IndexService (Hash_table* index, const char* key, const char* deviceId)
+{
+	ServiceIndexEntry* const entry = talloc (NULL, ServiceIndexEntry);
+	if (entry) {
+		*entry = (ServiceIndexEntry) {
+			.key	  = talloc_strdup (entry, key),
+			.deviceId = (deviceId ? talloc_strdup (entry, deviceId)
+				     : NULL),
+			.expires  = (deviceId ? 0 
+				     : time (NULL) + UNKNOWN_SID_DELAY),
+		};
+		if (entry->key == NULL || 
+		    (deviceId && entry->deviceId == NULL) ||
+		    hash_insert (index, entry) != entry)
+			talloc_free (entry);
+		else if (deviceId == NULL)
+			g_nb_unknown_sids++;
+	}
+}
+
+static void
+UnindexEntry (Hash_table* index, ServiceIndexEntry* entry)
+{
+	(void) hash_delete (index, entry);
+	if (entry->deviceId == NULL)
+		g_nb_unknown_sids--;
+	talloc_free (entry);
+}
+
+/*
+ * Remove the entries of a device, or the unknown keys if deviceId is NULL
+ */
+static void
+UnindexServices (Hash_table* index, const char* deviceId)
+{
+	const size_t n = hash_get_n_entries (index);
+	if (n == 0 || (deviceId == NULL && g_nb_unknown_sids == 0))
+		return; // ---------->
+	void** const entries = talloc_array (NULL, void*, n);
+	if (entries) {
+		const size_t nb = hash_get_entries (index, entries, n);
+		size_t i;
+		for (i = 0; i < nb; i++) {
+			ServiceIndexEntry* const entry = entries[i];
+			if (deviceId ? (entry->deviceId && 
+					strcmp (entry->deviceId, deviceId) == 0)
+			    : (entry->deviceId == NULL))
+				UnindexEntry (index, entry);
+		}
+		talloc_free (entries);
+	}
+}
+
+/*
+ * The SID of a service is about to change : forget the old one
+ */
+static void
+UnindexSid (const char* sid)
+{
+	if (sid) {
+		const ServiceIndexEntry searched = { .key = (char*) sid };
+		ServiceIndexEntry* const entry = hash_lookup 
+			(g_services_by_sid, &searched);
+		if (entry)
+			UnindexEntry (g_services_by_sid, entry);
+	}
+}
+
+/*
+ * New SIDs were given : they might have been unknown so far
+ */
+static void
+ForgetUnknownSids (void)
+{
+	UnindexServices (g_services_by_sid, NULL);
+}
+
+
+/*****************************************************************************
+ * InsertDeviceNode / RemoveDeviceNode
+ *
+ * Add or remove a device in the global device list and its indexes.
+ * The device list must be locked.
+ *****************************************************************************/
+static bool
+InsertDeviceNode (DeviceNode* devnode)
+{
+  if (hash_insert (g_devices_by_name, devnode) == NULL)
+    return false; // ---------->
+  if (hash_insert (g_devices_by_id, devnode) == NULL) {
+    (void) hash_delete (g_devices_by_name, devnode);
+    return false; // ---------->
+  }
+  ListAddTail (&GlobalDeviceList, devnode);
+  devnode->listnode = ListTail (&GlobalDeviceList);
+  return true;
+}
+
+static void
+RemoveDeviceNode (DeviceNode* devnode)
+{
+  UnindexServices (g_services_by_sid, devnode->deviceId);
+  UnindexServices (g_services_by_event_url, devnode->deviceId);
+  ExpiryRemove (devnode->slot);
+  devnode->slot = NO_SLOT;
+  (void) hash_delete (g_devices_by_name, devnode);
+  (void) hash_delete (g_devices_by_id, devnode);
+  if (devnode->listnode) {
+    devnode->listnode->item = NULL;
+    ListDelNode (&GlobalDeviceList, devnode->listnode, /*freeItem=>*/ 0);
+    devnode->listnode = NULL;
+  }
+}
+
+
+/*
+ * Find a service from its SID or event URL, through the indexes
+ */
 static Service*
 GetService (const char* s, enum GetFrom from) 
 {
+	if (s == NULL)
+		return NULL; // ---------->
+
+	// Indexed ?
+	Hash_table* const index = GetServiceIndex (from);
+	if (index) {
+		const ServiceIndexEntry searched = { .key = (char*) s };
+		ServiceIndexEntry* const entry = hash_lookup (index, 
+							      &searched);
+		if (entry && entry->deviceId == NULL) {
+			if (time (NULL) < entry->expires) {
+				Log_Printf (LOG_DEBUG, "Unknown SID %s", s);
+				return NULL; // ---------->
+			}
+			UnindexEntry (index, entry);
+		} else if (entry) {
+			const DeviceNode* const devnode = GetDeviceNodeFromId 
+				(entry->deviceId);
+			Service* const serv = (devnode ? Device_GetServiceFrom
+					       (devnode->d, s, from, false) 
+					       : NULL);
+			if (serv) 
+				return serv; // ---------->
+			// Obsolete entry
+			UnindexEntry (index, entry);
+		}
+	}
+
 	ListNode* node;
 	for (node = ListHead (&GlobalDeviceList);
 	     node != NULL;
@@ -169,10 +597,19 @@ GetService (const char* s, enum GetFrom from)
 		if (devnode) {
 			Service* const serv = Device_GetServiceFrom 
 				(devnode->d, s, from, false);
-			if (serv) 
+			if (serv) {
+				if (index)
+					IndexService (index, s, 
+						      devnode->deviceId);
 				return serv; // ---------->
+			}
 		}
 	}
+	if (from == FROM_SID && index) {
+		if (g_nb_unknown_sids >= UNKNOWN_SID_MAX)
+			ForgetUnknownSids();
+		IndexService (index, s, NULL);
+	}
 	Log_Printf (LOG_ERROR, "Can't find service matching %s in device list",
 		    NN(s));
 	return NULL;
@@ -223,11 +660,9 @@ DeviceList_RemoveDevice (const char* deviceId)
 
 	ithread_mutex_lock (&DeviceListMutex);
 	
-	ListNode* const node = GetDeviceListNodeFromId (deviceId);
-	if (node) {
-		DeviceNode* devnode = node->item;
-		node->item = 0;
-		ListDelNode (&GlobalDeviceList, node, /*freeItem=>*/ 0);
+	DeviceNode* const devnode = GetDeviceNodeFromId (deviceId);
+	if (devnode) {
+		RemoveDeviceNode (devnode);
 		// Do the notification while the global list is still locked
 		NotifyUpdate (E_DEVICE_REMOVED, devnode);
 		talloc_free (devnode);
@@ -270,6 +705,16 @@ DeviceList_RemoveAll (void)
   }
   ListDestroy (&GlobalDeviceList, /*freeItem=>*/ 0);
   ListInit (&GlobalDeviceList, 0, 0);
+  hash_clear (g_devices_by_name);
+  hash_clear (g_devices_by_id);
+  hash_clear (g_services_by_sid);
+  hash_clear (g_services_by_event_url);
+  g_nb_unknown_sids = 0;
+  g_expiry_seq++;
+  __sync_synchronize();
+  memset ((void*) g_expiry, 0, sizeof (g_expiry));
+  __sync_synchronize();
+  g_expiry_seq++;
 
   ithread_mutex_unlock( &DeviceListMutex );
   
@@ -330,161 +775,578 @@ HandleEvent (Upnp_SID sid,
 }
 
 
+/*****************************************************************************
+ * Description downloads
+ *
+ * The device descriptions are downloaded by a pool of worker threads, so
+ * that a slow or dead device does not delay the other ones. There is at
+ * most one download in progress per description URL (root and embedded
+ * devices share the same description), and an URL which failed is not
+ * tried again before DESC_RETRY_DELAY. 
+ * g_fetches is protected by DeviceListMutex.
+ *****************************************************************************/
+
+// Number of simultaneous downloads
+#define DESC_FETCH_THREADS	8
+
+// Timeout to connect to, then read from, a device (in seconds)
+#define DESC_FETCH_TIMEOUT	5
+
+// Delay before trying again a description URL which failed (in seconds)
+#define DESC_RETRY_DELAY	60
+
+// Maximum size of a description document
+#define DESC_MAX_SIZE		(1024 * 1024)
+
+typedef struct _FetchRequest {
+	char*	deviceId;
+	int	expires;
+} FetchRequest;
+
+typedef struct _Fetch {
+	char*		url;
+	bool		running;
+	time_t		retry_after;	// if failed
+	PtrArray*	requests;	// of FetchRequest, waiting for url
+} Fetch;
+
+static WorkerPool*	g_desc_pool = NULL;
+static PtrArray*	g_fetches = NULL;
+static volatile bool	g_stopping = false;
+
+
+static Fetch*
+FindFetch (const char* url)
+{
+	Fetch* fetch = NULL;
+	PTR_ARRAY_FOR_EACH_PTR (g_fetches, fetch) {
+		if (strcmp (fetch->url, url) == 0)
+			return fetch; // ---------->
+	} PTR_ARRAY_FOR_EACH_PTR_END;
+	return NULL;
+}
+
+static void
+RemoveFetch (Fetch* fetch)
+{
+	size_t i;
+	for (i = 0; i < PtrArray_GetSize (g_fetches); i++) {
+		if (PtrArray_GetElementAt (g_fetches, i) == fetch) {
+			(void) PtrArray_RemoveAtReorder (g_fetches, i);
+			break; // ---------->
+		}
+	}
+	talloc_free (fetch);
+}
+
+
+/*****************************************************************************
+ * DownloadDescription
+ *
+ * Like UpnpDownloadUrlItem, but with a short timeout. 
+ * The result is allocated in the talloc context.
+ *****************************************************************************/
+static int
+DownloadDescription (void* ctx, const char* url, char** text,
+		     char* content_type)
+{
+	*text = NULL;
+	*content_type = NUL;
+
+	// Devices are discovered in the background
+	IOSched_Slot* slot = NULL;
+	(void) IOSched_AcquireControl (url, IO_SCHED_BACKGROUND, NULL, true,
+				       &slot);
+
+	void* handle      = NULL;
+	int contentLength = 0;
+	int httpStatus    = 0;
+	char* contentType = NULL;
+	int rc = UpnpOpenHttpGet (url, &handle, &contentType, &contentLength,
+				  &httpStatus, DESC_FETCH_TIMEOUT);
+	if (rc != UPNP_E_SUCCESS) 
+		goto cleanup; // ---------->
+	if (httpStatus < 200 || httpStatus > 299) {
+		Log_Printf (LOG_ERROR, "Description %s : HTTP status %d",
+			    url, httpStatus);
+		(void) UpnpCloseHttpGet (handle);
+		rc = UPNP_E_BAD_HTTPMSG;
+		goto cleanup; // ---------->
+	}
+	if (contentType) {
+		strncpy (content_type, contentType, LINE_SIZE - 1);
+		content_type [LINE_SIZE - 1] = NUL;
+	}
+
+	rc = UpnpUtil_ReadBody (ctx, handle, UpnpReadHttpGet, contentLength,
+				DESC_MAX_SIZE, DESC_FETCH_TIMEOUT, text);
+	(void) UpnpCloseHttpGet (handle);
+
+cleanup:
+	IOSched_Release (slot);
+	return rc;
+}
+
+
+/*****************************************************************************
+ * CreateDevice
+ *
+ * Create a device from its description document, and add it to the
+ * global device list.
+ *****************************************************************************/
+static void
+CreateDevice (const char* deviceId, const char* descLocation, 
+	      const char* descDocText, int expires, bool from_registry)
+{
+	void* context = NULL; // TBD should be parent talloc TBD XXX
+
+	DeviceNode* devnode = talloc (context, DeviceNode);
+	// Initialize fields to empty values
+	*devnode = (struct _DeviceNode) { .slot = NO_SLOT }; 
+
+	devnode->d = Device_Create (devnode, g_ctrlpt_handle, 
+				    descLocation, deviceId, descDocText);
+	if (devnode->d == NULL) {
+		Log_Printf (LOG_ERROR, "Can't create Device Id=%s", 
+			    NN(deviceId));
+		talloc_free (devnode);
+		return; // ---------->
+	} 
+
+	// If SSDP target specified, check that the device matches it.
+	if (g_ssdp_target && strstr (g_ssdp_target, ":service:")) {
+		const Service* serv = Device_GetServiceFrom 
+			(devnode->d, g_ssdp_target, FROM_SERVICE_TYPE, false);
+		if (serv == NULL) {
+			Log_Printf (LOG_DEBUG, "Discovered device Id=%s "
+				    "has no '%s' service : ignored for %d "
+				    "seconds", NN(deviceId), g_ssdp_target,
+				    expires);
+			talloc_free (devnode);
+			ithread_mutex_lock (&DeviceListMutex);
+			IgnoredInsert (deviceId, descLocation, 
+				       time (NULL) + expires);
+			ithread_mutex_unlock (&DeviceListMutex);
+			return; // ---------->
+		}
+	}
+
+	// Relock the device list (and check that the same device has not 
+	// already been added by another thread while the list was unlocked)
+	ithread_mutex_lock (&DeviceListMutex);
+	if (GetDeviceNodeFromId (deviceId)) {
+		Log_Printf (LOG_WARNING, "Device Id=%s already added",
+			    NN(deviceId));
+		// Delete extraneous device descriptor. Note: service 
+		// subscription is not yet done, so the Service destructors 
+		// will not unsubscribe
+		talloc_free (devnode);
+	} else {
+		devnode->deviceId = talloc_strdup (devnode, deviceId);
+		devnode->descLocation = talloc_strdup (devnode, descLocation);
+		devnode->deadline = time (NULL) + expires;
+		devnode->unconfirmed = from_registry;
+		// Registry devices are confirmed through the locked path
+		devnode->slot = (from_registry ? NO_SLOT : 
+				 ExpiryInsert (deviceId, devnode->deadline));
+		
+		// Generate a unique, friendly, name for this device
+		const char* base = Device_GetDescDocItem 
+			(devnode->d, "friendlyName", true);
+		char* name = make_device_name (NULL, base);
+		talloc_set_name (devnode->d, "%s", name);
+		talloc_free (name);
+		devnode->name = talloc_get_name (devnode->d);
+		
+		Log_Printf (LOG_INFO, "Add new device : Name='%s' "
+			    "Id='%s' descURL='%s'", 
+			    NN(talloc_get_name (devnode->d)), 
+			    NN(deviceId), descLocation);
+		
+		// Insert the new device node in the list
+		if (! InsertDeviceNode (devnode)) {
+			Log_Printf (LOG_ERROR, "Can't add Device Id=%s", 
+				    NN(deviceId));
+			talloc_free (devnode);
+		} else {
+			// Don't wait for devices which might be gone : 
+			// subscribe once they are discovered again
+			if (! from_registry) {
+				Device_SusbcribeAllEvents (devnode->d);
+				ForgetUnknownSids();
+			}
+			
+			// Notify New Device Added, while the global 
+			// list is still locked
+			NotifyUpdate (E_DEVICE_ADDED, devnode);
+		}
+	}
+	ithread_mutex_unlock (&DeviceListMutex);
+}
+
+
+/*****************************************************************************
+ * SaveRegistry
+ *
+ * Save the known devices (UDN, description URL and document) in the
+ * registry file, as :
+ *	<djmount-registry>
+ *	  <device udn="..." location="...">description document</device>
+ *	</djmount-registry>
+ * The service URLs are given by the description documents.
+ *****************************************************************************/
+static void
+SaveRegistry (void)
+{
+	if (g_registry_file == NULL)
+		return; // ---------->
+
+	ithread_mutex_lock (&g_registry_mutex);
+	g_registry_dirty = false;
+
+	void* const tmp_ctx = talloc_new (NULL);
+	IXML_Document* doc = NULL;
+	IXML_Element* root = NULL;
+	char* text = NULL;
+	if (ixmlDocument_createDocumentEx (&doc) != IXML_SUCCESS ||
+	    ixmlDocument_createElementEx (doc, "djmount-registry", 
+					  &root) != IXML_SUCCESS ||
+	    ixmlNode_appendChild (XML_D2N (doc), XML_E2N (root)) 
+	    != IXML_SUCCESS)
+		goto cleanup; // ---------->
+
+	ithread_mutex_lock (&DeviceListMutex);
+	ListNode* node;
+	for (node = ListHead (&GlobalDeviceList);
+	     node != NULL;
+	     node = ListNext (&GlobalDeviceList, node)) {
+		const DeviceNode* const devnode = node->item;
+		if (devnode == NULL || devnode->descLocation == NULL)
+			continue; // ---------->
+		char* const desc = Device_GetDescDocTextCopy (devnode->d, 
+							      tmp_ctx);
+		IXML_Element* const elem = ixmlDocument_createElement 
+			(doc, "device");
+		IXML_Node* const data = (desc ? ixmlDocument_createTextNode 
+					 (doc, desc) : NULL);
+		if (elem == NULL || data == NULL) {
+			if (elem)
+				ixmlElement_free (elem);
+			continue; // ---------->
+		}
+		(void) ixmlElement_setAttribute (elem, "udn", 
+						 devnode->deviceId);
+		(void) ixmlElement_setAttribute (elem, "location", 
+						 devnode->descLocation);
+		(void) ixmlNode_appendChild (XML_E2N (elem), data);
+		(void) ixmlNode_appendChild (XML_E2N (root), XML_E2N (elem));
+	}
+	ithread_mutex_unlock (&DeviceListMutex);
+
+	text = XMLUtil_GetDocumentString (tmp_ctx, doc);
+
+	// Write a new file, then replace the old one
+	char* const tmp_file = talloc_asprintf (tmp_ctx, "%s.tmp", 
+						g_registry_file);
+	FILE* const f = fopen (tmp_file, "w");
+	if (f == NULL) {
+		Log_Printf (LOG_ERROR, "DeviceList : can't write registry "
+			    "'%s' : %s", tmp_file, strerror (errno));
+		goto cleanup; // ---------->
+	}
+	const bool ok = (fputs (text, f) >= 0);
+	if (fclose (f) != 0 || ! ok || rename (tmp_file, g_registry_file)) {
+		Log_Printf (LOG_ERROR, "DeviceList : can't write registry "
+			    "'%s' : %s", g_registry_file, strerror (errno));
+		(void) unlink (tmp_file);
+	}
+	
+cleanup:
+	if (doc)
+		ixmlDocument_free (doc);
+	talloc_free (tmp_ctx);
+	ithread_mutex_unlock (&g_registry_mutex);
+}
+
+
+/*****************************************************************************
+ * SaveRegistryLater / SaveRegistryIfQuiet
+ *****************************************************************************/
+static void
+SaveRegistryLater (void)
+{
+	g_registry_changed = time (NULL);
+	g_registry_dirty = true;
+}
+
+static void
+SaveRegistryIfQuiet (void)
+{
+	if (g_registry_dirty && 
+	    time (NULL) >= g_registry_changed + REGISTRY_SAVE_DELAY) {
+		// Do not leave the registry mutex locked at stop
+		int state;
+		(void) pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &state);
+		SaveRegistry();
+		(void) pthread_setcancelstate (state, NULL);
+	}
+}
+
+
+/*****************************************************************************
+ * LoadRegistry
+ *
+ * Create the devices saved in the registry file. They are removed if 
+ * not discovered again within REGISTRY_GRACE_PERIOD.
+ *****************************************************************************/
+static void
+LoadRegistry (void)
+{
+	if (g_registry_file == NULL)
+		return; // ---------->
+
+	IXML_Document* doc = NULL;
+	if (ixmlLoadDocumentEx (g_registry_file, &doc) != IXML_SUCCESS) {
+		Log_Printf (LOG_INFO, "DeviceList : no registry '%s'",
+			    g_registry_file);
+		return; // ---------->
+	}
+	IXML_NodeList* const devices = ixmlDocument_getElementsByTagName 
+		(doc, "device");
+	const unsigned long n = (devices ? ixmlNodeList_length (devices) : 0);
+	unsigned long i;
+	for (i = 0; i < n; i++) {
+		IXML_Element* const elem = (IXML_Element*) ixmlNodeList_item
+			(devices, i);
+		const char* const udn = ixmlElement_getAttribute (elem, "udn");
+		const char* const location = ixmlElement_getAttribute 
+			(elem, "location");
+		const char* const desc = XMLUtil_GetElementValue (elem);
+		if (udn && location && desc) {
+			Log_Printf (LOG_DEBUG, "DeviceList : registry device "
+				    "Id=%s", udn);
+			CreateDevice (udn, location, desc, 
+				      REGISTRY_GRACE_PERIOD, true);
+		}
+	}
+	if (devices)
+		ixmlNodeList_free (devices);
+	ixmlDocument_free (doc);
+	Log_Printf (LOG_INFO, "DeviceList : loaded %lu devices from "
+		    "registry '%s'", n, g_registry_file);
+}
+
+
+/*****************************************************************************
+ * SubscribeJob
+ *
+ * Worker job : subscribe to the events of a device from the registry,
+ * once it has been discovered again.
+ *****************************************************************************/
+static void
+SubscribeJob (void* arg)
+{
+	char* const deviceId = arg;
+	ithread_mutex_lock (&DeviceListMutex);
+	const DeviceNode* const devnode = GetDeviceNodeFromId (deviceId);
+	if (devnode) {
+		Device_SusbcribeAllEvents (devnode->d);
+		ForgetUnknownSids();
+	}
+	ithread_mutex_unlock (&DeviceListMutex);
+	talloc_free (deviceId);
+}
+
+
+/*****************************************************************************
+ * FetchJob
+ *
+ * Worker job : download a description, then create all the devices
+ * waiting for it.
+ *****************************************************************************/
+static void
+FetchJob (void* arg)
+{
+	Fetch* const fetch = arg;
+	void* const tmp_ctx = talloc_new (NULL);
+
+	char* descDocText = NULL;
+	char content_type [LINE_SIZE] = "";
+	int rc = UPNP_E_CANCELED;
+	if (! g_stopping) 
+		rc = DownloadDescription (tmp_ctx, fetch->url, &descDocText, 
+					  content_type);
+	if (rc != UPNP_E_SUCCESS) {
+		if (! g_stopping) {
+			Log_Printf (LOG_ERROR,
+				    "Error obtaining device description from "
+				    "url '%s' : %d (%s)", fetch->url, rc, 
+				    UpnpGetErrorMessage (rc));
+		}
+		if (rc/100 == UPNP_E_NETWORK_ERROR/100) {
+			Log_Printf (LOG_ERROR, "Check device network "
+				    "configuration (firewall ?)");
+		}
+	} else if (strncasecmp (content_type, "text/xml", 8)) {
+		// "text/xml" is specified in UPnP Device Architecture
+		// v1.0 -- however don't abort if incorrect because
+		// some broken UPnP device send other MIME types 
+		// (e.g. application/octet-stream).
+		Log_Printf (LOG_ERROR, "Device description at url '%s'"
+			    " has MIME '%s' instead of XML ! "
+			    "Trying to parse anyway ...", 
+			    fetch->url, content_type);
+	}
+
+	ithread_mutex_lock (&DeviceListMutex);
+	if (descDocText) {
+		// More requests can be queued while the devices are created
+		while (! PtrArray_IsEmpty (fetch->requests)) {
+			PtrArray* const requests = talloc_steal 
+				(tmp_ctx, fetch->requests);
+			fetch->requests = PtrArray_Create (fetch);
+			ithread_mutex_unlock (&DeviceListMutex);
+
+			const FetchRequest* req = NULL;
+			PTR_ARRAY_FOR_EACH_PTR (requests, req) {
+				CreateDevice (req->deviceId, fetch->url, 
+					      descDocText, req->expires, 
+					      false);
+			} PTR_ARRAY_FOR_EACH_PTR_END;
+			talloc_free (requests);
+
+			ithread_mutex_lock (&DeviceListMutex);
+		}
+		RemoveFetch (fetch);
+		SaveRegistryLater();
+	} else {
+		// Remember the failure, to not retry on each announcement
+		fetch->running = false;
+		fetch->retry_after = time (NULL) + DESC_RETRY_DELAY;
+		talloc_free (fetch->requests);
+		fetch->requests = PtrArray_Create (fetch);
+	}
+	ithread_mutex_unlock (&DeviceListMutex);
+
+	talloc_free (tmp_ctx);
+}
+
+
 /*****************************************************************************
  * AddDevice
  *
  * Description: 
  *       If the device is not already included in the global device list,
- *       add it.  Otherwise, update its advertisement expiration timeout.
+ *       add it (asynchronously, once its description is downloaded).  
+ *       Otherwise, update its advertisement expiration timeout.
  *
  * Parameters:
  *   descLocation -- The location of the description document URL
  *   expires -- The expiration time for this advertisement
  *
  *****************************************************************************/
-
-
 static void
 AddDevice (const char* deviceId,
 	   const char* descLocation,
 	   int expires)
 {
+	// Fast path : repeated advertisement of a known device
+	const time_t now = time (NULL);
+	if (ExpiryTouch (deviceId, now + expires))
+		return; // ---------->
+	// ... or of a device rejected by the SSDP target
+	if (descLocation && IsIgnored (deviceId, descLocation, now))
+		return; // ---------->
+
 	ithread_mutex_lock (&DeviceListMutex);
 
-	DeviceNode* devnode = NULL;
-	ListNode* node = GetDeviceListNodeFromId (deviceId);
-	if (node) 
-		devnode = node->item;
-	
-	if (devnode) {
+	DeviceNode* const devnode = GetDeviceNodeFromId (deviceId);
+	if (devnode && devnode->unconfirmed && descLocation &&
+	    strcmp (devnode->descLocation, descLocation) != 0) {
+		// Device from the registry, which has moved : forget it
+		Log_Printf (LOG_DEBUG, "AddDevice Id=%s moved to '%s'",
+			    NN(deviceId), descLocation);
+		RemoveDeviceNode (devnode);
+		NotifyUpdate (E_DEVICE_REMOVED, devnode);
+		talloc_free (devnode);
+	} else if (devnode) {
 		// The device is already there, so just update 
 		// the advertisement timeout field
 		Log_Printf (LOG_DEBUG, 
 			    "AddDevice Id=%s already exists, "
 			    "only update expiration = %d seconds",
 			    NN(deviceId), expires);
-		devnode->expires = expires;
-	} else {
-		// Else create a new device
-		Log_Printf (LOG_DEBUG, "AddDevice try new device Id=%s", 
+		SetDeadline (devnode, time (NULL) + expires);
+		if (devnode->unconfirmed) {
+			devnode->unconfirmed = false;
+			devnode->slot = ExpiryInsert (deviceId, 
+						      devnode->deadline);
+			char* const id = talloc_strdup (NULL, deviceId);
+			if (WorkerPool_Submit (g_desc_pool, SubscribeJob, 
+					       id) != 0)
+				talloc_free (id);
+		}
+		goto cleanup; // ---------->
+	} 
+	if (descLocation == NULL) {
+		Log_Printf (LOG_ERROR, 
+			    "NULL description doc. URL device Id=%s", 
 			    NN(deviceId));
-		
-		// *unlock* before trying to download the Device Description 
-		// Document, which can take a long time in some error cases 
-		// (e.g. timeout if network problems)
-		ithread_mutex_unlock (&DeviceListMutex);
+		goto cleanup; // ---------->
+	}
 
-		if (descLocation == NULL) {
-			Log_Printf (LOG_ERROR, 
-				    "NULL description doc. URL device Id=%s", 
-				    NN(deviceId));
-			return; // ---------->
+	Fetch* fetch = FindFetch (descLocation);
+	if (fetch && ! fetch->running && time (NULL) < fetch->retry_after) {
+		Log_Printf (LOG_DEBUG, "AddDevice Id=%s : url '%s' failed "
+			    "recently, not retrying yet", NN(deviceId), 
+			    descLocation);
+		goto cleanup; // ---------->
+	}
+	if (fetch == NULL) {
+		fetch = talloc (g_fetches, Fetch);
+		if (fetch == NULL)
+			goto cleanup; // ---------->
+		*fetch = (Fetch) {
+			.url	  = talloc_strdup (fetch, descLocation),
+			.running  = false,
+			.requests = PtrArray_Create (fetch),
+		};
+		if (fetch->url == NULL || fetch->requests == NULL ||
+		    ! PtrArray_Append (g_fetches, fetch)) {
+			talloc_free (fetch);
+			goto cleanup; // ---------->
 		}
+	}
 
-		char* descDocText = NULL;
-		char content_type [LINE_SIZE] = "";
-		int rc = UpnpDownloadUrlItem (descLocation, &descDocText, 
-					      content_type);
-		if (rc != UPNP_E_SUCCESS) {
-			Log_Printf (LOG_ERROR,
-				    "Error obtaining device description from "
-				    "url '%s' : %d (%s)", descLocation, rc, 
-				    UpnpGetErrorMessage (rc));
-			if (rc/100 == UPNP_E_NETWORK_ERROR/100) {
-				Log_Printf (LOG_ERROR, "Check device network "
-					    "configuration (firewall ?)");
-			}
-			return; // ---------->
-		} 
-		if (strncasecmp (content_type, "text/xml", 8)) {
-			// "text/xml" is specified in UPnP Device Architecture
-			// v1.0 -- however don't abort if incorrect because
-			// some broken UPnP device send other MIME types 
-			// (e.g. application/octet-stream).
-			Log_Printf (LOG_ERROR, "Device description at url '%s'"
-				    " has MIME '%s' instead of XML ! "
-				    "Trying to parse anyway ...", 
-				    descLocation, content_type);
+	// Queue the device (once) on the download of its description
+	FetchRequest* req = NULL;
+	PTR_ARRAY_FOR_EACH_PTR (fetch->requests, req) {
+		if (strcmp (req->deviceId, deviceId) == 0) {
+			req->expires = expires;
+			goto cleanup; // ---------->
 		}
-		
-		void* context = NULL; // TBD should be parent talloc TBD XXX
-
-		devnode = talloc (context, DeviceNode);
-		// Initialize fields to empty values
-		*devnode = (struct _DeviceNode) { }; 
-
-		devnode->d = Device_Create (devnode, g_ctrlpt_handle, 
-					    descLocation, deviceId,
-					    descDocText);
-		free (descDocText);
-		descDocText = NULL;
-
-		if (devnode->d == NULL) {
-			Log_Printf (LOG_ERROR, "Can't create Device Id=%s", 
-				    NN(deviceId));
-			talloc_free (devnode);
-			return; // ---------->
-		} else {
-			// If SSDP target specified, check that the device
-			// matches it.
-			if (g_ssdp_target && strstr (g_ssdp_target, ":service:")) {
-				const Service* serv = Device_GetServiceFrom 
-					(devnode->d, g_ssdp_target, 
-					 FROM_SERVICE_TYPE, false);
-				if (serv == NULL) {
-					Log_Printf (LOG_DEBUG,
-						    "Discovered device Id=%s "
-						    "has no '%s' service : "
-						    "forgetting", NN(deviceId),
-						    g_ssdp_target);
-					talloc_free (devnode);
-					return; // ---------->
-				}
-			}
-
-			// Relock the device list (and check that the same
-			// device has not already been added by another thread
-			// while the list was unlocked)
-			ithread_mutex_lock (&DeviceListMutex);
-			node = GetDeviceListNodeFromId (deviceId);
-			if (node) {
-				Log_Printf (LOG_WARNING, 
-					    "Device Id=%s already added",
-					    NN(deviceId));
-				// Delete extraneous device descriptor. Note:
-				// service subscription is not yet done, so 
-				// the Service destructors will not unsubscribe
-				talloc_free (devnode);
-			} else {
-				devnode->deviceId = talloc_strdup (devnode, 
-								   deviceId);
-				devnode->expires = expires;
-				
-				// Generate a unique, friendly, name 
-				// for this device
-				const char* base = Device_GetDescDocItem 
-					(devnode->d, "friendlyName", true);
-				char* name = make_device_name (NULL, base);
-				talloc_set_name (devnode->d, "%s", name);
-				talloc_free (name);
-				
-				Log_Printf (LOG_INFO, 
-					    "Add new device : Name='%s' "
-					    "Id='%s' descURL='%s'", 
-					    NN(talloc_get_name (devnode->d)), 
-					    NN(deviceId), descLocation);
-
-				// Insert the new device node in the list
-				ListAddTail (&GlobalDeviceList, devnode);
-
-				Device_SusbcribeAllEvents (devnode->d);
-				
-				// Notify New Device Added, while the global 
-				// list is still locked
-				NotifyUpdate (E_DEVICE_ADDED, devnode);
-			}
+	} PTR_ARRAY_FOR_EACH_PTR_END;
+	req = talloc (fetch->requests, FetchRequest);
+	if (req == NULL)
+		goto cleanup; // ---------->
+	*req = (FetchRequest) { 
+		.deviceId = talloc_strdup (req, deviceId),
+		.expires  = expires 
+	};
+	(void) PtrArray_Append (fetch->requests, req);
+
+	if (! fetch->running) {
+		Log_Printf (LOG_DEBUG, "AddDevice try new device Id=%s", 
+			    NN(deviceId));
+		fetch->running = true;
+		if (WorkerPool_Submit (g_desc_pool, FetchJob, fetch) != 0) {
+			Log_Printf (LOG_ERROR, "AddDevice can't queue url "
+				    "'%s'", descLocation);
+			RemoveFetch (fetch);
 		}
 	}
+
+cleanup:
 	ithread_mutex_unlock (&DeviceListMutex);
 }
   
@@ -509,10 +1371,13 @@ EventHandlerCallback (Upnp_EventType event_type,
 		      void* event, void* cookie)
 {
 	// Create a working context for temporary strings
-	void* const tmp_ctx = talloc_new (NULL);
+	void* const tmp_ctx = talloc_new_tmp (NULL, TALLOC_TMP_POOL_SIZE);
 
-	Log_Print (LOG_DEBUG, UpnpUtil_GetEventString (tmp_ctx, event_type, 
-						       event));
+	// Don't format anything unless printed (advertisements are frequent)
+	const bool debug = LOG_IS_DEBUG_ACTIVATED;
+	if (debug)
+		Log_Print (LOG_DEBUG, UpnpUtil_GetEventString 
+			   (tmp_ctx, event_type, event));
 	
 	switch ( event_type ) {
 		/*
@@ -532,14 +1397,13 @@ EventHandlerCallback (Upnp_EventType event_type,
 		// TBD else ??
       
 		if (e->DeviceId && e->DeviceId[0]) { 
-			Log_Printf (LOG_DEBUG, 
-				    "Discovery : device type '%s' "
-				    "OS '%s' at URL '%s'", NN(e->DeviceType), 
-				    NN(e->Os), NN(e->Location));
+			if (debug)
+				Log_Printf (LOG_DEBUG, 
+					    "Discovery : device type '%s' "
+					    "OS '%s' at URL '%s'", 
+					    NN(e->DeviceType), 
+					    NN(e->Os), NN(e->Location));
 			AddDevice (e->DeviceId, e->Location, e->Expires);
-			Log_Printf (LOG_DEBUG, "Discovery: "
-				    "DeviceList after AddDevice = \n%s",
-				    DeviceList_GetStatusString (tmp_ctx));
 		}
 		
 		break;
@@ -565,8 +1429,9 @@ EventHandlerCallback (Upnp_EventType event_type,
 			    e->DeviceId );
 		DeviceList_RemoveDevice (e->DeviceId);
 		
-		Log_Printf (LOG_DEBUG, "DeviceList after byebye: \n%s",
-			    DeviceList_GetStatusString (tmp_ctx));
+		if (debug)
+			Log_Printf (LOG_DEBUG, "DeviceList after byebye: \n%s",
+				    DeviceList_GetStatusString (tmp_ctx));
 		break;
 	}
     
@@ -632,11 +1497,13 @@ EventHandlerCallback (Upnp_EventType event_type,
 			Service* const serv = GetService (e->PublisherUrl,
 							  FROM_EVENT_URL);
 			if (serv) {
+				UnindexSid (Service_GetSid (serv));
 				if (event_type == 
 				    UPNP_EVENT_UNSUBSCRIBE_COMPLETE)
 					Service_SetSid (serv, NULL);
 				else			      
 					Service_SetSid (serv, e->Sid);
+				ForgetUnknownSids();
 			}
 			ithread_mutex_unlock (&DeviceListMutex);
 		}
@@ -656,8 +1523,11 @@ EventHandlerCallback (Upnp_EventType event_type,
       
 		Service* const serv = GetService (e->PublisherUrl, 
 						  FROM_EVENT_URL);
-		if (serv) 
+		if (serv) {
+			UnindexSid (Service_GetSid (serv));
 			Service_SubscribeEventURL (serv);
+			ForgetUnknownSids();
+		}
 		
 		ithread_mutex_unlock (&DeviceListMutex);
 		
@@ -727,7 +1597,14 @@ _DeviceList_LockService (const char* deviceName, const char* serviceType)
 
 	// XXX coarse implementation : lock the whole device list, 
 	// XXX not only the service.
+	METRICS_STATIC_ID (wait_id, METRICS_HISTOGRAM, 
+			   "djmount_lock_wait_seconds", 
+			   "Time spent waiting for locks", 
+			   "lock=\"devices\"");
+	Trace_Span wait;
+	Trace_Begin (&wait, "devices.lock", deviceName);
 	ithread_mutex_lock (&DeviceListMutex);
+	Metrics_Observe (wait_id, Trace_End (&wait));
 	
 	const DeviceNode* devnode = GetDeviceNodeFromName (deviceName, true);
 	if (devnode) 
@@ -761,7 +1638,7 @@ DeviceList_SendActionAsync (const char* deviceName, const char* serviceType,
   int rc = UPNP_E_INTERNAL_ERROR;
   DEVICE_LIST_CALL_SERVICE (rc, deviceName, serviceType,
 			    Service, SendActionAsync,
-			    EventHandlerCallback, actionName, 
+			    EventHandlerCallback, NULL, actionName, 
 			    nb_params, params);
   return rc;
 }
@@ -787,13 +1664,16 @@ DeviceList_SendAction (const char* deviceName, const char* serviceType,
  * GetDevicesNames
  *****************************************************************************/
 PtrArray*
-DeviceList_GetDevicesNames (void* context)
+DeviceList_GetDevicesNames (void* context, PtrArray** udns)
 {
 	ithread_mutex_lock (&DeviceListMutex);
 
 	Log_Printf (LOG_DEBUG, "GetDevicesNames");
 	PtrArray* const a = PtrArray_CreateWithCapacity 
 		(context, ListSize (&GlobalDeviceList));
+	if (udns) 
+		*udns = PtrArray_CreateWithCapacity 
+			(context, ListSize (&GlobalDeviceList));
 	if (a) {
 		ListNode* node;
 		for (node = ListHead (&GlobalDeviceList);
@@ -807,6 +1687,11 @@ DeviceList_GetDevicesNames (void* context)
 				// add pointer directly 
 				// TBD no need to copy ??? XXX
 				PtrArray_Append (a, (char*) NN(name)); 
+				if (udns && *udns)
+					PtrArray_Append (*udns, 
+							 Device_GetUDNCopy
+							 (devnode->d, 
+							  context));
 			}
 		}
 	}
@@ -863,10 +1748,11 @@ DeviceList_GetDeviceStatusString (void* context, const char* deviceName,
 	DeviceNode* const devnode = GetDeviceNodeFromName (deviceName, true);
 	if (devnode) { 
 		p = talloc_asprintf (context, "Device \"%s\" (", deviceName);
-		if (devnode->expires >= 0) 
-			tpr (&p, "expires in %d seconds", devnode->expires);
+		const long expires = GetDeadline (devnode) - time (NULL);
+		if (expires >= 0) 
+			tpr (&p, "expires in %ld seconds", expires);
 		else
-			tpr (&p, "expired %d seconds ago", -devnode->expires);
+			tpr (&p, "expired %ld seconds ago", -expires);
 		char* tmp = Device_GetStatusString (devnode->d, p, debug);
 		tpr (&p, ")\n%s", tmp);
 		talloc_free (tmp);
@@ -897,6 +1783,7 @@ static void
 VerifyTimeouts (int incr)
 {
 	ithread_mutex_lock (&DeviceListMutex);
+	const time_t now = time (NULL);
   
 	// During this traversal we pre-compute the next node in case 
 	// the current node is deleted
@@ -907,19 +1794,18 @@ VerifyTimeouts (int incr)
 		nextnode = ListNext (&GlobalDeviceList, node);
 		
 		DeviceNode* const devnode = node->item;
-		devnode->expires -= incr;
+		const long expires = GetDeadline (devnode) - now;
 		
-		if (devnode->expires <= -incr) {
+		if (expires <= -incr) {
 			// Too late : really remove the device from the list 
 			Log_Printf (LOG_DEBUG, "Remove expired device Id=%s", 
 				    devnode->deviceId);
-			node->item = NULL;
-			ListDelNode (&GlobalDeviceList, node, /*freeItem=>*/0);
+			RemoveDeviceNode (devnode);
 			// Do the notification while the global list is locked
 			NotifyUpdate (E_DEVICE_REMOVED, devnode);
 			talloc_free (devnode);
 
-		} else if (devnode->expires <= 0) {
+		} else if (expires <= 0) {
 			// This advertisement has expired, so we should 
 			// normally remove the device from the list.
 			// First, send out a search request for this device 
@@ -957,11 +1843,23 @@ CheckSubscriptionsLoop (void* arg)
 	while (true) {
 		isleep (CHECK_SUBSCRIPTIONS_TIMEOUT);
 		VerifyTimeouts (CHECK_SUBSCRIPTIONS_TIMEOUT);
+		SaveRegistryIfQuiet();
 	}
 	return NULL;
 }
 
 
+/*****************************************************************************
+ * DeviceList_SetRegistryFile
+ *****************************************************************************/
+void
+DeviceList_SetRegistryFile (const char* filename)
+{
+	talloc_free (g_registry_file);
+	g_registry_file = (filename ? talloc_strdup (NULL, filename) : NULL);
+}
+
+
 /*****************************************************************************
  * DeviceList_Start
  *****************************************************************************/
@@ -985,8 +1883,30 @@ DeviceList_Start (const char* ssdp_target,
 	gStateUpdateFun = eventCallback;
 	
 	ithread_mutex_init (&DeviceListMutex, NULL);
+	ithread_mutex_init (&g_registry_mutex, NULL);
 	
 	ListInit (&GlobalDeviceList, 0, 0);
+	g_devices_by_name = hash_initialize (INITIAL_TABLE_SIZE, NULL,
+					     name_hasher, name_comparator, 
+					     NULL);
+	g_devices_by_id   = hash_initialize (INITIAL_TABLE_SIZE, NULL,
+					     id_hasher, id_comparator, NULL);
+	g_services_by_sid = hash_initialize 
+		(INITIAL_TABLE_SIZE, NULL, service_index_hasher, 
+		 service_index_comparator, service_index_freer);
+	g_services_by_event_url = hash_initialize 
+		(INITIAL_TABLE_SIZE, NULL, service_index_hasher, 
+		 service_index_comparator, service_index_freer);
+	g_fetches   = PtrArray_Create (NULL);
+	g_desc_pool = WorkerPool_Create (NULL, "descriptions", 
+					 DESC_FETCH_THREADS);
+	g_stopping  = false;
+	if (g_devices_by_name == NULL || g_devices_by_id == NULL ||
+	    g_services_by_sid == NULL || g_services_by_event_url == NULL ||
+	    g_fetches == NULL || g_desc_pool == NULL) {
+		Log_Printf (LOG_ERROR, "DeviceList : can't allocate indexes");
+		return UPNP_E_OUTOF_MEMORY; // ---------->
+	}
 	
 	// Makes the XML parser more tolerant to malformed text
 	ixmlRelaxParser ('?');
@@ -1026,7 +1946,10 @@ DeviceList_Start (const char* ssdp_target,
 	Log_Printf (LOG_DEBUG, "Control Point Registered" );
 	
 	g_ssdp_target = talloc_strdup (NULL, ssdp_target);
-	DeviceList_RefreshAll (true);
+
+	// Known devices are available at once, until discovered again
+	LoadRegistry();
+	DeviceList_RefreshAll (false);
 	
 	// start a timer thread
 	ithread_create (&g_timer_thread, NULL, CheckSubscriptionsLoop, NULL);
@@ -1048,7 +1971,24 @@ DeviceList_Stop (void)
 	 */
 	
 	ithread_cancel (g_timer_thread);
+
+	/*
+	 * Detach the download queues from the SSDP callbacks, which can
+	 * still run until UpnpUnRegisterClient, then wait for the 
+	 * downloads in progress (the queued ones are skipped). 
+	 * The mutex is not held while waiting : the jobs need it.
+	 */
+	g_stopping = true;
+	ithread_mutex_lock (&DeviceListMutex);
+	WorkerPool* const desc_pool = g_desc_pool;
+	PtrArray* const fetches = g_fetches;
+	g_desc_pool = NULL;
+	g_fetches = NULL;
+	ithread_mutex_unlock (&DeviceListMutex);
+	talloc_free (desc_pool);
+	talloc_free (fetches);
 	
+	SaveRegistry();
 	DeviceList_RemoveAll();
 	talloc_free (g_ssdp_target);
 	g_ssdp_target = NULL;
@@ -1057,8 +1997,17 @@ DeviceList_Stop (void)
 	rc = UpnpFinish();
 	
 	ListDestroy (&GlobalDeviceList, /*freeItem=>*/ 0);
+	hash_free (g_devices_by_name);
+	g_devices_by_name = NULL;
+	hash_free (g_devices_by_id);
+	g_devices_by_id = NULL;
+	hash_free (g_services_by_sid);
+	g_services_by_sid = NULL;
+	hash_free (g_services_by_event_url);
+	g_services_by_event_url = NULL;
 	
 	ithread_mutex_destroy (&DeviceListMutex);
+	ithread_mutex_destroy (&g_registry_mutex);
 	
 	gStateUpdateFun = 0;
 	
@@ -186,10 +186,13 @@ extern "C" {
  * 	  The returned array should be freed using "talloc_free".
  *
  * @param talloc_context	parent context to allocate result, may be NULL
+ * @param udns		if not NULL, set to the UDNs of the devices, in
+ *			the same order (element type = "char*", 
+ *			allocated in talloc_context, NULL if unknown)
  * @return 			PtrArray (element type = "const char*")
  *****************************************************************************/
 PtrArray*
-DeviceList_GetDevicesNames (void* talloc_context);
+DeviceList_GetDevicesNames (void* talloc_context, PtrArray** udns);
 
 
 /*****************************************************************************
@@ -232,6 +235,19 @@ DeviceList_Start (const char* ssdp_target,
 		  DeviceList_EventCallback eventCallback);
 
 
+/*****************************************************************************
+ * @brief 	Set the file where the known devices are saved (at exit, 
+ *		and when new devices are discovered). At the next start,
+ *		these devices are available at once, then removed if they
+ *		are not discovered again within a few seconds.
+ *		Must be called before DeviceList_Start.
+ *
+ * @param filename	path of the registry file, or NULL for no registry
+ *****************************************************************************/
+void
+DeviceList_SetRegistryFile (const char* filename);
+
+
 /*****************************************************************************
  * @brief      	Destroy the device list and stops the UPnP Control Point.
  *
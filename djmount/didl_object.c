@@ -29,6 +29,9 @@
 #include "xml_util.h"
 #include "talloc_util.h"
 
+#include <string.h>
+#include <ctype.h>
+
 
 /******************************************************************************
  * DestroyObject
@@ -42,6 +45,7 @@ DestroyObject (DIDLObject* const o)
 {
 	if (o) {
 		ixmlElement_free (o->element);
+		StringPool_Release (o->strings, o->cds_class);
 		
 		// The "talloc'ed" strings will be deleted automatically 
 	}
@@ -54,6 +58,7 @@ DestroyObject (DIDLObject* const o)
  *****************************************************************************/
 DIDLObject*
 DIDLObject_Create (void* talloc_context,
+		   IN StringPool* strings,
 		   IN IXML_Element* elem, 
 		   IN bool is_container) 
 {
@@ -108,9 +113,27 @@ DIDLObject_Create (void* talloc_context,
 			o->basename[0] = '-';
 		}
 		
-		o->cds_class = String_StripSpaces 
-			(o, XMLUtil_FindFirstElementValue (node, "upnp:class",
-							   false, true));
+		const char* cds_class = XMLUtil_FindFirstElementValue 
+			(node, "upnp:class", false, true);
+		if (cds_class == NULL)
+			cds_class = "";
+		char* stripped = NULL;
+		if (isspace (cds_class[0]) || (cds_class[0] != NUL && isspace
+		    (cds_class[strlen (cds_class) - 1]))) {
+			stripped = String_StripSpaces (o, cds_class);
+			cds_class = stripped;
+		}
+		if (strings) {
+			o->cds_class = StringPool_Get (strings, cds_class);
+			if (o->cds_class)
+				o->strings = strings;
+		}
+		if (o->strings == NULL) {
+			o->cds_class = (stripped ? stripped 
+					: talloc_strdup (o, cds_class));
+		} else if (stripped) {
+			talloc_free (stripped);
+		}
 		if (o->cds_class == NULL)
 			o->cds_class = "";
 
@@ -31,6 +31,7 @@ extern "C" {
 
 #include <stdbool.h>
 #include <upnp/ixml.h>
+#include "string_pool.h"
 
 
 
@@ -60,7 +61,7 @@ typedef struct _DIDLObject {
 	char* 		id;
 	// TBD char* parentId;
 	const char* 	title;	
-	char* 		cds_class;
+	const char*	cds_class; // shared copy if created with a StringPool
 	// TBD bool  restricted; // TBD Not Yet Implemented
 	bool 		searchable;
 
@@ -80,6 +81,9 @@ typedef struct _DIDLObject {
 	// never empty "", or reserved name (e.g. starting with "." or "_")
 	char* 	basename;
 
+	// Pool holding "cds_class", or NULL if private copy
+	StringPool*	strings;
+
 } DIDLObject;
 
 
@@ -98,12 +102,18 @@ typedef struct _DIDLObject {
  *
  *	When finished, the object can be destroyed with "talloc_free".
  *
+ *	If a pool is given, the "cds_class" is shared with the other 
+ *	objects created from the same pool : the classes can then be 
+ *	compared with "==".
+ *
  * @param talloc_context        the talloc parent context
+ * @param strings		the pool of shared strings, or NULL
  * @param element	 	the XML description
  * @param is_container	 	true if container, false if item
  *****************************************************************************/
 DIDLObject*
 DIDLObject_Create (void* talloc_context,
+		   IN StringPool* strings,
 		   IN IXML_Element* element,
 		   IN bool is_container);
 	
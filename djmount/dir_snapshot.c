@@ -0,0 +1,195 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * DirSnapshot : entries of an opened directory.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "dir_snapshot.h"
+#include "talloc_util.h"
+
+#include <string.h>
+#include <errno.h>
+
+
+// Initial capacity of the arrays (they grow if necessary)
+#define INITIAL_ENTRIES		64
+#define INITIAL_NAMES_SIZE	2048
+
+
+typedef struct _Item {
+	size_t	name;	// offset in "names"
+	int	type;
+	ino_t	ino;
+	long	attr;	// index in "attrs", or -1
+} Item;
+
+struct _DirSnapshot {
+	char*		names;
+	size_t		names_size;
+	size_t		names_capacity;
+
+	Item*		items;
+	size_t		nb_items;
+	size_t		items_capacity;
+
+	struct stat*	attrs;
+	size_t		nb_attrs;
+	size_t		attrs_capacity;
+};
+
+
+/*****************************************************************************
+ * Grow
+ *
+ * Make sure that an array can hold "needed" elements, doubling its
+ * capacity if necessary.
+ *****************************************************************************/
+static void*
+Grow (DirSnapshot* snap, void* array, size_t elem_size, 
+      size_t* capacity, size_t initial, size_t needed)
+{
+	if (needed <= *capacity && array)
+		return array; // ---------->
+	size_t n = (*capacity ? *capacity : initial);
+	while (n < needed)
+		n *= 2;
+	void* const p = talloc_realloc_size (snap, array, n * elem_size);
+	if (p)
+		*capacity = n;
+	return p;
+}
+
+
+/*****************************************************************************
+ * DirSnapshot_Create
+ *****************************************************************************/
+DirSnapshot*
+DirSnapshot_Create (void* talloc_context)
+{
+	DirSnapshot* const snap = talloc (talloc_context, DirSnapshot);
+	if (snap) {
+		*snap = (DirSnapshot) { .names = NULL };
+	}
+	return snap;
+}
+
+
+/*****************************************************************************
+ * DirSnapshot_Add
+ *****************************************************************************/
+int
+DirSnapshot_Add (DirSnapshot* snap, const char* name, int type, ino_t ino,
+		 const struct stat* stbuf)
+{
+	if (snap == NULL || name == NULL)
+		return -EINVAL; // ---------->
+
+	size_t const len = strlen (name) + 1;
+	char* const names = Grow (snap, snap->names, 1, &snap->names_capacity,
+				  INITIAL_NAMES_SIZE, snap->names_size + len);
+	if (names == NULL)
+		return -ENOMEM; // ---------->
+	snap->names = names;
+
+	Item* const items = Grow (snap, snap->items, sizeof (Item), 
+				  &snap->items_capacity, INITIAL_ENTRIES, 
+				  snap->nb_items + 1);
+	if (items == NULL)
+		return -ENOMEM; // ---------->
+	snap->items = items;
+
+	long attr = -1;
+	if (stbuf) {
+		struct stat* const attrs = Grow (snap, snap->attrs, 
+						 sizeof (struct stat),
+						 &snap->attrs_capacity, 
+						 INITIAL_ENTRIES,
+						 snap->nb_attrs + 1);
+		if (attrs == NULL)
+			return -ENOMEM; // ---------->
+		snap->attrs = attrs;
+		attr = snap->nb_attrs++;
+		snap->attrs[attr] = *stbuf;
+		ino = stbuf->st_ino;
+	}
+
+	memcpy (snap->names + snap->names_size, name, len);
+	snap->items [snap->nb_items++] = (Item) {
+		.name = snap->names_size, .type = type, .ino = ino, 
+		.attr = attr
+	};
+	snap->names_size += len;
+	return 0;
+}
+
+
+/*****************************************************************************
+ * DirSnapshot_Filler
+ *****************************************************************************/
+int
+DirSnapshot_Filler (fuse_dirh_t h, const char* name, int type, ino_t ino)
+{
+	return DirSnapshot_Add ((DirSnapshot*) h, name, type, ino, NULL);
+}
+
+
+/*****************************************************************************
+ * DirSnapshot_StatFiller
+ *****************************************************************************/
+int
+DirSnapshot_StatFiller (void* h, const char* name, int type, 
+			const struct stat* stbuf)
+{
+	return DirSnapshot_Add ((DirSnapshot*) h, name, type, 0, stbuf);
+}
+
+
+/*****************************************************************************
+ * DirSnapshot_GetSize
+ *****************************************************************************/
+size_t
+DirSnapshot_GetSize (const DirSnapshot* snap)
+{
+	return (snap ? snap->nb_items : 0);
+}
+
+
+/*****************************************************************************
+ * DirSnapshot_GetEntry
+ *****************************************************************************/
+bool
+DirSnapshot_GetEntry (const DirSnapshot* snap, size_t index, 
+		      DirSnapshot_Entry* entry)
+{
+	if (snap == NULL || entry == NULL || index >= snap->nb_items)
+		return false; // ---------->
+
+	const Item* const item = snap->items + index;
+	*entry = (DirSnapshot_Entry) {
+		.name  = snap->names + item->name,
+		.type  = item->type,
+		.ino   = item->ino,
+		.stbuf = (item->attr < 0 ? NULL : snap->attrs + item->attr)
+	};
+	return true;
+}
+
@@ -0,0 +1,130 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * DirSnapshot : entries of an opened directory.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef DIR_SNAPSHOT_H_INCLUDED
+#define DIR_SNAPSHOT_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fuse.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/******************************************************************************
+ * @var DirSnapshot
+ *
+ *	This opaque type holds the entries of a directory, as listed when
+ *	the directory is opened, so that they can be returned by offset
+ *	in several "readdir" requests (the offset of an entry is its 
+ *	index + 1). The names are packed into one buffer, and the
+ *	attributes are only kept for the entries having them : the 
+ *	memory used is proportional to the size of the names only.
+ *	The snapshot is filled completely before the first entry is
+ *	returned : it is not filled incrementally as "readdir" advances.
+ *
+ *	The functions in this API are not thread safe. The snapshot is
+ *	destroyed with "talloc_free".
+ *
+ *****************************************************************************/
+
+typedef struct _DirSnapshot DirSnapshot;
+
+
+typedef struct _DirSnapshot_Entry {
+	const char*		name;
+	int			type;	// DT_xxx
+	ino_t			ino;	// 0 if not known
+	const struct stat*	stbuf;	// NULL if attributes not known
+} DirSnapshot_Entry;
+
+
+/*****************************************************************************
+ * @brief 	Creates a new empty snapshot.
+ *
+ * @param talloc_context	the talloc parent context
+ * @return			the new snapshot, or NULL if error.
+ *****************************************************************************/
+DirSnapshot*
+DirSnapshot_Create (void* talloc_context);
+
+
+/*****************************************************************************
+ * @brief 	Appends an entry to the snapshot.
+ *
+ * @param snap		the DirSnapshot object
+ * @param name		the name of the entry (copied)
+ * @param type		the type of the entry (DT_xxx)
+ * @param ino		the inode number of the entry, or 0
+ * @param stbuf		the attributes of the entry (copied), or NULL
+ *			(if not NULL, "ino" is taken from the attributes)
+ * @return		0 if ok, or -ENOMEM.
+ *****************************************************************************/
+int
+DirSnapshot_Add (DirSnapshot* snap, const char* name, int type, ino_t ino,
+		 const struct stat* stbuf);
+
+
+/*****************************************************************************
+ * @brief 	Same as DirSnapshot_Add, with the "fuse_dirfil_t" and
+ *		"VFS_StatFiller" prototypes (the handle being the snapshot),
+ *		to be used as fillers for VFS_Browse.
+ *****************************************************************************/
+int
+DirSnapshot_Filler (fuse_dirh_t h, const char* name, int type, ino_t ino);
+
+int
+DirSnapshot_StatFiller (void* h, const char* name, int type, 
+			const struct stat* stbuf);
+
+
+/*****************************************************************************
+ * @brief 	Returns the number of entries in the snapshot.
+ *****************************************************************************/
+size_t
+DirSnapshot_GetSize (const DirSnapshot* snap);
+
+
+/*****************************************************************************
+ * @brief 	Returns an entry of the snapshot. The returned pointers
+ *		are valid until the next call to DirSnapshot_Add.
+ *
+ * @param snap		the DirSnapshot object
+ * @param index		the index of the entry (0 = first)
+ * @param entry		the returned entry
+ * @return		false if no such entry.
+ *****************************************************************************/
+bool
+DirSnapshot_GetEntry (const DirSnapshot* snap, size_t index, 
+		      DirSnapshot_Entry* entry);
+
+
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
+
+#endif // DIR_SNAPSHOT_H_INCLUDED
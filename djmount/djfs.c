@@ -75,6 +75,32 @@ typedef struct _SearchHistory {
 
 
 
+/*****************************************************************************
+ * ObjectIno
+ *
+ * Inode number of a file or directory representing a DIDL object : it only 
+ * depends on the device, the object id, and the kind of file (e.g. media 
+ * file extension, or metadata), so that it stays the same across remounts
+ * and cache expirations. Returns 0 (i.e. default inode number) if the 
+ * device is not known.
+ *****************************************************************************/
+
+static ino_t
+ObjectIno (const char* const udn, const char* const id, 
+	   const char* const kind)
+{
+  if (udn == NULL || id == NULL)
+    return 0; // ---------->
+
+  // Separate the strings with a character which is unlikely in them
+  uint64_t h = String_Hash64 (STRING_HASH64_INIT, udn);
+  h = String_Hash64 (String_Hash64 (h, "\x1f"), id);
+  if (kind)
+    h = String_Hash64 (String_Hash64 (h, "\x1f"), kind);
+  return (h ? (ino_t) h : 1);
+}
+
+
 /*****************************************************************************
  * BrowseSearchDir
  *****************************************************************************/
@@ -82,7 +108,8 @@ typedef struct _SearchHistory {
 static VFS_BrowseStatus
 BrowseChildren (DJFS* const self, const char* const sub_path,
 		const VFS_Query* const query, void* const tmp_ctx,
-		const char* const devName, const DIDLObject* const parent, 
+		const char* const devName, const char* const udn,
+		const DIDLObject* const parent, 
 		bool const searchable, const char* const search_criteria,
 		ContentDir_Children* const children);
 
@@ -145,7 +172,7 @@ BrowseSearchDir (DJFS* const self, const char* const sub_path,
 				    tmp_ctx, parent->id, full_criteria);
 	  if (res) {
 	    BROWSE_SUB (BrowseChildren (self, BROWSE_PTR, query,
-					tmp_ctx, devName, parent,
+					tmp_ctx, devName, NULL, parent,
 					true, full_criteria,
 					res->children));
 	  }
@@ -194,11 +221,12 @@ BrowseSearchDir (DJFS* const self, const char* const sub_path,
 	  *h = (SearchHistory) {
 	    .serial      = ++(self->search_hist_serial),
 	    .time        = time (NULL),
-	    .parent_path = talloc_steal (h, parent_path),
-	    .basename	 = talloc_steal (h, new_basename),
+	    // Copy the strings : they are in the temporary pool
+	    .parent_path = talloc_strdup (h, parent_path),
+	    .basename	 = talloc_strdup (h, new_basename),
 	  };
 	  h->criteria = ( (new_criteria == new_basename) ? h->basename 
-			  : talloc_steal (h, new_criteria) );
+			  : talloc_strdup (h, new_criteria) );
 
 	  PtrArray_Append (self->search_hist, h);
 	  if (PtrArray_GetSize (self->search_hist) > self->search_hist_size) {
@@ -209,7 +237,7 @@ BrowseSearchDir (DJFS* const self, const char* const sub_path,
 	  DIR_BEGIN (new_basename) {
 	    VFS_SET_TIME (h->time);
 	    BROWSE_SUB (BrowseChildren (self, BROWSE_PTR, query,
-					tmp_ctx, devName, parent,
+					tmp_ctx, devName, NULL, parent,
 					true, full_criteria,
 					res->children));
 	  } DIR_END;
@@ -234,7 +262,8 @@ BrowseSearchDir (DJFS* const self, const char* const sub_path,
 static VFS_BrowseStatus
 BrowseChildren (DJFS* const self, const char* const sub_path,
 		const VFS_Query* const query, void* const tmp_ctx,
-		const char* const devName, const DIDLObject* const parent, 
+		const char* const devName, const char* const udn,
+		const DIDLObject* const parent, 
 		bool const searchable, const char* const search_criteria,
 		ContentDir_Children* const children)
 {
@@ -251,7 +280,7 @@ BrowseChildren (DJFS* const self, const char* const sub_path,
 #endif
       PTR_ARRAY_FOR_EACH_PTR (children->objects, o) {
 	if (o->is_container) {
-	  DIR_BEGIN (o->basename) {
+	  DIR_BEGIN_INO (o->basename, ObjectIno (udn, o->id, NULL)) {
 	    const ContentDir_BrowseResult* res;
 	    DEVICE_LIST_CALL_SERVICE (res, devName,
 				      CONTENT_DIR_SERVICE_TYPE,
@@ -264,7 +293,7 @@ BrowseChildren (DJFS* const self, const char* const sub_path,
 	      // (might be confusing)
 	      BROWSE_SUB (BrowseChildren 
 			  (self, BROWSE_PTR, query, tmp_ctx, 
-			   devName, o,
+			   devName, udn, o,
 			   searchable && (search_criteria == NULL),
 			   NULL, res->children));
 	    }
@@ -278,14 +307,20 @@ BrowseChildren (DJFS* const self, const char* const sub_path,
 		   res_size < 0 ||
 		   res_size > FILE_BUFFER_MAX_CONTENT_LENGTH) ) {
 	      char* name = MediaFile_GetName (tmp_ctx, o, file.playlist);
-	      FILE_BEGIN (name) {
+	      FILE_BEGIN_INO (name, ObjectIno (udn, o->id, file.playlist)) {
 		const char* const str = MediaFile_GetPlaylistContent 
 		  (&file, tmp_ctx);
 		FILE_SET_STRING (str, FILE_BUFFER_STRING_STEAL);
 	      } FILE_END;
 	    } else {
 	      char* name = MediaFile_GetName (tmp_ctx, o, file.extension);
-	      FILE_BEGIN (name) {
+	      // Size not given by the server : start probing it
+	      // in background, while this directory is being listed
+	      // (not when only looking up a path through it)
+	      if (res_size < 0 && *BROWSE_PTR == '\0' &&
+		  (query->filler || query->stat_filler))
+		(void) FileBuffer_ProbeSize (file.uri, false);
+	      FILE_BEGIN_INO (name, ObjectIno (udn, o->id, file.extension)) {
 		FILE_SET_URL (file.uri, res_size);
 	      } FILE_END;
 	    }
@@ -298,7 +333,7 @@ BrowseChildren (DJFS* const self, const char* const sub_path,
 	DIR_BEGIN (".metadata") {
 	  PTR_ARRAY_FOR_EACH_PTR (children->objects, o) {
 	    char* const name = MediaFile_GetName (tmp_ctx, o, "xml");
-	    FILE_BEGIN (name) {
+	    FILE_BEGIN_INO (name, ObjectIno (udn, o->id, ".metadata")) {
 	      const char* const str = talloc_asprintf
 		(tmp_ctx, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n%s",
 		 DIDLObject_GetElementString (o, tmp_ctx));
@@ -354,7 +389,10 @@ BrowseRoot (VFS* const vfs, const char* const sub_path,
   
   BROWSE_BEGIN(sub_path, query) {
     
-    const PtrArray* const names = DeviceList_GetDevicesNames (tmp_ctx);
+    // Names and UDNs (for the inode numbers) in one pass
+    PtrArray* udns = NULL;
+    const PtrArray* const names = DeviceList_GetDevicesNames (tmp_ctx, 
+							      &udns);
     
     FILE_BEGIN("devices") {
       if (names) {
@@ -369,8 +407,10 @@ BrowseRoot (VFS* const vfs, const char* const sub_path,
     } FILE_END;
     
     const char* devName;
+    size_t dev_index = 0;
     PTR_ARRAY_FOR_EACH_PTR (names, devName) {
-      DIR_BEGIN (devName) {
+      const char* const udn = PtrArray_GetElementAt (udns, dev_index++);
+      DIR_BEGIN_INO (devName, ObjectIno (udn, "0", NULL)) {
 	if (self->flags & DJFS_SHOW_DEBUG) {
 	  SYMLINK_BEGIN (".status") {
 	    const char* const str = talloc_asprintf (tmp_ctx, 
@@ -409,7 +449,7 @@ BrowseRoot (VFS* const vfs, const char* const sub_path,
 	    }
 	    if (current && current->children) {
 	      BROWSE_SUB (BrowseChildren (self, BROWSE_PTR, query, tmp_ctx, 
-					  devName, root, searchable,
+					  devName, udn, root, searchable,
 					  NULL, current->children));
 	    }
 	  }
@@ -451,7 +491,8 @@ BrowseDebug (VFS* const vfs, const char* const sub_path,
     } FILE_END;
 
     // Status of each device
-    const PtrArray* const names = DeviceList_GetDevicesNames (tmp_ctx);
+    const PtrArray* const names = DeviceList_GetDevicesNames (tmp_ctx, 
+							      NULL);
     const char* devName;
     PTR_ARRAY_FOR_EACH_PTR (names, devName) {
       DIR_BEGIN (devName) {
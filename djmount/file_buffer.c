@@ -26,16 +26,26 @@
 #endif
 
 #include "file_buffer.h"
+#include "http_stream.h"
+#include "worker_pool.h"
+#include "cache.h"
+#include "ptr_array.h"
+#include "io_sched.h"
 #include "talloc_util.h"
+#include "string_util.h"
 #include "log.h"
+#include "trace.h"
+#include "metrics.h"
 #include "minmax.h"
 
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>	// Import intmax_t and PRIdMAX
+#include <time.h>
 
 #include <upnp/upnp.h>
 #include <upnp/upnptools.h>
+#include <upnp/ithread.h>
 
 
 // Same definition as in "libupnp/upnp/src/inc/httpreadwrite.h"
@@ -49,9 +59,181 @@ struct _FileBuffer {
 	off_t		file_size; 
 	const char*	url;
 	const char*	content;
+
+	/*
+	 * Read-ahead window (remote files only), protected by mutex.
+	 * The next window is downloaded into the spare buffer without
+	 * the mutex held (one download at a time), then swapped in.
+	 */
+	ithread_mutex_t	mutex;
+	char*		window;
+	char*		spare;
+	bool		filling;
+	off_t		window_offset;
+	size_t		window_length;
+	off_t		next_offset; // to detect sequential reads
+
+	/*
+	 * Persistent connection (remote files only), protected by mutex.
+	 * It only holds an IOSched slot during FileBuffer_Splice : an
+	 * idle connection never delays the requests of other files.
+	 */
+	HttpStream*	stream;
+	bool		stream_failed; // don't retry if server not compliant
+
+	// Head and tail of the file, downloaded in background at open
+	struct _Prefetch* prefetch;
 };
 
 
+/*
+ * Global settings and resources, for remote files
+ */
+static bool		 g_initialized = false;
+static FileBuffer_Options g_options;
+
+// Threads downloading the stripes of read-ahead windows
+static WorkerPool*	 g_stripe_pool = NULL;
+
+// Threads downloading the head and tail of opened files
+static WorkerPool*	 g_prefetch_pool = NULL;
+
+// Number of threads in the prefetch pool
+#define PREFETCH_THREADS	4
+
+/*
+ * Sizes of remote files not given by the server, probed by HTTP.
+ * The cache only holds the results : the pending probes (their urls, 
+ * which also identify them to boost them) are listed apart, so that 
+ * they are never evicted from the cache and submitted again.
+ */
+typedef struct _ProbedSize {
+	off_t		size;
+} ProbedSize;
+
+static ithread_mutex_t	 g_sizes_mutex;
+static ithread_cond_t	 g_sizes_cond;
+static Cache*		 g_sizes = NULL;
+static PtrArray*	 g_probes = NULL; // pending, element = "char*" url
+static WorkerPool*	 g_probe_pool = NULL;
+
+#define PROBE_THREADS		4
+#define PROBE_MAX_PENDING	32	// per device
+#define PROBE_CACHE_SIZE	1024
+#define PROBE_CACHE_TIMEOUT	600	// seconds
+#define PROBE_TIMEOUT		10	// seconds
+#define PROBE_MAX_WAIT		2	// seconds
+
+
+/*****************************************************************************
+ * SizeCacheFreeExpiredData
+ *****************************************************************************/
+static void
+SizeCacheFreeExpiredData (const char* url, void* data)
+{
+	talloc_free (data);
+}
+
+
+/*****************************************************************************
+ * FileBuffer_Initialize
+ *****************************************************************************/
+int
+FileBuffer_Initialize (void* talloc_context,
+		       const FileBuffer_Options* options)
+{
+	if (g_initialized)
+		return 0; // ---------->
+
+	g_options = (options ? *options : FILE_BUFFER_DEFAULT_OPTIONS);
+	g_options.stripes     = MAX (g_options.stripes, 1);
+	g_options.stripe_size = MAX (g_options.stripe_size, 4096);
+
+	/*
+	 * The first stripe of a window is downloaded by the reading thread
+	 * itself, the others by the pool : size the pool for a couple of
+	 * simultaneous streams.
+	 */
+	if (g_options.stripes > 1) {
+		g_stripe_pool = WorkerPool_Create (talloc_context, "stripes",
+						   2 * (g_options.stripes - 1));
+		if (g_stripe_pool == NULL) {
+			Log_Printf (LOG_ERROR, "FileBuffer : can't create "
+				    "stripes threads, parallel ranges "
+				    "disabled");
+		}
+	}
+	if (g_options.prefetch_head > 0 || g_options.prefetch_tail > 0) {
+		g_prefetch_pool = WorkerPool_Create (talloc_context, 
+						     "prefetch", 
+						     PREFETCH_THREADS);
+		if (g_prefetch_pool == NULL) {
+			Log_Printf (LOG_ERROR, "FileBuffer : can't create "
+				    "prefetch threads, prefetch disabled");
+		}
+	}
+	if (g_options.probe_size) {
+		g_sizes = Cache_Create (talloc_context, PROBE_CACHE_SIZE,
+					PROBE_CACHE_TIMEOUT, 
+					SizeCacheFreeExpiredData);
+		g_probes = PtrArray_Create (talloc_context);
+		if (g_sizes && g_probes) {
+			Cache_SetName (g_sizes, "sizes");
+			g_probe_pool = WorkerPool_Create (talloc_context,
+							  "probe",
+							  PROBE_THREADS);
+		}
+		if (g_probe_pool == NULL) {
+			Log_Printf (LOG_ERROR, "FileBuffer : can't create "
+				    "probe threads, size probing disabled");
+			talloc_free (g_sizes);
+			g_sizes = NULL;
+			talloc_free (g_probes);
+			g_probes = NULL;
+		}
+		ithread_mutex_init (&g_sizes_mutex, NULL);
+		ithread_cond_init (&g_sizes_cond, NULL);
+	}
+	g_initialized = true;
+
+	Log_Printf (LOG_DEBUG, "FileBuffer : stripes=%lu stripe_size=%lu "
+		    "prefetch_head=%lu "
+		    "prefetch_tail=%lu probe_size=%d", 
+		    (unsigned long) g_options.stripes,
+		    (unsigned long) g_options.stripe_size,
+		    (unsigned long) g_options.prefetch_head,
+		    (unsigned long) g_options.prefetch_tail,
+		    (int) g_options.probe_size);
+	return 0;
+}
+
+
+/*****************************************************************************
+ * FileBuffer_Finish
+ *****************************************************************************/
+void
+FileBuffer_Finish (void)
+{
+	if (g_initialized) {
+		g_initialized = false;
+		talloc_free (g_stripe_pool);
+		g_stripe_pool = NULL;
+		talloc_free (g_prefetch_pool);
+		g_prefetch_pool = NULL;
+		if (g_options.probe_size) {
+			talloc_free (g_probe_pool);
+			g_probe_pool = NULL;
+			talloc_free (g_sizes);
+			g_sizes = NULL;
+			talloc_free (g_probes);
+			g_probes = NULL;
+			ithread_cond_destroy (&g_sizes_cond);
+			ithread_mutex_destroy (&g_sizes_mutex);
+		}
+	}
+}
+
+
 /******************************************************************************
  * FileBuffer_CreateFromString
  *****************************************************************************/
@@ -87,6 +269,30 @@ FileBuffer_CreateFromString (void* talloc_context, const char* content,
 }
 
 
+/******************************************************************************
+ * DestroyURLBuffer
+ *****************************************************************************/
+static void
+CloseStream (FileBuffer* const file)
+{
+	if (file->stream) {
+		talloc_free (file->stream);
+		file->stream = NULL;
+	}
+}
+
+static void UnrefPrefetch (struct _Prefetch* prefetch);
+
+static int
+DestroyURLBuffer (FileBuffer* const file)
+{
+	CloseStream (file);
+	UnrefPrefetch (file->prefetch);
+	ithread_mutex_destroy (&file->mutex);
+	return 0; // ok -> deallocate memory
+}
+
+
 /******************************************************************************
  * FileBuffer_CreateFromURL
  *****************************************************************************/
@@ -97,14 +303,25 @@ FileBuffer_CreateFromURL (void* talloc_context, const char* url,
 	FileBuffer* const file = talloc (talloc_context, FileBuffer);
 	if (file) {
 		*file = (FileBuffer) {
-			.exact_read   = (file_size >= 0),
-			.file_size    = file_size,
-			.content      = NULL,
-			.url	      = NULL
+			.exact_read    = (file_size >= 0),
+			.file_size     = file_size,
+			.content       = NULL,
+			.url	       = NULL,
+			.window        = NULL,
+			.spare         = NULL,
+			.filling       = false,
+			.window_offset = 0,
+			.window_length = 0,
+			.next_offset   = -1,
+			.stream        = NULL,
+			.stream_failed = false,
+			.prefetch      = NULL,
 		};
 		if (url) {
 			file->url = talloc_strdup (file, url);
 		}
+		ithread_mutex_init (&file->mutex, NULL);
+		talloc_set_destructor (file, DestroyURLBuffer);
 	}
 	return file;
 }
@@ -116,7 +333,149 @@ FileBuffer_CreateFromURL (void* talloc_context, const char* url,
 off_t
 FileBuffer_GetSize (const FileBuffer* file)
 {
-	return (file && file->file_size);
+	return (file ? file->file_size : -1);
+}
+
+
+/*****************************************************************************
+ * FindProbe
+ *
+ *	Returns the index of the pending probe of an url (or -1), and 
+ *	counts the pending probes of the same device ("host:port").
+ *	g_sizes_mutex must be locked.
+ *****************************************************************************/
+static long
+FindProbe (const char* url, size_t* nb_device)
+{
+	const char* p = strstr (url, "://");
+	p = (p ? p + 3 : url);
+	const size_t len = (p - url) + strcspn (p, "/");
+
+	long found = -1;
+	*nb_device = 0;
+	size_t i;
+	for (i = 0; i < PtrArray_GetSize (g_probes); i++) {
+		const char* const s = PtrArray_GetElementAt (g_probes, i);
+		if (strncmp (s, url, len) == 0 && 
+		    (s[len] == '/' || s[len] == NUL)) {
+			(*nb_device)++;
+			if (strcmp (s, url) == 0)
+				found = i;
+		}
+	}
+	return found;
+}
+
+
+/*****************************************************************************
+ * ProbeSizeJob
+ *****************************************************************************/
+static void
+ProbeSizeJob (void* arg)
+{
+	char* const url = (char*) arg;
+
+	IOSched_Slot* slot = NULL;
+	(void) IOSched_Acquire (url, IO_SCHED_BACKGROUND, url, true, &slot);
+	const off_t size = HttpStream_ProbeSize (url, PROBE_TIMEOUT);
+	IOSched_Release (slot);
+
+	ithread_mutex_lock (&g_sizes_mutex);
+	ProbedSize** const pp = (ProbedSize**) Cache_Get (g_sizes, url);
+	if (pp) {
+		if (*pp == NULL)
+			*pp = talloc (g_sizes, ProbedSize);
+		if (*pp)
+			**pp = (ProbedSize) { .size = size };
+	}
+	size_t i;
+	for (i = 0; i < PtrArray_GetSize (g_probes); i++) {
+		if (PtrArray_GetElementAt (g_probes, i) == url) {
+			(void) PtrArray_RemoveAtReorder (g_probes, i);
+			break; // ---------->
+		}
+	}
+	ithread_cond_broadcast (&g_sizes_cond);
+	ithread_mutex_unlock (&g_sizes_mutex);
+
+	talloc_free (url);
+}
+
+
+/*****************************************************************************
+ * FileBuffer_ProbeSize
+ *****************************************************************************/
+off_t
+FileBuffer_ProbeSize (const char* url, bool wait)
+{
+	if (url == NULL || g_sizes == NULL)
+		return -1; // ---------->
+
+	/*
+	 * Do not block a stat or open for the whole HTTP timeout : past
+	 * PROBE_MAX_WAIT, the size is reported as unknown, and the next
+	 * calls get the result of the background probe.
+	 */
+	struct timespec deadline;
+	clock_gettime (CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += PROBE_MAX_WAIT;
+
+	off_t size = -1;
+	ithread_mutex_lock (&g_sizes_mutex);
+	while (true) {
+		size_t nb_device = 0;
+		const long i = FindProbe (url, &nb_device);
+		if (i < 0) {
+			ProbedSize** const pp = (ProbedSize**) Cache_Get 
+				(g_sizes, url);
+			if (pp == NULL)
+				break; // ---------->
+			if (*pp) {
+				size = (*pp)->size;
+				break; // ---------->
+			}
+			/*
+			 * Unknown url : start probing in background, unless
+			 * too many probes already wait for this device (the 
+			 * url will be probed when listed or opened again).
+			 */
+			if (nb_device >= PROBE_MAX_PENDING)
+				break; // ---------->
+			char* const job_url = talloc_strdup (NULL, url);
+			if (job_url == NULL || 
+			    ! PtrArray_Append (g_probes, job_url)) {
+				talloc_free (job_url);
+				break; // ---------->
+			}
+			if (WorkerPool_Submit (g_probe_pool, ProbeSizeJob,
+					       job_url) != 0) {
+				(void) PtrArray_RemoveAtReorder 
+					(g_probes, 
+					 PtrArray_GetSize (g_probes) - 1);
+				talloc_free (job_url);
+				break; // ---------->
+			}
+			continue; // ----------> now pending
+		}
+		if (! wait)
+			break; // ---------->
+		IOSched_Boost (PtrArray_GetElementAt (g_probes, i));
+		if (ithread_cond_timedwait (&g_sizes_cond, &g_sizes_mutex,
+					    &deadline) == ETIMEDOUT)
+			break; // ---------->
+	}
+	ithread_mutex_unlock (&g_sizes_mutex);
+	return size;
+}
+
+
+/*****************************************************************************
+ * FileBuffer_IsProbingSize
+ *****************************************************************************/
+bool
+FileBuffer_IsProbingSize (void)
+{
+	return (g_sizes != NULL);
 }
 
 
@@ -130,13 +489,537 @@ FileBuffer_HasExactRead (const FileBuffer* file)
 }
 
 
+/*****************************************************************************
+ * FileBuffer_IsRemote
+ *****************************************************************************/
+bool
+FileBuffer_IsRemote (const FileBuffer* file)
+{
+	return (file && file->url);
+}
+
+
 /******************************************************************************
- * FileBuffer_Read
+ * ReadRange
+ *
+ * Download a range of a remote file, into a memory buffer.
+ * The exact number of bytes requested is read if the file size is known.
+ * The request is scheduled with the given priority, on behalf of 'owner'.
+ * Returns number of bytes read, or < 0 if error.
  *****************************************************************************/
+static ssize_t
+ReadRange (const char* url, const off_t file_size, char* buffer, 
+	   size_t size, const off_t offset, 
+	   IOSched_Priority priority, const void* owner)
+{
+	ssize_t n = 0;
 
-ssize_t
-FileBuffer_Read (FileBuffer* file, char* buffer, 
-		 size_t size, const off_t offset)
+	// TBD
+	// TBD this is not optimised !! open / close on each read
+	// TBD
+
+	METRICS_STATIC_ID (fg_wait_id, METRICS_HISTOGRAM, 
+			   "djmount_io_sched_wait_seconds",
+			   "Time spent waiting for a connection to a device",
+			   "priority=\"foreground\"");
+	METRICS_STATIC_ID (bg_wait_id, METRICS_HISTOGRAM, 
+			   "djmount_io_sched_wait_seconds",
+			   "Time spent waiting for a connection to a device",
+			   "priority=\"background\"");
+	METRICS_STATIC_ID (fg_read_id, METRICS_HISTOGRAM, 
+			   "djmount_http_range_read_seconds",
+			   "Duration of the HTTP range requests",
+			   "priority=\"foreground\"");
+	METRICS_STATIC_ID (bg_read_id, METRICS_HISTOGRAM, 
+			   "djmount_http_range_read_seconds",
+			   "Duration of the HTTP range requests",
+			   "priority=\"background\"");
+	METRICS_STATIC_ID (bytes_id, METRICS_COUNTER, 
+			   "djmount_http_range_read_bytes_total",
+			   "Number of bytes read by HTTP range requests", 
+			   NULL);
+	const bool foreground = (priority == IO_SCHED_FOREGROUND);
+
+	IOSched_Slot* slot = NULL;
+	Trace_Span wait;
+	Trace_Begin (&wait, "io_sched.wait", url);
+	(void) IOSched_Acquire (url, priority, owner, true, &slot);
+	Metrics_Observe (foreground ? fg_wait_id : bg_wait_id, 
+			 Trace_End (&wait));
+	const uint64_t begin = Metrics_Now();
+
+	void* handle      = NULL;
+	int contentLength = 0;
+	int httpStatus    = 0;
+	char* contentType = NULL;
+	int rc = UpnpOpenHttpGetEx (url, &handle,
+				    &contentType, &contentLength,
+				    &httpStatus,
+				    offset, offset + size - 1,
+				    HTTP_DEFAULT_TIMEOUT
+				    );
+	if (rc != UPNP_E_SUCCESS) 
+		goto HTTP_CHECK; // ---------->
+	// TBD TBD free contentType ??? I don't know ...
+	
+	/*
+	 * Read available bytes, or all bytes requested if size is known :
+	 * perform a loop because I am not sure that HTTP GET guaranty
+	 * to return the exact number of bytes requested.
+	 */
+	do {
+		size_t read_size = size - n;
+		if (n > 0) {
+			Log_Printf (LOG_DEBUG, 
+				    "UpnpReadHttpGet loop ! url '%s' "
+				    "read %" PRIdMAX " left %" PRIdMAX,
+				    url, (intmax_t) n, 
+				    (intmax_t) read_size);
+		}
+		
+		rc = UpnpReadHttpGet (handle, buffer + n, &read_size,
+				      HTTP_DEFAULT_TIMEOUT);
+		if (rc != UPNP_E_SUCCESS) {
+			(void) UpnpCloseHttpGet (handle);
+			goto HTTP_CHECK; // ---------->
+		}
+		
+		// Prevent infinite loop (shouldn't happen though)
+		if (read_size == 0)
+			break; // ---------->
+		n += read_size;
+		
+	} while (file_size >= 0 && n < size);
+	
+	rc = UpnpCloseHttpGet (handle);
+	
+HTTP_CHECK:
+	IOSched_Release (slot);
+	Metrics_Observe (foreground ? fg_read_id : bg_read_id, 
+			 Metrics_Now() - begin);
+	if (rc != UPNP_E_SUCCESS) {
+		Log_Printf (LOG_ERROR, 
+			    "GetHttp url '%s' (size %" PRIdMAX 
+			    ", offset %" PRIdMAX ", file_size %" 
+			    PRIdMAX ") : error %d (%s)", 
+			    url, (intmax_t) size, 
+			    (intmax_t) offset, 
+			    (intmax_t) file_size, 
+			    rc, UpnpGetErrorMessage (rc));
+		switch (rc) {
+		case UPNP_E_OUTOF_MEMORY : 	n = -ENOMEM; break;
+		default:			n = -EIO;    break;
+		}
+	} else {
+		Metrics_Add (bytes_id, n);
+	}
+	return n;
+}
+
+
+/******************************************************************************
+ * AdjustRange
+ *
+ * Check the range requested on a remote file, and truncate it to the 
+ * file size if known. Returns 0 if ok, or < 0 if error.
+ *****************************************************************************/
+static int
+AdjustRange (const FileBuffer* file, size_t* size, const off_t offset)
+{
+	/*
+	 * Warning : the libupnp API (UpnpOpenHttpGetEx, 
+	 * UpnpReadHttpGet ...) has strange prototypes for length 
+	 * and ranges : "int" is not sufficient for large files !
+	 */
+	if (offset > FILE_BUFFER_MAX_CONTENT_LENGTH ||
+	    offset > FILE_BUFFER_MAX_CONTENT_LENGTH - *size) {
+		Log_Printf (LOG_ERROR, 
+			    "GetHttp url '%s' overflowed "
+			    "size %" PRIdMAX " or offset %" PRIdMAX,
+			    file->url, (intmax_t) *size, 
+			    (intmax_t) offset);
+		return -EOVERFLOW; // ---------->
+	}
+	
+	// Adjust request to file size, if known
+	if (file->file_size >= 0) {
+		if (offset > file->file_size - *size) {
+			*size = MAX (0, file->file_size - offset);
+			Log_Printf (LOG_DEBUG, 
+				    "GetHttp truncate to size %" 
+				    PRIdMAX, (intmax_t) *size);
+		}
+	}
+	return 0;
+}
+
+
+/******************************************************************************
+ * Parallel download of the stripes of a read-ahead window
+ *****************************************************************************/
+
+typedef struct _StripeBatch {
+	const FileBuffer*	file;
+	ithread_mutex_t		mutex;
+	ithread_cond_t		cond;
+	size_t			pending;
+	bool			error;
+} StripeBatch;
+
+typedef struct _Stripe {
+	StripeBatch*	batch;
+	char*		buffer;
+	size_t		size;
+	off_t		offset;
+} Stripe;
+
+
+static void
+ReadStripe (void* arg)
+{
+	Stripe* const stripe = (Stripe*) arg;
+	StripeBatch* const batch = stripe->batch;
+
+	const ssize_t n = ReadRange (batch->file->url, batch->file->file_size,
+				     stripe->buffer, stripe->size, 
+				     stripe->offset, IO_SCHED_FOREGROUND,
+				     batch->file);
+
+	ithread_mutex_lock (&batch->mutex);
+	if (n != stripe->size)
+		batch->error = true;
+	batch->pending--;
+	ithread_cond_signal (&batch->cond);
+	ithread_mutex_unlock (&batch->mutex);
+}
+
+
+/******************************************************************************
+ * FillWindow
+ *
+ * Download 'length' bytes of a file, starting at 'offset', into a 
+ * read-ahead buffer. The file mutex must NOT be locked : the stripes
+ * wait for IOSched slots, which other threads may hold while waiting
+ * for the mutex (see FileBuffer_Splice).
+ * Returns true if ok.
+ *****************************************************************************/
+static bool
+FillWindow (const FileBuffer* file, char* window, const off_t offset, 
+	    const size_t length)
+{
+	/*
+	 * Split the window into stripes (the last one might be shorter).
+	 * Stripes are written in place, so are reassembled in order.
+	 */
+	const size_t nb_stripes = MIN (g_options.stripes, 
+				       (length + g_options.stripe_size - 1) /
+				       g_options.stripe_size);
+	Stripe stripes [nb_stripes];
+	StripeBatch batch = { 
+		.file = file, .pending = nb_stripes, .error = false 
+	};
+	ithread_mutex_init (&batch.mutex, NULL);
+	ithread_cond_init (&batch.cond, NULL);
+
+	size_t i;
+	for (i = 0; i < nb_stripes; i++) {
+		const size_t start = i * g_options.stripe_size;
+		stripes[i] = (Stripe) {
+			.batch  = &batch,
+			.buffer = window + start,
+			.size   = MIN (g_options.stripe_size, length - start),
+			.offset = offset + start
+		};
+	}
+	// The first stripe is downloaded by the current thread
+	for (i = 1; i < nb_stripes; i++) {
+		if (g_stripe_pool == NULL ||
+		    WorkerPool_Submit (g_stripe_pool, ReadStripe, 
+				       stripes + i) != 0)
+			ReadStripe (stripes + i);
+	}
+	ReadStripe (stripes + 0);
+
+	ithread_mutex_lock (&batch.mutex);
+	while (batch.pending > 0)
+		ithread_cond_wait (&batch.cond, &batch.mutex);
+	ithread_mutex_unlock (&batch.mutex);
+	ithread_cond_destroy (&batch.cond);
+	ithread_mutex_destroy (&batch.mutex);
+
+	if (batch.error)
+		return false; // ---------->
+	Log_Printf (LOG_DEBUG, "GetHttp url '%s' : read-ahead %" PRIdMAX 
+		    " bytes at offset %" PRIdMAX " (%lu stripes)",
+		    file->url, (intmax_t) length, 
+		    (intmax_t) offset, (unsigned long) nb_stripes);
+	return true;
+}
+
+
+/******************************************************************************
+ * ReadWindow
+ *
+ * Serve a read from the read-ahead window, downloading the next window
+ * first if the read is sequential. Returns false if the read should 
+ * be sent directly to the server.
+ *****************************************************************************/
+static bool
+ReadWindow (FileBuffer* file, char* buffer, size_t size, const off_t offset)
+{
+	const size_t window_size = g_options.stripes * g_options.stripe_size;
+	bool found = false;
+	char* window = NULL;
+	size_t length = 0;
+
+	ithread_mutex_lock (&file->mutex);
+	const bool sequential = (offset == file->next_offset);
+	file->next_offset = offset + size;
+	if (offset >= file->window_offset &&
+	    offset + size <= file->window_offset + file->window_length) {
+		memcpy (buffer, file->window + (offset - file->window_offset),
+			size);
+		found = true;
+	} else if (sequential && ! file->filling && size <= window_size) {
+		if (file->spare == NULL)
+			file->spare = talloc_size (file, window_size);
+		window = file->spare;
+		file->spare = NULL;
+		file->filling = (window != NULL);
+		length = MIN (window_size, file->file_size - offset);
+	}
+	ithread_mutex_unlock (&file->mutex);
+	if (window == NULL)
+		return found; // ---------->
+
+	const bool ok = FillWindow (file, window, offset, length);
+
+	ithread_mutex_lock (&file->mutex);
+	if (ok) {
+		file->spare = file->window;
+		file->window = window;
+		file->window_offset = offset;
+		file->window_length = length;
+		memcpy (buffer, window, size);
+	} else {
+		file->spare = window;
+	}
+	file->filling = false;
+	ithread_mutex_unlock (&file->mutex);
+	return ok;
+}
+
+
+/******************************************************************************
+ * Background download of the head and tail of a file.
+ *
+ * The downloaded data is shared between the FileBuffer and the pending
+ * jobs, and freed by the last one to release it : closing the file does
+ * not wait for the downloads to finish.
+ *****************************************************************************/
+
+typedef enum _PrefetchState {
+	PREFETCH_PENDING,
+	PREFETCH_DONE,
+	PREFETCH_FAILED
+} PrefetchState;
+
+typedef struct _PrefetchRange {
+	struct _Prefetch*	prefetch;
+	off_t			offset;
+	size_t			length;
+	char*			data;
+	PrefetchState		state;
+} PrefetchRange;
+
+typedef struct _Prefetch {
+	ithread_mutex_t		mutex;
+	ithread_cond_t		cond;
+	int			refcount; 
+	char*			url;
+	off_t			file_size;
+	size_t			nb_ranges;
+	PrefetchRange		ranges [2]; // head and tail
+} Prefetch;
+
+
+static void
+UnrefPrefetch (Prefetch* prefetch)
+{
+	if (prefetch) {
+		ithread_mutex_lock (&prefetch->mutex);
+		const bool last = (--prefetch->refcount == 0);
+		ithread_mutex_unlock (&prefetch->mutex);
+		if (last) {
+			ithread_cond_destroy (&prefetch->cond);
+			ithread_mutex_destroy (&prefetch->mutex);
+			talloc_free (prefetch);
+		}
+	}
+}
+
+
+static void
+PrefetchRangeJob (void* arg)
+{
+	PrefetchRange* const range = (PrefetchRange*) arg;
+	Prefetch* const prefetch = range->prefetch;
+
+	const ssize_t n = ReadRange (prefetch->url, prefetch->file_size,
+				     range->data, range->length, 
+				     range->offset, IO_SCHED_BACKGROUND, 
+				     prefetch);
+
+	ithread_mutex_lock (&prefetch->mutex);
+	range->state = (n == range->length ? PREFETCH_DONE : PREFETCH_FAILED);
+	ithread_cond_broadcast (&prefetch->cond);
+	ithread_mutex_unlock (&prefetch->mutex);
+
+	Log_Printf (LOG_DEBUG, "GetHttp url '%s' : prefetched %" PRIdMAX 
+		    " bytes at offset %" PRIdMAX " (%s)", prefetch->url, 
+		    (intmax_t) range->length, (intmax_t) range->offset,
+		    (range->state == PREFETCH_DONE ? "ok" : "failed"));
+	UnrefPrefetch (prefetch);
+}
+
+
+/******************************************************************************
+ * FileBuffer_Prefetch
+ *****************************************************************************/
+int
+FileBuffer_Prefetch (FileBuffer* file)
+{
+	if (file == NULL)
+		return -EINVAL; // ---------->
+	if (file->url == NULL || file->file_size <= 0 || 
+	    file->prefetch || g_prefetch_pool == NULL)
+		return 0; // ---------->
+
+	const off_t file_size = file->file_size;
+	const size_t head = MIN (g_options.prefetch_head, file_size);
+	const size_t tail = MIN (g_options.prefetch_tail, file_size - head);
+
+	// Small files are entirely prefetched as the head
+	Prefetch* const prefetch = talloc (NULL, Prefetch);
+	if (prefetch == NULL)
+		return -ENOMEM; // ---------->
+	*prefetch = (Prefetch) {
+		.refcount  = 1,
+		.url       = talloc_strdup (prefetch, file->url),
+		.file_size = file_size,
+		.nb_ranges = 0,
+	};
+	if (prefetch->url == NULL) {
+		talloc_free (prefetch);
+		return -ENOMEM; // ---------->
+	}
+	if (head > 0) {
+		prefetch->ranges [prefetch->nb_ranges++] = (PrefetchRange) {
+			.offset = 0, .length = head
+		};
+	}
+	if (tail > 0) {
+		prefetch->ranges [prefetch->nb_ranges++] = (PrefetchRange) {
+			.offset = file_size - tail, .length = tail
+		};
+	}
+	ithread_mutex_init (&prefetch->mutex, NULL);
+	ithread_cond_init (&prefetch->cond, NULL);
+
+	size_t i;
+	for (i = 0; i < prefetch->nb_ranges; i++) {
+		PrefetchRange* const range = prefetch->ranges + i;
+		range->prefetch = prefetch;
+		range->data  = talloc_size (prefetch, range->length);
+		range->state = PREFETCH_FAILED;
+		if (range->data == NULL)
+			continue; // ---------->
+		ithread_mutex_lock (&prefetch->mutex);
+		range->state = PREFETCH_PENDING;
+		prefetch->refcount++;
+		ithread_mutex_unlock (&prefetch->mutex);
+		if (WorkerPool_Submit (g_prefetch_pool, PrefetchRangeJob, 
+				       range) != 0) {
+			range->state = PREFETCH_FAILED;
+			UnrefPrefetch (prefetch);
+		}
+	}
+	file->prefetch = prefetch;
+	return 0;
+}
+
+
+/******************************************************************************
+ * ReadPrefetched
+ *
+ * Try to serve a request from the head or tail of the file, waiting 
+ * for their download if necessary. 
+ * Returns the number of bytes copied, or -1 if not available.
+ *****************************************************************************/
+static ssize_t
+ReadPrefetched (const FileBuffer* file, char* buffer, 
+		size_t size, const off_t offset)
+{
+	Prefetch* const prefetch = file->prefetch;
+	ssize_t n = -1;
+	if (prefetch) {
+		ithread_mutex_lock (&prefetch->mutex);
+		size_t i;
+		for (i = 0; i < prefetch->nb_ranges; i++) {
+			const PrefetchRange* const range = prefetch->ranges + i;
+			if (offset < range->offset || 
+			    offset + size > range->offset + range->length)
+				continue; // ---------->
+			// A user is waiting now
+			if (range->state == PREFETCH_PENDING)
+				IOSched_Boost (prefetch);
+			while (range->state == PREFETCH_PENDING)
+				ithread_cond_wait (&prefetch->cond,
+						   &prefetch->mutex);
+			if (range->state == PREFETCH_DONE) {
+				memcpy (buffer, range->data + 
+					(offset - range->offset), size);
+				n = size;
+			}
+			break; // ---------->
+		}
+		ithread_mutex_unlock (&prefetch->mutex);
+	}
+	return n;
+}
+
+
+/******************************************************************************
+ * IsPrefetched
+ *
+ * True if the requested range is (or will be) in the head or tail.
+ *****************************************************************************/
+static bool
+IsPrefetched (const FileBuffer* file, size_t size, const off_t offset)
+{
+	Prefetch* const prefetch = file->prefetch;
+	bool found = false;
+	if (prefetch) {
+		ithread_mutex_lock (&prefetch->mutex);
+		size_t i;
+		for (i = 0; i < prefetch->nb_ranges && ! found; i++) {
+			const PrefetchRange* const range = prefetch->ranges + i;
+			found = (range->state != PREFETCH_FAILED &&
+				 offset >= range->offset && 
+				 offset + size <= range->offset + 
+				 range->length);
+		}
+		ithread_mutex_unlock (&prefetch->mutex);
+	}
+	return found;
+}
+
+
+/******************************************************************************
+ * ReadBuffer
+ *****************************************************************************/
+static ssize_t
+ReadBuffer (FileBuffer* file, char* buffer, size_t size, const off_t offset)
 {
 	ssize_t n = 0;
 	if (file == NULL) {
@@ -163,96 +1046,141 @@ FileBuffer_Read (FileBuffer* file, char* buffer,
 			    file->url, (intmax_t) size, (intmax_t) offset,
 			    (intmax_t) file->file_size);
 		
+		const int rc = AdjustRange (file, &size, offset);
+		if (rc || size == 0)
+			return rc; // ---------->
+
+		n = ReadPrefetched (file, buffer, size, offset);
+		if (n >= 0)
+			return n; // ---------->
+
 		/*
-		 * Warning : the libupnp API (UpnpOpenHttpGetEx, 
-		 * UpnpReadHttpGet ...) has strange prototypes for length 
-		 * and ranges : "int" is not sufficient for large files !
+		 * Serve the request from the read-ahead window if possible.
+		 * The window is only used when the file size is known, 
+		 * and after a sequential access has been detected.
 		 */
-		if (offset > FILE_BUFFER_MAX_CONTENT_LENGTH ||
-		    offset > FILE_BUFFER_MAX_CONTENT_LENGTH - size) {
-			Log_Printf (LOG_ERROR, 
-				    "GetHttp url '%s' overflowed "
-				    "size %" PRIdMAX " or offset %" PRIdMAX,
-				    file->url, (intmax_t) size, 
-				    (intmax_t) offset);
-			return -EOVERFLOW; // ---------->
-		}
+		if (g_initialized && file->exact_read &&
+		    ReadWindow (file, buffer, size, offset))
+			return size; // ---------->
 
-		// Adjust request to file size, if known
-		if (file->file_size >= 0) {
-			if (offset > file->file_size - size) {
-				size = MAX (0, file->file_size - offset);
-				Log_Printf (LOG_DEBUG, 
-					    "GetHttp truncate to size %" 
-					    PRIdMAX, (intmax_t) size);
-			}
-		}
+		n = ReadRange (file->url, file->file_size, 
+			       buffer, size, offset, 
+			       IO_SCHED_FOREGROUND, file);
+	}
+	return n;
+}
 
-		// TBD
-		// TBD this is not optimised !! open / close on each read
-		// TBD
-
-		void* handle      = NULL;
-		int contentLength = 0;
-		int httpStatus    = 0;
-		char* contentType = NULL;
-		int rc = UpnpOpenHttpGetEx (file->url, &handle,
-					    &contentType, &contentLength,
-					    &httpStatus,
-					    offset, offset + size - 1,
-					    HTTP_DEFAULT_TIMEOUT
-					    );
-		if (rc != UPNP_E_SUCCESS) 
-			goto HTTP_CHECK; // ---------->
-		// TBD TBD free contentType ??? I don't know ...
 
-		/*
-		 * Read available bytes, or all bytes requested if exact_read :
-		 * perform a loop because I am not sure that HTTP GET guaranty
-		 * to return the exact number of bytes requested.
-		 */
-		do {
-			size_t read_size = size - n;
-			if (n > 0) {
-				Log_Printf (LOG_DEBUG, 
-					    "UpnpReadHttpGet loop ! url '%s' "
-					    "read %" PRIdMAX " left %" PRIdMAX,
-					    file->url, (intmax_t) n, 
-					    (intmax_t) read_size);
-			}
-			
-			rc = UpnpReadHttpGet (handle, buffer + n, &read_size,
-					      HTTP_DEFAULT_TIMEOUT);
-			if (rc != UPNP_E_SUCCESS) {
-				(void) UpnpCloseHttpGet (handle);
-				goto HTTP_CHECK; // ---------->
-			}
+/******************************************************************************
+ * FileBuffer_Read
+ *****************************************************************************/
 
-			// Prevent infinite loop (shouldn't happen though)
-			if (read_size == 0)
-				break; // ---------->
-			n += read_size;
+ssize_t
+FileBuffer_Read (FileBuffer* file, char* buffer, 
+		 size_t size, const off_t offset)
+{
+	Trace_Span span;
+	Trace_Begin (&span, "file.read", (file ? file->url : NULL));
+	const ssize_t n = ReadBuffer (file, buffer, size, offset);
+	Trace_End (&span);
+	return n;
+}
 
-		} while (file->exact_read && n < size);
 
-		rc = UpnpCloseHttpGet (handle);
+/******************************************************************************
+ * FileBuffer_Splice
+ *****************************************************************************/
+ssize_t
+FileBuffer_Splice (FileBuffer* file, int pipe_fd, 
+		   size_t size, const off_t offset)
+{
+	if (file == NULL)
+		return -EINVAL; // ---------->
 
-	HTTP_CHECK:
-		if (rc != UPNP_E_SUCCESS) {
-			Log_Printf (LOG_ERROR, 
-				    "GetHttp url '%s' (size %" PRIdMAX 
-				    ", offset %" PRIdMAX ", file_size %" 
-				    PRIdMAX ") : error %d (%s)", 
-				    file->url, (intmax_t) size, 
-				    (intmax_t) offset, 
-				    (intmax_t) file->file_size, 
-				    rc, UpnpGetErrorMessage (rc));
-			switch (rc) {
-			case UPNP_E_OUTOF_MEMORY : 	n = -ENOMEM; break;
-			default:			n = -EIO;    break;
+	/*
+	 * Only remote files with a known size, read from a single 
+	 * connection : striped windows are reassembled in memory anyway.
+	 */
+	if (file->url == NULL || ! file->exact_read || ! g_initialized ||
+	    g_options.stripes > 1 || file->stream_failed)
+		return -ENOTSUP; // ---------->
+
+	int rc = AdjustRange (file, &size, offset);
+	if (rc || size == 0)
+		return rc; // ---------->
+
+	// Head and tail are served from memory, by FileBuffer_Read
+	if (IsPrefetched (file, size, offset))
+		return -ENOTSUP; // ---------->
+
+	/*
+	 * Do not wait for a connection : use the copy path.
+	 * Lock order : IOSched slot, then file mutex (never wait for a 
+	 * slot with the file mutex locked).
+	 */
+	IOSched_Slot* slot = NULL;
+	if (IOSched_Acquire (file->url, IO_SCHED_FOREGROUND, file, false,
+			     &slot))
+		return -EAGAIN; // ---------->
+
+	/*
+	 * AdjustRange has clamped 'size' to the file size, so anything
+	 * short of 'size' is a closed connection, not the end of file :
+	 * keep reopening until the range is complete, or until a fresh
+	 * connection brings nothing (the server disagrees on the size).
+	 */
+	ssize_t n = 0;
+	ithread_mutex_lock (&file->mutex);
+
+	while (n < size) {
+		const off_t pos = offset + n;
+		if (file->stream && HttpStream_GetOffset (file->stream) != pos)
+			CloseStream (file);
+		const bool fresh = (file->stream == NULL);
+		if (fresh) {
+			file->stream = HttpStream_Open (file, file->url, pos,
+							HTTP_DEFAULT_TIMEOUT);
+			if (file->stream == NULL) {
+				file->stream_failed = true;
+				if (n == 0)
+					n = -ENOTSUP;
+				break; // ---------->
+			}
+		}
+		const ssize_t r = HttpStream_Splice (file->stream, pipe_fd,
+						     size - n);
+		if (r < 0) {
+			Log_Printf (LOG_ERROR, "GetHttp url '%s' (size %" 
+				    PRIdMAX ", offset %" PRIdMAX ") : "
+				    "splice error : %s", file->url, 
+				    (intmax_t) size, (intmax_t) pos,
+				    strerror (-r));
+			CloseStream (file);
+			// Partial content is already in the pipe : keep it
+			if (n == 0)
+				n = -EIO;
+			break; // ---------->
+		}
+		n += r;
+		if (n < size) {
+			/*
+			 * The server might have closed an idle connection :
+			 * the end of the stream is not the end of the file,
+			 * so reopen at the current position.
+			 */
+			CloseStream (file);
+			if (fresh && r == 0) {
+				Log_Printf (LOG_ERROR, "GetHttp url '%s' : "
+					    "unexpected end of file at "
+					    "offset %" PRIdMAX, file->url,
+					    (intmax_t) pos);
+				break; // ---------->
 			}
 		}
 	}
+	file->next_offset = offset + MAX (n, 0);
+
+	ithread_mutex_unlock (&file->mutex);
+	IOSched_Release (slot);
 	return n;
 }
-
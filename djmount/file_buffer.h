@@ -40,9 +40,11 @@ extern "C" {
  *
  *	This opaque type encapsulates the content of a file (local or remote).
  *	
- *      NOTE THAT THE FUNCTION API IS NOT THREAD SAFE. Functions which 
- *	might modify the FileBuffer state (all non-const ones) in different
- *	threads should synchronise accesses through appropriate locking.
+ *      NOTE THAT THE FUNCTION API IS NOT THREAD SAFE, except 
+ *	FileBuffer_Read which can be called concurrently on the same object
+ *	(as FUSE does). Other functions which might modify the FileBuffer 
+ *	state in different threads should synchronise accesses through 
+ *	appropriate locking.
  *
  *****************************************************************************/
 
@@ -63,6 +65,65 @@ typedef struct _FileBuffer FileBuffer;
 #define FILE_BUFFER_MAX_CONTENT_LENGTH		((uintmax_t) INT_MAX)
 
 
+/*****************************************************************************
+ * @var FileBuffer_Options
+ *
+ *	Global settings for remote files (see FileBuffer_Initialize) :
+ *
+ *	- stripes : when a sequential read pattern is detected on a remote
+ *	  file, each read which misses the read-ahead buffer fetches a
+ *	  whole window of 'stripes' x 'stripe_size' bytes. The window is
+ *	  split into 'stripes' ranges downloaded in parallel, over 
+ *	  separate HTTP connections.
+ *	- stripe_size : size (in bytes) of each range.
+ *	- prefetch_head, prefetch_tail : size (in bytes) of the beginning
+ *	  and end of remote files downloaded in background when they are
+ *	  opened (see FileBuffer_Prefetch), 0 to disable (default).
+ *	- probe_size : get the size of remote files from the server when
+ *	  it is not known in advance (see FileBuffer_ProbeSize).
+ *
+ *****************************************************************************/
+
+typedef struct _FileBuffer_Options {
+	size_t	stripes;
+	size_t	stripe_size;
+	size_t	prefetch_head;
+	size_t	prefetch_tail;
+	bool	probe_size;
+} FileBuffer_Options;
+
+#define FILE_BUFFER_DEFAULT_OPTIONS	((FileBuffer_Options) {	\
+		.stripes		= 1,			\
+		.stripe_size		= 256 * 1024,		\
+		.prefetch_head		= 0,			\
+		.prefetch_tail		= 0,			\
+		.probe_size		= false,		\
+	})
+
+
+/*****************************************************************************
+ * @brief 	Initialise global resources (threads ...) used to access
+ *		remote files. Before this function is called (or if
+ *		it fails), remote files are read without read-ahead, 
+ *		connection limit or parallel ranges.
+ *
+ * @param talloc_context	the talloc parent context
+ * @param options		the settings (copied)
+ * @return			0 if ok, or < 0 if error
+ *****************************************************************************/
+int
+FileBuffer_Initialize (void* talloc_context,
+		       const FileBuffer_Options* options);
+
+
+/*****************************************************************************
+ * @brief 	Release all global resources allocated by 
+ *		FileBuffer_Initialize.
+ *****************************************************************************/
+void
+FileBuffer_Finish (void);
+
+
 /*****************************************************************************
  * @var FileBuffer_StringAlloc
  *
@@ -126,6 +187,34 @@ off_t
 FileBuffer_GetSize (const FileBuffer* file);
 
 
+/*****************************************************************************
+ * @brief 	Returns the size of a remote file which is not given by the
+ *		server in the content directory, by asking the server
+ *		for the file itself. Results are cached per url, and
+ *		the requests are sent in background threads ; when too
+ *		many requests already wait for the same device, the
+ *		size is not probed (until the next call).
+ *		Does nothing (returns -1) unless the 'probe_size' option
+ *		is set (see FileBuffer_Initialize).
+ *
+ * @param url		the url of the remote file
+ * @param wait		if false, returns immediately (-1) when the
+ *			size is not known yet, but starts probing it.
+ *			If true, waits a few seconds at most.
+ * @return		the file size, or -1 if not known.
+ *****************************************************************************/
+off_t
+FileBuffer_ProbeSize (const char* url, bool wait);
+
+
+/*****************************************************************************
+ * @brief 	Returns true if the size of remote files not given by the 
+ *		server is probed (see FileBuffer_ProbeSize).
+ *****************************************************************************/
+bool
+FileBuffer_IsProbingSize (void);
+
+
 /*****************************************************************************
  * @brief 	Predicate : true if FileBuffer_Read always return the exact
  *		number of bytes requested (except on EOF or error)
@@ -136,6 +225,17 @@ bool
 FileBuffer_HasExactRead (const FileBuffer* file);
 
 
+/*****************************************************************************
+ * @brief 	Predicate : true if the content is read from an url
+ *		(else it is generated locally, and might change each time
+ *		the file is opened).
+ *
+ * @param file		the FileBuffer object
+ *****************************************************************************/
+bool
+FileBuffer_IsRemote (const FileBuffer* file);
+
+
 /*****************************************************************************
  * @brief 	Read part of the file, into an existing buffer.
  *		Note: this method might modify the FileBuffer object, 
@@ -152,6 +252,46 @@ FileBuffer_Read (FileBuffer* file, char* buffer,
 		 size_t size, off_t offset);
 
 
+/*****************************************************************************
+ * @brief 	Start downloading, in background, the beginning and the end
+ *		of a remote file, where players usually look for headers
+ *		and indexes before streaming. Subsequent reads of these
+ *		ranges are served from memory (waiting for the download
+ *		to complete if necessary).
+ *		Does nothing if the file is not remote, if its size is 
+ *		unknown, or if FileBuffer_Initialize has not been called.
+ *
+ * @param file		the FileBuffer object
+ * @return		0 if ok (or nothing to do), or < 0 if error.
+ *****************************************************************************/
+int
+FileBuffer_Prefetch (FileBuffer* file);
+
+
+/*****************************************************************************
+ * @brief 	Move part of a remote file into a pipe, without copying it
+ *		in user space (zero-copy) : the content is spliced from
+ *		the network connection, which is kept open between 
+ *		sequential reads. The pipe shall have enough free space 
+ *		to receive 'size' bytes.
+ *
+ *		If an error other than -ENOTSUP or -EAGAIN is returned,
+ *		part of the content might have been written into the pipe.
+ *
+ * @param file		the FileBuffer object
+ * @param pipe_fd	the write end of the pipe
+ * @param size		size to read
+ * @param offset	starting offset
+ * @return		number of bytes moved (might be 0), 
+ *			or -ENOTSUP / -EAGAIN if the file can't be read
+ *			this way (use FileBuffer_Read instead),
+ *			or another value < 0 if error.
+ *****************************************************************************/
+ssize_t
+FileBuffer_Splice (FileBuffer* file, int pipe_fd, 
+		   size_t size, off_t offset);
+
+
 #ifdef __cplusplus
 }; // extern "C"
 #endif 
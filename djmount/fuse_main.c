@@ -26,6 +26,9 @@
 #endif
 
 #include <fuse.h>
+#if FUSE_USE_VERSION >= 26
+#	include <fuse_lowlevel.h>
+#endif
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -33,6 +36,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <sys/statfs.h>
+#include <sys/ioctl.h>
 #ifdef HAVE_SETXATTR
 #	include <sys/xattr.h>
 #endif
@@ -40,6 +44,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "talloc_util.h"
 #include "device_list.h"
@@ -49,6 +54,13 @@
 #include "djfs.h"
 #include "content_dir.h"
 #include "charset.h"
+#include "file_buffer.h"
+#include "io_sched.h"
+#include "node_table.h"
+#include "cache.h"
+#include "dir_snapshot.h"
+#include "trace.h"
+#include "metrics.h"
 #include "minmax.h"
 
 
@@ -62,11 +74,6 @@
 #	define FUSE_VERSION	(FUSE_MAJOR_VERSION * 10 + FUSE_MINOR_VERSION)
 #endif
 
-// "-o readdir_ino" option available ?
-#if FUSE_VERSION >= 23
-#	define HAVE_FUSE_O_READDIR_INO	1
-#endif
-
 // "-o nonempty" option available ?
 #if FUSE_VERSION >= 24
 #	define HAVE_FUSE_O_NONEMPTY	1
@@ -77,6 +84,21 @@
 #	define HAVE_FUSE_FILE_INFO_DIRECT_IO	1
 #endif
 
+// "readdir" operation, with offsets ?
+#if FUSE_USE_VERSION >= 25
+#	define HAVE_FUSE_READDIR		1
+#endif
+
+// low-level API (with the FUSE 2.6 session functions) ?
+#if FUSE_USE_VERSION >= 26
+#	define HAVE_FUSE_LOWLEVEL		1
+#endif
+
+// "read_buf" operation, to reply with the content of a file descriptor ?
+#if FUSE_USE_VERSION >= 29 && HAVE_SPLICE
+#	define HAVE_FUSE_READ_BUF		1
+#endif
+
 
 
 /*****************************************************************************
@@ -102,9 +124,195 @@ static VFS* g_djfs = NULL;
  * Charset conversions (display <-> UTF-8) for filesystem
  *****************************************************************************/
 
+/*
+ * Converted file names, in both directions : the names listed in a 
+ * directory are converted once, and the paths given by the kernel 
+ * afterwards are converted back using the same entries, until they 
+ * expire with the content directory cache. ASCII names are left 
+ * unchanged by the conversions, hence are not stored.
+ * The caches are split into stripes, selected by a hash of the name
+ * to convert, each with its own mutex : concurrent lookups of different
+ * names seldom wait for each other.
+ */
+typedef struct _NameStripe {
+	ithread_mutex_t	mutex;
+	Cache*		cache [2]; // per Charset_Direction
+} NameStripe;
+
+static NameStripe*	g_names = NULL; // NAME_STRIPES, or NULL if unused
+
+#define NAME_CACHE_SIZE	4096	// total, for all the stripes
+#define NAME_STRIPES	8
+
+
+static void
+name_free_expired_data (const char* key, void* data)
+{
+	talloc_free (data);
+}
+
+static void
+InitNameCache (void* talloc_context)
+{
+	if (! Charset_IsConverting())
+		return; // ---------->
+
+	g_names = talloc_array (talloc_context, NameStripe, NAME_STRIPES);
+	if (g_names == NULL)
+		return; // ---------->
+	int s;
+	for (s = 0; s < NAME_STRIPES; s++) {
+		NameStripe* const stripe = g_names + s;
+		int i;
+		for (i = 0; i < 2; i++) {
+			stripe->cache[i] = Cache_Create 
+				(g_names, NAME_CACHE_SIZE / NAME_STRIPES,
+				 CONTENT_DIR_CACHE_TIMEOUT,
+				 name_free_expired_data);
+			if (stripe->cache[i] == NULL) {
+				Log_Printf (LOG_ERROR, "Can't create name "
+					    "cache, names not memoized");
+				talloc_free (g_names);
+				g_names = NULL;
+				return; // ---------->
+			}
+			// Same name : the stripes share their metrics
+			Cache_SetName (stripe->cache[i], 
+				       (i == CHARSET_TO_UTF8 ?
+					"names_to_utf8" : "names_from_utf8"));
+		}
+	}
+	for (s = 0; s < NAME_STRIPES; s++) 
+		ithread_mutex_init (&g_names[s].mutex, NULL);
+}
+
+static void
+FinishNameCache (void)
+{
+	if (g_names) {
+		int s;
+		for (s = 0; s < NAME_STRIPES; s++) 
+			ithread_mutex_destroy (&g_names[s].mutex);
+		talloc_free (g_names);
+		g_names = NULL;
+	}
+}
+
+static NameStripe*
+GetNameStripe (const char* name)
+{
+	return g_names + (String_Hash (name) % NAME_STRIPES);
+}
+
+static void
+StoreName (Charset_Direction dir, const char* key, const char* value)
+{
+	NameStripe* const stripe = GetNameStripe (key);
+	ithread_mutex_lock (&stripe->mutex);
+	void** const slot = Cache_Get (stripe->cache[dir], key);
+	if (slot) {
+		talloc_free (*slot);
+		*slot = talloc_strdup (stripe->cache[dir], value);
+	}
+	ithread_mutex_unlock (&stripe->mutex);
+}
+
+/*
+ * Convert a file name (without '/'), using the name cache.
+ * The result is "name" itself, "buffer", or a talloc'ed string 
+ * (if longer than bufsize) which should be freed by the caller.
+ */
+static char*
+ConvertName (Charset_Direction dir, const char* name, 
+	     char* buffer, size_t bufsize)
+{
+	if (g_names == NULL || String_IsASCII (name))
+		return Charset_ConvertString (dir, name, buffer, bufsize,
+					      NULL); // ---------->
+
+	bool found = false;
+	NameStripe* const stripe = GetNameStripe (name);
+	ithread_mutex_lock (&stripe->mutex);
+	void** const slot = Cache_Get (stripe->cache[dir], name);
+	if (slot && *slot) {
+		const size_t len = strlen (*slot);
+		if (len < bufsize) {
+			memcpy (buffer, *slot, len + 1);
+			found = true;
+		}
+	}
+	ithread_mutex_unlock (&stripe->mutex);
+	if (found)
+		return buffer; // ---------->
+
+	char* const res = Charset_ConvertString (dir, name, buffer, bufsize, 
+						 NULL);
+	if (res && res != name) {
+		StoreName (dir, name, res);
+		// Reverse mapping, for the paths given by the kernel
+		StoreName (dir == CHARSET_TO_UTF8 ? CHARSET_FROM_UTF8 
+			   : CHARSET_TO_UTF8, res, name);
+	}
+	return res;
+}
+
+/*
+ * Convert a path, one name at a time using the name cache.
+ * Same result as ConvertName.
+ */
+static char*
+ConvertPath (Charset_Direction dir, const char* path, 
+	     char* buffer, size_t bufsize)
+{
+	if (g_names == NULL || String_IsASCII (path))
+		return Charset_ConvertString (dir, path, buffer, bufsize,
+					      NULL); // ---------->
+
+	char name [NAME_MAX + 1];
+	char name_buffer [NAME_MAX + 1];
+	size_t len = 0;
+	const char* p = path;
+	while (*p) {
+		const size_t n = strcspn (p, "/");
+		const char* converted = p;
+		size_t converted_len = n;
+		char* res = NULL;
+		if (n > 0 && n < sizeof (name)) {
+			memcpy (name, p, n);
+			name[n] = NUL;
+			res = ConvertName (dir, name, name_buffer, 
+					   sizeof (name_buffer));
+			if (res == NULL)
+				return NULL; // ---------->
+			converted = res;
+			converted_len = strlen (res);
+		} 
+		if (n >= sizeof (name) || 
+		    len + converted_len + 2 > bufsize) {
+			if (res != name && res != name_buffer)
+				talloc_free (res);
+			// Too long : convert the whole path at once
+			return Charset_ConvertString 
+				(dir, path, buffer, bufsize, 
+				 NULL); // ---------->
+		}
+		memcpy (buffer + len, converted, converted_len);
+		len += converted_len;
+		if (res != name && res != name_buffer)
+			talloc_free (res);
+		p += n;
+		if (*p == '/')
+			buffer[len++] = *p++;
+	}
+	buffer[len] = NUL;
+	return buffer;
+}
+
+
 typedef struct {
 	fuse_dirh_t    h;
 	fuse_dirfil_t  filler;
+	VFS_StatFiller stat_filler;
 } my_dir_handle;
 
 static int filler_from_utf8 (fuse_dirh_t h, const char *name, 
@@ -112,10 +320,8 @@ static int filler_from_utf8 (fuse_dirh_t h, const char *name,
 {
 	// Convert filename to display charset
 	char buffer [NAME_MAX + 1];
-	char* display_name = Charset_ConvertString (CHARSET_FROM_UTF8, 
-						    name, 
-						    buffer, sizeof (buffer),
-						    NULL);
+	char* display_name = ConvertName (CHARSET_FROM_UTF8, name, 
+					  buffer, sizeof (buffer));
 	my_dir_handle* const my_h = (my_dir_handle*) h;
 	int rc = my_h->filler (my_h->h, display_name, type, ino);
 	if (display_name != buffer && display_name != name)
@@ -123,6 +329,19 @@ static int filler_from_utf8 (fuse_dirh_t h, const char *name,
 	return rc;
 }
 
+static int stat_filler_from_utf8 (void* h, const char *name, 
+				  int type, const struct stat* stbuf)
+{
+	char buffer [NAME_MAX + 1];
+	char* display_name = ConvertName (CHARSET_FROM_UTF8, name, 
+					  buffer, sizeof (buffer));
+	my_dir_handle* const my_h = (my_dir_handle*) h;
+	int rc = my_h->stat_filler (my_h->h, display_name, type, stbuf);
+	if (display_name != buffer && display_name != name)
+		talloc_free (display_name);
+	return rc;
+}
+
 static int
 Browse (const VFS_Query* query)
 {
@@ -133,15 +352,23 @@ Browse (const VFS_Query* query)
 		VFS_Query utfq = *query;
 		// Convert filename from display charset 
 		char buffer [PATH_MAX];
-		char* const utf_path = Charset_ConvertString 
-			(CHARSET_TO_UTF8, query->path, buffer, sizeof (buffer),
-			 NULL);
+		Trace_Span span;
+		Trace_Begin (&span, "charset.path", query->path);
+		char* const utf_path = ConvertPath 
+			(CHARSET_TO_UTF8, query->path, buffer, 
+			 sizeof (buffer));
+		Trace_End (&span);
 		utfq.path = utf_path;
-		my_dir_handle my_h = { .h = query->h, .filler = query->filler};
+		my_dir_handle my_h = { .h = query->h, .filler = query->filler,
+				       .stat_filler = query->stat_filler };
 		if (query->filler) {
 			utfq.h = (void*) &my_h;
 			utfq.filler = filler_from_utf8;
 		}
+		if (query->stat_filler) {
+			utfq.h = (void*) &my_h;
+			utfq.stat_filler = stat_filler_from_utf8;
+		}
 		rc = VFS_Browse (g_djfs, &utfq);
 		if (utf_path != buffer && utf_path != query->path)
 			talloc_free (utf_path);
@@ -161,6 +388,36 @@ Browse (const VFS_Query* query)
 	return rc;
 }
 
+/*****************************************************************************
+ * EndOp
+ *
+ * Ends the span of a FUSE operation, and records its duration into the
+ * histogram of the operation, registered at first use into '*id'.
+ *****************************************************************************/
+static void
+EndOp (Trace_Span* span, Metrics_Id* id)
+{
+	const uint64_t usec = Trace_End (span);
+	if (*id == METRICS_NONE) {
+		char labels [64];
+		// Span names are "fuse.<op>"
+		snprintf (labels, sizeof (labels), "op=\"%s\"", 
+			  span->name + sizeof ("fuse.") - 1);
+		*id = Metrics_Register (METRICS_HISTOGRAM, 
+					"djmount_fuse_op_seconds",
+					"Duration of the FUSE operations",
+					labels);
+	}
+	Metrics_Observe (*id, usec);
+}
+
+#define OP_END(SPAN)						\
+	do {							\
+		static Metrics_Id id__ = METRICS_NONE;		\
+		EndOp (&(SPAN), &id__);				\
+	} while (0)
+
+
 /*****************************************************************************
  * FUSE Operations
  *****************************************************************************/
@@ -170,7 +427,10 @@ fs_getattr (const char* path, struct stat* stbuf)
 {
 	*stbuf = (struct stat) { .st_mode = 0 };
 	const VFS_Query q = { .path = path, .stbuf = stbuf };
+	Trace_Span span;
+	Trace_Begin (&span, "fuse.getattr", path);
 	int rc = Browse (&q);
+	OP_END (span);
 	
 	return rc;
 }
@@ -180,18 +440,82 @@ fs_readlink (const char *path, char *buf, size_t size)
 {
 	VFS_Query const q = { .path = path,
 			      .lnk_buf = buf, .lnk_bufsiz = size };
+	Trace_Span span;
+	Trace_Begin (&span, "fuse.readlink", path);
 	int rc = Browse (&q);
+	OP_END (span);
 	return rc;
 }
 
+#if HAVE_FUSE_READDIR
+
+/*
+ * The entries are listed once at "opendir", into a snapshot, then 
+ * returned by offset in as many "readdir" as needed to fill the kernel
+ * buffers : a large directory is not browsed again for each buffer.
+ */
+static int 
+fs_opendir (const char* path, struct fuse_file_info* fi)
+{
+	DirSnapshot* const snap = DirSnapshot_Create (NULL);
+	if (snap == NULL)
+		return -ENOMEM; // ---------->
+	const VFS_Query q = { .path = path, .h = (fuse_dirh_t) snap, 
+			      .filler = DirSnapshot_Filler };
+	Trace_Span span;
+	Trace_Begin (&span, "fuse.opendir", path);
+	int const rc = Browse (&q);
+	OP_END (span);
+	if (rc) 
+		talloc_free (snap);
+	else
+		fi->fh = (intptr_t) snap;
+	return rc;
+}
+
+static int 
+fs_readdir (const char* path, void* buf, fuse_fill_dir_t filler,
+	    off_t offset, struct fuse_file_info* fi)
+{
+	const DirSnapshot* const snap = (const DirSnapshot*) fi->fh;
+	if (snap == NULL)
+		return -EBADF; // ---------->
+	size_t i = (offset > 0 ? offset : 0);
+	DirSnapshot_Entry e;
+	while (DirSnapshot_GetEntry (snap, i, &e)) {
+		const struct stat stbuf = { 
+			.st_ino = e.ino, .st_mode = DTTOIF (e.type) 
+		};
+		// Next offset = index of next entry + 1
+		if (filler (buf, e.name, &stbuf, ++i) != 0)
+			break; // buffer full ---------->
+	}
+	return 0;
+}
+
+static int 
+fs_releasedir (const char* path, struct fuse_file_info* fi)
+{
+	talloc_free ((DirSnapshot*) fi->fh);
+	fi->fh = 0;
+	return 0;
+}
+
+#else
+
 static int 
 fs_getdir (const char* path, fuse_dirh_t h, fuse_dirfil_t filler)
 {
 	const VFS_Query q = { .path = path, .h = h, .filler = filler };
+	Trace_Span span;
+	Trace_Begin (&span, "fuse.getdir", path);
 	int rc = Browse (&q);
+	OP_END (span);
 	return rc;
 }  
 
+#endif /* HAVE_FUSE_READDIR */
+
 
 static int 
 fs_mknod (const char* path, mode_t mode, dev_t rdev)
@@ -294,11 +618,16 @@ fs_open (const char* path, struct fuse_file_info* fi)
 	FileBuffer* file = NULL;
 	const VFS_Query q = { .path = path, .talloc_context = context, 
 			      .file = &file };
+	Trace_Span span;
+	Trace_Begin (&span, "fuse.open", path);
 	int rc = Browse (&q);
 	if (rc) {
 		talloc_free (file);
 		file = NULL;
+	} else {
+		(void) FileBuffer_Prefetch (file);
 	}
+	OP_END (span);
 	fi->fh = (intptr_t) file;
 
 #if HAVE_FUSE_FILE_INFO_DIRECT_IO	
@@ -324,11 +653,144 @@ fs_read (const char* path, char* buf, size_t size, off_t offset,
 	 struct fuse_file_info* fi)
 {
 	FileBuffer* const file = (FileBuffer*) fi->fh;
+	Trace_Span span;
+	Trace_Begin (&span, "fuse.read", path);
 	int rc = FileBuffer_Read (file, buf, size, offset);
+	OP_END (span);
 	return rc;
 }
 
 
+#if HAVE_FUSE_READ_BUF
+
+/*
+ * Zero-copy reads : the content of remote files is spliced from the
+ * network connection into a pipe, which is given to FUSE to be spliced
+ * again into the FUSE device. Each thread has its own pipe : it is 
+ * filled and emptied while the same request is being processed.
+ */
+
+// Size requested for the pipes (must hold the largest read request)
+#define READ_PIPE_SIZE		(1024 * 1024)
+
+typedef struct _ReadPipe {
+	int	fd[2];
+	size_t	size;
+} ReadPipe;
+
+static pthread_key_t g_read_pipe_key;
+
+static void
+DestroyReadPipe (void* arg)
+{
+	ReadPipe* const p = (ReadPipe*) arg;
+	if (p) {
+		close (p->fd[0]);
+		close (p->fd[1]);
+		talloc_free (p);
+	}
+}
+
+static ReadPipe*
+GetReadPipe (size_t size)
+{
+	ReadPipe* p = pthread_getspecific (g_read_pipe_key);
+	if (p) {
+		// Bytes left by a failed request would be given to the next 
+		// one : start again with an empty pipe
+		int pending = 0;
+		if (ioctl (p->fd[0], FIONREAD, &pending) != 0 || pending != 0) {
+			Log_Printf (LOG_WARNING, "Read pipe not empty (%d bytes)"
+				    " : recreated", pending);
+			(void) pthread_setspecific (g_read_pipe_key, NULL);
+			DestroyReadPipe (p);
+			p = NULL;
+		}
+	}
+	if (p == NULL) {
+		p = talloc (NULL, ReadPipe);
+		if (p == NULL)
+			return NULL; // ---------->
+		if (pipe (p->fd) != 0) {
+			talloc_free (p);
+			return NULL; // ---------->
+		}
+		p->size = 4096 * 16; // Linux default
+#ifdef F_SETPIPE_SZ
+		int const rc = fcntl (p->fd[1], F_SETPIPE_SZ, READ_PIPE_SIZE);
+		if (rc > 0)
+			p->size = rc;
+#endif
+		(void) pthread_setspecific (g_read_pipe_key, p);
+	}
+	return (size <= p->size ? p : NULL);
+}
+
+
+static int
+fs_read_buf (const char* path, struct fuse_bufvec** bufp, 
+	     size_t size, off_t offset, struct fuse_file_info* fi)
+{
+	FileBuffer* const file = (FileBuffer*) fi->fh;
+	struct fuse_bufvec* const buf = malloc (sizeof (struct fuse_bufvec));
+	if (buf == NULL)
+		return -ENOMEM; // ---------->
+	*buf = FUSE_BUFVEC_INIT (size);
+
+	ReadPipe* const p = GetReadPipe (size);
+	if (p) {
+		Trace_Span span;
+		Trace_Begin (&span, "fuse.read_buf", path);
+		ssize_t const n = FileBuffer_Splice (file, p->fd[1], 
+						     size, offset);
+		OP_END (span);
+		if (n >= 0) {
+			buf->buf[0].size  = n;
+			buf->buf[0].flags = FUSE_BUF_IS_FD;
+			buf->buf[0].fd    = p->fd[0];
+			*bufp = buf;
+			return 0; // ---------->
+		} 
+		if (n != -ENOTSUP && n != -EAGAIN) {
+			// Discard any partial content left in the pipe
+			(void) pthread_setspecific (g_read_pipe_key, NULL);
+			DestroyReadPipe (p);
+		}
+	}
+
+	// Fallback : copy content into memory
+	buf->buf[0].mem = malloc (size);
+	if (buf->buf[0].mem == NULL) {
+		free (buf);
+		return -ENOMEM; // ---------->
+	}
+	Trace_Span span;
+	Trace_Begin (&span, "fuse.read_buf", path);
+	int const rc = FileBuffer_Read (file, buf->buf[0].mem, size, offset);
+	OP_END (span);
+	if (rc < 0) {
+		free (buf->buf[0].mem);
+		free (buf);
+		return rc; // ---------->
+	}
+	buf->buf[0].size = rc;
+	*bufp = buf;
+	return 0;
+}
+
+
+static void*
+fs_init (struct fuse_conn_info* conn)
+{
+	// Let FUSE splice the pipes returned by "read_buf", if possible
+	conn->want |= (conn->capable & 
+		       (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE));
+	return NULL;
+}
+
+#endif /* HAVE_FUSE_READ_BUF */
+
+
 static int 
 fs_write (const char* path, const char* buf, size_t size,
 	  off_t offset, struct fuse_file_info* fi)
@@ -439,7 +901,13 @@ fs_removexattr (const char *path, const char *name)
 static struct fuse_operations fs_oper = {
 	.getattr	= fs_getattr,
 	.readlink	= fs_readlink,
+#if HAVE_FUSE_READDIR
+	.opendir	= fs_opendir,
+	.readdir	= fs_readdir,
+	.releasedir	= fs_releasedir,
+#else
 	.getdir		= fs_getdir,
+#endif
 	.mknod		= fs_mknod,
 	.mkdir		= fs_mkdir,
 	.symlink	= fs_symlink,
@@ -453,6 +921,10 @@ static struct fuse_operations fs_oper = {
 	.utime		= fs_utime,
 	.open		= fs_open,
 	.read		= fs_read,
+#if HAVE_FUSE_READ_BUF
+	.read_buf	= fs_read_buf,
+	.init		= fs_init,
+#endif
 	.write		= fs_write,
 	.statfs		= fs_statfs,
 	.flush      	= NULL,
@@ -467,6 +939,486 @@ static struct fuse_operations fs_oper = {
 };
 
 
+#if HAVE_FUSE_LOWLEVEL
+
+/*****************************************************************************
+ * FUSE low-level Operations
+ *
+ * The kernel identifies files by inode numbers, which are mapped to
+ * paths in the virtual file system by a NodeTable. Entries and
+ * attributes are cached by the kernel for as long as the content
+ * directories cache their results, so that most lookups and stat
+ * never reach djmount.
+ *****************************************************************************/
+
+static NodeTable* g_nodes = NULL;
+
+// Kernel cache timeouts, in seconds
+static double g_entry_timeout = CONTENT_DIR_CACHE_TIMEOUT;
+static double g_negative_timeout = 1.0;
+
+// "-o kernel_cache" option (a high-level FUSE option)
+static bool g_kernel_cache = false;
+
+// Same value as FUSE_UNKNOWN_INO in FUSE high-level library
+#define UNKNOWN_INO	0xffffffff
+
+/*
+ * Attributes of the files listed by "opendir", so that the "lookup" and 
+ * "getattr" which usually follow (e.g. "ls -l", media scanners) need not 
+ * browse the file system again. Entries expire with the content directory
+ * cache. Protected by g_attrs_mutex.
+ */
+static Cache*		g_attrs = NULL;
+static ithread_mutex_t	g_attrs_mutex;
+
+#define ATTR_CACHE_SIZE	4096
+
+
+static char*
+GetChildPath (void* ctx, const char* dir, const char* name)
+{
+	return talloc_asprintf (ctx, "%s%s%s", dir,
+				(strcmp (dir, "/") == 0 ? "" : "/"), name);
+}
+
+
+static void
+attr_free_expired_data (const char* key, void* data)
+{
+	talloc_free (data);
+}
+
+static void
+SetCachedAttr (const char* path, const struct stat* stbuf)
+{
+	ithread_mutex_lock (&g_attrs_mutex);
+	struct stat** const sp = (struct stat**) Cache_Get (g_attrs, path);
+	if (sp) {
+		if (*sp == NULL)
+			*sp = talloc (g_attrs, struct stat);
+		if (*sp)
+			**sp = *stbuf;
+	}
+	ithread_mutex_unlock (&g_attrs_mutex);
+}
+
+static bool
+GetCachedAttr (const char* path, struct stat* stbuf)
+{
+	bool found = false;
+	ithread_mutex_lock (&g_attrs_mutex);
+	struct stat* const* const sp = (struct stat**) Cache_Get (g_attrs, 
+								   path);
+	if (sp && *sp) {
+		*stbuf = **sp;
+		found = true;
+	}
+	ithread_mutex_unlock (&g_attrs_mutex);
+	return found;
+}
+
+
+static int
+GetAttr (const char* path, struct stat* stbuf)
+{
+	if (GetCachedAttr (path, stbuf))
+		return 0; // ---------->
+	*stbuf = (struct stat) { .st_mode = 0 };
+	const VFS_Query q = { .path = path, .stbuf = stbuf };
+	return Browse (&q);
+}
+
+
+static void
+ll_init (void* userdata, struct fuse_conn_info* conn)
+{
+#if HAVE_FUSE_READ_BUF
+	// Let FUSE splice the pipes filled by "ll_read", if possible
+	conn->want |= (conn->capable & 
+		       (FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE));
+#endif
+}
+
+
+static void
+ll_lookup (fuse_req_t req, fuse_ino_t parent, const char* name)
+{
+	void* const tmp_ctx = talloc_new_tmp (NULL, TALLOC_TMP_POOL_SIZE);
+	struct fuse_entry_param e = { 
+		.ino = 0, .generation = 0,
+		.attr_timeout = g_entry_timeout, 
+		.entry_timeout = g_entry_timeout
+	};
+	int rc = -ENOENT;
+	Trace_Span span;
+	Trace_Begin (&span, "fuse.lookup", name);
+	const char* const dir = NodeTable_GetPath (g_nodes, tmp_ctx, parent);
+	if (dir) {
+		const char* const path = GetChildPath (tmp_ctx, dir, name);
+		rc = (path ? GetAttr (path, &e.attr) : -ENOMEM);
+		if (rc == 0) {
+			// Note : "st_ino" is the stable inode number given
+			// by the VFS, independent of the node id "e.ino"
+			e.ino = NodeTable_Lookup (g_nodes, path);
+			if (e.ino == 0)
+				rc = -ENOMEM;
+		}
+	}
+	OP_END (span);
+	if (rc == 0) {
+		fuse_reply_entry (req, &e);
+	} else if (rc == -ENOENT) {
+		// Negative entry : cached for a short time only, because
+		// new devices can appear at any time
+		e.entry_timeout = g_negative_timeout;
+		fuse_reply_entry (req, &e);
+	} else {
+		fuse_reply_err (req, -rc);
+	}
+	talloc_free (tmp_ctx);
+}
+
+
+static void
+ll_forget (fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+	NodeTable_Forget (g_nodes, ino, nlookup);
+	fuse_reply_none (req);
+}
+
+
+static void
+ll_getattr (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+	char* const path = NodeTable_GetPath (g_nodes, NULL, ino);
+	struct stat stbuf;
+	Trace_Span span;
+	Trace_Begin (&span, "fuse.getattr", path);
+	int const rc = (path ? GetAttr (path, &stbuf) : -ENOENT);
+	OP_END (span);
+	if (rc == 0) {
+		fuse_reply_attr (req, &stbuf, g_entry_timeout);
+	} else {
+		fuse_reply_err (req, -rc);
+	}
+	talloc_free (path);
+}
+
+
+static void
+ll_readlink (fuse_req_t req, fuse_ino_t ino)
+{
+	char* const path = NodeTable_GetPath (g_nodes, NULL, ino);
+	char buf [PATH_MAX] = "";
+	int rc = -ENOENT;
+	if (path) {
+		const VFS_Query q = { .path = path, 
+				      .lnk_buf = buf, .lnk_bufsiz = sizeof (buf) };
+		Trace_Span span;
+		Trace_Begin (&span, "fuse.readlink", path);
+		rc = Browse (&q);
+		OP_END (span);
+	}
+	if (rc == 0)
+		fuse_reply_readlink (req, buf);
+	else
+		fuse_reply_err (req, -rc);
+	talloc_free (path);
+}
+
+
+/*
+ * Directory content, listed at "opendir" into a snapshot, and returned by 
+ * offset in "readdir" (in one or several requests, depending on the 
+ * kernel buffer size) : the FUSE directory entries are only built for 
+ * the requested range. The attributes of the returned entries, when
+ * known, are put in the attribute cache at the same time.
+ *
+ * Note : the kernel can receive these attributes directly with the
+ * entries ("readdirplus") only through the FUSE 3 API ; with FUSE 2, 
+ * they are returned by the following lookups, without browsing again.
+ *
+ * Limitation : the whole listing is built at "opendir", so the first
+ * "readdir" of a large container waits for all its children, even if
+ * only the first entries are read. This is no worse than before (each
+ * readdir listed the whole container), and the content directory
+ * downloads and caches all the children of a container anyway.
+ */
+typedef struct _OpenDir {
+	DirSnapshot*	snap;
+	char*		path;
+} OpenDir;
+
+
+static void
+ll_opendir (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+	OpenDir* const d = talloc (NULL, OpenDir);
+	int rc = -ENOMEM;
+	if (d) {
+		*d = (OpenDir) {
+			.snap = DirSnapshot_Create (d),
+			.path = NodeTable_GetPath (g_nodes, d, ino)
+		};
+		if (d->path == NULL) {
+			rc = -ENOENT;
+		} else if (d->snap) {
+			const VFS_Query q = { 
+				.path = d->path, .h = (fuse_dirh_t) d->snap,
+				.filler = DirSnapshot_Filler,
+				.stat_filler = DirSnapshot_StatFiller 
+			};
+			Trace_Span span;
+			Trace_Begin (&span, "fuse.opendir", d->path);
+			rc = Browse (&q);
+			OP_END (span);
+		}
+	}
+	if (rc == 0) {
+		fi->fh = (intptr_t) d;
+		if (fuse_reply_open (req, fi) != 0) {
+			// Interrupted : releasedir is not called
+			talloc_free (d);
+		}
+	} else {
+		talloc_free (d);
+		fuse_reply_err (req, -rc);
+	}
+}
+
+
+static void
+ll_readdir (fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+	    struct fuse_file_info* fi)
+{
+	const OpenDir* const d = (const OpenDir*) fi->fh;
+	if (d == NULL) {
+		fuse_reply_err (req, EBADF);
+		return; // ---------->
+	}
+	char* const buf = talloc_size (NULL, size);
+	if (buf == NULL) {
+		fuse_reply_err (req, ENOMEM);
+		return; // ---------->
+	}
+	size_t used = 0;
+	size_t i = (off > 0 ? off : 0);
+	DirSnapshot_Entry e;
+	while (DirSnapshot_GetEntry (d->snap, i, &e)) {
+		struct stat stbuf = { 
+			.st_ino  = (e.ino ? e.ino : UNKNOWN_INO),
+			.st_mode = DTTOIF (e.type) 
+		};
+		if (e.stbuf)
+			stbuf = *e.stbuf;
+		// Next offset = index of next entry + 1
+		size_t const len = fuse_add_direntry (req, buf + used, 
+						      size - used, e.name,
+						      &stbuf, i + 1);
+		if (len > size - used)
+			break; // buffer full ---------->
+		used += len;
+		i++;
+		if (e.stbuf) {
+			char* const path = GetChildPath (NULL, d->path, 
+							 e.name);
+			if (path) 
+				SetCachedAttr (path, &stbuf);
+			talloc_free (path);
+		}
+	}
+	fuse_reply_buf (req, buf, used);
+	talloc_free (buf);
+}
+
+
+static void
+ll_releasedir (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+	talloc_free ((OpenDir*) fi->fh);
+	fi->fh = 0;
+	fuse_reply_err (req, 0);
+}
+
+
+static void
+ll_open (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+	if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+		fuse_reply_err (req, EACCES);
+		return; // ---------->
+	} 
+	char* const path = NodeTable_GetPath (g_nodes, NULL, ino);
+	FileBuffer* file = NULL;
+	int rc = -ENOENT;
+	if (path) {
+		const VFS_Query q = { .path = path, .talloc_context = NULL, 
+				      .file = &file };
+		Trace_Span span;
+		Trace_Begin (&span, "fuse.open", path);
+		rc = Browse (&q);
+		OP_END (span);
+	}
+	if (rc) {
+		talloc_free (file);
+		fuse_reply_err (req, -rc);
+	} else {
+		(void) FileBuffer_Prefetch (file);
+		fi->fh = (intptr_t) file;
+		/*
+		 * Same as fs_open(), and also if the content is generated 
+		 * locally : its size might have changed since the 
+		 * attributes were cached by the kernel.
+		 */
+		fi->direct_io = ( FileBuffer_GetSize (file) < 0 ||
+				  ! FileBuffer_HasExactRead (file) ||
+				  ! FileBuffer_IsRemote (file) );
+		fi->keep_cache = g_kernel_cache;
+		if (fuse_reply_open (req, fi) != 0) {
+			// Interrupted : release is not called
+			talloc_free (file);
+		}
+	}
+	talloc_free (path);
+}
+
+
+static void
+ll_read (fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset,
+	 struct fuse_file_info* fi)
+{
+	FileBuffer* const file = (FileBuffer*) fi->fh;
+
+#if HAVE_FUSE_READ_BUF
+	ReadPipe* const p = GetReadPipe (size);
+	if (p) {
+		Trace_Span span;
+		Trace_Begin (&span, "fuse.read", NULL);
+		ssize_t const n = FileBuffer_Splice (file, p->fd[1], 
+						     size, offset);
+		OP_END (span);
+		if (n >= 0) {
+			struct fuse_bufvec buf = FUSE_BUFVEC_INIT (n);
+			buf.buf[0].flags = FUSE_BUF_IS_FD;
+			buf.buf[0].fd    = p->fd[0];
+			if (fuse_reply_data (req, &buf, 
+					     FUSE_BUF_SPLICE_MOVE) != 0) {
+				// Discard any content left in the pipe
+				(void) pthread_setspecific (g_read_pipe_key,
+							    NULL);
+				DestroyReadPipe (p);
+			}
+			return; // ---------->
+		} 
+		if (n != -ENOTSUP && n != -EAGAIN) {
+			(void) pthread_setspecific (g_read_pipe_key, NULL);
+			DestroyReadPipe (p);
+		}
+	}
+#endif
+
+	char* const buf = malloc (size);
+	if (buf == NULL) {
+		fuse_reply_err (req, ENOMEM);
+		return; // ---------->
+	}
+	Trace_Span span;
+	Trace_Begin (&span, "fuse.read", NULL);
+	int const rc = FileBuffer_Read (file, buf, size, offset);
+	OP_END (span);
+	if (rc < 0)
+		fuse_reply_err (req, -rc);
+	else
+		fuse_reply_buf (req, buf, rc);
+	free (buf);
+}
+
+
+static void
+ll_release (fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi)
+{
+	talloc_free ((FileBuffer*) fi->fh);
+	fi->fh = 0;
+	fuse_reply_err (req, 0);
+}
+
+
+static struct fuse_lowlevel_ops fs_ll_oper = {
+	.init		= ll_init,
+	.lookup		= ll_lookup,
+	.forget		= ll_forget,
+	.getattr	= ll_getattr,
+	.readlink	= ll_readlink,
+	.opendir	= ll_opendir,
+	.readdir	= ll_readdir,
+	.releasedir	= ll_releasedir,
+	.open		= ll_open,
+	.read		= ll_read,
+	.release	= ll_release,
+	// Other operations are not supported (read-only file system)
+};
+
+
+/*****************************************************************************
+ * FUSE low-level main loop (same as fuse_main for the high-level API)
+ *****************************************************************************/
+static int
+lowlevel_main (int argc, char* argv[])
+{
+	struct fuse_args args = FUSE_ARGS_INIT (argc, argv);
+	char* mountpoint = NULL;
+	int multithreaded = 1;
+	int foreground = 1;
+	int rc = -1;
+
+	g_nodes = NodeTable_Create (NULL);
+	g_attrs = Cache_Create (NULL, ATTR_CACHE_SIZE, 
+				CONTENT_DIR_CACHE_TIMEOUT,
+				attr_free_expired_data);
+	if (g_nodes == NULL || g_attrs == NULL) {
+		talloc_free (g_nodes);
+		talloc_free (g_attrs);
+		return -1; // ---------->
+	}
+	Cache_SetName (g_attrs, "attrs");
+	ithread_mutex_init (&g_attrs_mutex, NULL);
+
+	if (fuse_parse_cmdline (&args, &mountpoint, &multithreaded, 
+				&foreground) == 0) {
+		struct fuse_chan* const ch = fuse_mount (mountpoint, &args);
+		if (ch) {
+			struct fuse_session* const se = fuse_lowlevel_new 
+				(&args, &fs_ll_oper, sizeof (fs_ll_oper), 
+				 NULL);
+			if (se) {
+				if (fuse_set_signal_handlers (se) == 0) {
+					fuse_session_add_chan (se, ch);
+					rc = (multithreaded ?
+					      fuse_session_loop_mt (se) :
+					      fuse_session_loop (se));
+					fuse_remove_signal_handlers (se);
+					fuse_session_remove_chan (ch);
+				}
+				fuse_session_destroy (se);
+			}
+			fuse_unmount (mountpoint, ch);
+		}
+	}
+	free (mountpoint);
+	fuse_opt_free_args (&args);
+
+	talloc_free (g_nodes);
+	g_nodes = NULL;
+	ithread_mutex_destroy (&g_attrs_mutex);
+	talloc_free (g_attrs);
+	g_attrs = NULL;
+	return (rc ? 1 : 0);
+}
+
+#endif /* HAVE_FUSE_LOWLEVEL */
+
+
 /*****************************************************************************
  * @fn 		stdout_print 
  * @brief 	Output log messages.
@@ -539,8 +1491,32 @@ usage (FILE* stream, const char* progname)
      "    playlists              use playlists for AV files, instead of plain files\n"
      "    search_history=<size>  number of remembered searches (default: %lu)\n"
      "                           (set to 0 to disable search)\n"
+     "    stripes=<n>            parallel connections used to read ahead\n"
+     "                           sequential streams (default: %lu)\n"
+     "    stripe_size=<kb>       size of each read-ahead range (default: %lu)\n"
+     "    max_conn=<n>           max simultaneous file reads per server\n"
+     "                           (default: %lu)\n"
+     "                           (set to 0 for no limit)\n"
+     "    prefetch_head=<kb>     size of the beginning of files downloaded\n"
+     "                           when they are opened (default: %lu)\n"
+     "                           (e.g. 64 to speed up media probing)\n"
+     "    prefetch_tail=<kb>     size of the end of files downloaded\n"
+     "                           when they are opened (default: %lu)\n"
+     "    probe_size             ask the server for the size of files, when\n"
+     "                           not given in the content directory\n"
+     "    registry=<file>        save the discovered devices in this file,\n"
+     "                           to show them at once at the next mount\n"
+#if HAVE_FUSE_LOWLEVEL
+     "    highlevel              use the FUSE path-based API, instead of the\n"
+     "                           low-level API (no kernel caching of entries)\n"
+#endif
      "    sloppy                 ignore unknown options (e.g., for /etc/fstab)\n"
-     "\n", DEFAULT_SEARCH_HISTORY_SIZE);
+     "\n", DEFAULT_SEARCH_HISTORY_SIZE,
+     (unsigned long) FILE_BUFFER_DEFAULT_OPTIONS.stripes,
+     (unsigned long) FILE_BUFFER_DEFAULT_OPTIONS.stripe_size / 1024,
+     (unsigned long) IO_SCHED_DEFAULT_MAX_DEVICE_REQUESTS,
+     (unsigned long) FILE_BUFFER_DEFAULT_OPTIONS.prefetch_head / 1024,
+     (unsigned long) FILE_BUFFER_DEFAULT_OPTIONS.prefetch_tail / 1024);
   fprintf 
     (stream,
      "See FUSE documentation for the following mount options:\n%s",
@@ -627,6 +1603,12 @@ main (int argc, char *argv[])
 	char* charset = NULL;
 	DJFS_Flags djfs_flags = DEFAULT_DJFS_FLAGS;
 	size_t search_history_size = DEFAULT_SEARCH_HISTORY_SIZE;
+	FileBuffer_Options file_options = FILE_BUFFER_DEFAULT_OPTIONS;
+	size_t max_device_requests = IO_SCHED_DEFAULT_MAX_DEVICE_REQUESTS;
+	char* registry_file = NULL;
+#if HAVE_FUSE_LOWLEVEL
+	bool lowlevel = true;
+#endif
 
 	char* fuse_argv[32] = { argv[0] };
 	int fuse_argc = 1;
@@ -681,6 +1663,41 @@ main (int argc, char *argv[])
 				} else if (strncmp(s, "search_history=", 15)
 					   == 0) {
 					search_history_size = atoi (s+15);
+				} else if (strncmp(s, "stripes=", 8) == 0) {
+					file_options.stripes = atoi (s+8);
+				} else if (strncmp(s, "stripe_size=", 12) == 0) {
+					file_options.stripe_size = 
+						(size_t) atoi (s+12) * 1024;
+				} else if (strncmp(s, "max_conn=", 9) == 0) {
+					max_device_requests = atoi (s+9);
+				} else if (strncmp(s, "prefetch_head=", 14) == 0) {
+					file_options.prefetch_head = 
+						(size_t) atoi (s+14) * 1024;
+				} else if (strncmp(s, "prefetch_tail=", 14) == 0) {
+					file_options.prefetch_tail = 
+						(size_t) atoi (s+14) * 1024;
+				} else if (strcmp(s, "probe_size") == 0) {
+					file_options.probe_size = true;
+				} else if (strncmp(s, "registry=", 9) == 0) {
+					// Absolute path : the daemon changes
+					// its working directory
+					char cwd [PATH_MAX];
+					if (s[9] == '/' || 
+					    getcwd (cwd, sizeof (cwd)) == NULL)
+						registry_file = talloc_strdup
+							(tmp_ctx, s+9);
+					else
+						registry_file = 
+							talloc_asprintf
+							(tmp_ctx, "%s/%s", 
+							 cwd, s+9);
+#if HAVE_FUSE_LOWLEVEL
+				} else if (strcmp(s, "highlevel") == 0) {
+					lowlevel = false;
+				} else if (strcmp(s, "kernel_cache") == 0) {
+					// Passed to FUSE later, if high-level
+					g_kernel_cache = true;
+#endif
 				//check for '-s|-o sloppy' -- ignore unknown options
 				} else if (strncmp(s, "sloppy", 15) == 0 ||
 						(strlen(s) == 1 && strncmp(s, "s", 1) == 0)) {
@@ -769,10 +1786,21 @@ main (int argc, char *argv[])
 	// Force Read-only (write operations not implemented yet)
 	FUSE_ARG ("-r"); 
 
-#if HAVE_FUSE_O_READDIR_INO
-	// try to fill in d_ino in readdir
+#if HAVE_FUSE_LOWLEVEL
+	// Options of the FUSE high-level library only
+	if (! lowlevel && g_kernel_cache) {
+		FUSE_ARG ("-o");
+		FUSE_ARG ("kernel_cache");
+	}
+	if (! lowlevel) {
+		// use the inode numbers given by the VFS (in stat and readdir)
+		FUSE_ARG ("-o");
+		FUSE_ARG ("use_ino");
+	}
+#else
+	// use the inode numbers given by the VFS (in stat and readdir)
 	FUSE_ARG ("-o");
-	FUSE_ARG ("readdir_ino");
+	FUSE_ARG ("use_ino");
 #endif
 #if !HAVE_FUSE_FILE_INFO_DIRECT_IO	
 	// Set global "direct_io" option, if not available per open file,
@@ -790,6 +1818,7 @@ main (int argc, char *argv[])
 		Log_Printf (LOG_ERROR, "Error initialising charset='%s'",
 			    NN(charset));
 	}
+	InitNameCache (tmp_ctx);
 
 	/* 
 	 * Create virtual file system
@@ -820,11 +1849,37 @@ main (int argc, char *argv[])
 			exit (err); // ---------->
 		}
 	}
+
+	/*
+	 * From now on, print log messages in a separate thread (must be 
+	 * done after the process is daemonized)
+	 */
+	rc = Log_StartThread();
+	if (rc) {
+		Log_Printf (LOG_WARNING, "Error starting log thread : %d", rc);
+	}
 	
+	rc = IOSched_Initialize (tmp_ctx, max_device_requests);
+	if (rc) {
+		Log_Printf (LOG_ERROR, "Error initialising I/O scheduler : %d",
+			    rc);
+	}
+
+	/*
+	 * Start threads used to access remote files (must be done after
+	 * the process is daemonized)
+	 */
+	rc = FileBuffer_Initialize (tmp_ctx, &file_options);
+	if (rc) {
+		Log_Printf (LOG_ERROR, "Error initialising file buffers : %d",
+			    rc);
+	}
+
 	/*
 	 * Initialise UPnP Control point and starts FUSE file system
 	 */
 	
+	DeviceList_SetRegistryFile (registry_file);
 	rc = DeviceList_Start (CONTENT_DIR_SERVICE_TYPE, NULL);
 	if (rc != UPNP_E_SUCCESS) {
 		Log_Printf (LOG_ERROR, 
@@ -834,15 +1889,29 @@ main (int argc, char *argv[])
 	}
 	
 
+#if HAVE_FUSE_READ_BUF
+	(void) pthread_key_create (&g_read_pipe_key, DestroyReadPipe);
+#endif
+
 	fuse_argv[fuse_argc] = NULL; // End FUSE arguments list
+#if HAVE_FUSE_LOWLEVEL
+	if (lowlevel)
+		rc = lowlevel_main (fuse_argc, fuse_argv);
+	else
+		rc = fuse_main (fuse_argc, fuse_argv, &fs_oper, NULL);
+#else
 	rc = fuse_main (fuse_argc, fuse_argv, &fs_oper);
+#endif
 	if (rc != 0) {
 		Log_Printf (LOG_ERROR, "Error in FUSE main loop = %d", rc);
 	}
 	
 	Log_Printf (LOG_DEBUG, "Shutting down ...");
 	DeviceList_Stop();
+	FileBuffer_Finish();
+	IOSched_Finish();
 	
+	FinishNameCache();
 	(void) Charset_Finish();
 	Log_Finish();
 
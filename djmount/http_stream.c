@@ -0,0 +1,466 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * HttpStream : HTTP GET of an open-ended range, over a raw socket.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "http_stream.h"
+#include "talloc_util.h"
+#include "string_util.h"
+#include "log.h"
+#include "minmax.h"
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <inttypes.h>	// Import intmax_t and PRIdMAX
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+
+// Maximum size of the response headers
+#define MAX_HEADERS_SIZE	8192
+
+
+struct _HttpStream {
+	int	sock;
+	off_t	offset;
+
+	// Beginning of the body, received with the headers
+	char*	pending;
+	size_t	pending_length;
+};
+
+
+/*****************************************************************************
+ * DestroyStream
+ *****************************************************************************/
+static int
+DestroyStream (HttpStream* const stream)
+{
+	if (stream->sock >= 0)
+		close (stream->sock);
+	return 0; // ok -> deallocate memory
+}
+
+
+/*****************************************************************************
+ * ParseURL
+ *
+ * Split "http://host[:port]/path" into its components (talloc'ed).
+ *****************************************************************************/
+static bool
+ParseURL (void* ctx, const char* url,
+	  char** host, char** port, const char** path)
+{
+	if (strncasecmp (url, "http://", 7) != 0)
+		return false; // ---------->
+	const char* const h = url + 7;
+	const char* p = h + strcspn (h, "/");
+	*path = (*p ? p : "/");
+
+	const char* colon = NULL;
+	if (*h == '[') {
+		// IPv6 literal address
+		const char* const end = memchr (h, ']', p - h);
+		if (end == NULL)
+			return false; // ---------->
+		*host = talloc_strndup (ctx, h + 1, end - h - 1);
+		colon = (end + 1 < p && end[1] == ':') ? end + 1 : NULL;
+	} else {
+		colon = memchr (h, ':', p - h);
+		*host = talloc_strndup (ctx, h, (colon ? colon : p) - h);
+	}
+	*port = (colon ? talloc_strndup (ctx, colon + 1, p - colon - 1)
+		 : talloc_strdup (ctx, "80"));
+	return (*host && **host && *port && **port);
+}
+
+
+/*****************************************************************************
+ * Connect
+ *****************************************************************************/
+static int
+Connect (const char* host, const char* port, int timeout)
+{
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM
+	};
+	struct addrinfo* res = NULL;
+	int rc = getaddrinfo (host, port, &hints, &res);
+	if (rc) {
+		Log_Printf (LOG_ERROR, "HttpStream : can't resolve '%s' : %s",
+			    host, gai_strerror (rc));
+		return -EHOSTUNREACH; // ---------->
+	}
+	int sock = -1;
+	struct addrinfo* ai;
+	for (ai = res; ai && sock < 0; ai = ai->ai_next) {
+		sock = socket (ai->ai_family, ai->ai_socktype,
+			       ai->ai_protocol);
+		if (sock < 0)
+			continue; // ---------->
+		// connect, send and recv are bounded by the same timeout
+		const struct timeval tv = { .tv_sec = timeout };
+		(void) setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO,
+				   &tv, sizeof (tv));
+		(void) setsockopt (sock, SOL_SOCKET, SO_SNDTIMEO,
+				   &tv, sizeof (tv));
+		if (connect (sock, ai->ai_addr, ai->ai_addrlen) != 0) {
+			close (sock);
+			sock = -1;
+		}
+	}
+	freeaddrinfo (res);
+	return (sock >= 0 ? sock : -ECONNREFUSED);
+}
+
+
+/*****************************************************************************
+ * SendAll
+ *****************************************************************************/
+static int
+SendAll (int sock, const char* buf, size_t size)
+{
+	while (size > 0) {
+		const ssize_t n = send (sock, buf, size, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue; // ---------->
+			return -errno; // ---------->
+		}
+		buf  += n;
+		size -= n;
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * ReceiveHeaders
+ *
+ * Reads the response headers. The beginning of the body received along
+ * with them (if any) is kept in the stream, to be returned first.
+ *****************************************************************************/
+static char*
+ReceiveHeaders (void* ctx, HttpStream* stream)
+{
+	char* const buf = talloc_size (ctx, MAX_HEADERS_SIZE + 1);
+	if (buf == NULL)
+		return NULL; // ---------->
+	size_t len = 0;
+	while (len < MAX_HEADERS_SIZE) {
+		const ssize_t n = recv (stream->sock, buf + len,
+					MAX_HEADERS_SIZE - len, 0);
+		if (n < 0 && errno == EINTR)
+			continue; // ---------->
+		if (n <= 0)
+			break; // ---------->
+		len += n;
+		buf[len] = NUL;
+		char* const end = strstr (buf, "\r\n\r\n");
+		if (end) {
+			const size_t hlen = end + 4 - buf;
+			if (len > hlen) {
+				stream->pending = talloc_memdup
+					(stream, buf + hlen, len - hlen);
+				stream->pending_length = len - hlen;
+			}
+			buf[hlen] = NUL;
+			return buf; // ---------->
+		}
+	}
+	return NULL;
+}
+
+
+/*****************************************************************************
+ * TakePending
+ *
+ * Returns the number of bytes to deliver from the pending buffer.
+ *****************************************************************************/
+static size_t
+TakePending (HttpStream* stream, size_t size)
+{
+	const size_t n = MIN (size, stream->pending_length);
+	stream->pending_length -= n;
+	stream->offset += n;
+	return n;
+}
+
+
+/*****************************************************************************
+ * GetHeader
+ *
+ * Returns the value of a header line, or NULL if not found.
+ *****************************************************************************/
+static const char*
+GetHeader (const char* headers, const char* name)
+{
+	const size_t len = strlen (name);
+	const char* p = strstr (headers, "\r\n");
+	while (p && p[2] != '\r') {
+		p += 2;
+		if (strncasecmp (p, name, len) == 0 && p[len] == ':') {
+			p += len + 1;
+			while (*p == ' ' || *p == '\t')
+				p++;
+			return p; // ---------->
+		}
+		p = strstr (p, "\r\n");
+	}
+	return NULL;
+}
+
+
+/*****************************************************************************
+ * SendRequest
+ *
+ * Sends a request (with an optional "Range" header) and reads the 
+ * response headers, which are allocated in 'tmp_ctx'.
+ *****************************************************************************/
+static HttpStream*
+SendRequest (void* talloc_context, void* tmp_ctx, 
+	     const char* url, const char* method, const char* range,
+	     off_t offset, int timeout, const char** headers)
+{
+	char* host = NULL;
+	char* port = NULL;
+	const char* path = NULL;
+
+	*headers = NULL;
+	if (url == NULL || ! ParseURL (tmp_ctx, url, &host, &port, &path)) {
+		Log_Printf (LOG_DEBUG, "HttpStream : unsupported url '%s'",
+			    NN(url));
+		return NULL; // ---------->
+	}
+	const int sock = Connect (host, port, timeout);
+	if (sock < 0)
+		return NULL; // ---------->
+
+	HttpStream* const stream = talloc (talloc_context, HttpStream);
+	if (stream == NULL) {
+		close (sock);
+		return NULL; // ---------->
+	}
+	*stream = (HttpStream) { 
+		.sock = sock, .offset = offset,
+		.pending = NULL, .pending_length = 0
+	};
+	talloc_set_destructor (stream, DestroyStream);
+
+	const bool ipv6 = (strchr (host, ':') != NULL);
+	const char* const request = talloc_asprintf
+		(tmp_ctx,
+		 "%s %s HTTP/1.1\r\n"
+		 "Host: %s%s%s:%s\r\n"
+		 "%s%s%s"
+		 "Connection: close\r\n"
+		 "\r\n",
+		 method, path, (ipv6 ? "[" : ""), host, (ipv6 ? "]" : ""), 
+		 port, (range ? "Range: " : ""), (range ? range : ""),
+		 (range ? "\r\n" : ""));
+	int rc = (request ? SendAll (sock, request, strlen (request))
+		  : -ENOMEM);
+	*headers = (rc ? NULL : ReceiveHeaders (tmp_ctx, stream));
+	if (*headers == NULL) {
+		Log_Printf (LOG_ERROR, "HttpStream url '%s' : no response",
+			    url);
+		talloc_free (stream);
+		return NULL; // ---------->
+	}
+	return stream;
+}
+
+
+/*****************************************************************************
+ * HttpStream_Open
+ *****************************************************************************/
+HttpStream*
+HttpStream_Open (void* talloc_context, const char* url, off_t offset,
+		 int timeout)
+{
+	void* const tmp_ctx = talloc_new (NULL);
+	const char* headers = NULL;
+	const char* const bytes = talloc_asprintf (tmp_ctx, "bytes=%" 
+						   PRIdMAX "-", 
+						   (intmax_t) offset);
+	HttpStream* stream = SendRequest (talloc_context, tmp_ctx, url,
+					  "GET", bytes, offset, timeout,
+					  &headers);
+	if (stream == NULL)
+		goto cleanup; // ---------->
+
+	/*
+	 * Only accept the exact range requested, as a plain body
+	 */
+	int status = 0;
+	(void) sscanf (headers, "HTTP/%*d.%*d %d", &status);
+	const char* const encoding = GetHeader (headers,
+						"Transfer-Encoding");
+	if (encoding && strncasecmp (encoding, "identity", 8) != 0) {
+		Log_Printf (LOG_DEBUG, "HttpStream url '%s' : "
+			    "unsupported encoding", url);
+		goto error; // ---------->
+	}
+	if (status == 206) {
+		const char* const range = GetHeader (headers,
+						     "Content-Range");
+		intmax_t start = -1;
+		if (range == NULL ||
+		    sscanf (range, "bytes %" SCNdMAX, &start) != 1 ||
+		    start != offset) {
+			Log_Printf (LOG_DEBUG, "HttpStream url '%s' : "
+				    "unexpected range '%s'", url, NN(range));
+			goto error; // ---------->
+		}
+	} else if (! (status == 200 && offset == 0)) {
+		Log_Printf (LOG_DEBUG, "HttpStream url '%s' : status %d",
+			    url, status);
+		goto error; // ---------->
+	}
+	Log_Printf (LOG_DEBUG, "HttpStream url '%s' : opened at offset %"
+		    PRIdMAX, url, (intmax_t) offset);
+	goto cleanup; // ---------->
+
+error:
+	talloc_free (stream);
+	stream = NULL;
+cleanup:
+	talloc_free (tmp_ctx);
+	return stream;
+}
+
+
+/*****************************************************************************
+ * HttpStream_ProbeSize
+ *****************************************************************************/
+off_t
+HttpStream_ProbeSize (const char* url, int timeout)
+{
+	void* const tmp_ctx = talloc_new (NULL);
+	intmax_t size = -1;
+	const char* headers = NULL;
+	int status = 0;
+
+	/*
+	 * 1) "HEAD" request : size is the Content-Length
+	 */
+	HttpStream* stream = SendRequest (tmp_ctx, tmp_ctx, url, "HEAD", 
+					  NULL, 0, timeout, &headers);
+	if (stream == NULL)
+		goto cleanup; // ---------->
+	(void) sscanf (headers, "HTTP/%*d.%*d %d", &status);
+	const char* length = GetHeader (headers, "Content-Length");
+	if (status == 200 && length &&
+	    sscanf (length, "%" SCNdMAX, &size) == 1)
+		goto cleanup; // ---------->
+	talloc_free (stream);
+
+	/*
+	 * 2) some servers do not implement "HEAD" : request the first
+	 *    byte only, and get the size from the Content-Range.
+	 */
+	size = -1;
+	stream = SendRequest (tmp_ctx, tmp_ctx, url, "GET", "bytes=0-0", 
+			      0, timeout, &headers);
+	if (stream == NULL)
+		goto cleanup; // ---------->
+	status = 0;
+	(void) sscanf (headers, "HTTP/%*d.%*d %d", &status);
+	if (status == 206) {
+		const char* const range = GetHeader (headers, 
+						     "Content-Range");
+		const char* const slash = (range ? strchr (range, '/') : NULL);
+		if (slash == NULL || sscanf (slash + 1, "%" SCNdMAX, 
+					     &size) != 1)
+			size = -1;
+	} else if (status == 200) {
+		// Range ignored : the whole file would be returned
+		length = GetHeader (headers, "Content-Length");
+		if (length == NULL || sscanf (length, "%" SCNdMAX, 
+					      &size) != 1)
+			size = -1;
+	}
+
+cleanup:
+	Log_Printf (LOG_DEBUG, "HttpStream url '%s' : probed size %" PRIdMAX,
+		    NN(url), size);
+	talloc_free (tmp_ctx);
+	return (size >= 0 ? (off_t) size : -1);
+}
+
+
+/*****************************************************************************
+ * HttpStream_GetOffset
+ *****************************************************************************/
+off_t
+HttpStream_GetOffset (const HttpStream* stream)
+{
+	return (stream ? stream->offset : -1);
+}
+
+
+/*****************************************************************************
+ * HttpStream_Splice
+ *****************************************************************************/
+ssize_t
+HttpStream_Splice (HttpStream* stream, int pipe_fd, size_t size)
+{
+#if HAVE_SPLICE
+	if (stream == NULL)
+		return -EINVAL; // ---------->
+	size_t done = 0;
+	if (stream->pending_length > 0) {
+		const char* const p = stream->pending + 
+			(talloc_get_size (stream->pending) - 
+			 stream->pending_length);
+		const size_t len = MIN (size, stream->pending_length);
+		const ssize_t n = write (pipe_fd, p, len);
+		if (n < 0)
+			return -errno; // ---------->
+		done = TakePending (stream, n);
+	}
+	while (done < size) {
+		const ssize_t n = splice (stream->sock, NULL, pipe_fd, NULL,
+					  size - done, SPLICE_F_MOVE);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue; // ---------->
+			return -errno; // ---------->
+		}
+		if (n == 0)
+			break; // end of file ---------->
+		done += n;
+		stream->offset += n;
+	}
+	return done;
+#else
+	return -ENOSYS;
+#endif
+}
+
@@ -0,0 +1,108 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * HttpStream : HTTP GET of an open-ended range, over a raw socket.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef HTTP_STREAM_H_INCLUDED
+#define HTTP_STREAM_H_INCLUDED
+
+#include <sys/types.h>		// Import "off_t" and "ssize_t"
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/******************************************************************************
+ * @var HttpStream
+ *
+ *	This opaque type is an HTTP connection, on which the body of a
+ *	"GET" request for the range [offset, end of file] is being received.
+ *	Contrary to the libupnp HTTP client API, the socket is accessible,
+ *	so that the body can be moved to other file descriptors without
+ *	copy in user space (see HttpStream_Splice).
+ *
+ *	The stream is closed with "talloc_free".
+ *
+ *      NOTE THAT THE FUNCTION API IS NOT THREAD SAFE.
+ *
+ *****************************************************************************/
+
+typedef struct _HttpStream HttpStream;
+
+
+/*****************************************************************************
+ * @brief 	Connects to the server, sends the request and reads the
+ *		response headers. Fails if the server does not return
+ *		the requested range as a plain (not chunked) body.
+ *
+ * @param talloc_context	the talloc parent context
+ * @param url			the source url ("http://" only)
+ * @param offset		start of the range
+ * @param timeout		network timeout, in seconds
+ * @return			the new stream, or NULL if error
+ *****************************************************************************/
+HttpStream*
+HttpStream_Open (void* talloc_context, const char* url, off_t offset,
+		 int timeout);
+
+
+/*****************************************************************************
+ * @brief 	Get the size of a remote file, for servers which do not
+ *		announce it : sends a "HEAD" request, or (if not supported)
+ *		a "GET" request for the first byte only.
+ *
+ * @param url			the source url ("http://" only)
+ * @param timeout		network timeout, in seconds
+ * @return			the size of the file, or -1 if unknown
+ *****************************************************************************/
+off_t
+HttpStream_ProbeSize (const char* url, int timeout);
+
+
+/*****************************************************************************
+ * @brief 	Returns the file offset of the next byte to be received.
+ *****************************************************************************/
+off_t
+HttpStream_GetOffset (const HttpStream* stream);
+
+
+/*****************************************************************************
+ * @brief 	Move bytes from the stream into a pipe, without copying
+ *		them in user space. The pipe shall have enough free space
+ *		to receive 'size' bytes.
+ *
+ * @param stream	the HttpStream object
+ * @param pipe_fd	the write end of the pipe
+ * @param size		number of bytes to move
+ * @return		number of bytes moved (< size only on end of
+ *			file), or < 0 if error (-errno).
+ *****************************************************************************/
+ssize_t
+HttpStream_Splice (HttpStream* stream, int pipe_fd, size_t size);
+
+
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
+
+#endif // HTTP_STREAM_H_INCLUDED
@@ -0,0 +1,434 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * IOSched : scheduling of the requests sent to the UPnP devices.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "io_sched.h"
+#include "ptr_array.h"
+#include "talloc_util.h"
+#include "string_util.h"
+#include "log.h"
+#include "minmax.h"
+
+#include <string.h>
+#include <errno.h>
+#include <upnp/ithread.h>
+
+
+/*
+ * Requests in progress, and waiting requests, for one device
+ * (identified by the "host:port" part of the urls) and one class of
+ * requests (data or control) : each class has its own budget.
+ */
+typedef struct _Waiter {
+	IOSched_Priority	priority;
+	const void*		owner;
+	bool			granted;
+	struct _Waiter*		next;
+} Waiter;
+
+typedef struct _Device {
+	char*		name;
+	bool		control;
+	size_t		active;
+	size_t		active_background;
+	PtrArray*	slots;	 // slots in progress
+	Waiter*		waiters; // FIFO list
+
+	// Statistics
+	unsigned long	nb_foreground;
+	unsigned long	nb_background;
+	unsigned long	nb_waits;
+	unsigned long	nb_boosts;
+} Device;
+
+struct _IOSched_Slot {
+	Device*			device;
+	IOSched_Priority	priority;
+	const void*		owner;
+};
+
+
+static bool		 g_initialized = false;
+static ithread_mutex_t	 g_mutex;
+static ithread_cond_t	 g_cond;
+static PtrArray*	 g_devices = NULL;
+static size_t		 g_max_requests = 0;
+static size_t		 g_max_background = 0;
+static const size_t	 g_max_control = IO_SCHED_MAX_CONTROL_REQUESTS;
+static const size_t	 g_max_control_background = 1;
+
+
+/*****************************************************************************
+ * GetDevice
+ *
+ * Find (or create) the device of an url, for a class of requests. 
+ * The mutex must be locked.
+ *****************************************************************************/
+static Device*
+GetDevice (const char* url, bool control)
+{
+	const char* p = strstr (url, "://");
+	p = (p ? p + 3 : url);
+	const size_t len = strcspn (p, "/");
+
+	Device* d = NULL;
+	PTR_ARRAY_FOR_EACH_PTR (g_devices, d) {
+		if (d->control == control &&
+		    strncmp (d->name, p, len) == 0 && d->name[len] == NUL)
+			return d; // ---------->
+	} PTR_ARRAY_FOR_EACH_PTR_END;
+
+	d = talloc (g_devices, Device);
+	if (d) {
+		*d = (Device) {
+			.name    = talloc_strndup (d, p, len),
+			.control = control,
+			.slots   = PtrArray_Create (d),
+			.waiters = NULL,
+		};
+		if (d->name == NULL || d->slots == NULL ||
+		    ! PtrArray_Append (g_devices, d)) {
+			talloc_free (d);
+			d = NULL;
+		}
+	}
+	return d;
+}
+
+
+/*****************************************************************************
+ * CountOwnerSlots
+ *****************************************************************************/
+static size_t
+CountOwnerSlots (const Device* device, const void* owner)
+{
+	size_t n = 0;
+	if (owner) {
+		const IOSched_Slot* s = NULL;
+		PTR_ARRAY_FOR_EACH_PTR (device->slots, s) {
+			if (s->owner == owner)
+				n++;
+		} PTR_ARRAY_FOR_EACH_PTR_END;
+	}
+	return n;
+}
+
+
+/*****************************************************************************
+ * Dispatch
+ *
+ * Grant the free slots of a device to the best waiting requests.
+ * The mutex must be locked.
+ *****************************************************************************/
+static void
+Dispatch (Device* device)
+{
+	const size_t max_requests = 
+		(device->control ? g_max_control : g_max_requests);
+	const size_t max_background = 
+		(device->control ? g_max_control_background 
+		 : g_max_background);
+	bool granted = false;
+	while (device->active < max_requests) {
+		Waiter* best = NULL;
+		size_t best_count = 0;
+		Waiter* w;
+		for (w = device->waiters; w; w = w->next) {
+			if (w->granted)
+				continue; // ---------->
+			if (best && w->priority > best->priority)
+				continue; // ---------->
+			const size_t count = CountOwnerSlots (device,
+							      w->owner);
+			// Strictly better only : FIFO order between equals
+			if (best == NULL || w->priority < best->priority ||
+			    count < best_count) {
+				best = w;
+				best_count = count;
+			}
+		}
+		if (best == NULL)
+			break; // ---------->
+		if (best->priority == IO_SCHED_BACKGROUND &&
+		    device->active_background >= max_background)
+			break; // throttled ---------->
+
+		best->granted = true;
+		device->active++;
+		if (best->priority == IO_SCHED_BACKGROUND)
+			device->active_background++;
+		granted = true;
+	}
+	if (granted)
+		ithread_cond_broadcast (&g_cond);
+}
+
+
+/*****************************************************************************
+ * RemoveWaiter
+ *****************************************************************************/
+static void
+RemoveWaiter (Device* device, const Waiter* waiter)
+{
+	Waiter** pw;
+	for (pw = &device->waiters; *pw; pw = &(*pw)->next) {
+		if (*pw == waiter) {
+			*pw = waiter->next;
+			break; // ---------->
+		}
+	}
+}
+
+
+/*****************************************************************************
+ * IOSched_Initialize
+ *****************************************************************************/
+int
+IOSched_Initialize (void* talloc_context, size_t max_device_requests)
+{
+	if (g_initialized)
+		return 0; // ---------->
+
+	g_devices = PtrArray_Create (talloc_context);
+	if (g_devices == NULL)
+		return -ENOMEM; // ---------->
+	ithread_mutex_init (&g_mutex, NULL);
+	ithread_cond_init (&g_cond, NULL);
+
+	/*
+	 * Background requests can use half of the connections (at least
+	 * one) : they are never started while foreground requests wait,
+	 * but once started, they can't be preempted.
+	 */
+	g_max_requests   = max_device_requests;
+	g_max_background = MAX (1, max_device_requests / 2);
+	g_initialized    = true;
+
+	Log_Printf (LOG_DEBUG, "IOSched : max_device_requests=%lu "
+		    "max_background=%lu",
+		    (unsigned long) g_max_requests,
+		    (unsigned long) g_max_background);
+	return 0;
+}
+
+
+/*****************************************************************************
+ * IOSched_Finish
+ *****************************************************************************/
+void
+IOSched_Finish (void)
+{
+	if (g_initialized) {
+		g_initialized = false;
+		talloc_free (g_devices);
+		g_devices = NULL;
+		ithread_cond_destroy (&g_cond);
+		ithread_mutex_destroy (&g_mutex);
+	}
+}
+
+
+/*****************************************************************************
+ * Acquire
+ *****************************************************************************/
+static int
+Acquire (const char* url, bool control, IOSched_Priority priority,
+	 const void* owner, bool wait, IOSched_Slot** slot)
+{
+	if (url == NULL || slot == NULL)
+		return -EINVAL; // ---------->
+	*slot = NULL;
+	if (! g_initialized || g_max_requests < 1)
+		return 0; // ---------->
+
+	int rc = 0;
+	ithread_mutex_lock (&g_mutex);
+
+	Device* const device = GetDevice (url, control);
+	IOSched_Slot* const s = (device ? talloc (device, IOSched_Slot)
+				 : NULL);
+	if (s == NULL) {
+		rc = -ENOMEM;
+		goto cleanup; // ---------->
+	}
+
+	// Queue the request, at the end of the list
+	Waiter waiter = {
+		.priority = priority, .owner = owner,
+		.granted = false, .next = NULL
+	};
+	Waiter** pw = &device->waiters;
+	while (*pw)
+		pw = &(*pw)->next;
+	*pw = &waiter;
+
+	Dispatch (device);
+	if (wait && ! waiter.granted) {
+		device->nb_waits++;
+		while (! waiter.granted)
+			ithread_cond_wait (&g_cond, &g_mutex);
+	}
+	RemoveWaiter (device, &waiter);
+
+	if (! waiter.granted) {
+		talloc_free (s);
+		rc = -EAGAIN;
+		goto cleanup; // ---------->
+	}
+	// The priority might have been raised while waiting
+	*s = (IOSched_Slot) {
+		.device = device, .priority = waiter.priority,
+		.owner = owner
+	};
+	(void) PtrArray_Append (device->slots, s);
+	if (waiter.priority == IO_SCHED_FOREGROUND)
+		device->nb_foreground++;
+	else
+		device->nb_background++;
+	*slot = s;
+
+cleanup:
+	ithread_mutex_unlock (&g_mutex);
+	return rc;
+}
+
+
+/*****************************************************************************
+ * IOSched_Acquire / IOSched_AcquireControl
+ *****************************************************************************/
+int
+IOSched_Acquire (const char* url, IOSched_Priority priority,
+		 const void* owner, bool wait, IOSched_Slot** slot)
+{
+	return Acquire (url, false, priority, owner, wait, slot);
+}
+
+int
+IOSched_AcquireControl (const char* url, IOSched_Priority priority,
+			const void* owner, bool wait, IOSched_Slot** slot)
+{
+	return Acquire (url, true, priority, owner, wait, slot);
+}
+
+
+/*****************************************************************************
+ * IOSched_Release
+ *****************************************************************************/
+void
+IOSched_Release (IOSched_Slot* slot)
+{
+	if (slot && g_initialized) {
+		ithread_mutex_lock (&g_mutex);
+		Device* const device = slot->device;
+		device->active--;
+		if (slot->priority == IO_SCHED_BACKGROUND)
+			device->active_background--;
+		size_t i;
+		for (i = 0; i < PtrArray_GetSize (device->slots); i++) {
+			if (PtrArray_GetElementAt (device->slots, i) == slot) {
+				(void) PtrArray_RemoveAtReorder 
+					(device->slots, i);
+				break; // ---------->
+			}
+		}
+		talloc_free (slot);
+		Dispatch (device);
+		ithread_mutex_unlock (&g_mutex);
+	}
+}
+
+
+/*****************************************************************************
+ * IOSched_Boost
+ *****************************************************************************/
+void
+IOSched_Boost (const void* owner)
+{
+	if (owner && g_initialized) {
+		ithread_mutex_lock (&g_mutex);
+		Device* d = NULL;
+		PTR_ARRAY_FOR_EACH_PTR (g_devices, d) {
+			bool boosted = false;
+			Waiter* w;
+			for (w = d->waiters; w; w = w->next) {
+				if (w->owner == owner && ! w->granted &&
+				    w->priority != IO_SCHED_FOREGROUND) {
+					w->priority = IO_SCHED_FOREGROUND;
+					boosted = true;
+				}
+			}
+			if (boosted) {
+				d->nb_boosts++;
+				Dispatch (d);
+			}
+		} PTR_ARRAY_FOR_EACH_PTR_END;
+		ithread_mutex_unlock (&g_mutex);
+	}
+}
+
+
+/*****************************************************************************
+ * IOSched_GetStatusString
+ *****************************************************************************/
+char*
+IOSched_GetStatusString (void* result_context, const char* spacer)
+{
+	char* p = talloc_strdup (result_context, "");
+	if (spacer == NULL)
+		spacer = "";
+	if (! g_initialized || g_max_requests < 1) {
+		tpr (&p, "%sRequests not limited\n", spacer);
+		return p; // ---------->
+	}
+
+	ithread_mutex_lock (&g_mutex);
+	tpr (&p, "%sMax requests per device = %lu (background = %lu)\n",
+	     spacer, (unsigned long) g_max_requests,
+	     (unsigned long) g_max_background);
+	tpr (&p, "%sMax control requests per device = %lu "
+	     "(background = %lu)\n", spacer, (unsigned long) g_max_control,
+	     (unsigned long) g_max_control_background);
+	Device* d = NULL;
+	PTR_ARRAY_FOR_EACH_PTR (g_devices, d) {
+		size_t nb_waiting = 0;
+		const Waiter* w;
+		for (w = d->waiters; w; w = w->next)
+			nb_waiting++;
+		tpr (&p, "%s+- %s%s\n", spacer, d->name, 
+		     (d->control ? " (control)" : ""));
+		tpr (&p, "%s     +- active     = %lu (background = %lu)\n",
+		     spacer, (unsigned long) d->active,
+		     (unsigned long) d->active_background);
+		tpr (&p, "%s     +- waiting    = %lu\n", spacer,
+		     (unsigned long) nb_waiting);
+		tpr (&p, "%s     +- foreground = %lu\n", spacer,
+		     d->nb_foreground);
+		tpr (&p, "%s     +- background = %lu (boosted = %lu)\n",
+		     spacer, d->nb_background, d->nb_boosts);
+		tpr (&p, "%s     +- waits      = %lu\n", spacer, d->nb_waits);
+	} PTR_ARRAY_FOR_EACH_PTR_END;
+	ithread_mutex_unlock (&g_mutex);
+	return p;
+}
+
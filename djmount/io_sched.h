@@ -0,0 +1,162 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * IOSched : scheduling of the requests sent to the UPnP devices.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef IO_SCHED_H_INCLUDED
+#define IO_SCHED_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/******************************************************************************
+ * @var IOSched_Priority
+ *
+ *	Requests which a user is waiting for (FUSE reads and lookups) are
+ *	FOREGROUND : they are always served before BACKGROUND requests
+ *	(prefetching, size probing ...), which moreover can only use
+ *	part of the connections to each device.
+ *	Control requests (SOAP actions, device descriptions) have their
+ *	own, smaller, budget per device (see IOSched_AcquireControl) :
+ *	they never wait behind file transfers, nor delay them.
+ *
+ *****************************************************************************/
+
+typedef enum _IOSched_Priority {
+	IO_SCHED_FOREGROUND = 0,
+	IO_SCHED_BACKGROUND = 1
+} IOSched_Priority;
+
+
+/******************************************************************************
+ * @var IOSched_Slot
+ *
+ *	This opaque type is the permission to have one request in
+ *	progress with a device, given by IOSched_Acquire and returned
+ *	with IOSched_Release.
+ *
+ *	Among the waiting requests of a same priority, the slots are
+ *	given first to the owners (e.g. opened files) having the fewest
+ *	requests in progress with the device, then in FIFO order.
+ *
+ *	All functions in this API are thread safe.
+ *
+ *****************************************************************************/
+
+typedef struct _IOSched_Slot IOSched_Slot;
+
+
+// Default maximum number of simultaneous requests to the same device
+#define IO_SCHED_DEFAULT_MAX_DEVICE_REQUESTS	4
+
+// Maximum number of simultaneous control requests to the same device
+// (1 of them background), unless requests are not limited
+#define IO_SCHED_MAX_CONTROL_REQUESTS		2
+
+
+/*****************************************************************************
+ * @brief 	Initialise the scheduler. Before this function is called,
+ *		requests are not limited.
+ *
+ * @param talloc_context	the talloc parent context
+ * @param max_device_requests	maximum number of simultaneous requests
+ *				to the same device (0 = unlimited)
+ * @return			0 if ok, or < 0 if error.
+ *****************************************************************************/
+int
+IOSched_Initialize (void* talloc_context, size_t max_device_requests);
+
+
+/*****************************************************************************
+ * @brief 	Release the resources of the scheduler. All slots shall
+ *		have been released.
+ *****************************************************************************/
+void
+IOSched_Finish (void);
+
+
+/*****************************************************************************
+ * @brief 	Wait until a new request can be sent to the device serving
+ *		an url (or fail immediately if 'wait' is false and none
+ *		can be sent now).
+ *
+ * @param url		the url of the request ("http://host:port/...")
+ * @param priority	the priority of the request
+ * @param owner		the object on behalf of which the request is sent
+ *			(for fairness and IOSched_Boost), or NULL
+ * @param wait		wait for a slot to become available
+ * @param slot		the slot to release after the request
+ *			(NULL if requests are not limited)
+ * @return		0 if ok, -EAGAIN if no slot available now,
+ *			or another value < 0 if error.
+ *****************************************************************************/
+int
+IOSched_Acquire (const char* url, IOSched_Priority priority,
+		 const void* owner, bool wait, IOSched_Slot** slot);
+
+
+/*****************************************************************************
+ * @brief 	Same as IOSched_Acquire, for a control request (SOAP 
+ *		action, description download ...) : these requests are 
+ *		limited separately from the file transfers, to
+ *		IO_SCHED_MAX_CONTROL_REQUESTS per device.
+ *****************************************************************************/
+int
+IOSched_AcquireControl (const char* url, IOSched_Priority priority,
+			const void* owner, bool wait, IOSched_Slot** slot);
+
+
+/*****************************************************************************
+ * @brief 	Release a slot given by IOSched_Acquire or 
+ *		IOSched_AcquireControl (NULL is allowed).
+ *****************************************************************************/
+void
+IOSched_Release (IOSched_Slot* slot);
+
+
+/*****************************************************************************
+ * @brief 	Raise to FOREGROUND the waiting requests of an owner,
+ *		because a user is now waiting for their result.
+ *
+ * @param owner		the owner given to IOSched_Acquire
+ *****************************************************************************/
+void
+IOSched_Boost (const void* owner);
+
+
+/*****************************************************************************
+ * @brief 	Returns a string describing the state of the scheduler.
+ * 	  	The returned string should be freed using "talloc_free".
+ *****************************************************************************/
+char*
+IOSched_GetStatusString (void* result_context, const char* spacer);
+
+
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
+
+#endif // IO_SCHED_H_INCLUDED
@@ -25,6 +25,12 @@
 #include "log.h"
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <upnp/ithread.h>
 #include <stdbool.h>
 
@@ -42,6 +48,45 @@ static Log_PrintFunction gPrintFun = NULL;
 static bool g_initialized = false;
 static ithread_mutex_t g_log_mutex;
 
+// Thread holding the mutex through Log_Lock (its messages are printed
+// synchronously, not to be mixed with the writer thread output)
+static ithread_t g_lock_owner;
+static int	 g_lock_depth = 0;
+
+
+/*
+ * Asynchronous output : the messages are formatted by the calling thread
+ * into a bounded ring (multi-producer, lock-free), and printed by a 
+ * single writer thread. When the ring is full, messages are dropped
+ * (and counted). Messages longer than a record are allocated apart.
+ *
+ * Each record has a sequence number : equal to its position when free,
+ * position + 1 when written, and position + LOG_RING_SIZE when printed 
+ * (i.e. free for the next round).
+ */
+#define LOG_RING_SIZE		512	// records, power of 2
+#define LOG_RECORD_SIZE		4096	// bytes, including final NUL
+
+typedef struct _Record {
+	volatile size_t	seq;
+	Log_Level	level;
+	char*		long_msg; // malloc'ed, if too long for msg
+	char		msg[LOG_RECORD_SIZE];
+} Record;
+
+// Static : producers might still use the ring while the writer stops
+static Record		g_ring [LOG_RING_SIZE];
+static volatile size_t	g_enqueue_pos = 0;
+static size_t		g_dequeue_pos = 0; // writer thread only
+static sem_t		g_ring_sem;
+static ithread_t	g_writer;
+static volatile bool	g_async = false;
+static volatile bool	g_stopping = false;
+
+// Statistics
+static volatile unsigned long g_nb_queued = 0;
+static volatile unsigned long g_nb_dropped = 0;
+
 
 /*
  * Current log level
@@ -105,6 +150,7 @@ Log_Initialize (Log_PrintFunction print_function )
 int
 Log_Finish ()
 {
+	Log_StopThread();
 	gPrintFun = NULL;
 	if (g_initialized) {
 		g_initialized = false;
@@ -114,6 +160,196 @@ Log_Finish ()
 }
 
 
+/*****************************************************************************
+ * AcquireRecord
+ *
+ * Reserve the next free record of the ring, or returns NULL if full.
+ *****************************************************************************/
+static Record*
+AcquireRecord (size_t* pos)
+{
+	size_t p = g_enqueue_pos;
+	for (;;) {
+		Record* const r = g_ring + (p % LOG_RING_SIZE);
+		const size_t seq = r->seq;
+		__sync_synchronize();
+		if (seq == p) {
+			if (__sync_bool_compare_and_swap (&g_enqueue_pos, 
+							  p, p + 1)) {
+				*pos = p;
+				return r; // ---------->
+			}
+		} else if ((ssize_t) (seq - p) < 0) {
+			// Not printed yet since the previous round
+			__sync_fetch_and_add (&g_nb_dropped, 1);
+			return NULL; // ---------->
+		}
+		p = g_enqueue_pos;
+	}
+}
+
+
+/*****************************************************************************
+ * PublishRecord
+ *****************************************************************************/
+static void
+PublishRecord (Record* r, size_t pos)
+{
+	__sync_synchronize();
+	r->seq = pos + 1;
+	__sync_fetch_and_add (&g_nb_queued, 1);
+	(void) sem_post (&g_ring_sem);
+}
+
+
+/*****************************************************************************
+ * IsSynchronous
+ *
+ * Messages are printed by the calling thread if the writer thread is 
+ * not running, or if the calling thread has locked the logger.
+ *****************************************************************************/
+static bool
+IsSynchronous (void)
+{
+	return (! g_async || 
+		(g_lock_depth > 0 && pthread_equal (g_lock_owner, 
+						    ithread_self())));
+}
+
+
+/*****************************************************************************
+ * PrintRecords
+ *
+ * Print the records written in the ring. If "wait" is false, stop at the
+ * first record still being formatted (its producer might be gone).
+ *****************************************************************************/
+static void
+PrintRecords (bool wait)
+{
+	while (g_dequeue_pos != g_enqueue_pos) {
+		Record* const r = g_ring + (g_dequeue_pos % LOG_RING_SIZE);
+		// The producer might still be formatting the message
+		while (r->seq != g_dequeue_pos + 1) {
+			if (! wait)
+				return; // ---------->
+			sched_yield();
+			__sync_synchronize();
+		}
+		ithread_mutex_lock (&g_log_mutex);
+		if (gPrintFun)
+			gPrintFun (r->level, r->long_msg ? r->long_msg 
+				   : r->msg);
+		ithread_mutex_unlock (&g_log_mutex);
+		free (r->long_msg);
+		r->long_msg = NULL;
+		__sync_synchronize();
+		r->seq = g_dequeue_pos + LOG_RING_SIZE;
+		g_dequeue_pos++;
+	}
+}
+
+
+/*****************************************************************************
+ * WriterLoop
+ *****************************************************************************/
+static void*
+WriterLoop (void* arg)
+{
+	unsigned long nb_reported = 0;
+	bool stop = false;
+	while (! stop) {
+		while (sem_wait (&g_ring_sem) != 0 && errno == EINTR)
+			continue;
+		stop = g_stopping;
+		__sync_synchronize();
+
+		PrintRecords (true);
+
+		const unsigned long nb_dropped = g_nb_dropped;
+		if (nb_dropped != nb_reported) {
+			char buf[80];
+			snprintf (buf, sizeof (buf), 
+				  "Log : %lu message(s) dropped (ring full)",
+				  nb_dropped - nb_reported);
+			nb_reported = nb_dropped;
+			ithread_mutex_lock (&g_log_mutex);
+			if (gPrintFun)
+				gPrintFun (LOG_WARNING, buf);
+			ithread_mutex_unlock (&g_log_mutex);
+		}
+	}
+	return NULL;
+}
+
+
+/*****************************************************************************
+ * Log_StartThread
+ *****************************************************************************/
+int
+Log_StartThread (void)
+{
+	if (! g_initialized || g_async)
+		return 0; // ---------->
+
+	size_t i;
+	for (i = 0; i < LOG_RING_SIZE; i++)
+		g_ring[i].seq = i;
+	g_enqueue_pos = g_dequeue_pos = 0;
+	g_stopping = false;
+	if (sem_init (&g_ring_sem, 0, 0) != 0)
+		return -errno; // ---------->
+	int rc = ithread_create (&g_writer, NULL, WriterLoop, NULL);
+	if (rc != 0) {
+		sem_destroy (&g_ring_sem);
+		return -rc; // ---------->
+	}
+	__sync_synchronize();
+	g_async = true;
+
+	// Print the pending messages if the program exits without 
+	// calling Log_Finish
+	static bool registered = false;
+	if (! registered) {
+		registered = true;
+		(void) atexit (Log_StopThread);
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * Log_StopThread
+ *****************************************************************************/
+void
+Log_StopThread (void)
+{
+	if (g_async) {
+		// New messages are now printed synchronously
+		g_async = false;
+		__sync_synchronize();
+		g_stopping = true;
+		(void) sem_post (&g_ring_sem);
+		ithread_join (g_writer, NULL);
+		sem_destroy (&g_ring_sem);
+		// Messages written while stopping
+		PrintRecords (false);
+	}
+}
+
+
+/*****************************************************************************
+ * Log_GetCounters
+ *****************************************************************************/
+void
+Log_GetCounters (unsigned long* nb_queued, unsigned long* nb_dropped)
+{
+	if (nb_queued)
+		*nb_queued = g_nb_queued;
+	if (nb_dropped)
+		*nb_dropped = g_nb_dropped;
+}
+
+
 /*****************************************************************************
  * Log_IsActivated
  *****************************************************************************/
@@ -131,9 +367,21 @@ int
 Log_Print (Log_Level level, const char* msg)
 {
 	if (Log_IsActivated (level) && msg) { 
-		ithread_mutex_lock (&g_log_mutex);
-		gPrintFun (level, msg);
-		ithread_mutex_unlock (&g_log_mutex);
+		if (IsSynchronous()) {
+			ithread_mutex_lock (&g_log_mutex);
+			gPrintFun (level, msg);
+			ithread_mutex_unlock (&g_log_mutex);
+		} else {
+			size_t pos;
+			Record* const r = AcquireRecord (&pos);
+			if (r) {
+				r->level = level;
+				if (strlen (msg) >= sizeof (r->msg))
+					r->long_msg = strdup (msg);
+				snprintf (r->msg, sizeof (r->msg), "%s", msg);
+				PublishRecord (r, pos);
+			}
+		}
 	}
 	return 0;
 }
@@ -147,17 +395,48 @@ Log_Printf (Log_Level level, const char* fmt, ... )
 {
 	if (Log_IsActivated (level) && fmt) { 
 		va_list ap;
-		char buf[4096] = "";
+		int rc;
 		
+		if (IsSynchronous()) {
+			char buf[LOG_RECORD_SIZE] = "";
+			char* long_buf = NULL;
+			va_start (ap, fmt);
+			rc = vsnprintf (buf, sizeof(buf), fmt, ap);
+			va_end (ap);
+			if (rc >= (int) sizeof (buf) && 
+			    (long_buf = malloc (rc + 1))) {
+				va_start (ap, fmt);
+				(void) vsnprintf (long_buf, rc + 1, fmt, ap);
+				va_end (ap);
+			}
+			if (rc >= 0) {
+				ithread_mutex_lock (&g_log_mutex);
+				gPrintFun (level, long_buf ? long_buf : buf);
+				ithread_mutex_unlock (&g_log_mutex);
+			}
+			free (long_buf);
+			return rc; // ---------->
+		}
+
+		// Format directly into the ring : no lock, no I/O
+		size_t pos;
+		Record* const r = AcquireRecord (&pos);
+		if (r == NULL)
+			return -1; // dropped ---------->
+		r->level = level;
 		va_start (ap, fmt);
-		int rc = vsnprintf (buf, sizeof(buf), fmt, ap);
+		rc = vsnprintf (r->msg, sizeof (r->msg), fmt, ap);
 		va_end (ap);
-		
-		if (rc >= 0) {
-			ithread_mutex_lock (&g_log_mutex);
-			gPrintFun (level, buf);
-			ithread_mutex_unlock (&g_log_mutex);
+		if (rc < 0) {
+			r->msg[0] = '\0';
+		} else if (rc >= (int) sizeof (r->msg) && 
+			   (r->long_msg = malloc (rc + 1))) {
+			// Else printed truncated
+			va_start (ap, fmt);
+			(void) vsnprintf (r->long_msg, rc + 1, fmt, ap);
+			va_end (ap);
 		}
+		PublishRecord (r, pos);
 		return rc;
 	}
 	return -1;
@@ -182,12 +461,16 @@ Log_SetMaxLevel (Log_Level max_level)
 int
 Log_Lock()
 {
-	return ithread_mutex_lock (&g_log_mutex);
+	int const rc = ithread_mutex_lock (&g_log_mutex);
+	if (rc == 0 && g_lock_depth++ == 0)
+		g_lock_owner = ithread_self();
+	return rc;
 }
 
 int
 Log_Unlock()
 {
+	g_lock_depth--;
 	return ithread_mutex_unlock (&g_log_mutex);
 }
 
@@ -124,6 +124,33 @@ int Log_Initialize (Log_PrintFunction print_function);
 int Log_Finish (void);
 
 
+/**
+ * @brief Starts the writer thread.
+ *	After this call, the messages are formatted by the calling thread
+ *	into a bounded lock-free ring, and printed by a dedicated thread : 
+ *	logging doesn't wait for the output anymore. When the ring is full,
+ *	messages are dropped (and their number logged later).
+ *	Must be called after the process is daemonized (if any).
+ *
+ * @return 0 if ok, or < 0 if error (messages stay synchronous).
+ */
+int Log_StartThread (void);
+
+
+/**
+ * @brief Prints the pending messages, and stops the writer thread.
+ *	Called by Log_Finish, and at exit.
+ */
+void Log_StopThread (void);
+
+
+/**
+ * @brief Returns the number of messages queued to the writer thread,
+ *	and dropped because the ring was full, since the program start.
+ */
+void Log_GetCounters (unsigned long* nb_queued, unsigned long* nb_dropped);
+
+
 /**
  * @brief Log a message
  *	Log a message, if allowed by current log level (see Log_SetMaxLevel).
@@ -176,7 +203,8 @@ bool Log_IsActivated (Log_Level level);
  *	NOTE : a lock is automatically performed for each individual 
  *	"Log_Print", therefore explicit "lock" and "unlock" are only 
  *	necessary when a thread wants to display atomically a large amount 
- *	of text in several "Log_Print" calls.
+ *	of text in several "Log_Print" calls. While the logger is locked,
+ *	the messages of the owner thread are printed synchronously.
  */
 
 int Log_Lock (void);
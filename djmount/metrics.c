@@ -0,0 +1,391 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * Metrics : counters and latency histograms, in Prometheus format.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "metrics.h"
+#include "talloc_util.h"
+#include "string_util.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include <upnp/ithread.h>
+
+
+/*
+ * Maximum number of series : a few histograms per device and action, 
+ * for many devices. The values of the series are allocated as they
+ * are registered.
+ */
+#define METRICS_MAX_SERIES	1024
+
+/*
+ * Histogram buckets : durations below 4 us have their own bucket, then
+ * each power of 2 [2^k, 2^(k+1)[ is divided into 4 buckets, up to 
+ * 2^MAX_BITS us. The last bucket counts the larger durations.
+ */
+#define SUB_BITS	2
+#define NB_SUB		(1 << SUB_BITS)
+#define MAX_BITS	27
+#define NB_BUCKETS	((MAX_BITS - SUB_BITS + 1) * NB_SUB + 1)
+
+// Cells of a histogram : buckets, then sum of durations
+#define HISTOGRAM_CELLS	(NB_BUCKETS + 1)
+
+
+typedef struct _Series {
+	Metrics_Type	type;
+	char*		name;
+	char*		help;
+	char*		labels;
+	size_t		first_cell;
+} Series;
+
+/*
+ * Values written by one thread. The cells are only (re)allocated with
+ * g_mutex locked, when the thread first uses a series registered after
+ * the previous allocation.
+ */
+typedef struct _Shard {
+	struct _Shard*	next;
+	size_t		nb_cells;
+	uint64_t*	cells;
+} Shard;
+
+
+/*
+ * The registry is allocated with malloc, not talloc : the series live 
+ * as long as the program, and are not reported as talloc leaks.
+ */
+static ithread_mutex_t	g_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Series		g_series [METRICS_MAX_SERIES];
+static size_t		g_nb_series = 0;
+static size_t		g_nb_cells = 0;
+
+static Shard*		g_shards = NULL;   // threads alive
+static uint64_t*		g_retired = NULL; // threads ended, g_nb_cells
+
+static pthread_once_t	g_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t	g_key;
+static __thread Shard*	t_shard = NULL;
+
+
+/*****************************************************************************
+ * DestroyShard
+ *
+ * Thread exit : keep the values of the thread.
+ *****************************************************************************/
+static void
+DestroyShard (void* arg)
+{
+	Shard* const shard = (Shard*) arg;
+	ithread_mutex_lock (&g_mutex);
+	size_t i;
+	for (i = 0; i < shard->nb_cells; i++)
+		g_retired[i] += shard->cells[i];
+	Shard** p;
+	for (p = &g_shards; *p; p = &(*p)->next) {
+		if (*p == shard) {
+			*p = shard->next;
+			break; // ---------->
+		}
+	}
+	ithread_mutex_unlock (&g_mutex);
+	free (shard->cells);
+	free (shard);
+}
+
+static void
+CreateKey (void)
+{
+	(void) pthread_key_create (&g_key, DestroyShard);
+}
+
+
+/*****************************************************************************
+ * GrowShard
+ *
+ * Make room for all the series registered so far.
+ *****************************************************************************/
+static bool
+GrowShard (Shard* shard)
+{
+	ithread_mutex_lock (&g_mutex);
+	const size_t nb_cells = g_nb_cells;
+	uint64_t* const cells = realloc (shard->cells, 
+					 sizeof (uint64_t) * nb_cells);
+	if (cells) {
+		memset (cells + shard->nb_cells, 0, 
+			sizeof (uint64_t) * (nb_cells - shard->nb_cells));
+		shard->cells = cells;
+		shard->nb_cells = nb_cells;
+	}
+	ithread_mutex_unlock (&g_mutex);
+	return (cells != NULL);
+}
+
+
+/*****************************************************************************
+ * GetShard
+ *
+ * Returns the shard of the calling thread, with at least nb_cells.
+ *****************************************************************************/
+static Shard*
+GetShard (size_t nb_cells)
+{
+	if (t_shard == NULL) {
+		Shard* const shard = calloc (1, sizeof (Shard));
+		if (shard == NULL)
+			return NULL; // ---------->
+		(void) pthread_once (&g_key_once, CreateKey);
+		(void) pthread_setspecific (g_key, shard);
+		ithread_mutex_lock (&g_mutex);
+		shard->next = g_shards;
+		g_shards = shard;
+		ithread_mutex_unlock (&g_mutex);
+		t_shard = shard;
+	}
+	if (t_shard->nb_cells < nb_cells && ! GrowShard (t_shard))
+		return NULL; // ---------->
+	return t_shard;
+}
+
+
+/*****************************************************************************
+ * BucketIndex / BucketMax
+ *****************************************************************************/
+static size_t
+BucketIndex (uint64_t usec)
+{
+	if (usec < NB_SUB)
+		return usec; // ---------->
+	const int msb = 63 - __builtin_clzll (usec);
+	if (msb >= MAX_BITS)
+		return NB_BUCKETS - 1; // ---------->
+	const size_t sub = (usec >> (msb - SUB_BITS)) & (NB_SUB - 1);
+	return (msb - SUB_BITS + 1) * NB_SUB + sub;
+}
+
+// Largest duration (in us) of a bucket
+static uint64_t
+BucketMax (size_t i)
+{
+	if (i < NB_SUB)
+		return i; // ---------->
+	const int msb = i / NB_SUB + SUB_BITS - 1;
+	const uint64_t sub = i % NB_SUB;
+	return ((NB_SUB + sub + 1) << (msb - SUB_BITS)) - 1;
+}
+
+
+/*****************************************************************************
+ * Metrics_Register
+ *****************************************************************************/
+Metrics_Id
+Metrics_Register (Metrics_Type type, const char* name, const char* help,
+		  const char* labels)
+{
+	if (name == NULL)
+		return METRICS_NONE; // ---------->
+	if (labels == NULL)
+		labels = "";
+
+	Metrics_Id id = METRICS_NONE;
+	ithread_mutex_lock (&g_mutex);
+	size_t i;
+	for (i = 0; i < g_nb_series; i++) {
+		const Series* const s = g_series + i;
+		if (strcmp (s->name, name) == 0 && 
+		    strcmp (s->labels, labels) == 0) {
+			id = i;
+			goto cleanup; // ---------->
+		}
+	}
+	const size_t nb_cells = (type == METRICS_HISTOGRAM ? 
+				 HISTOGRAM_CELLS : 1);
+	if (g_nb_series >= METRICS_MAX_SERIES)
+		goto cleanup; // ---------->
+	uint64_t* const retired = realloc (g_retired, sizeof (uint64_t) * 
+					   (g_nb_cells + nb_cells));
+	if (retired == NULL)
+		goto cleanup; // ---------->
+	memset (retired + g_nb_cells, 0, sizeof (uint64_t) * nb_cells);
+	g_retired = retired;
+	Series* const s = g_series + g_nb_series;
+	*s = (Series) {
+		.type	    = type,
+		.name	    = strdup (name),
+		.help	    = strdup (help ? help : ""),
+		.labels	    = strdup (labels),
+		.first_cell = g_nb_cells
+	};
+	if (s->name == NULL || s->help == NULL || s->labels == NULL) {
+		free (s->name);
+		free (s->help);
+		free (s->labels);
+		goto cleanup; // ---------->
+	}
+	id = g_nb_series++;
+	g_nb_cells += nb_cells;
+
+cleanup:
+	ithread_mutex_unlock (&g_mutex);
+	return id;
+}
+
+
+/*****************************************************************************
+ * Metrics_Add
+ *****************************************************************************/
+void
+Metrics_Add (Metrics_Id id, uint64_t n)
+{
+	if (id >= 0) {
+		const size_t cell = g_series[id].first_cell;
+		Shard* const shard = GetShard (cell + 1);
+		if (shard)
+			shard->cells [cell] += n;
+	}
+}
+
+
+/*****************************************************************************
+ * Metrics_Observe
+ *****************************************************************************/
+void
+Metrics_Observe (Metrics_Id id, uint64_t usec)
+{
+	if (id >= 0) {
+		const size_t first = g_series[id].first_cell;
+		Shard* const shard = GetShard (first + HISTOGRAM_CELLS);
+		if (shard) {
+			uint64_t* const cells = shard->cells + first;
+			cells [BucketIndex (usec)]++;
+			cells [NB_BUCKETS] += usec;
+		}
+	}
+}
+
+
+/*****************************************************************************
+ * Metrics_Now
+ *****************************************************************************/
+uint64_t
+Metrics_Now (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/*****************************************************************************
+ * PrintSeries
+ *****************************************************************************/
+static void
+PrintSeries (FILE* file, const Series* s, const uint64_t* cells)
+{
+	const char* const sep = (*s->labels ? "," : "");
+	if (s->type == METRICS_COUNTER) {
+		fprintf (file, "%s%s%s%s %" PRIu64 "\n", s->name, 
+			 (*s->labels ? "{" : ""), s->labels, 
+			 (*s->labels ? "}" : ""), cells[0]);
+		return; // ---------->
+	}
+	uint64_t count = 0;
+	size_t i;
+	for (i = 0; i < NB_BUCKETS - 1; i++) {
+		count += cells[i];
+		fprintf (file, "%s_bucket{%s%sle=\"%.6f\"} %" PRIu64 "\n", 
+			 s->name, s->labels, sep, BucketMax (i) / 1e6, count);
+	}
+	count += cells [NB_BUCKETS - 1];
+	fprintf (file, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", 
+		 s->name, s->labels, sep, count);
+	fprintf (file, "%s_sum{%s} %.6f\n", s->name, s->labels, 
+		 cells [NB_BUCKETS] / 1e6);
+	fprintf (file, "%s_count{%s} %" PRIu64 "\n", s->name, s->labels, 
+		 count);
+}
+
+
+/*****************************************************************************
+ * Metrics_GetPrometheus
+ *****************************************************************************/
+char*
+Metrics_GetPrometheus (void* result_context)
+{
+	StringStream* const ss = StringStream_Create (result_context);
+	if (ss == NULL)
+		return NULL; // ---------->
+	FILE* const file = StringStream_GetFile (ss);
+
+	ithread_mutex_lock (&g_mutex);
+
+	// Sum the values of all the threads
+	uint64_t* const total = malloc (sizeof (uint64_t) * 
+					(g_nb_cells ? g_nb_cells : 1));
+	if (total) {
+		if (g_retired)
+			memcpy (total, g_retired, 
+				sizeof (uint64_t) * g_nb_cells);
+		const Shard* shard;
+		for (shard = g_shards; shard; shard = shard->next) {
+			size_t i;
+			for (i = 0; i < shard->nb_cells; i++)
+				total[i] += shard->cells[i];
+		}
+		// Series of the same metric are grouped under one header
+		size_t i, j;
+		for (i = 0; i < g_nb_series; i++) {
+			const Series* const s = g_series + i;
+			for (j = 0; j < i; j++)
+				if (strcmp (g_series[j].name, s->name) == 0)
+					break; // ---------->
+			if (j < i)
+				continue; // already printed ---------->
+			fprintf (file, "# HELP %s %s\n# TYPE %s %s\n", 
+				 s->name, s->help, s->name, 
+				 (s->type == METRICS_COUNTER ? "counter" 
+				  : "histogram"));
+			for (j = i; j < g_nb_series; j++) {
+				const Series* const sj = g_series + j;
+				if (strcmp (sj->name, s->name) == 0)
+					PrintSeries (file, sj, total + 
+						     sj->first_cell);
+			}
+		}
+		free (total);
+	}
+	ithread_mutex_unlock (&g_mutex);
+
+	char* const text = StringStream_GetSnapshot (ss, result_context, NULL);
+	talloc_free (ss);
+	return text;
+}
+
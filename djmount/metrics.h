@@ -0,0 +1,126 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * Metrics : counters and latency histograms, in Prometheus format.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/******************************************************************************
+ * @var Metrics_Id
+ *
+ *	Identifier of a series, i.e. a metric name with a set of labels
+ *	(e.g. djmount_fuse_op_seconds{op="getattr"}).
+ *
+ *	Each thread updates its own copy of the values, without lock
+ *	nor atomic operation : the copies are only summed when exported.
+ *	Histograms are log-linear (as HDR histograms) : 4 buckets per
+ *	power of 2 microseconds, i.e. a relative error below 25%, 
+ *	from 1 microsecond up to 2^27 microseconds (about 2 minutes).
+ *
+ *	Registration takes a lock : call sites with fixed labels should
+ *	register once (see METRICS_STATIC_ID). All functions in this API
+ *	are thread safe.
+ *
+ *****************************************************************************/
+
+typedef int Metrics_Id;
+
+#define METRICS_NONE	((Metrics_Id) -1)
+
+typedef enum _Metrics_Type {
+	METRICS_COUNTER,
+	METRICS_HISTOGRAM
+} Metrics_Type;
+
+
+/*****************************************************************************
+ * @brief 	Returns the series of a metric with some labels, creating
+ *		it if necessary.
+ *
+ * @param type		counter, or histogram of durations
+ * @param name		the metric name (the unit of histograms is seconds)
+ * @param help		description of the metric
+ * @param labels	labels, in Prometheus syntax (e.g. 'op="read"'),
+ *			or NULL
+ * @return		the series, or METRICS_NONE if too many series.
+ *****************************************************************************/
+Metrics_Id
+Metrics_Register (Metrics_Type type, const char* name, const char* help,
+		  const char* labels);
+
+
+/*****************************************************************************
+ * @brief 	Register a series once, into a static variable.
+ *****************************************************************************/
+#define METRICS_STATIC_ID(VAR,TYPE,NAME,HELP,LABELS)			\
+	static Metrics_Id VAR = METRICS_NONE;				\
+	if (VAR == METRICS_NONE)					\
+		VAR = Metrics_Register (TYPE, NAME, HELP, LABELS)
+
+
+/*****************************************************************************
+ * @brief 	Increments a counter (METRICS_NONE is allowed).
+ *****************************************************************************/
+void
+Metrics_Add (Metrics_Id id, uint64_t n);
+
+
+/*****************************************************************************
+ * @brief 	Records a duration into a histogram (METRICS_NONE is allowed).
+ *
+ * @param id		the series
+ * @param usec		the duration, in microseconds
+ *****************************************************************************/
+void
+Metrics_Observe (Metrics_Id id, uint64_t usec);
+
+
+/*****************************************************************************
+ * @brief 	Returns the current time in microseconds, to measure 
+ *		durations.
+ *****************************************************************************/
+uint64_t
+Metrics_Now (void);
+
+
+/*****************************************************************************
+ * @brief 	Returns all the series, in Prometheus text format.
+ * 	  	The returned string should be freed using "talloc_free".
+ *****************************************************************************/
+char*
+Metrics_GetPrometheus (void* result_context);
+
+
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
+
+#endif // METRICS_H_INCLUDED
+
@@ -0,0 +1,246 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * NodeTable : inode numbers of the files known by the kernel.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "node_table.h"
+#include "talloc_util.h"
+#include "string_util.h"
+#include "log.h"
+#include "minmax.h"
+#include "hash.h"	// import gnulib hash
+
+#include <string.h>
+#include <inttypes.h>
+#include <upnp/ithread.h>
+
+
+// Initial number of entries in the hash tables (they grow if necessary)
+#define INITIAL_TABLE_SIZE	1024
+
+
+typedef struct _Node {
+	NodeTable_Ino	ino;
+	char*		path;
+	uint64_t	nlookup;
+} Node;
+
+struct _NodeTable {
+	ithread_mutex_t	mutex;
+	Hash_table*	by_ino;
+	Hash_table*	by_path;
+	NodeTable_Ino	next_ino;
+	Node*		root;
+};
+
+
+/******************************************************************************
+ * Hash functions
+ *****************************************************************************/
+static size_t
+ino_hasher (const void* entry, size_t table_size)
+{
+	return ((const Node*) entry)->ino % table_size;
+}
+
+static bool
+ino_comparator (const void* e1, const void* e2)
+{
+	return (((const Node*) e1)->ino == ((const Node*) e2)->ino);
+}
+
+static size_t
+path_hasher (const void* entry, size_t table_size)
+{
+	return String_Hash (((const Node*) entry)->path) % table_size;
+}
+
+static bool
+path_comparator (const void* e1, const void* e2)
+{
+	return (strcmp (((const Node*) e1)->path,
+			((const Node*) e2)->path) == 0);
+}
+
+
+/*****************************************************************************
+ * DestroyTable
+ *****************************************************************************/
+static int
+DestroyTable (NodeTable* const table)
+{
+	// Nodes are talloc'ed children of the table : nothing else to free
+	if (table->by_ino)
+		hash_free (table->by_ino);
+	if (table->by_path)
+		hash_free (table->by_path);
+	ithread_mutex_destroy (&table->mutex);
+	return 0; // ok -> deallocate memory
+}
+
+
+/*****************************************************************************
+ * NodeTable_Create
+ *****************************************************************************/
+NodeTable*
+NodeTable_Create (void* talloc_context)
+{
+	NodeTable* const table = talloc (talloc_context, NodeTable);
+	if (table == NULL)
+		return NULL; // ---------->
+	*table = (NodeTable) {
+		.by_ino   = hash_initialize (INITIAL_TABLE_SIZE, NULL,
+					     ino_hasher, ino_comparator, NULL),
+		.by_path  = hash_initialize (INITIAL_TABLE_SIZE, NULL,
+					     path_hasher, path_comparator,
+					     NULL),
+		.next_ino = NODE_TABLE_ROOT_INO + 1,
+		.root	  = talloc (table, Node),
+	};
+	ithread_mutex_init (&table->mutex, NULL);
+	talloc_set_destructor (table, DestroyTable);
+	if (table->by_ino == NULL || table->by_path == NULL ||
+	    table->root == NULL) {
+		talloc_free (table);
+		return NULL; // ---------->
+	}
+	*table->root = (Node) {
+		.ino = NODE_TABLE_ROOT_INO,
+		.path = talloc_strdup (table->root, "/"),
+		.nlookup = 1
+	};
+	if (hash_insert (table->by_ino, table->root) == NULL ||
+	    hash_insert (table->by_path, table->root) == NULL) {
+		talloc_free (table);
+		return NULL; // ---------->
+	}
+	return table;
+}
+
+
+/*****************************************************************************
+ * NodeTable_Lookup
+ *****************************************************************************/
+NodeTable_Ino
+NodeTable_Lookup (NodeTable* table, const char* path)
+{
+	if (table == NULL || path == NULL)
+		return 0; // ---------->
+
+	NodeTable_Ino ino = 0;
+	ithread_mutex_lock (&table->mutex);
+
+	const Node searched = { .path = (char*) path };
+	Node* node = hash_lookup (table->by_path, &searched);
+	if (node == NULL) {
+		node = talloc (table, Node);
+		if (node == NULL)
+			goto cleanup; // ---------->
+		*node = (Node) {
+			.ino = table->next_ino++,
+			.path = talloc_strdup (node, path),
+			.nlookup = 0
+		};
+		if (node->path == NULL ||
+		    hash_insert (table->by_ino, node) == NULL) {
+			talloc_free (node);
+			goto cleanup; // ---------->
+		}
+		if (hash_insert (table->by_path, node) == NULL) {
+			(void) hash_delete (table->by_ino, node);
+			talloc_free (node);
+			goto cleanup; // ---------->
+		}
+	}
+	if (node != table->root)
+		node->nlookup++;
+	ino = node->ino;
+
+cleanup:
+	ithread_mutex_unlock (&table->mutex);
+	return ino;
+}
+
+
+/*****************************************************************************
+ * NodeTable_Forget
+ *****************************************************************************/
+void
+NodeTable_Forget (NodeTable* table, NodeTable_Ino ino, uint64_t nlookup)
+{
+	if (table == NULL || ino == NODE_TABLE_ROOT_INO)
+		return; // ---------->
+
+	ithread_mutex_lock (&table->mutex);
+	const Node searched = { .ino = ino };
+	Node* const node = hash_lookup (table->by_ino, &searched);
+	if (node) {
+		node->nlookup -= MIN (nlookup, node->nlookup);
+		if (node->nlookup == 0) {
+			(void) hash_delete (table->by_ino, node);
+			(void) hash_delete (table->by_path, node);
+			talloc_free (node);
+		}
+	} else {
+		Log_Printf (LOG_WARNING, "NodeTable : forget unknown node %"
+			    PRIu64, ino);
+	}
+	ithread_mutex_unlock (&table->mutex);
+}
+
+
+/*****************************************************************************
+ * NodeTable_GetPath
+ *****************************************************************************/
+char*
+NodeTable_GetPath (NodeTable* table, void* result_context,
+		   NodeTable_Ino ino)
+{
+	if (table == NULL)
+		return NULL; // ---------->
+
+	ithread_mutex_lock (&table->mutex);
+	const Node searched = { .ino = ino };
+	const Node* const node = hash_lookup (table->by_ino, &searched);
+	char* const path = (node ? talloc_strdup (result_context, node->path)
+			    : NULL);
+	ithread_mutex_unlock (&table->mutex);
+	return path;
+}
+
+
+/*****************************************************************************
+ * NodeTable_GetNrNodes
+ *****************************************************************************/
+size_t
+NodeTable_GetNrNodes (NodeTable* table)
+{
+	size_t n = 0;
+	if (table) {
+		ithread_mutex_lock (&table->mutex);
+		n = hash_get_n_entries (table->by_ino);
+		ithread_mutex_unlock (&table->mutex);
+	}
+	return n;
+}
+
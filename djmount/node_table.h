@@ -0,0 +1,116 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * NodeTable : inode numbers of the files known by the kernel.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef NODE_TABLE_H_INCLUDED
+#define NODE_TABLE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/******************************************************************************
+ * @var NodeTable
+ *
+ *	This opaque type maps the inode numbers given to the kernel (FUSE
+ *	low-level API) to the paths of the files in the virtual file
+ *	system, with the lookup count of each node : a node is kept
+ *	(with the same inode number) until the kernel forgets it.
+ *	The root directory "/" has inode number NODE_TABLE_ROOT_INO,
+ *	and is never forgotten.
+ *
+ *	All functions in this API are thread safe (except destruction).
+ *	The table is destroyed with "talloc_free".
+ *
+ *****************************************************************************/
+
+typedef struct _NodeTable NodeTable;
+
+typedef uint64_t NodeTable_Ino;
+
+#define NODE_TABLE_ROOT_INO	((NodeTable_Ino) 1)
+
+
+/*****************************************************************************
+ * @brief 	Creates a new table, containing the root directory only.
+ *
+ * @param talloc_context	the talloc parent context
+ * @return			the new table, or NULL if error.
+ *****************************************************************************/
+NodeTable*
+NodeTable_Create (void* talloc_context);
+
+
+/*****************************************************************************
+ * @brief 	Returns the node of a path (creating it if necessary),
+ *		and increments its lookup count.
+ *
+ * @param table		the NodeTable object
+ * @param path		absolute path of the file
+ * @return		the inode number, or 0 if error.
+ *****************************************************************************/
+NodeTable_Ino
+NodeTable_Lookup (NodeTable* table, const char* path);
+
+
+/*****************************************************************************
+ * @brief 	Decrements the lookup count of a node, and removes it
+ *		from the table when it reaches 0.
+ *
+ * @param table		the NodeTable object
+ * @param ino		the inode number
+ * @param nlookup	number of lookups to forget
+ *****************************************************************************/
+void
+NodeTable_Forget (NodeTable* table, NodeTable_Ino ino, uint64_t nlookup);
+
+
+/*****************************************************************************
+ * @brief 	Returns the path of a node.
+ *		The returned string should be freed using "talloc_free".
+ *
+ * @param table		the NodeTable object
+ * @param result_context the talloc parent context of the result
+ * @param ino		the inode number
+ * @return		the path, or NULL if the node is unknown.
+ *****************************************************************************/
+char*
+NodeTable_GetPath (NodeTable* table, void* result_context,
+		   NodeTable_Ino ino);
+
+
+/*****************************************************************************
+ * @brief 	Returns the number of nodes in the table.
+ *****************************************************************************/
+size_t
+NodeTable_GetNrNodes (NodeTable* table);
+
+
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
+
+#endif // NODE_TABLE_H_INCLUDED
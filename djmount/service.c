@@ -33,13 +33,25 @@
 #include "xml_util.h"
 #include "upnp_util.h"
 #include "talloc_util.h"
+#include "io_sched.h"
+#include "soap_template.h"
+#include "trace.h"
+#include "metrics.h"
 
+#include <pthread.h>
 #include <upnp/upnp.h>
 #include <upnp/upnptools.h>
+#if HAVE_UPNPOPENHTTPCONNECTION
+#	include <upnp/UpnpString.h>
+#endif
 
 #include "service_p.h"
 
 
+// Initial number of entries in the variable index (it grows if necessary)
+#define INITIAL_VARIABLES_SIZE	16
+
+
 /** Default timeout to request during subscriptions */
 #define SUBSCRIBE_DEFAULT_TIMEOUT 	1801
 
@@ -48,6 +60,37 @@
 #define MAX_VA_PARAMS	64
 
 
+// Timeout of the SOAP requests sent without libupnp's DOM, in seconds
+#define SOAP_TIMEOUT	30
+
+// Maximum size of the answers to these requests, in bytes
+#define SOAP_MAX_SIZE	(4 * 1024 * 1024)
+
+
+#if HAVE_UPNPOPENHTTPCONNECTION
+// Protects the templates of the SOAP requests of all the services
+static ithread_mutex_t	g_soap_mutex;
+
+// Buffer of each thread, for the text of the SOAP requests
+typedef struct _SoapBuffer {
+	char*	data;
+	size_t	size;
+} SoapBuffer;
+
+static pthread_key_t	g_soap_key;
+static bool		g_soap_key_created = false;
+#endif
+
+// Metric of the synchronous calls of an action, on one service
+typedef struct _ActionMetric {
+	char*		action;
+	Metrics_Id	id;
+} ActionMetric;
+
+// Protects the action metrics of all the services
+static ithread_mutex_t	g_metrics_mutex;
+
+
 /******************************************************************************
  * Service_SubscribeEventURL
  *****************************************************************************/
@@ -132,11 +175,13 @@ finalize (Object* obj)
 		// If we have a valid control SID, then unsubscribe 
 		(void) Service_UnsubscribeEventURL (serv);
     
-		/* Delete variable list.
+		/* Delete variable index.
 		 * Note that items are not destroyed : they are talloc'ed and
 		 * automatically deallocated when parent Service is detroyed.
 		 */
-		ListDestroy (&serv->variables, /*freeItem=>*/ 0);
+		if (serv->variables)
+			hash_free (serv->variables);
+		serv->variables = NULL;
 		
 		// The "talloc'ed" strings will be deleted automatically : 
 		// nothing to do 
@@ -166,20 +211,25 @@ Service_SetSid (Service* serv, Upnp_SID sid)
 /*****************************************************************************
  * GetVariable
  *****************************************************************************/
-static ListNode*
+static size_t
+variable_hasher (const void* entry, size_t table_size)
+{
+	return String_Hash (((const StringPair*) entry)->name) % table_size;
+}
+
+static bool
+variable_comparator (const void* e1, const void* e2)
+{
+	return (strcmp (((const StringPair*) e1)->name,
+			((const StringPair*) e2)->name) == 0);
+}
+
+static StringPair*
 GetVariable (const Service* serv, const char* name)
 {
-	if (serv && name) {
-		ListNode* node;
-		LinkedList* const variables = 
-			discard_const_p (LinkedList, &serv->variables);
-		for (node = ListHead (variables);
-		     node != NULL;
-		     node = ListNext (variables, node)) {
-			StringPair* const var = node->item;
-			if (var && var->name && strcmp (var->name, name) == 0) 
-				return node; // ---------->
-		}
+	if (serv && name && serv->variables) {
+		const StringPair searched = { .name = (char*) name };
+		return hash_lookup (serv->variables, &searched); // ---------->
 	}
 	return NULL;
 }
@@ -236,11 +286,9 @@ Service_UpdateState (Service* serv, IXML_Document* changedVariables)
 	      Log_Printf (LOG_DEBUG, "Variable Update '%s' = '%s'",
 			  NN(name), NN(value));
 	      
-	      ListNode* node = GetVariable (serv, name);
-	      StringPair* var;
-	      if (node) {
+	      StringPair* var = GetVariable (serv, name);
+	      if (var) {
 		// Update existing node
-		var = node->item;
 		talloc_free (var->value);
 		var->value = talloc_strdup (var, value);
 	      } else {
@@ -248,7 +296,14 @@ Service_UpdateState (Service* serv, IXML_Document* changedVariables)
 		var = talloc (serv, StringPair);
 		var->name  = talloc_strdup (var, name);
 		var->value = talloc_strdup (var, value);
-		ListAddTail (&serv->variables, var);
+		if (serv->variables == NULL ||
+		    hash_insert (serv->variables, var) == NULL ||
+		    ! PtrArray_Append (serv->variable_list, var)) {
+		  if (serv->variables)
+		    (void) hash_delete (serv->variables, var);
+		  talloc_free (var);
+		  continue; // ---------->
+		}
 	      }
 	      if (OBJECT_METHOD (serv,update_variable))
 		OBJECT_METHOD (serv, update_variable) (serv, 
@@ -300,6 +355,139 @@ MakeAction (const char* actionName, const char* serviceType,
   return res;
 }
 
+#if HAVE_UPNPOPENHTTPCONNECTION
+
+/*****************************************************************************
+ * GetTemplate
+ *
+ *	Returns the template of an action (created at the first use).
+ *****************************************************************************/
+static const SoapTemplate*
+GetTemplate (Service* serv, const char* actionName,
+	     int nb_params, const StringPair* params)
+{
+	const SoapTemplate* tmpl = NULL;
+	ithread_mutex_lock (&g_soap_mutex);
+	SoapTemplate* t = NULL;
+	PTR_ARRAY_FOR_EACH_PTR (serv->soap_templates, t) {
+		if (SoapTemplate_Matches (t, actionName, nb_params, params)) {
+			tmpl = t;
+			break; // ---------->
+		}
+	} PTR_ARRAY_FOR_EACH_PTR_END;
+	if (tmpl == NULL) {
+		t = SoapTemplate_Create (serv, serv->serviceType, actionName,
+					 nb_params, params);
+		if (t && PtrArray_Append (serv->soap_templates, t)) {
+			tmpl = t;
+		} else {
+			talloc_free (t);
+		}
+	}
+	ithread_mutex_unlock (&g_soap_mutex);
+	return tmpl;
+}
+
+
+/*****************************************************************************
+ * FreeSoapBuffer
+ *****************************************************************************/
+static void
+FreeSoapBuffer (void* p)
+{
+	SoapBuffer* const b = (SoapBuffer*) p;
+	if (b) {
+		talloc_free (b->data);
+		talloc_free (b);
+	}
+}
+
+
+/*****************************************************************************
+ * SendSoapRequest
+ *
+ *	Send an action made from its template, in a buffer reused by the
+ *	thread. The answer is the DOM document of the whole response 
+ *	(the s:Envelope, where UpnpSendAction only returns its 
+ *	u:<action>Response element : callers look the output arguments 
+ *	up by name, at any depth), and a SOAP error code (> 0) if the 
+ *	device returned a fault.
+ *****************************************************************************/
+static int
+SendSoapRequest (const Service* serv, const SoapTemplate* tmpl,
+		 const StringPair* params, IXML_Document** response)
+{
+	SoapBuffer* b = pthread_getspecific (g_soap_key);
+	if (b == NULL) {
+		b = talloc_zero (NULL, SoapBuffer);
+		if (b == NULL || pthread_setspecific (g_soap_key, b) != 0) {
+			talloc_free (b);
+			return UPNP_E_OUTOF_MEMORY; // ---------->
+		}
+	}
+	size_t len = SoapTemplate_Fill (tmpl, params, &b->data, &b->size);
+	if (len == 0)
+		return UPNP_E_OUTOF_MEMORY; // ---------->
+
+	void* handle = NULL;
+	char* text = NULL;
+	int httpStatus = 0;
+	UpnpString* const headers = UpnpString_new ();
+	int rc = UPNP_E_OUTOF_MEMORY;
+	if (headers == NULL ||
+	    ! UpnpString_set_String (headers, 
+				     SoapTemplate_GetHeaders (tmpl)))
+		goto cleanup; // ---------->
+	rc = UpnpOpenHttpConnection (serv->controlURL, &handle, 
+				     SOAP_TIMEOUT);
+	if (rc != UPNP_E_SUCCESS)
+		goto cleanup; // ---------->
+	rc = UpnpMakeHttpRequest (UPNP_HTTPMETHOD_POST, serv->controlURL, 
+				  handle, headers, 
+				  "text/xml; charset=\"utf-8\"", (int) len,
+				  SOAP_TIMEOUT);
+	if (rc == UPNP_E_SUCCESS)
+		rc = UpnpWriteHttpRequest (handle, b->data, &len, 
+					   SOAP_TIMEOUT);
+	if (rc == UPNP_E_SUCCESS)
+		rc = UpnpEndHttpRequest (handle, SOAP_TIMEOUT);
+	int contentLength = 0;
+	char* contentType = NULL;
+	if (rc == UPNP_E_SUCCESS)
+		rc = UpnpGetHttpResponse (handle, NULL, &contentType, 
+					  &contentLength, &httpStatus,
+					  SOAP_TIMEOUT);
+	if (rc == UPNP_E_SUCCESS)
+		rc = UpnpUtil_ReadBody (NULL, handle, UpnpReadHttpResponse,
+					contentLength, SOAP_MAX_SIZE, 
+					SOAP_TIMEOUT, &text);
+	if (rc != UPNP_E_SUCCESS)
+		goto cleanup; // ---------->
+
+	*response = ixmlParseBuffer (text);
+	if (*response == NULL) {
+		rc = UPNP_E_BAD_RESPONSE;
+	} else if (httpStatus != 200) {
+		// SOAP fault : return the UPnP error code
+		const char* const s = XMLUtil_FindFirstElementValue
+			(XML_D2N (*response), "errorCode", true, true);
+		STRING_TO_INT (s, rc, UPNP_E_BAD_RESPONSE);
+		if (rc <= 0)
+			rc = UPNP_E_BAD_RESPONSE;
+	}
+
+cleanup:
+	if (handle)
+		(void) UpnpCloseHttpConnection (handle);
+	if (headers)
+		UpnpString_delete (headers);
+	talloc_free (text);
+	return rc;
+}
+
+#endif // HAVE_UPNPOPENHTTPCONNECTION
+
+
 /*****************************************************************************
  * ActionError
  *****************************************************************************/
@@ -351,7 +539,7 @@ ActionError (Service* serv, const char* actionName,
  *****************************************************************************/
 int
 Service_SendActionAsync (const Service* serv,
-			 Upnp_FunPtr callback,
+			 Upnp_FunPtr callback, const void* cookie,
 			 const char* actionName,
 			 int nb_params, const StringPair* params)
 {
@@ -371,7 +559,7 @@ Service_SendActionAsync (const Service* serv,
       // Send action request
       rc = UpnpSendActionAsync (serv->ctrlpt_handle, serv->controlURL,
 				serv->serviceType, NULL, actionNode,
-				callback, /* cookie => */ serv);
+				callback, cookie);
       if (rc != UPNP_E_SUCCESS) 
 	Log_Printf (LOG_ERROR, "Error in UpnpSendActionAsync -- %d", rc);
       
@@ -387,7 +575,7 @@ Service_SendActionAsync (const Service* serv,
  *****************************************************************************/
 int	
 Service_SendActionAsyncVa (const Service* serv,
-			   Upnp_FunPtr callback,
+			   Upnp_FunPtr callback, const void* cookie,
 			   const char* actionName, ...)
 {
   // Get names+values
@@ -402,18 +590,40 @@ Service_SendActionAsyncVa (const Service* serv,
   va_end (ap);
   Log_Printf (LOG_DEBUG, "Service_SendActionAsyncVa : %d pairs found", nb);
   
-  return Service_SendActionAsync (serv, callback, actionName, nb, params);
+  return Service_SendActionAsync (serv, callback, cookie, actionName,
+				  nb, params);
 }
 
 
 /*****************************************************************************
- * Service_SendAction
+ * AcquireSlot
  *****************************************************************************/
-int
-Service_SendAction (Service* serv,
-		    IXML_Document** response,
-		    const char* actionName,
-		    int nb_params, const StringPair* params)
+static IOSched_Slot*
+AcquireSlot (Service* serv)
+{
+  // Synchronous actions are sent on behalf of a waiting user
+  METRICS_STATIC_ID (wait_id, METRICS_HISTOGRAM, 
+		     "djmount_io_sched_wait_seconds",
+		     "Time spent waiting for a connection to a device",
+		     "priority=\"foreground\",class=\"control\"");
+  IOSched_Slot* slot = NULL;
+  Trace_Span wait;
+  Trace_Begin (&wait, "io_sched.wait", serv->controlURL);
+  (void) IOSched_AcquireControl (serv->controlURL, IO_SCHED_FOREGROUND, 
+				 serv, true, &slot);
+  Metrics_Observe (wait_id, Trace_End (&wait));
+  return slot;
+}
+
+
+/*****************************************************************************
+ * SendAction
+ *****************************************************************************/
+static int
+SendAction (Service* serv,
+	    IXML_Document** response,
+	    const char* actionName,
+	    int nb_params, const StringPair* params)
 {
   int rc = UPNP_E_SUCCESS;
   Log_Printf (LOG_DEBUG, "Service_SendAction '%s'", NN(actionName));
@@ -426,6 +636,21 @@ Service_SendAction (Service* serv,
     rc = UPNP_E_INVALID_PARAM;
   } else {
 
+#if HAVE_UPNPOPENHTTPCONNECTION
+    // Send the text of the request, without building a DOM document
+    const SoapTemplate* const tmpl = 
+      (g_soap_key_created ? GetTemplate (serv, actionName, nb_params, params)
+       : NULL);
+    if (tmpl) {
+      *response = NULL;
+      IOSched_Slot* const slot = AcquireSlot (serv);
+      rc = SendSoapRequest (serv, tmpl, params, response);
+      IOSched_Release (slot);
+      ActionError (serv, actionName, rc, response);
+      return rc; // ---------->
+    }
+#endif
+
     IXML_Document* actionNode = MakeAction (actionName, serv->serviceType, 
 					    nb_params, params);
     if (actionNode == NULL) {
@@ -433,9 +658,11 @@ Service_SendAction (Service* serv,
     } else {
       // Send action request
       *response = NULL;
+      IOSched_Slot* const slot = AcquireSlot (serv);
       rc = UpnpSendAction (serv->ctrlpt_handle, serv->controlURL,
 			   serv->serviceType, NULL, actionNode,
 			   response);
+      IOSched_Release (slot);
       ActionError (serv, actionName, rc, response);
       ixmlDocument_free (actionNode);
       actionNode = NULL;
@@ -445,6 +672,68 @@ Service_SendAction (Service* serv,
 }
 
 
+/*****************************************************************************
+ * GetActionMetric
+ *
+ *	Returns the metric of an action (registered at the first call).
+ *****************************************************************************/
+static Metrics_Id
+GetActionMetric (Service* serv, const char* actionName)
+{
+  Metrics_Id id = METRICS_NONE;
+  ithread_mutex_lock (&g_metrics_mutex);
+  const ActionMetric* m = NULL;
+  PTR_ARRAY_FOR_EACH_PTR (serv->action_metrics, m) {
+    if (strcmp (m->action, actionName) == 0) {
+      id = m->id;
+      goto cleanup; // ---------->
+    }
+  } PTR_ARRAY_FOR_EACH_PTR_END;
+
+  // Per device ("host:port" of the control url) and action
+  const char* p = strstr (serv->controlURL, "://");
+  p = (p ? p + 3 : serv->controlURL);
+  char labels [256];
+  snprintf (labels, sizeof (labels), "device=\"%.*s\",action=\"%s\"",
+	    (int) strcspn (p, "/\""), p, actionName);
+  id = Metrics_Register (METRICS_HISTOGRAM, "djmount_soap_action_seconds",
+			 "Duration of the synchronous SOAP actions", labels);
+  ActionMetric* const new_m = talloc (serv, ActionMetric);
+  if (new_m) {
+    *new_m = (ActionMetric) { 
+      .action = talloc_strdup (new_m, actionName), .id = id 
+    };
+    if (new_m->action == NULL || 
+	! PtrArray_Append (serv->action_metrics, new_m))
+      talloc_free (new_m);
+  }
+
+cleanup:
+  ithread_mutex_unlock (&g_metrics_mutex);
+  return id;
+}
+
+
+/*****************************************************************************
+ * Service_SendAction
+ *****************************************************************************/
+int
+Service_SendAction (Service* serv,
+		    IXML_Document** response,
+		    const char* actionName,
+		    int nb_params, const StringPair* params)
+{
+  Trace_Span span;
+  Trace_Begin (&span, "soap.action", actionName);
+  const int rc = SendAction (serv, response, actionName, nb_params, params);
+  const uint64_t usec = Trace_End (&span);
+
+  if (serv && serv->controlURL && actionName)
+    Metrics_Observe (GetActionMetric (serv, actionName), usec);
+  return rc;
+}
+
+
 /*****************************************************************************
  * Service_SendActionVa
  *****************************************************************************/
@@ -493,17 +782,12 @@ get_status_string (const Service* serv,
 	
 	// Print variables
 	tpr (&p, "%s+- ServiceStateTable\n", spacer);
-	ListNode* node;
-	LinkedList* const variables = discard_const_p (LinkedList,
-						       &serv->variables);
-	for (node = ListHead (variables);
-	     node != NULL;
-	     node = ListNext (variables, node)) {
-		StringPair* const var = node->item;
+	const StringPair* var = NULL;
+	PTR_ARRAY_FOR_EACH_PTR (serv->variable_list, var) {
 		tpr (&p, "%s|    +- %-10s = %.150s%s\n", spacer, 
 		     NN(var->name), NN(var->value), 
 		     (var->value && strlen(var->value) > 150) ? "..." : "");
-	}
+	} PTR_ARRAY_FOR_EACH_PTR_END;
 	
 	// Last Action
 	tpr (&p, "%s+- Last Action     = %s\n", spacer, NN(serv->la_name));
@@ -570,6 +854,13 @@ init_class (Service_Class* const isa)
 	CLASS_BASE_CAST(isa)->finalize = finalize;
 	isa->update_variable   = NULL;
 	isa->get_status_string = get_status_string;
+
+	ithread_mutex_init (&g_metrics_mutex, NULL);
+#if HAVE_UPNPOPENHTTPCONNECTION
+	ithread_mutex_init (&g_soap_mutex, NULL);
+	g_soap_key_created = (pthread_key_create (&g_soap_key, 
+						  FreeSoapBuffer) == 0);
+#endif
 }
 
 OBJECT_INIT_CLASS(Service, Object, init_class);
@@ -610,8 +901,13 @@ Service_Create (void* talloc_context,
 	
 	self->sid = NULL;
 	
-	// Initialise list of variables
-	ListInit (&self->variables, 0, 0);
+	// Initialise variables
+	self->variables = hash_initialize (INITIAL_VARIABLES_SIZE, NULL,
+					   variable_hasher, 
+					   variable_comparator, NULL);
+	self->variable_list = PtrArray_Create (self);
+	self->soap_templates = PtrArray_Create (self);
+	self->action_metrics = PtrArray_Create (self);
 	
 	// For debugging
 	self->la_name = self->la_error_code = self->la_error_desc = NULL;
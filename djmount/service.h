@@ -87,13 +87,14 @@ Service_SubscribeEventURL (Service* serv);
  *
  * @param serv         the service object
  * @param callback     the callback to receive the results
+ * @param cookie       the cookie given to the callback
  * @param actionName   the name of the action
  * @param nb_params    number of pairs (names + values)
  * @param params       list of pairs : names + values 
  *****************************************************************************/
 int 
 Service_SendActionAsync (const Service* serv, Upnp_FunPtr callback,
-			 const char* actionName,
+			 const void* cookie, const char* actionName,
 			 int nb_params, const StringPair* params);
 
 
@@ -103,13 +104,14 @@ Service_SendActionAsync (const Service* serv, Upnp_FunPtr callback,
  *
  * @param serv      	the service object
  * @param callback      the callback to receive the results
+ * @param cookie        the cookie given to the callback
  * @param actionName    the name of the action
  * @param ...		list of Name / Value pairs.
  *			This list shall be terminated by NULL / NULL.
  *****************************************************************************/
 int 
 Service_SendActionAsyncVa (const Service* serv,Upnp_FunPtr callback,
-			   const char* actionName, ...);
+			   const void* cookie, const char* actionName, ...);
 
 
 /*****************************************************************************
@@ -28,7 +28,8 @@
 #include "service.h"
 #include "object_p.h"
 
-#include <upnp/LinkedList.h>
+#include "ptr_array.h"
+#include "hash.h"	// import gnulib hash
 
 
 /******************************************************************************
@@ -45,10 +46,17 @@ OBJECT_DEFINE_STRUCT(Service,
 		     char* controlURL;
 		     char* sid;
 		     
-		     // TBD XXX to replace by hashtable XXX
-		     LinkedList	variables;
+		     // State variables (StringPair), indexed by name
+		     Hash_table* variables;
+		     PtrArray*	 variable_list; // in order of first update
 		     
 		     UpnpClient_Handle ctrlpt_handle;
+
+		     // Templates of the SOAP requests (SoapTemplate)
+		     PtrArray* soap_templates;
+
+		     // Duration metric of each action (ActionMetric)
+		     PtrArray* action_metrics;
 		     
 		     // Last Action information, for debugging
 		     char* la_name;
@@ -0,0 +1,241 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * SoapTemplate : precompiled SOAP requests.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "soap_template.h"
+#include "talloc_util.h"
+#include "log.h"
+
+#include <string.h>
+
+
+/*
+ * Text of the envelope, as sent by libupnp (UpnpSendAction)
+ */
+#define ENVELOPE_BEGIN							\
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n"		\
+	"<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" " \
+	"s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">" \
+	"<s:Body>"
+
+#define ENVELOPE_END	"</s:Body></s:Envelope>\r\n"
+
+// Characters to escape in the values
+#define SPECIAL_CHARS	"&<>\""
+
+
+struct _SoapTemplate {
+	char*	action;
+	int	nb_params;
+	char**	names;
+	char*	headers;
+
+	// Text before each value, and after the last one
+	char**	chunks;
+	size_t*	lengths;
+	size_t	fixed_length;
+};
+
+
+/*****************************************************************************
+ * SoapTemplate_Create
+ *****************************************************************************/
+SoapTemplate*
+SoapTemplate_Create (void* talloc_context, const char* serviceType,
+		     const char* actionName,
+		     int nb_params, const StringPair* params)
+{
+	if (serviceType == NULL || actionName == NULL || nb_params < 0 ||
+	    (nb_params > 0 && params == NULL))
+		return NULL; // ---------->
+
+	SoapTemplate* const tmpl = talloc (talloc_context, SoapTemplate);
+	if (tmpl == NULL)
+		return NULL; // ---------->
+	*tmpl = (SoapTemplate) {
+		.action    = talloc_strdup (tmpl, actionName),
+		.nb_params = nb_params,
+		.names	   = talloc_array (tmpl, char*, nb_params + 1),
+		.headers   = talloc_asprintf (tmpl, "SOAPACTION: \"%s#%s\""
+					      "\r\n", serviceType, 
+					      actionName),
+		.chunks	   = talloc_array (tmpl, char*, nb_params + 1),
+		.lengths   = talloc_array (tmpl, size_t, nb_params + 1),
+	};
+	if (tmpl->action == NULL || tmpl->names == NULL || 
+	    tmpl->headers == NULL || tmpl->chunks == NULL || 
+	    tmpl->lengths == NULL)
+		goto FAIL; // ---------->
+
+	char* chunk = talloc_asprintf (tmpl, ENVELOPE_BEGIN 
+				       "<u:%s xmlns:u=\"%s\">", 
+				       actionName, serviceType);
+	int i;
+	for (i = 0; i < nb_params; i++) {
+		const char* const name = params[i].name;
+		if (name == NULL || chunk == NULL)
+			goto FAIL; // ---------->
+		tmpl->names[i] = talloc_strdup (tmpl, name);
+		tmpl->chunks[i] = talloc_asprintf_append (chunk, "<%s>", 
+							  name);
+		if (tmpl->names[i] == NULL || tmpl->chunks[i] == NULL)
+			goto FAIL; // ---------->
+		chunk = talloc_asprintf (tmpl, "</%s>", name);
+	}
+	tmpl->chunks[nb_params] = (chunk ? talloc_asprintf_append 
+				   (chunk, "</u:%s>" ENVELOPE_END, 
+				    actionName) : NULL);
+	if (tmpl->chunks[nb_params] == NULL)
+		goto FAIL; // ---------->
+
+	for (i = 0; i <= nb_params; i++) {
+		tmpl->lengths[i] = strlen (tmpl->chunks[i]);
+		tmpl->fixed_length += tmpl->lengths[i];
+	}
+	return tmpl; // ---------->
+
+FAIL:
+	Log_Printf (LOG_ERROR, "SoapTemplate can't create action '%s'",
+		    actionName);
+	talloc_free (tmpl);
+	return NULL;
+}
+
+
+/*****************************************************************************
+ * SoapTemplate_Matches
+ *****************************************************************************/
+bool
+SoapTemplate_Matches (const SoapTemplate* tmpl, const char* actionName,
+		      int nb_params, const StringPair* params)
+{
+	if (tmpl == NULL || actionName == NULL ||
+	    nb_params != tmpl->nb_params || 
+	    strcmp (actionName, tmpl->action) != 0)
+		return false; // ---------->
+	int i;
+	for (i = 0; i < nb_params; i++) {
+		if (params[i].name == NULL ||
+		    strcmp (params[i].name, tmpl->names[i]) != 0)
+			return false; // ---------->
+	}
+	return true;
+}
+
+
+/*****************************************************************************
+ * SoapTemplate_GetHeaders
+ *****************************************************************************/
+const char*
+SoapTemplate_GetHeaders (const SoapTemplate* tmpl)
+{
+	return (tmpl ? tmpl->headers : NULL);
+}
+
+
+/*****************************************************************************
+ * EscapedLength
+ *****************************************************************************/
+static size_t
+EscapedLength (const char* s)
+{
+	size_t len = 0;
+	for (;;) {
+		const size_t n = strcspn (s, SPECIAL_CHARS);
+		len += n;
+		s += n;
+		switch (*s++) {
+		case NUL:  return len; // ---------->
+		case '&':  len += 5; break; // "&amp;"
+		case '"':  len += 6; break; // "&quot;"
+		default:   len += 4; break; // "&lt;" or "&gt;"
+		}
+	}
+}
+
+
+/*****************************************************************************
+ * CopyEscaped
+ *****************************************************************************/
+static char*
+CopyEscaped (char* p, const char* s)
+{
+	for (;;) {
+		const size_t n = strcspn (s, SPECIAL_CHARS);
+		memcpy (p, s, n);
+		p += n;
+		s += n;
+		const char* entity = NULL;
+		switch (*s++) {
+		case NUL:  return p; // ---------->
+		case '&':  entity = "&amp;";  break;
+		case '"':  entity = "&quot;"; break;
+		case '<':  entity = "&lt;";   break;
+		default:   entity = "&gt;";   break;
+		}
+		const size_t len = strlen (entity);
+		memcpy (p, entity, len);
+		p += len;
+	}
+}
+
+
+/*****************************************************************************
+ * SoapTemplate_Fill
+ *****************************************************************************/
+size_t
+SoapTemplate_Fill (const SoapTemplate* tmpl, const StringPair* params,
+		   char** buffer, size_t* bufsize)
+{
+	if (tmpl == NULL || buffer == NULL || bufsize == NULL ||
+	    (tmpl->nb_params > 0 && params == NULL))
+		return 0; // ---------->
+
+	size_t len = tmpl->fixed_length;
+	int i;
+	for (i = 0; i < tmpl->nb_params; i++) {
+		if (params[i].value)
+			len += EscapedLength (params[i].value);
+	}
+	if (*buffer == NULL || *bufsize < len + 1) {
+		char* const p = talloc_realloc_size (NULL, *buffer, len + 1);
+		if (p == NULL)
+			return 0; // ---------->
+		*buffer  = p;
+		*bufsize = len + 1;
+	}
+
+	char* p = *buffer;
+	for (i = 0; i < tmpl->nb_params; i++) {
+		memcpy (p, tmpl->chunks[i], tmpl->lengths[i]);
+		p += tmpl->lengths[i];
+		if (params[i].value)
+			p = CopyEscaped (p, params[i].value);
+	}
+	memcpy (p, tmpl->chunks[i], tmpl->lengths[i]);
+	p += tmpl->lengths[i];
+	*p = NUL;
+	return len;
+}
+
@@ -0,0 +1,107 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * SoapTemplate : precompiled SOAP requests.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SOAP_TEMPLATE_H_INCLUDED
+#define SOAP_TEMPLATE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "string_util.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/******************************************************************************
+ * @var SoapTemplate
+ *
+ *	This opaque type holds the text of the SOAP envelope of an action,
+ *	with one slot for the value of each argument : a request is made
+ *	by copying the text and the (escaped) values, without building
+ *	a DOM document.
+ *
+ *	A template is read-only once created : it can be used by several
+ *	threads at the same time. It is destroyed with "talloc_free".
+ *
+ *****************************************************************************/
+
+typedef struct _SoapTemplate SoapTemplate;
+
+
+/*****************************************************************************
+ * @brief 	Creates the template of an action.
+ *
+ * @param talloc_context	the talloc parent context
+ * @param serviceType		the service type
+ * @param actionName		the name of the action
+ * @param nb_params		number of arguments
+ * @param params		the arguments (only the names are used)
+ * @return			the new template, or NULL if error.
+ *****************************************************************************/
+SoapTemplate*
+SoapTemplate_Create (void* talloc_context, const char* serviceType,
+		     const char* actionName,
+		     int nb_params, const StringPair* params);
+
+
+/*****************************************************************************
+ * @brief 	Returns true if the template is for this action, with
+ *		these argument names (in the same order).
+ *****************************************************************************/
+bool
+SoapTemplate_Matches (const SoapTemplate* tmpl, const char* actionName,
+		      int nb_params, const StringPair* params);
+
+
+/*****************************************************************************
+ * @brief 	Returns the HTTP header lines to send with the request
+ *		("SOAPACTION"), each terminated by CRLF.
+ *****************************************************************************/
+const char*
+SoapTemplate_GetHeaders (const SoapTemplate* tmpl);
+
+
+/*****************************************************************************
+ * @brief 	Make the body of a request. The buffer is grown if 
+ *		necessary (using talloc_realloc), and can be reused for
+ *		other requests.
+ *
+ * @param tmpl		the SoapTemplate object
+ * @param params	the arguments (same number as the template, only
+ *			the values are used ; NULL values are empty)
+ * @param buffer	the buffer (can be NULL initially)
+ * @param bufsize	size of the buffer
+ * @return		length of the body (without the final NUL),
+ *			or 0 if error.
+ *****************************************************************************/
+size_t
+SoapTemplate_Fill (const SoapTemplate* tmpl, const StringPair* params,
+		   char** buffer, size_t* bufsize);
+
+
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
+
+#endif // SOAP_TEMPLATE_H_INCLUDED
@@ -0,0 +1,245 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * StringPool : shared copies of repetitive strings.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "string_pool.h"
+#include "talloc_util.h"
+#include "string_util.h"
+#include "hash.h"	// import gnulib hash
+
+#include <string.h>
+#include <stdbool.h>
+#include <upnp/ithread.h>
+
+
+// Initial number of entries in the hash table (it grows if necessary)
+#define INITIAL_TABLE_SIZE	256
+
+
+// The characters of the string are allocated just after the entry
+typedef struct _Entry {
+	char*		string;
+	size_t		refs;
+} Entry;
+
+struct _StringPool {
+	ithread_mutex_t	mutex;
+	Hash_table*	table;
+	bool		destroyed; // waiting for the last string
+
+	// Statistics
+	size_t		nb_refs;
+	unsigned long	nb_gets;
+	unsigned long	nb_hits;
+};
+
+
+/******************************************************************************
+ * Hash functions
+ *****************************************************************************/
+static size_t
+entry_hasher (const void* entry, size_t table_size)
+{
+	return String_Hash (((const Entry*) entry)->string) % table_size;
+}
+
+static bool
+entry_comparator (const void* e1, const void* e2)
+{
+	return (strcmp (((const Entry*) e1)->string,
+			((const Entry*) e2)->string) == 0);
+}
+
+
+/*****************************************************************************
+ * DestroyPool
+ *****************************************************************************/
+static int
+DestroyPool (StringPool* const pool)
+{
+	// Entries are talloc'ed children of the pool : nothing else to free
+	if (pool->table)
+		hash_free (pool->table);
+	ithread_mutex_destroy (&pool->mutex);
+	return 0; // ok -> deallocate memory
+}
+
+
+/*****************************************************************************
+ * StringPool_Create
+ *****************************************************************************/
+StringPool*
+StringPool_Create (void* talloc_context)
+{
+	StringPool* const pool = talloc (talloc_context, StringPool);
+	if (pool == NULL)
+		return NULL; // ---------->
+	*pool = (StringPool) {
+		.table = hash_initialize (INITIAL_TABLE_SIZE, NULL,
+					  entry_hasher, entry_comparator,
+					  NULL),
+		.destroyed = false,
+	};
+	ithread_mutex_init (&pool->mutex, NULL);
+	talloc_set_destructor (pool, DestroyPool);
+	if (pool->table == NULL) {
+		talloc_free (pool);
+		return NULL; // ---------->
+	}
+	return pool;
+}
+
+
+/*****************************************************************************
+ * StringPool_Destroy
+ *****************************************************************************/
+void
+StringPool_Destroy (StringPool* pool)
+{
+	if (pool == NULL)
+		return; // ---------->
+
+	ithread_mutex_lock (&pool->mutex);
+	const bool empty = (hash_get_n_entries (pool->table) == 0);
+	if (! empty) {
+		// Detach from the owner : freed by the last StringPool_Release
+		pool->destroyed = true;
+		(void) talloc_steal (NULL, pool);
+	}
+	ithread_mutex_unlock (&pool->mutex);
+	if (empty)
+		talloc_free (pool);
+}
+
+
+/*****************************************************************************
+ * StringPool_Get
+ *****************************************************************************/
+const char*
+StringPool_Get (StringPool* pool, const char* s)
+{
+	if (pool == NULL || s == NULL)
+		return NULL; // ---------->
+
+	ithread_mutex_lock (&pool->mutex);
+	pool->nb_gets++;
+
+	const Entry searched = { .string = (char*) s };
+	Entry* e = hash_lookup (pool->table, &searched);
+	if (e) {
+		pool->nb_hits++;
+	} else {
+		const size_t len = strlen (s);
+		e = talloc_size (pool, sizeof (Entry) + len + 1);
+		if (e == NULL)
+			goto cleanup; // ---------->
+		*e = (Entry) { .string = (char*) (e + 1), .refs = 0 };
+		memcpy (e->string, s, len + 1);
+		if (hash_insert (pool->table, e) == NULL) {
+			talloc_free (e);
+			e = NULL;
+			goto cleanup; // ---------->
+		}
+	}
+	e->refs++;
+	pool->nb_refs++;
+
+cleanup:
+	ithread_mutex_unlock (&pool->mutex);
+	return (e ? e->string : NULL);
+}
+
+
+/*****************************************************************************
+ * StringPool_Release
+ *****************************************************************************/
+void
+StringPool_Release (StringPool* pool, const char* s)
+{
+	if (pool == NULL || s == NULL)
+		return; // ---------->
+
+	Entry* const e = ((Entry*) s) - 1;
+	bool free_pool = false;
+
+	ithread_mutex_lock (&pool->mutex);
+	pool->nb_refs--;
+	if (--(e->refs) == 0) {
+		(void) hash_delete (pool->table, e);
+		talloc_free (e);
+		free_pool = (pool->destroyed && 
+			     hash_get_n_entries (pool->table) == 0);
+	}
+	ithread_mutex_unlock (&pool->mutex);
+
+	if (free_pool)
+		talloc_free (pool);
+}
+
+
+/*****************************************************************************
+ * StringPool_GetNrStrings
+ *****************************************************************************/
+size_t
+StringPool_GetNrStrings (StringPool* pool)
+{
+	size_t n = 0;
+	if (pool) {
+		ithread_mutex_lock (&pool->mutex);
+		n = hash_get_n_entries (pool->table);
+		ithread_mutex_unlock (&pool->mutex);
+	}
+	return n;
+}
+
+
+/*****************************************************************************
+ * StringPool_GetStatusString
+ *****************************************************************************/
+char*
+StringPool_GetStatusString (StringPool* pool, 
+			    void* result_context, const char* spacer)
+{
+	if (pool == NULL)
+		return NULL; // ---------->
+
+	char* p = talloc_strdup (result_context, "");
+	if (spacer == NULL)
+		spacer = "";
+
+	ithread_mutex_lock (&pool->mutex);
+	tpr (&p, "%s+- Strings         = %lu (references = %lu)\n", spacer,
+	     (unsigned long) hash_get_n_entries (pool->table),
+	     (unsigned long) pool->nb_refs);
+	tpr (&p, "%s+- Lookups         = %lu\n", spacer, pool->nb_gets);
+	if (pool->nb_gets > 0) {
+		tpr (&p, "%s     +- hits       = %lu (%.1f%%)\n", spacer,
+		     pool->nb_hits, 
+		     (float) (pool->nb_hits * 100.0 / pool->nb_gets));
+	}
+	ithread_mutex_unlock (&pool->mutex);
+	return p;
+}
+
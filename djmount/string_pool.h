@@ -0,0 +1,114 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * StringPool : shared copies of repetitive strings.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef STRING_POOL_H_INCLUDED
+#define STRING_POOL_H_INCLUDED
+
+#include <stddef.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/******************************************************************************
+ * @var StringPool
+ *
+ *	This opaque type keeps a single, reference counted, copy of
+ *	strings which repeat a lot (e.g. the "upnp:class" of the DIDL-Lite
+ *	objects of a device) : equal strings got from the same pool are
+ *	the same pointer, hence can be compared with "==".
+ *
+ *	The pool is destroyed with "StringPool_Destroy", but remains
+ *	allocated until the last string is released : the strings can
+ *	outlive the owner of the pool.
+ *
+ *	All functions in this API are thread safe.
+ *
+ *****************************************************************************/
+
+typedef struct _StringPool StringPool;
+
+
+/*****************************************************************************
+ * @brief 	Creates a new, empty pool.
+ *
+ * @param talloc_context	the talloc parent context
+ * @return			the new pool, or NULL if error.
+ *****************************************************************************/
+StringPool*
+StringPool_Create (void* talloc_context);
+
+
+/*****************************************************************************
+ * @brief 	Destroy the pool. The memory is deallocated when the
+ *		last string got from the pool is released.
+ *****************************************************************************/
+void
+StringPool_Destroy (StringPool* pool);
+
+
+/*****************************************************************************
+ * @brief 	Returns the copy of a string in the pool (adding it if 
+ *		necessary), and increments its reference count.
+ *
+ * @param pool		the StringPool object
+ * @param s		the string
+ * @return		the shared copy, or NULL if error.
+ *****************************************************************************/
+const char*
+StringPool_Get (StringPool* pool, const char* s);
+
+
+/*****************************************************************************
+ * @brief 	Decrements the reference count of a string got from
+ *		"StringPool_Get" (NULL is allowed), and removes it from
+ *		the pool when it reaches 0.
+ *****************************************************************************/
+void
+StringPool_Release (StringPool* pool, const char* s);
+
+
+/*****************************************************************************
+ * @brief 	Returns the number of different strings in the pool.
+ *****************************************************************************/
+size_t
+StringPool_GetNrStrings (StringPool* pool);
+
+
+/*****************************************************************************
+ * @brief 	Returns a string describing the state of the pool.
+ * 	  	The returned string should be freed using "talloc_free".
+ *****************************************************************************/
+char*
+StringPool_GetStatusString (StringPool* pool, 
+			    void* result_context, const char* spacer);
+
+
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
+
+#endif // STRING_POOL_H_INCLUDED
+
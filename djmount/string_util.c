@@ -164,6 +164,55 @@ String_Hash (const char* str)
 
 
 
+/*****************************************************************************
+ * String_Hash64
+ * Refer to :
+ *	http://www.isthe.com/chongo/tech/comp/fnv/
+ *****************************************************************************/
+
+uint64_t
+String_Hash64 (uint64_t hash, const char* str)
+{
+  unsigned char c;
+
+  while ((c = *str++)) {
+    hash ^= c;
+    hash *= UINT64_C(0x100000001b3); // 64-bit FNV prime
+  }
+  return hash;
+}
+
+
+/*****************************************************************************
+ * String_IsASCII
+ *****************************************************************************/
+
+#define HIGHS	UINT64_C(0x8080808080808080)
+
+bool
+String_IsASCII (const char* str)
+{
+	const unsigned char* p = (const unsigned char*) str;
+	const unsigned char* const end = p + strlen (str);
+
+	// Test 8 bytes at a time : any high bit set is a non-ASCII byte
+	while (end - p >= (ptrdiff_t) sizeof (uint64_t)) {
+		uint64_t w;
+		memcpy (&w, p, sizeof (w));
+		if (w & HIGHS)
+			return false; // ---------->
+		p += sizeof (w);
+	}
+	for (; p < end; p++) {
+		if (*p & 0x80)
+			return false; // ---------->
+	}
+	return true;
+}
+
+#undef HIGHS
+
+
 /*****************************************************************************
  * StringStream
  *****************************************************************************/
@@ -129,6 +129,31 @@ String_HashType
 String_Hash (const char* str);
 
 
+/*****************************************************************************
+ * @fn 		String_Hash64
+ * @brief	64-bit hash of a string (FNV-1a), stable across runs and
+ *		platforms. Several strings can be hashed together by 
+ *		passing the result of the previous call as "hash".
+ *
+ * @param hash		STRING_HASH64_INIT, or a previous result
+ * @param str		the string (not including its terminating NUL)
+ *****************************************************************************/
+#define STRING_HASH64_INIT	UINT64_C(0xcbf29ce484222325)
+
+uint64_t
+String_Hash64 (uint64_t hash, const char* str);
+
+
+
+/*****************************************************************************
+ * @fn 		String_IsASCII
+ * @brief	Returns true if the string contains only 7-bit ASCII 
+ *		characters (tests 8 bytes at a time).
+ *****************************************************************************/
+bool
+String_IsASCII (const char* str);
+
+
 
 /*****************************************************************************
  * StringStream
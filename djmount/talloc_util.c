@@ -43,6 +43,19 @@ tpr (char** s, const char* fmt, ...)
 }
 
 
-
-
+/******************************************************************************
+ * talloc_new_tmp
+ *****************************************************************************/
+void*
+talloc_new_tmp (const void* context, size_t pool_size)
+{
+#if HAVE_TALLOC_POOL
+	void* const pool = talloc_pool (context, pool_size);
+	if (pool) {
+		talloc_set_name_const (pool, "tmp_pool");
+		return pool; // ---------->
+	}
+#endif
+	return talloc_new (context);
+}
 
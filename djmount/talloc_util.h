@@ -57,6 +57,25 @@ bool
 tpr (char** s, const char* fmt, ...) PRINTF_ATTRIBUTE(2,3);
 
 
+/*****************************************************************************
+ * Default size of the memory pools of temporary contexts, in bytes.
+ *****************************************************************************/
+#define TALLOC_TMP_POOL_SIZE	(16 * 1024)
+
+
+/*****************************************************************************
+ * Creates a new context for temporary allocations, equivalent to
+ * "talloc_new" but taking the allocations of its children from a memory
+ * pool of "pool_size" bytes (if "talloc_pool" is available) : the many
+ * small allocations made while serving a request then cost no malloc.
+ * Note : the pool is released only when all its children are freed,
+ * hence they should be copied, not "talloc_steal"'ed, to long-lived
+ * contexts.
+ *****************************************************************************/
+void*
+talloc_new_tmp (const void* context, size_t pool_size);
+
+
 
 
 #ifdef __cplusplus
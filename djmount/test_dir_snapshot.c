@@ -0,0 +1,114 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * Testing DirSnapshot - entries of an opened directory.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+ 
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "dir_snapshot.h"
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include "talloc_util.h"
+
+
+#undef NDEBUG
+#include <assert.h>
+
+
+#define NB_ENTRIES	10000
+
+
+int 
+main (int argc, char * argv[])
+{
+	talloc_enable_leak_report();
+
+	DirSnapshot* snap = DirSnapshot_Create (NULL);
+	assert (snap != NULL);
+	assert (DirSnapshot_GetSize (snap) == 0);
+
+	DirSnapshot_Entry e;
+	assert (! DirSnapshot_GetEntry (snap, 0, &e));
+
+	assert (DirSnapshot_Filler ((fuse_dirh_t) snap, ".", DT_DIR, 0) == 0);
+	assert (DirSnapshot_Filler ((fuse_dirh_t) snap, "..", DT_DIR, 
+				    12345) == 0);
+
+	// Every other entry has attributes (its size = its index),
+	// inode numbers = index + 100
+	int i;
+	for (i = 0; i < NB_ENTRIES; i++) {
+		char name [20];
+		sprintf (name, "file%d", i);
+		if (i % 2) {
+			const struct stat stbuf = { 
+				.st_mode = S_IFREG | 0444, .st_size = i,
+				.st_ino = i + 100
+			};
+			assert (DirSnapshot_StatFiller (snap, name, DT_REG,
+							&stbuf) == 0);
+		} else {
+			assert (DirSnapshot_Add (snap, name, DT_REG, i + 100,
+						 NULL) == 0);
+		}
+	}
+	assert (DirSnapshot_GetSize (snap) == NB_ENTRIES + 2);
+
+	assert (DirSnapshot_GetEntry (snap, 0, &e));
+	assert (strcmp (e.name, ".") == 0 && e.type == DT_DIR);
+	assert (e.stbuf == NULL && e.ino == 0);
+	assert (DirSnapshot_GetEntry (snap, 1, &e));
+	assert (strcmp (e.name, "..") == 0 && e.type == DT_DIR);
+	assert (e.ino == 12345);
+
+	for (i = 0; i < NB_ENTRIES; i++) {
+		char name [20];
+		sprintf (name, "file%d", i);
+		assert (DirSnapshot_GetEntry (snap, i + 2, &e));
+		assert (strcmp (e.name, name) == 0);
+		assert (e.type == DT_REG);
+		assert (e.ino == i + 100);
+		if (i % 2) {
+			assert (e.stbuf != NULL);
+			assert (e.stbuf->st_size == i);
+		} else {
+			assert (e.stbuf == NULL);
+		}
+	}
+	assert (! DirSnapshot_GetEntry (snap, NB_ENTRIES + 2, &e));
+
+	assert (DirSnapshot_Add (snap, NULL, DT_REG, 0, NULL) != 0);
+	assert (DirSnapshot_GetSize (snap) == NB_ENTRIES + 2);
+	assert (DirSnapshot_GetSize (NULL) == 0);
+	
+	printf ("%d entries : %ld bytes\n", NB_ENTRIES + 2,
+		(long) talloc_total_size (snap));
+
+	talloc_free (snap);
+	snap = NULL;
+
+	size_t bytes = talloc_total_size (NULL);
+	assert (bytes == 0);
+
+	exit (0);
+}
+
@@ -0,0 +1,250 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * Testing IOSched.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include "io_sched.h"
+#include "talloc_util.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+#undef NDEBUG
+#include <assert.h>
+
+
+#define URL_A	"http://10.0.0.1:8200/MediaItems/1.mp3"
+#define URL_B	"http://10.0.0.2:8200/MediaItems/1.mp3"
+
+
+// Order in which the waiting threads got their slot
+static pthread_mutex_t	g_order_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char		g_order [8];
+static int		g_nb_order = 0;
+
+typedef struct _Waiter {
+	IOSched_Priority	priority;
+	char			tag;
+	IOSched_Slot*		slot;
+} Waiter;
+
+
+static void*
+wait_slot (void* arg)
+{
+	Waiter* const w = (Waiter*) arg;
+	assert (IOSched_Acquire (URL_A, w->priority, w, true, &w->slot) == 0);
+	assert (w->slot != NULL);
+	pthread_mutex_lock (&g_order_mutex);
+	g_order [g_nb_order++] = w->tag;
+	pthread_mutex_unlock (&g_order_mutex);
+	return NULL;
+}
+
+
+// Wait until 'n' requests are queued on URL_A
+static void
+wait_queued (void* ctx, int n)
+{
+	char pattern [40];
+	snprintf (pattern, sizeof (pattern), "waiting    = %d\n", n);
+	for (;;) {
+		char* const s = IOSched_GetStatusString (ctx, "");
+		const bool found = (strstr (s, pattern) != NULL);
+		talloc_free (s);
+		if (found)
+			return; // ---------->
+		usleep (1000);
+	}
+}
+
+static int
+get_order (void)
+{
+	pthread_mutex_lock (&g_order_mutex);
+	const int n = g_nb_order;
+	pthread_mutex_unlock (&g_order_mutex);
+	return n;
+}
+
+
+int
+main (int argc, char* argv[])
+{
+	talloc_enable_leak_report();
+
+	// Create a working context for memory allocations
+	void* const ctx = talloc_new (NULL);
+
+	// Not initialised : requests are not limited
+	IOSched_Slot* s1 = NULL;
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s1) == 0);
+	assert (s1 == NULL);
+
+	// 2 requests per device, 1 of them background
+	assert (IOSched_Initialize (ctx, 2) == 0);
+
+	/*
+	 * Per-device limit
+	 */
+	IOSched_Slot* s2 = NULL;
+	IOSched_Slot* s3 = NULL;
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s1) == 0 && s1);
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s2) == 0 && s2);
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s3) == -EAGAIN && s3 == NULL);
+	// Other device : own budget
+	assert (IOSched_Acquire (URL_B, IO_SCHED_FOREGROUND, NULL, false,
+				 &s3) == 0 && s3);
+	IOSched_Release (s3);
+	IOSched_Release (s2);
+	IOSched_Release (s1);
+
+	/*
+	 * Background requests are throttled to half of the budget
+	 */
+	assert (IOSched_Acquire (URL_A, IO_SCHED_BACKGROUND, NULL, false,
+				 &s1) == 0 && s1);
+	assert (IOSched_Acquire (URL_A, IO_SCHED_BACKGROUND, NULL, false,
+				 &s2) == -EAGAIN);
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s2) == 0 && s2);
+	IOSched_Release (s2);
+	IOSched_Release (s1);
+
+	/*
+	 * Foreground waiters are served first, even if queued last
+	 */
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s1) == 0);
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s2) == 0);
+	Waiter bg = { .priority = IO_SCHED_BACKGROUND, .tag = 'b' };
+	Waiter fg = { .priority = IO_SCHED_FOREGROUND, .tag = 'f' };
+	pthread_t t_bg, t_fg;
+	assert (pthread_create (&t_bg, NULL, wait_slot, &bg) == 0);
+	wait_queued (ctx, 1);
+	assert (pthread_create (&t_fg, NULL, wait_slot, &fg) == 0);
+	wait_queued (ctx, 2);
+	IOSched_Release (s1);
+	pthread_join (t_fg, NULL);
+	assert (get_order() == 1 && g_order[0] == 'f');
+	IOSched_Release (s2);
+	pthread_join (t_bg, NULL);
+	assert (get_order() == 2 && g_order[1] == 'b');
+	IOSched_Release (fg.slot);
+	IOSched_Release (bg.slot);
+
+	/*
+	 * Boost : a background waiter becomes foreground
+	 */
+	g_nb_order = 0;
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s1) == 0);
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s2) == 0);
+	Waiter bg1 = { .priority = IO_SCHED_BACKGROUND, .tag = '1' };
+	Waiter bg2 = { .priority = IO_SCHED_BACKGROUND, .tag = '2' };
+	pthread_t t1, t2;
+	assert (pthread_create (&t1, NULL, wait_slot, &bg1) == 0);
+	wait_queued (ctx, 1);
+	assert (pthread_create (&t2, NULL, wait_slot, &bg2) == 0);
+	wait_queued (ctx, 2);
+	IOSched_Boost (&bg2);
+	IOSched_Release (s1);
+	pthread_join (t2, NULL);
+	assert (get_order() == 1 && g_order[0] == '2');
+	IOSched_Release (s2);
+	pthread_join (t1, NULL);
+	IOSched_Release (bg1.slot);
+	IOSched_Release (bg2.slot);
+
+	/*
+	 * Splice and read of a same file : the splice holds a slot, then
+	 * locks the file ; the read waits for a slot without the file
+	 * locked (see FillWindow). A splice which can't get a slot at
+	 * once falls back to the read, and nothing deadlocks even when
+	 * all the slots are taken.
+	 */
+	g_nb_order = 0;
+	pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s1) == 0);
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s2) == 0);
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s3) == -EAGAIN);
+	Waiter rd = { .priority = IO_SCHED_FOREGROUND, .tag = 'r' };
+	pthread_t t_rd;
+	assert (pthread_create (&t_rd, NULL, wait_slot, &rd) == 0);
+	wait_queued (ctx, 1);
+	pthread_mutex_lock (&file_mutex);   // splice in progress
+	pthread_mutex_unlock (&file_mutex);
+	IOSched_Release (s1);
+	pthread_join (t_rd, NULL);
+	assert (get_order() == 1 && g_order[0] == 'r');
+	IOSched_Release (rd.slot);
+	IOSched_Release (s2);
+
+	/*
+	 * Control requests : own budget, separate from the data transfers
+	 */
+	IOSched_Slot* c1 = NULL;
+	IOSched_Slot* c2 = NULL;
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s1) == 0);
+	assert (IOSched_Acquire (URL_A, IO_SCHED_FOREGROUND, NULL, false,
+				 &s2) == 0);
+	assert (IOSched_AcquireControl (URL_A, IO_SCHED_BACKGROUND, NULL,
+					false, &c1) == 0 && c1);
+	assert (IOSched_AcquireControl (URL_A, IO_SCHED_BACKGROUND, NULL,
+					false, &c2) == -EAGAIN);
+	assert (IOSched_AcquireControl (URL_A, IO_SCHED_FOREGROUND, NULL,
+					false, &c2) == 0 && c2);
+	// IO_SCHED_MAX_CONTROL_REQUESTS = 2
+	assert (IOSched_AcquireControl (URL_A, IO_SCHED_FOREGROUND, NULL,
+					false, &s3) == -EAGAIN);
+	IOSched_Release (c2);
+	IOSched_Release (c1);
+	IOSched_Release (s2);
+	IOSched_Release (s1);
+
+	char* const status = IOSched_GetStatusString (ctx, "  ");
+	printf ("%s", status);
+	assert (strstr (status, "active     = 0") != NULL);
+	talloc_free (status);
+
+	IOSched_Finish();
+
+	// Delete all storage
+	talloc_free (ctx);
+
+	size_t bytes = talloc_total_size (NULL);
+	assert (bytes == 0);
+
+	exit (0);
+}
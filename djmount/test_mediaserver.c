@@ -0,0 +1,1040 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * Local UPnP MediaServer, serving a synthetic library : to test and
+ * measure djmount on a single host, without real devices.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <config.h>
+
+#include "log.h"
+#include "talloc_util.h"
+#include "string_util.h"
+#include "xml_util.h"
+#include "minmax.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+
+#include <upnp/upnp.h>
+#include <upnp/upnptools.h>
+#include <upnp/ithread.h>
+
+
+/*
+ * The library is a tree of containers : each container below 'depth'
+ * has 'fanout' sub-containers, and each container at 'depth' has
+ * 'nb_items' items (e.g. depth=2 fanout=10 nb_items=1000 => 100 000
+ * items). Objects are not stored : they are computed from their id,
+ * which is the list of the indexes from the root, e.g. "0.3.7.42".
+ */
+#define MAX_DEPTH	16
+
+typedef enum _TitleCharset {
+	TITLE_ASCII,
+	TITLE_LATIN1,	// accented latin characters
+	TITLE_CJK	// 3-bytes UTF-8 characters
+} TitleCharset;
+
+static struct {
+	const char*	ip_address;
+	unsigned short	port;
+	const char*	name;
+	unsigned	depth;
+	unsigned	fanout;
+	unsigned	nb_items;	// per container at 'depth'
+	unsigned	title_len;	// minimum title length, in bytes
+	TitleCharset	charset;
+	intmax_t	item_size;	// bytes
+	unsigned	max_results;	// per Browse or Search, 0 = unlimited
+	unsigned	latency;	// milliseconds, per action or file
+	unsigned	bandwidth;	// KB/s per file, 0 = unlimited
+	unsigned	error_rate;	// percentage of failed requests
+	unsigned	event_period;	// seconds, 0 = no events
+} g_opt = {
+	.ip_address	= NULL,
+	.port		= 0,
+	.name		= "djmount test server",
+	.depth		= 2,
+	.fanout		= 10,
+	.nb_items	= 1000,
+	.title_len	= 0,
+	.charset	= TITLE_ASCII,
+	.item_size	= 4 * 1024 * 1024,
+	.max_results	= 0,
+	.latency	= 0,
+	.bandwidth	= 0,
+	.error_rate	= 0,
+	.event_period	= 0,
+};
+
+
+#define CDS_TYPE	"urn:schemas-upnp-org:service:ContentDirectory:1"
+#define CDS_ID		"urn:upnp-org:serviceId:ContentDirectory"
+
+#define VIRTUAL_DIR	"/test"
+#define SCPD_PATH	VIRTUAL_DIR "/cds.xml"
+#define CONTENT_PATH	VIRTUAL_DIR "/content/"
+#define CONTENT_SUFFIX	".mp3"
+
+// Seconds
+#define ADVERTISEMENT_EXPIRE	1800
+
+
+static UpnpDevice_Handle g_device = -1;
+static char		 g_udn [64];
+static char		 g_base_url [64];
+static unsigned long	 g_update_id = 1;
+
+static __thread unsigned int t_seed = 0;
+
+
+// UPnP errors
+#define ERR_INVALID_ACTION	401
+#define ERR_INVALID_ARGS	402
+#define ERR_ACTION_FAILED	501
+#define ERR_NO_SUCH_OBJECT	701
+
+
+static const char DESCRIPTION[] =
+	"<?xml version=\"1.0\"?>\n"
+	"<root xmlns=\"urn:schemas-upnp-org:device-1-0\">\n"
+	"<specVersion><major>1</major><minor>0</minor></specVersion>\n"
+	"<device>\n"
+	"<deviceType>urn:schemas-upnp-org:device:MediaServer:1</deviceType>\n"
+	"<friendlyName>%s</friendlyName>\n"
+	"<manufacturer>djmount</manufacturer>\n"
+	"<modelName>test_mediaserver</modelName>\n"
+	"<UDN>%s</UDN>\n"
+	"<serviceList>\n"
+	"<service>\n"
+	"<serviceType>" CDS_TYPE "</serviceType>\n"
+	"<serviceId>" CDS_ID "</serviceId>\n"
+	"<SCPDURL>" SCPD_PATH "</SCPDURL>\n"
+	"<controlURL>" VIRTUAL_DIR "/control/cds</controlURL>\n"
+	"<eventSubURL>" VIRTUAL_DIR "/event/cds</eventSubURL>\n"
+	"</service>\n"
+	"</serviceList>\n"
+	"</device>\n"
+	"</root>\n";
+
+#define ARG(NAME,DIR,VAR)						\
+	"<argument><name>" NAME "</name><direction>" DIR "</direction>"	\
+	"<relatedStateVariable>" VAR "</relatedStateVariable></argument>"
+
+#define VAR(NAME,TYPE,EVENTS)						\
+	"<stateVariable sendEvents=\"" EVENTS "\"><name>" NAME "</name>"	\
+	"<dataType>" TYPE "</dataType></stateVariable>\n"
+
+static const char SCPD[] =
+	"<?xml version=\"1.0\"?>\n"
+	"<scpd xmlns=\"urn:schemas-upnp-org:service-1-0\">\n"
+	"<specVersion><major>1</major><minor>0</minor></specVersion>\n"
+	"<actionList>\n"
+	"<action><name>GetSearchCapabilities</name><argumentList>"
+	ARG("SearchCaps", "out", "SearchCapabilities")
+	"</argumentList></action>\n"
+	"<action><name>GetSortCapabilities</name><argumentList>"
+	ARG("SortCaps", "out", "SortCapabilities")
+	"</argumentList></action>\n"
+	"<action><name>GetSystemUpdateID</name><argumentList>"
+	ARG("Id", "out", "SystemUpdateID")
+	"</argumentList></action>\n"
+	"<action><name>Browse</name><argumentList>"
+	ARG("ObjectID", "in", "A_ARG_TYPE_ObjectID")
+	ARG("BrowseFlag", "in", "A_ARG_TYPE_BrowseFlag")
+	ARG("Filter", "in", "A_ARG_TYPE_Filter")
+	ARG("StartingIndex", "in", "A_ARG_TYPE_Index")
+	ARG("RequestedCount", "in", "A_ARG_TYPE_Count")
+	ARG("SortCriteria", "in", "A_ARG_TYPE_SortCriteria")
+	ARG("Result", "out", "A_ARG_TYPE_Result")
+	ARG("NumberReturned", "out", "A_ARG_TYPE_Count")
+	ARG("TotalMatches", "out", "A_ARG_TYPE_Count")
+	ARG("UpdateID", "out", "A_ARG_TYPE_UpdateID")
+	"</argumentList></action>\n"
+	"<action><name>Search</name><argumentList>"
+	ARG("ContainerID", "in", "A_ARG_TYPE_ObjectID")
+	ARG("SearchCriteria", "in", "A_ARG_TYPE_SearchCriteria")
+	ARG("Filter", "in", "A_ARG_TYPE_Filter")
+	ARG("StartingIndex", "in", "A_ARG_TYPE_Index")
+	ARG("RequestedCount", "in", "A_ARG_TYPE_Count")
+	ARG("SortCriteria", "in", "A_ARG_TYPE_SortCriteria")
+	ARG("Result", "out", "A_ARG_TYPE_Result")
+	ARG("NumberReturned", "out", "A_ARG_TYPE_Count")
+	ARG("TotalMatches", "out", "A_ARG_TYPE_Count")
+	ARG("UpdateID", "out", "A_ARG_TYPE_UpdateID")
+	"</argumentList></action>\n"
+	"</actionList>\n"
+	"<serviceStateTable>\n"
+	VAR("SearchCapabilities", "string", "no")
+	VAR("SortCapabilities", "string", "no")
+	VAR("SystemUpdateID", "ui4", "yes")
+	VAR("ContainerUpdateIDs", "string", "yes")
+	VAR("A_ARG_TYPE_ObjectID", "string", "no")
+	VAR("A_ARG_TYPE_Result", "string", "no")
+	VAR("A_ARG_TYPE_SearchCriteria", "string", "no")
+	VAR("A_ARG_TYPE_BrowseFlag", "string", "no")
+	VAR("A_ARG_TYPE_Filter", "string", "no")
+	VAR("A_ARG_TYPE_SortCriteria", "string", "no")
+	VAR("A_ARG_TYPE_Index", "ui4", "no")
+	VAR("A_ARG_TYPE_Count", "ui4", "no")
+	VAR("A_ARG_TYPE_UpdateID", "ui4", "no")
+	"</serviceStateTable>\n"
+	"</scpd>\n";
+
+static const char DIDL_BEGIN[] =
+	"<DIDL-Lite xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\""
+	" xmlns:dc=\"http://purl.org/dc/elements/1.1/\""
+	" xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\">";
+
+static const char DIDL_END[] = "</DIDL-Lite>";
+
+
+
+/*****************************************************************************
+ * Synthetic library
+ *****************************************************************************/
+
+typedef struct _Object {
+	unsigned	depth;			// 0 = root
+	unsigned	index [MAX_DEPTH + 1];	// from the root
+} Object;
+
+
+static bool
+IsItem (const Object* o)
+{
+	return o->depth > g_opt.depth;
+}
+
+static unsigned
+GetChildCount (const Object* o)
+{
+	if (IsItem (o))
+		return 0; // ---------->
+	return (o->depth < g_opt.depth ? g_opt.fanout : g_opt.nb_items);
+}
+
+static void
+GetChild (const Object* o, unsigned i, Object* child)
+{
+	*child = *o;
+	child->index [child->depth++] = i;
+}
+
+static void
+GetParent (const Object* o, Object* parent)
+{
+	*parent = *o;
+	if (parent->depth > 0)
+		parent->depth--;
+}
+
+
+/*****************************************************************************
+ * ParseId
+ *****************************************************************************/
+static bool
+ParseId (const char* id, Object* o)
+{
+	*o = (Object) { .depth = 0 };
+	if (id == NULL || *id++ != '0')
+		return false; // ---------->
+	while (*id == '.') {
+		const unsigned count = GetChildCount (o);
+		char* end = NULL;
+		errno = 0;
+		const unsigned long i = strtoul (id + 1, &end, 10);
+		if (end == id + 1 || errno || i >= count)
+			return false; // ---------->
+		GetChild (o, i, o);
+		id = end;
+	}
+	return (*id == NUL);
+}
+
+
+/*****************************************************************************
+ * PrintId
+ *****************************************************************************/
+static void
+PrintId (FILE* file, const Object* o)
+{
+	fputc ('0', file);
+	unsigned i;
+	for (i = 0; i < o->depth; i++)
+		fprintf (file, ".%u", o->index[i]);
+}
+
+
+/*****************************************************************************
+ * GetTitle
+ *
+ * Titles are unique among siblings, and padded to 'title_len' bytes.
+ *****************************************************************************/
+static const char*
+GetTitle (const Object* o, char* buffer, size_t size)
+{
+	static const char* const PREFIX[] = {
+		[TITLE_ASCII]  = "",
+		[TITLE_LATIN1] = "\xc3\x89t\xc3\xa9 \xc3\xa0 No\xc3\xabl ",
+		[TITLE_CJK]    = "\xe9\x9f\xb3\xe6\xa5\xbd ",
+	};
+	int n;
+	if (o->depth == 0)
+		n = snprintf (buffer, size, "%sLibrary",
+			      PREFIX [g_opt.charset]);
+	else
+		n = snprintf (buffer, size, "%s%s %u", PREFIX [g_opt.charset],
+			      (IsItem (o) ? "Track" : "Folder"),
+			      o->index [o->depth - 1]);
+	if (n < 0)
+		n = 0;
+	size_t len = MIN ((size_t) n, size - 1);
+	if (len < g_opt.title_len && len + 1 < size)
+		buffer [len++] = ' ';
+	while (len < g_opt.title_len && len + 1 < size) {
+		buffer [len] = 'a' + (len % 26);
+		len++;
+	}
+	buffer [len] = NUL;
+	return buffer;
+}
+
+
+/*****************************************************************************
+ * PrintObject
+ *
+ * Print the DIDL-Lite element of an object (titles have no characters
+ * to escape).
+ *****************************************************************************/
+static void
+PrintObject (FILE* file, const Object* o)
+{
+	const char* const tag = (IsItem (o) ? "item" : "container");
+	fprintf (file, "<%s id=\"", tag);
+	PrintId (file, o);
+	if (o->depth == 0) {
+		fputs ("\" parentID=\"-1", file);
+	} else {
+		Object parent;
+		GetParent (o, &parent);
+		fputs ("\" parentID=\"", file);
+		PrintId (file, &parent);
+	}
+	fputs ("\" restricted=\"1\"", file);
+	if (! IsItem (o))
+		fprintf (file, " childCount=\"%u\"", GetChildCount (o));
+
+	char title [1024];
+	fprintf (file, "><dc:title>%s</dc:title>",
+		 GetTitle (o, title, sizeof (title)));
+	if (IsItem (o)) {
+		fputs ("<upnp:class>object.item.audioItem.musicTrack"
+		       "</upnp:class>", file);
+		fprintf (file, "<res protocolInfo=\"http-get:*:audio/mpeg:*\""
+			 " size=\"%" PRIdMAX "\">%s" CONTENT_PATH,
+			 g_opt.item_size, g_base_url);
+		PrintId (file, o);
+		fputs (CONTENT_SUFFIX "</res>", file);
+	} else {
+		fputs ("<upnp:class>object.container.storageFolder"
+		       "</upnp:class>", file);
+	}
+	fprintf (file, "</%s>", tag);
+}
+
+
+
+/*****************************************************************************
+ * Injected latency and errors
+ *****************************************************************************/
+
+static void
+Delay (void)
+{
+	if (g_opt.latency > 0)
+		usleep (g_opt.latency * 1000);
+}
+
+static bool
+InjectError (void)
+{
+	if (g_opt.error_rate == 0)
+		return false; // ---------->
+	if (t_seed == 0)
+		t_seed = (unsigned int) (uintptr_t) &t_seed ^ time (NULL);
+	return (unsigned) (rand_r (&t_seed) % 100) < g_opt.error_rate;
+}
+
+
+
+/*****************************************************************************
+ * Actions
+ *****************************************************************************/
+
+typedef struct _Page {
+	unsigned long	start;
+	unsigned long	count;		// 0 = all
+	unsigned long	nb_matches;
+	unsigned long	nb_returned;
+	FILE*		file;
+} Page;
+
+
+/*****************************************************************************
+ * AddToPage
+ *****************************************************************************/
+static void
+AddToPage (Page* page, const Object* o)
+{
+	if (page->nb_matches >= page->start &&
+	    (page->count == 0 || page->nb_returned < page->count)) {
+		PrintObject (page->file, o);
+		page->nb_returned++;
+	}
+	page->nb_matches++;
+}
+
+
+/*****************************************************************************
+ * InitPage
+ *****************************************************************************/
+static int
+InitPage (Page* page, const IXML_Node* args, FILE* file)
+{
+	const char* const start = XMLUtil_FindFirstElementValue
+		(args, "StartingIndex", true, false);
+	const char* const count = XMLUtil_FindFirstElementValue
+		(args, "RequestedCount", true, false);
+	if (start == NULL || count == NULL)
+		return ERR_INVALID_ARGS; // ---------->
+	*page = (Page) {
+		.start = strtoul (start, NULL, 10),
+		.count = strtoul (count, NULL, 10),
+		.file  = file
+	};
+	if (g_opt.max_results > 0 &&
+	    (page->count == 0 || page->count > g_opt.max_results))
+		page->count = g_opt.max_results;
+	return 0;
+}
+
+
+/*****************************************************************************
+ * MakeResult
+ *****************************************************************************/
+static IXML_Document*
+MakeResult (void* tmp_ctx, const char* actionName, StringStream* ss,
+	    const Page* page)
+{
+	fputs (DIDL_END, StringStream_GetFile (ss));
+	char* const didl = StringStream_GetSnapshot (ss, tmp_ctx, NULL);
+	char returned [32], matches [32], update [32];
+	snprintf (returned, sizeof (returned), "%lu", page->nb_returned);
+	snprintf (matches, sizeof (matches), "%lu", page->nb_matches);
+	snprintf (update, sizeof (update), "%lu", g_update_id);
+	return UpnpMakeActionResponse (actionName, CDS_TYPE, 4,
+				       "Result", NN(didl),
+				       "NumberReturned", returned,
+				       "TotalMatches", matches,
+				       "UpdateID", update);
+}
+
+
+/*****************************************************************************
+ * Browse
+ *****************************************************************************/
+static int
+Browse (void* tmp_ctx, const IXML_Node* args, IXML_Document** result)
+{
+	Object o;
+	if (! ParseId (XMLUtil_FindFirstElementValue (args, "ObjectID",
+						      true, false), &o))
+		return ERR_NO_SUCH_OBJECT; // ---------->
+	const char* const flag = XMLUtil_FindFirstElementValue
+		(args, "BrowseFlag", true, false);
+	if (flag == NULL)
+		return ERR_INVALID_ARGS; // ---------->
+
+	StringStream* const ss = StringStream_Create (tmp_ctx);
+	FILE* const file = StringStream_GetFile (ss);
+	fputs (DIDL_BEGIN, file);
+	Page page;
+	int rc = InitPage (&page, args, file);
+	if (rc)
+		return rc; // ---------->
+
+	if (strcmp (flag, "BrowseMetadata") == 0) {
+		page = (Page) { .count = 1, .file = file };
+		AddToPage (&page, &o);
+	} else if (strcmp (flag, "BrowseDirectChildren") == 0) {
+		// Only the objects returned are computed
+		const unsigned long total = GetChildCount (&o);
+		unsigned long i;
+		for (i = page.start; i < total && (page.count == 0 ||
+			     page.nb_returned < page.count); i++) {
+			Object child;
+			GetChild (&o, i, &child);
+			PrintObject (file, &child);
+			page.nb_returned++;
+		}
+		page.nb_matches = total;
+	} else {
+		return ERR_INVALID_ARGS; // ---------->
+	}
+	*result = MakeResult (tmp_ctx, "Browse", ss, &page);
+	return 0;
+}
+
+
+/*****************************************************************************
+ * SearchTree
+ *
+ * Only 'dc:title contains "..."' is understood : any other criteria
+ * matches all the items.
+ *****************************************************************************/
+static void
+SearchTree (const Object* o, const char* text, Page* page)
+{
+	if (IsItem (o)) {
+		char title [1024];
+		if (text == NULL ||
+		    strstr (GetTitle (o, title, sizeof (title)), text))
+			AddToPage (page, o);
+	} else {
+		const unsigned n = GetChildCount (o);
+		unsigned i;
+		for (i = 0; i < n; i++) {
+			Object child;
+			GetChild (o, i, &child);
+			SearchTree (&child, text, page);
+		}
+	}
+}
+
+
+/*****************************************************************************
+ * Search
+ *****************************************************************************/
+static int
+Search (void* tmp_ctx, const IXML_Node* args, IXML_Document** result)
+{
+	Object o;
+	if (! ParseId (XMLUtil_FindFirstElementValue (args, "ContainerID",
+						      true, false), &o))
+		return ERR_NO_SUCH_OBJECT; // ---------->
+	const char* const criteria = XMLUtil_FindFirstElementValue
+		(args, "SearchCriteria", true, false);
+
+	char* text = NULL;
+	const char* p = (criteria ? strstr (criteria, "dc:title") : NULL);
+	p = (p ? strstr (p, "contains") : NULL);
+	p = (p ? strchr (p, '"') : NULL);
+	if (p) {
+		p++;
+		text = talloc_strndup (tmp_ctx, p, strcspn (p, "\""));
+	}
+
+	StringStream* const ss = StringStream_Create (tmp_ctx);
+	FILE* const file = StringStream_GetFile (ss);
+	fputs (DIDL_BEGIN, file);
+	Page page;
+	int rc = InitPage (&page, args, file);
+	if (rc)
+		return rc; // ---------->
+	SearchTree (&o, text, &page);
+	*result = MakeResult (tmp_ctx, "Search", ss, &page);
+	return 0;
+}
+
+
+/*****************************************************************************
+ * HandleAction
+ *****************************************************************************/
+static void
+HandleAction (struct Upnp_Action_Request* req)
+{
+	void* const tmp_ctx = talloc_new (NULL);
+	char buffer [32];
+	IXML_Document* result = NULL;
+	int rc = 0;
+
+	Log_Printf (LOG_DEBUG, "Action '%s'", req->ActionName);
+	Delay();
+	const IXML_Node* const args = XML_D2N (req->ActionRequest);
+	if (InjectError()) {
+		rc = ERR_ACTION_FAILED;
+	} else if (strcmp (req->ActionName, "Browse") == 0) {
+		rc = Browse (tmp_ctx, args, &result);
+	} else if (strcmp (req->ActionName, "Search") == 0) {
+		rc = Search (tmp_ctx, args, &result);
+	} else if (strcmp (req->ActionName, "GetSearchCapabilities") == 0) {
+		result = UpnpMakeActionResponse (req->ActionName, CDS_TYPE, 1,
+						 "SearchCaps", "dc:title");
+	} else if (strcmp (req->ActionName, "GetSortCapabilities") == 0) {
+		result = UpnpMakeActionResponse (req->ActionName, CDS_TYPE, 1,
+						 "SortCaps", "");
+	} else if (strcmp (req->ActionName, "GetSystemUpdateID") == 0) {
+		snprintf (buffer, sizeof (buffer), "%lu", g_update_id);
+		result = UpnpMakeActionResponse (req->ActionName, CDS_TYPE, 1,
+						 "Id", buffer);
+	} else {
+		rc = ERR_INVALID_ACTION;
+	}
+
+	if (rc == 0 && result == NULL)
+		rc = ERR_ACTION_FAILED;
+	req->ErrCode = (rc ? rc : UPNP_E_SUCCESS);
+	req->ActionResult = result;
+	if (rc) {
+		snprintf (req->ErrStr, sizeof (req->ErrStr), "%s",
+			  (rc == ERR_NO_SUCH_OBJECT ? "No such object" :
+			   rc == ERR_INVALID_ARGS ? "Invalid Args" :
+			   rc == ERR_INVALID_ACTION ? "Invalid Action" :
+			   "Action Failed"));
+		Log_Printf (LOG_WARNING, "Action '%s' : error %d (%s)",
+			    req->ActionName, rc, req->ErrStr);
+	}
+	talloc_free (tmp_ctx);
+}
+
+
+/*****************************************************************************
+ * EventCallback
+ *****************************************************************************/
+static int
+EventCallback (Upnp_EventType type, void* event, void* cookie)
+{
+	switch (type) {
+	case UPNP_CONTROL_ACTION_REQUEST:
+		HandleAction ((struct Upnp_Action_Request*) event);
+		break;
+
+	case UPNP_CONTROL_GET_VAR_REQUEST:
+	{
+		struct Upnp_State_Var_Request* const req =
+			(struct Upnp_State_Var_Request*) event;
+		if (strcmp (req->StateVarName, "SystemUpdateID") == 0) {
+			char buffer [32];
+			snprintf (buffer, sizeof (buffer), "%lu", g_update_id);
+			req->CurrentVal = ixmlCloneDOMString (buffer);
+			req->ErrCode = UPNP_E_SUCCESS;
+		} else {
+			req->ErrCode = ERR_INVALID_ARGS;
+		}
+		break;
+	}
+
+	case UPNP_EVENT_SUBSCRIPTION_REQUEST:
+	{
+		struct Upnp_Subscription_Request* const req =
+			(struct Upnp_Subscription_Request*) event;
+		char buffer [32];
+		snprintf (buffer, sizeof (buffer), "%lu", g_update_id);
+		const char* names[]  = { "SystemUpdateID",
+					 "ContainerUpdateIDs" };
+		const char* values[] = { buffer, "" };
+		int const rc = UpnpAcceptSubscription
+			(g_device, req->UDN, req->ServiceId, names, values,
+			 2, req->Sid);
+		Log_Printf (LOG_DEBUG, "Subscription '%s' : %d", req->Sid, rc);
+		break;
+	}
+
+	default:
+		Log_Printf (LOG_DEBUG, "Ignored event %d", (int) type);
+		break;
+	}
+	return 0;
+}
+
+
+/*****************************************************************************
+ * EventLoop
+ *
+ * Periodically notifies a change of the library, to the subscribers.
+ *****************************************************************************/
+static void*
+EventLoop (void* arg)
+{
+	while (true) {
+		isleep (g_opt.event_period);
+		const unsigned long id =
+			__sync_add_and_fetch (&g_update_id, 1);
+		char update [32];
+		char containers [64];
+		snprintf (update, sizeof (update), "%lu", id);
+		snprintf (containers, sizeof (containers), "0,%lu", id);
+		const char* names[]  = { "SystemUpdateID",
+					 "ContainerUpdateIDs" };
+		const char* values[] = { update, containers };
+		int const rc = UpnpNotify (g_device, g_udn, CDS_ID,
+					   names, values, 2);
+		if (rc != UPNP_E_SUCCESS)
+			Log_Printf (LOG_ERROR, "UpnpNotify error %d (%s)",
+				    rc, UpnpGetErrorMessage (rc));
+	}
+	return NULL;
+}
+
+
+
+/*****************************************************************************
+ * Web server : description of the service, and content of the items
+ *
+ * The web server of libupnp handles the HTTP requests, including ranges
+ * (using "seek") : the content is generated on the fly.
+ *****************************************************************************/
+
+typedef struct _WebFile {
+	const char*	text;	// NULL => generated content
+	intmax_t	size;
+	intmax_t	pos;
+	size_t		seed;
+} WebFile;
+
+
+/*****************************************************************************
+ * OpenWebFile
+ *****************************************************************************/
+static bool
+OpenWebFile (const char* filename, WebFile* f)
+{
+	if (strcmp (filename, SCPD_PATH) == 0) {
+		*f = (WebFile) { .text = SCPD, .size = sizeof (SCPD) - 1 };
+		return true; // ---------->
+	}
+	const size_t prefix = sizeof (CONTENT_PATH) - 1;
+	const size_t suffix = sizeof (CONTENT_SUFFIX) - 1;
+	const size_t len = strlen (filename);
+	if (len <= prefix + suffix ||
+	    strncmp (filename, CONTENT_PATH, prefix) != 0 ||
+	    strcmp (filename + len - suffix, CONTENT_SUFFIX) != 0)
+		return false; // ---------->
+
+	char id [len];
+	memcpy (id, filename + prefix, len - prefix - suffix);
+	id [len - prefix - suffix] = NUL;
+	Object o;
+	if (! ParseId (id, &o) || ! IsItem (&o))
+		return false; // ---------->
+	*f = (WebFile) { .size = g_opt.item_size, .seed = String_Hash (id) };
+	return true;
+}
+
+
+static int
+WebGetInfo (const char* filename, struct File_Info* info)
+{
+	WebFile f;
+	if (! OpenWebFile (filename, &f))
+		return -1; // ---------->
+	info->file_length   = f.size;
+	info->last_modified = 0;
+	info->is_directory  = 0;
+	info->is_readable   = 1;
+	info->content_type  = ixmlCloneDOMString (f.text ? "text/xml"
+						  : "audio/mpeg");
+	return 0;
+}
+
+static UpnpWebFileHandle
+WebOpen (const char* filename, enum UpnpOpenFileMode mode)
+{
+	Log_Printf (LOG_DEBUG, "Open '%s'", filename);
+	if (mode != UPNP_READ)
+		return NULL; // ---------->
+	Delay();
+	if (InjectError()) {
+		Log_Printf (LOG_WARNING, "Open '%s' : injected error",
+			    filename);
+		return NULL; // ---------->
+	}
+	WebFile* const f = talloc (NULL, WebFile);
+	if (f && ! OpenWebFile (filename, f)) {
+		talloc_free (f);
+		return NULL; // ---------->
+	}
+	return f;
+}
+
+static int
+WebRead (UpnpWebFileHandle handle, char* buf, size_t buflen)
+{
+	WebFile* const f = (WebFile*) handle;
+	const size_t n = (f->pos >= f->size ? 0 :
+			  MIN (buflen, (size_t) (f->size - f->pos)));
+	if (f->text) {
+		memcpy (buf, f->text + f->pos, n);
+	} else {
+		// Same bytes for the same offset, whatever the ranges
+		size_t i;
+		for (i = 0; i < n; i++) {
+			const uintmax_t off = f->pos + i;
+			buf[i] = (char) (f->seed + off * 31 + (off >> 10));
+		}
+		if (g_opt.bandwidth > 0)
+			usleep ((uint64_t) n * 1000000 /
+				((uint64_t) g_opt.bandwidth * 1024));
+	}
+	f->pos += n;
+	return n;
+}
+
+static int
+WebWrite (UpnpWebFileHandle handle, char* buf, size_t buflen)
+{
+	return -1;
+}
+
+static int
+WebSeek (UpnpWebFileHandle handle, off_t offset, int origin)
+{
+	WebFile* const f = (WebFile*) handle;
+	intmax_t pos;
+	switch (origin) {
+	case SEEK_SET:	pos = offset; break;
+	case SEEK_CUR:	pos = f->pos + offset; break;
+	case SEEK_END:	pos = f->size + offset; break;
+	default:	return -1; // ---------->
+	}
+	if (pos < 0 || pos > f->size)
+		return -1; // ---------->
+	f->pos = pos;
+	return 0;
+}
+
+static int
+WebClose (UpnpWebFileHandle handle)
+{
+	talloc_free (handle);
+	return 0;
+}
+
+
+
+/*****************************************************************************
+ * stdout_print
+ *****************************************************************************/
+static void
+stdout_print (Log_Level level, const char* const msg)
+{
+	Log_BeginColor (level, stdout);
+	switch (level) {
+	case LOG_ERROR:    printf ("[E] "); break;
+	case LOG_WARNING:  printf ("[W] "); break;
+	case LOG_INFO:	   printf ("[I] "); break;
+	case LOG_DEBUG:	   printf ("[D] "); break;
+	default:
+		printf ("[%d] ", (int) level);
+		break;
+	}
+	printf ("%s", msg);
+	Log_EndColor (level, stdout);
+	printf ("\n");
+}
+
+
+/*****************************************************************************
+ * usage
+ *****************************************************************************/
+static void
+usage (FILE* stream, const char* progname)
+{
+	fprintf (stream,
+		 "usage: %s [options]\n"
+		 "\n"
+		 "Serves a synthetic library as a UPnP MediaServer.\n"
+		 "\n"
+		 "Library:\n"
+		 "    -d depth       levels of containers (default %u)\n"
+		 "    -f fanout      sub-containers per container "
+		 "(default %u)\n"
+		 "    -n items       items per container at the last level "
+		 "(default %u)\n"
+		 "    -t length      minimum title length, in bytes\n"
+		 "    -c charset     titles : ascii, latin1 or cjk "
+		 "(default ascii)\n"
+		 "    -s bytes       size of the items (default %" PRIdMAX
+		 ")\n"
+		 "    -m count       maximum results per Browse or Search\n"
+		 "Injected faults:\n"
+		 "    -l msec        latency of each action, "
+		 "and of opening files\n"
+		 "    -b kbytes      bandwidth per file, in KB/s\n"
+		 "    -e percent     percentage of failed actions "
+		 "and files\n"
+		 "    -u seconds     period of update events\n"
+		 "Network:\n"
+		 "    -i address     IP address (default : first interface)\n"
+		 "    -p port        port (default : any)\n"
+		 "    -N name        friendly name\n"
+		 "    -v             debug messages\n",
+		 progname, g_opt.depth, g_opt.fanout, g_opt.nb_items,
+		 g_opt.item_size);
+}
+
+
+/*****************************************************************************
+ * main
+ *****************************************************************************/
+int
+main (int argc, char* argv[])
+{
+	int rc;
+	Log_Level max_level = LOG_INFO;
+
+	int opt;
+	while ((opt = getopt (argc, argv, "d:f:n:t:c:s:m:l:b:e:u:i:p:N:vh"))
+	       != -1) {
+		switch (opt) {
+		case 'd': g_opt.depth	     = atoi (optarg); break;
+		case 'f': g_opt.fanout	     = atoi (optarg); break;
+		case 'n': g_opt.nb_items     = atoi (optarg); break;
+		case 't': g_opt.title_len    = atoi (optarg); break;
+		case 's': g_opt.item_size    = strtoimax (optarg, NULL, 10);
+			  break;
+		case 'm': g_opt.max_results  = atoi (optarg); break;
+		case 'l': g_opt.latency	     = atoi (optarg); break;
+		case 'b': g_opt.bandwidth    = atoi (optarg); break;
+		case 'e': g_opt.error_rate   = atoi (optarg); break;
+		case 'u': g_opt.event_period = atoi (optarg); break;
+		case 'i': g_opt.ip_address   = optarg; break;
+		case 'p': g_opt.port	     = atoi (optarg); break;
+		case 'N': g_opt.name	     = optarg; break;
+		case 'v': max_level	     = LOG_DEBUG; break;
+		case 'c':
+			if (strcmp (optarg, "ascii") == 0)
+				g_opt.charset = TITLE_ASCII;
+			else if (strcmp (optarg, "latin1") == 0)
+				g_opt.charset = TITLE_LATIN1;
+			else if (strcmp (optarg, "cjk") == 0)
+				g_opt.charset = TITLE_CJK;
+			else {
+				usage (stderr, argv[0]);
+				exit (EXIT_FAILURE); // ---------->
+			}
+			break;
+		case 'h':
+			usage (stdout, argv[0]);
+			exit (EXIT_SUCCESS); // ---------->
+		default:
+			usage (stderr, argv[0]);
+			exit (EXIT_FAILURE); // ---------->
+		}
+	}
+	if (optind < argc || g_opt.depth > MAX_DEPTH || g_opt.fanout < 1 ||
+	    g_opt.item_size < 0) {
+		usage (stderr, argv[0]);
+		exit (EXIT_FAILURE); // ---------->
+	}
+
+	talloc_enable_leak_report();
+
+	rc = Log_Initialize (stdout_print);
+	if (rc != 0) {
+		fprintf (stderr, "Error initialising Log\n");
+		exit (rc); // ---------->
+	}
+	Log_Colorize (true);
+	Log_SetMaxLevel (max_level);
+
+	// Signals are caught by the main thread only (see sigwait below)
+	sigset_t sigs_to_catch;
+	sigemptyset (&sigs_to_catch);
+	sigaddset (&sigs_to_catch, SIGINT);
+	sigaddset (&sigs_to_catch, SIGTERM);
+	pthread_sigmask (SIG_BLOCK, &sigs_to_catch, NULL);
+
+	rc = UpnpInit (g_opt.ip_address, g_opt.port);
+	if (rc != UPNP_E_SUCCESS) {
+		Log_Printf (LOG_ERROR, "UpnpInit error %d (%s)",
+			    rc, UpnpGetErrorMessage (rc));
+		UpnpFinish();
+		exit (EXIT_FAILURE); // ---------->
+	}
+	snprintf (g_base_url, sizeof (g_base_url), "http://%s:%u",
+		  UpnpGetServerIpAddress(),
+		  (unsigned) UpnpGetServerPort());
+	snprintf (g_udn, sizeof (g_udn),
+		  "uuid:djmount-test-mediaserver-%u-%lu",
+		  (unsigned) UpnpGetServerPort(), (unsigned long) getpid());
+
+	static struct UpnpVirtualDirCallbacks callbacks = {
+		.get_info = WebGetInfo,
+		.open	  = WebOpen,
+		.read	  = WebRead,
+		.write	  = WebWrite,
+		.seek	  = WebSeek,
+		.close	  = WebClose,
+	};
+	rc = UpnpEnableWebserver (1);
+	if (rc == UPNP_E_SUCCESS)
+		rc = UpnpSetVirtualDirCallbacks (&callbacks);
+	if (rc == UPNP_E_SUCCESS)
+		rc = UpnpAddVirtualDir (VIRTUAL_DIR);
+	if (rc == UPNP_E_SUCCESS) {
+		char* const desc = talloc_asprintf (NULL, DESCRIPTION,
+						    g_opt.name, g_udn);
+		rc = UpnpRegisterRootDevice2 (UPNPREG_BUF_DESC, desc,
+					      strlen (desc), 1,
+					      EventCallback, NULL,
+					      &g_device);
+		talloc_free (desc);
+	}
+	if (rc == UPNP_E_SUCCESS)
+		rc = UpnpSendAdvertisement (g_device, ADVERTISEMENT_EXPIRE);
+	if (rc != UPNP_E_SUCCESS) {
+		Log_Printf (LOG_ERROR, "Error starting the device : %d (%s)",
+			    rc, UpnpGetErrorMessage (rc));
+		UpnpFinish();
+		exit (EXIT_FAILURE); // ---------->
+	}
+
+	if (g_opt.event_period > 0) {
+		ithread_t event_thread;
+		ithread_create (&event_thread, NULL, EventLoop, NULL);
+	}
+
+	uintmax_t nb_items = g_opt.nb_items;
+	unsigned i;
+	for (i = 0; i < g_opt.depth; i++)
+		nb_items *= g_opt.fanout;
+	Log_Printf (LOG_INFO, "Serving '%s' (%s) at %s : %" PRIuMAX
+		    " items of %" PRIdMAX " bytes", g_opt.name, g_udn,
+		    g_base_url, nb_items, g_opt.item_size);
+
+	int sig;
+	sigwait (&sigs_to_catch, &sig);
+	Log_Printf (LOG_INFO, "Shutting down on signal %d...", sig);
+
+	UpnpUnRegisterRootDevice (g_device);
+	UpnpFinish();
+	Log_Finish();
+
+	exit (EXIT_SUCCESS);
+}
+
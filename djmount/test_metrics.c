@@ -0,0 +1,154 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * Testing Metrics.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+ 
+#include <config.h>
+
+#include "metrics.h"
+#include "talloc_util.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+
+#undef NDEBUG
+#include <assert.h>
+
+
+#define NB_THREADS	4
+#define NB_LOOPS	1000
+
+
+static Metrics_Id g_counter = METRICS_NONE;
+static Metrics_Id g_histogram = METRICS_NONE;
+
+
+static void*
+thread_loop (void* arg)
+{
+	int i;
+	for (i = 0; i < NB_LOOPS; i++) {
+		Metrics_Add (g_counter, 1);
+		Metrics_Observe (g_histogram, 1000);
+	}
+	return NULL;
+}
+
+
+static void
+assert_contains (const char* text, const char* line)
+{
+	if (strstr (text, line) == NULL) {
+		fprintf (stderr, "missing line '%s'\n", line);
+		assert (0);
+	}
+}
+
+
+int 
+main (int argc, char* argv[])
+{
+	talloc_enable_leak_report();
+
+	// Create a working context for memory allocations
+	void* const ctx = talloc_new (NULL);
+
+	g_counter = Metrics_Register (METRICS_COUNTER, "test_total", 
+				      "Test counter", NULL);
+	g_histogram = Metrics_Register (METRICS_HISTOGRAM, "test_seconds",
+					"Test histogram", "op=\"a\"");
+	assert (g_counter != METRICS_NONE && g_histogram != METRICS_NONE);
+	assert (g_counter != g_histogram);
+
+	// Same name and labels => same series
+	assert (Metrics_Register (METRICS_COUNTER, "test_total", "", "") 
+		== g_counter);
+	const Metrics_Id other = Metrics_Register 
+		(METRICS_COUNTER, "test_total", "", "k=\"2\"");
+	assert (other != g_counter);
+	Metrics_Add (METRICS_NONE, 1);
+
+	// Values of all the threads (ended or not) are summed
+	pthread_t threads [NB_THREADS];
+	int i;
+	for (i = 0; i < NB_THREADS; i++)
+		assert (pthread_create (threads + i, NULL, thread_loop, 
+					NULL) == 0);
+	for (i = 0; i < NB_THREADS; i++)
+		pthread_join (threads[i], NULL);
+	Metrics_Add (other, 5);
+	Metrics_Observe (g_histogram, 3);
+	Metrics_Observe (g_histogram, 1ULL << 40);
+
+	// Registered after the shard of this thread was allocated
+	const Metrics_Id bounds = Metrics_Register 
+		(METRICS_HISTOGRAM, "test_bounds_seconds", "Bounds", NULL);
+	assert (bounds != METRICS_NONE);
+	Metrics_Observe (bounds, (1ULL << 26) - 1);
+	Metrics_Observe (bounds, 1ULL << 26);
+	Metrics_Observe (bounds, (1ULL << 27) - 1);
+	Metrics_Observe (bounds, 1ULL << 27);
+
+	// Histograms of many devices : the values grow as needed
+	Metrics_Id many = METRICS_NONE;
+	for (i = 0; i < 200; i++) {
+		char labels [32];
+		sprintf (labels, "device=\"%d\"", i);
+		many = Metrics_Register (METRICS_HISTOGRAM, 
+					 "test_many_seconds", "Many", labels);
+		assert (many != METRICS_NONE);
+	}
+	Metrics_Observe (many, 10);
+
+	char* const text = Metrics_GetPrometheus (ctx);
+	assert (text != NULL);
+	printf ("%s", text);
+	assert_contains (text, "# TYPE test_total counter\n");
+	assert_contains (text, "\ntest_total 4000\n");
+	assert_contains (text, "\ntest_total{k=\"2\"} 5\n");
+	assert_contains (text, "# TYPE test_seconds histogram\n");
+	// Buckets are cumulative ; 1000 us is in [896, 1023]
+	assert_contains (text, "test_seconds_bucket{op=\"a\",le=\"0.000003\"} 1\n");
+	assert_contains (text, "test_seconds_bucket{op=\"a\",le=\"0.000895\"} 1\n");
+	assert_contains (text, "test_seconds_bucket{op=\"a\",le=\"0.001023\"} 4001\n");
+	assert_contains (text, "test_seconds_bucket{op=\"a\",le=\"+Inf\"} 4002\n");
+	assert_contains (text, "test_seconds_count{op=\"a\"} 4002\n");
+	assert_contains (text, "test_seconds_sum{op=\"a\"} 1099515.627779\n");
+	// Last finite bucket ends at 2^27 - 1 us, larger ones are +Inf
+	assert_contains (text, "test_bounds_seconds_bucket{le=\"67.108863\"} 1\n");
+	assert_contains (text, "test_bounds_seconds_bucket{le=\"83.886079\"} 2\n");
+	assert_contains (text, 
+			 "test_bounds_seconds_bucket{le=\"134.217727\"} 3\n"
+			 "test_bounds_seconds_bucket{le=\"+Inf\"} 4\n");
+	assert_contains (text, "test_many_seconds_count{device=\"199\"} 1\n");
+	assert_contains (text, "test_many_seconds_count{device=\"0\"} 0\n");
+	// One header per metric name
+	assert (strstr (strstr (text, "# TYPE test_total") + 1, 
+			"# TYPE test_total") == NULL);
+	talloc_free (text);
+
+	// Delete all storage
+	talloc_free (ctx);
+
+	size_t bytes = talloc_total_size (NULL);
+	assert (bytes == 0);
+	
+	exit (0);
+}
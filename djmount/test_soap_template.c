@@ -0,0 +1,149 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * Testing SoapTemplate.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+ 
+#include <config.h>
+
+#include "soap_template.h"
+#include "talloc_util.h"
+#include <stdio.h>
+#include <string.h>
+
+
+#undef NDEBUG
+#include <assert.h>
+
+
+#define SERVICE_TYPE	"urn:schemas-upnp-org:service:ContentDirectory:1"
+
+#define BEGIN								\
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n"		\
+	"<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" " \
+	"s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\">" \
+	"<s:Body>"
+
+#define END	"</s:Body></s:Envelope>\r\n"
+
+
+static void
+test_no_params (void* ctx)
+{
+	SoapTemplate* const t = SoapTemplate_Create 
+		(ctx, SERVICE_TYPE, "GetSearchCapabilities", 0, NULL);
+	assert (t != NULL);
+	assert (strcmp (SoapTemplate_GetHeaders (t), "SOAPACTION: \"" 
+			SERVICE_TYPE "#GetSearchCapabilities\"\r\n") == 0);
+	assert (SoapTemplate_Matches (t, "GetSearchCapabilities", 0, NULL));
+	assert (! SoapTemplate_Matches (t, "Browse", 0, NULL));
+
+	char* buffer = NULL;
+	size_t bufsize = 0;
+	const size_t len = SoapTemplate_Fill (t, NULL, &buffer, &bufsize);
+	const char* const expected = BEGIN 
+		"<u:GetSearchCapabilities xmlns:u=\"" SERVICE_TYPE "\">"
+		"</u:GetSearchCapabilities>" END;
+	assert (len == strlen (expected));
+	assert (strcmp (buffer, expected) == 0);
+	talloc_free (buffer);
+}
+
+
+static void
+test_params (void* ctx)
+{
+	StringPair params[] = {
+		{ "ObjectID",	"0" },
+		{ "BrowseFlag",	"BrowseDirectChildren" },
+		{ "Filter",	"*" },
+		{ "SortCriteria", NULL },
+	};
+	SoapTemplate* const t = SoapTemplate_Create (ctx, SERVICE_TYPE, 
+						     "Browse", 4, params);
+	assert (t != NULL);
+	assert (SoapTemplate_Matches (t, "Browse", 4, params));
+	assert (! SoapTemplate_Matches (t, "Browse", 3, params));
+	assert (! SoapTemplate_Matches (t, "Search", 4, params));
+	StringPair other[] = {
+		{ "ContainerID", "0" },
+		{ "BrowseFlag",	 "BrowseDirectChildren" },
+		{ "Filter",	 "*" },
+		{ "SortCriteria", NULL },
+	};
+	assert (! SoapTemplate_Matches (t, "Browse", 4, other));
+
+	// Reuse the same buffer, growing it
+	char* buffer = NULL;
+	size_t bufsize = 0;
+	size_t len = SoapTemplate_Fill (t, params, &buffer, &bufsize);
+	const char* expected = BEGIN 
+		"<u:Browse xmlns:u=\"" SERVICE_TYPE "\">"
+		"<ObjectID>0</ObjectID>"
+		"<BrowseFlag>BrowseDirectChildren</BrowseFlag>"
+		"<Filter>*</Filter>"
+		"<SortCriteria></SortCriteria>"
+		"</u:Browse>" END;
+	assert (len == strlen (expected));
+	assert (strcmp (buffer, expected) == 0);
+	assert (bufsize > len);
+
+	params[0].value = "a&b<c>d\"e";
+	params[3].value = "&&";
+	len = SoapTemplate_Fill (t, params, &buffer, &bufsize);
+	expected = BEGIN 
+		"<u:Browse xmlns:u=\"" SERVICE_TYPE "\">"
+		"<ObjectID>a&amp;b&lt;c&gt;d&quot;e</ObjectID>"
+		"<BrowseFlag>BrowseDirectChildren</BrowseFlag>"
+		"<Filter>*</Filter>"
+		"<SortCriteria>&amp;&amp;</SortCriteria>"
+		"</u:Browse>" END;
+	assert (len == strlen (expected));
+	assert (strcmp (buffer, expected) == 0);
+
+	// Shorter request in the same buffer
+	params[0].value = "1";
+	params[3].value = "";
+	const size_t old_bufsize = bufsize;
+	len = SoapTemplate_Fill (t, params, &buffer, &bufsize);
+	assert (len == strlen (buffer));
+	assert (strstr (buffer, "<ObjectID>1</ObjectID>") != NULL);
+	assert (bufsize == old_bufsize);
+	talloc_free (buffer);
+}
+
+
+int 
+main (int argc, char* argv[])
+{
+	talloc_enable_leak_report();
+
+	// Create a working context for memory allocations
+	void* const ctx = talloc_new (NULL);
+
+	test_no_params (ctx);
+	test_params (ctx);
+
+	// Delete all storage
+	talloc_free (ctx);
+
+	size_t bytes = talloc_total_size (NULL);
+	assert (bytes == 0);
+	
+	exit (0);
+}
@@ -105,6 +105,53 @@ test_string_to_int()
 	assert (imax == INTMAX_MAX);
 }
 
+static void
+test_string_hash64()
+{
+	// Reference values of the FNV-1a 64-bit hash
+	assert (String_Hash64 (STRING_HASH64_INIT, "") == 
+		UINT64_C(0xcbf29ce484222325));
+	assert (String_Hash64 (STRING_HASH64_INIT, "a") == 
+		UINT64_C(0xaf63dc4c8601ec8c));
+	assert (String_Hash64 (STRING_HASH64_INIT, "foobar") == 
+		UINT64_C(0x85944171f73967e8));
+
+	// Hashing in several parts
+	assert (String_Hash64 (String_Hash64 (STRING_HASH64_INIT, "foo"), 
+			       "bar") ==
+		String_Hash64 (STRING_HASH64_INIT, "foobar"));
+
+	assert (String_Hash64 (STRING_HASH64_INIT, "/a/b") !=
+		String_Hash64 (STRING_HASH64_INIT, "/a/c"));
+}
+
+static void
+test_string_is_ascii()
+{
+	assert (String_IsASCII (""));
+	assert (String_IsASCII ("a"));
+	assert (String_IsASCII ("Hello, World ! 0123456789 ~"));
+	assert (! String_IsASCII ("caf\xc3\xa9"));
+	assert (! String_IsASCII ("\xe9t\xe9"));
+
+	// Non-ASCII character at each position, around word boundaries
+	char buffer [64];
+	size_t len, i;
+	for (len = 1; len < 40; len++) {
+		memset (buffer, 'x', len);
+		buffer[len] = NUL;
+		assert (String_IsASCII (buffer));
+		assert (String_IsASCII (buffer + 1));
+		for (i = 0; i < len; i++) {
+			buffer[i] = '\x80';
+			assert (! String_IsASCII (buffer));
+			buffer[i] = '\x7f';
+			assert (String_IsASCII (buffer));
+			buffer[i] = 'x';
+		}
+	}
+}
+
 static void
 test_string_stream()
 {
@@ -159,6 +206,8 @@ main(int argc, char * argv[])
 
 	test_string_to_int();
 	test_string_stream();
+	test_string_hash64();
+	test_string_is_ascii();
 
 	size_t bytes = talloc_total_size (NULL);
 	assert (bytes == 0);
@@ -0,0 +1,113 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * Testing StringPool.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+ 
+#include <config.h>
+
+#include "string_pool.h"
+#include "talloc_util.h"
+#include <stdio.h>
+#include <string.h>
+
+
+#undef NDEBUG
+#include <assert.h>
+
+
+#define MUSIC_TRACK	"object.item.audioItem.musicTrack"
+
+
+static void
+test_get_release (void* ctx)
+{
+	StringPool* const pool = StringPool_Create (ctx);
+	assert (pool != NULL);
+	assert (StringPool_GetNrStrings (pool) == 0);
+	assert (StringPool_Get (pool, NULL) == NULL);
+
+	// Equal strings share the same copy
+	char buffer[] = MUSIC_TRACK;
+	const char* const s1 = StringPool_Get (pool, MUSIC_TRACK);
+	const char* const s2 = StringPool_Get (pool, buffer);
+	assert (s1 != NULL && s1 != buffer);
+	assert (s1 == s2);
+	assert (strcmp (s1, MUSIC_TRACK) == 0);
+	const char* const s3 = StringPool_Get (pool, "object.container");
+	assert (s3 != s1);
+	const char* const s4 = StringPool_Get (pool, "");
+	assert (s4 != NULL && *s4 == '\0');
+	assert (StringPool_GetNrStrings (pool) == 3);
+
+	// The copy is kept until the last reference is released
+	StringPool_Release (pool, s1);
+	assert (StringPool_GetNrStrings (pool) == 3);
+	assert (StringPool_Get (pool, buffer) == s2);
+	StringPool_Release (pool, s2);
+	StringPool_Release (pool, s2);
+	assert (StringPool_GetNrStrings (pool) == 2);
+	StringPool_Release (pool, s3);
+	StringPool_Release (pool, s4);
+	StringPool_Release (pool, NULL);
+	assert (StringPool_GetNrStrings (pool) == 0);
+
+	char* const status = StringPool_GetStatusString (pool, ctx, "  ");
+	assert (status != NULL);
+	printf ("%s", status);
+	talloc_free (status);
+
+	StringPool_Destroy (pool);
+}
+
+
+static void
+test_destroy (void* ctx)
+{
+	// Strings outlive the owner of the pool
+	void* const owner = talloc_new (ctx);
+	StringPool* const pool = StringPool_Create (owner);
+	assert (pool != NULL);
+	const char* const s = StringPool_Get (pool, MUSIC_TRACK);
+	assert (s != NULL);
+	StringPool_Destroy (pool);
+	talloc_free (owner);
+	assert (strcmp (s, MUSIC_TRACK) == 0);
+	StringPool_Release (pool, s);
+}
+
+
+int 
+main (int argc, char* argv[])
+{
+	talloc_enable_leak_report();
+
+	// Create a working context for memory allocations
+	void* const ctx = talloc_new (NULL);
+
+	test_get_release (ctx);
+	test_destroy (ctx);
+
+	// Delete all storage
+	talloc_free (ctx);
+
+	size_t bytes = talloc_total_size (NULL);
+	assert (bytes == 0);
+	
+	exit (0);
+}
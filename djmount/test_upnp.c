@@ -71,6 +71,7 @@ typedef enum CommandType {
 	CMD_LEAK, 
 	CMD_LEAK_FULL,
 	CMD_BROWSE, 
+	CMD_BROWSE_ASYNC, 
 	CMD_METADATA, 
 	CMD_LS,
 	CMD_SEARCHCAP,
@@ -107,6 +108,7 @@ static const struct CommandStruct CMDLIST[] = {
   { "refresh", 	CMD_REFRESH, 	1, ""},
   { "printdev", CMD_PRINTDEV, 	2, "<devname>"},
   { "browse", 	CMD_BROWSE, 	3, "<devname> <objectId>"},
+  { "abrowse", 	CMD_BROWSE_ASYNC, 3, "<devname> <objectId>"},
   { "metadata", CMD_METADATA, 	3, "<devname> <objectId>"},
   { "ls", 	CMD_LS, 	2, "<path>"},
   { "searchcap",CMD_SEARCHCAP,  2, "<devname>"},
@@ -196,6 +198,26 @@ static int fuse_dirfil_for_ls (fuse_dirh_t h, const char *name,
 }
 
 
+static void
+print_browse_result (void* cookie, int rc, 
+		     const ContentDir_BrowseResult* res)
+{
+	char* const objectId = cookie;
+	if (res == NULL) {
+		Log_Printf (LOG_MAIN, "abrowse '%s' : error %d", 
+			    objectId, rc);
+	} else {
+		Log_Printf (LOG_MAIN, "abrowse '%s' :", objectId);
+		const DIDLObject* o = NULL;
+		PTR_ARRAY_FOR_EACH_PTR (res->children->objects, o) {
+			Log_Printf (LOG_MAIN, "%6s \"%s\"", 
+				    NN(o->id), NN(o->basename));
+		} PTR_ARRAY_FOR_EACH_PTR_END;
+	}
+	talloc_free (objectId);
+}
+
+
 static int
 process_command (const char* cmdline)
 {
@@ -307,6 +329,21 @@ process_command (const char* cmdline)
 	}
 	break;
 	
+	case CMD_BROWSE_ASYNC:
+	{
+		// The result is printed later, by the callback
+		char* const objectId = talloc_strdup (NULL, strarg[2]);
+		DEVICE_LIST_CALL_SERVICE (rc, strarg[1], 
+					  CONTENT_DIR_SERVICE_TYPE,
+					  ContentDir, BrowseAsync, 
+					  objectId,
+					  CONTENT_DIR_BROWSE_DIRECT_CHILDREN,
+					  print_browse_result, objectId);
+		if (rc != UPNP_E_SUCCESS)
+			talloc_free (objectId);
+	}
+	break;
+	
 	case CMD_METADATA: {
 		const ContentDir_BrowseResult* res = NULL;
 		DEVICE_LIST_CALL_SERVICE (res, strarg[1], 
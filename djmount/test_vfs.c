@@ -603,7 +603,11 @@ main (int argc, char *argv[])
 #endif
 
 	fuse_argv[fuse_argc] = NULL; // End FUSE arguments list
+#if FUSE_USE_VERSION >= 26
+	rc = fuse_main (fuse_argc, fuse_argv, &fs_oper, NULL);
+#else
 	rc = fuse_main (fuse_argc, fuse_argv, &fs_oper);
+#endif
 	if (rc != 0) {
 		Log_Printf (LOG_ERROR, "Error in FUSE main loop = %d", rc);
 	}
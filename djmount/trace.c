@@ -0,0 +1,202 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * Trace : timing of the requests, from FUSE operations to the devices.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "trace.h"
+#include "talloc_util.h"
+#include "string_util.h"
+
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+
+// Number of spans kept (the oldest ones are overwritten)
+#define TRACE_RING_SIZE		4096
+
+#define TRACE_DETAIL_SIZE	64
+
+/*
+ * Each event has a sequence number : 0 while being written, then its
+ * position in the ring + 1 (the readers ignore the events modified 
+ * while they are copied).
+ */
+typedef struct _Event {
+	volatile uint64_t	seq;
+	const char*		name;
+	uint64_t		trace_id;
+	uint64_t		begin;
+	uint64_t		duration;
+	long			tid;
+	char			detail [TRACE_DETAIL_SIZE];
+} Event;
+
+static Event		 g_ring [TRACE_RING_SIZE];
+static volatile uint64_t g_next_event = 0;
+static volatile uint64_t g_next_trace_id = 0;
+
+// Current trace of the thread
+static __thread uint64_t t_trace_id = 0;
+static __thread unsigned t_depth = 0;
+static __thread long	 t_tid = 0;
+
+
+/*****************************************************************************
+ * Now
+ *****************************************************************************/
+static uint64_t
+Now (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/*****************************************************************************
+ * Trace_Begin
+ *****************************************************************************/
+void
+Trace_Begin (Trace_Span* span, const char* name, const char* detail)
+{
+	if (t_depth++ == 0)
+		t_trace_id = __sync_add_and_fetch (&g_next_trace_id, 1);
+	*span = (Trace_Span) {
+		.name = name, .detail = detail, 
+		.begin = Now(), .trace_id = t_trace_id
+	};
+}
+
+
+/*****************************************************************************
+ * Trace_End
+ *****************************************************************************/
+uint64_t
+Trace_End (Trace_Span* span)
+{
+	const uint64_t end = Now();
+	if (t_depth > 0)
+		t_depth--;
+	if (t_tid == 0)
+		t_tid = syscall (SYS_gettid);
+
+	const uint64_t pos = __sync_fetch_and_add (&g_next_event, 1);
+	Event* const e = g_ring + (pos % TRACE_RING_SIZE);
+	e->seq = 0;
+	__sync_synchronize();
+	e->name     = span->name;
+	e->trace_id = span->trace_id;
+	e->begin    = span->begin;
+	e->duration = end - span->begin;
+	e->tid      = t_tid;
+	if (span->detail) {
+		size_t len = strnlen (span->detail, sizeof (e->detail) - 1);
+		memcpy (e->detail, span->detail, len);
+		if (span->detail [len] != NUL) {
+			// Truncated : do not cut an UTF-8 character
+			while (len > 0 && (e->detail [len - 1] & 0xC0) == 0x80)
+				len--;
+			if (len > 0 && (e->detail [len - 1] & 0x80))
+				len--;
+		}
+		e->detail [len] = NUL;
+	} else {
+		e->detail[0] = NUL;
+	}
+	__sync_synchronize();
+	e->seq = pos + 1;
+	return e->duration;
+}
+
+
+/*****************************************************************************
+ * PrintJSONString
+ *****************************************************************************/
+static void
+PrintJSONString (FILE* file, const char* s)
+{
+	putc ('"', file);
+	for (; *s; s++) {
+		const unsigned char c = *s;
+		if (c == '"' || c == '\\')
+			fprintf (file, "\\%c", c);
+		else if (c < 0x20)
+			fprintf (file, "\\u%04x", c);
+		else
+			putc (c, file);
+	}
+	putc ('"', file);
+}
+
+
+/*****************************************************************************
+ * Trace_GetChromeJSON
+ *****************************************************************************/
+char*
+Trace_GetChromeJSON (void* result_context)
+{
+	StringStream* const ss = StringStream_Create (result_context);
+	if (ss == NULL)
+		return NULL; // ---------->
+	FILE* const file = StringStream_GetFile (ss);
+	const pid_t pid = getpid();
+
+	fprintf (file, "{\"traceEvents\":[");
+	const uint64_t last = g_next_event;
+	uint64_t pos = (last > TRACE_RING_SIZE ? last - TRACE_RING_SIZE : 0);
+	bool first = true;
+	for (; pos < last; pos++) {
+		const Event* const e = g_ring + (pos % TRACE_RING_SIZE);
+		if (e->seq != pos + 1)
+			continue; // being written, or overwritten ---------->
+		__sync_synchronize();
+		Event copy = *e;
+		__sync_synchronize();
+		if (e->seq != pos + 1)
+			continue; // overwritten meanwhile ---------->
+		copy.detail [sizeof (copy.detail) - 1] = NUL;
+
+		fprintf (file, "%s\n{\"name\":\"%s\",\"cat\":\"djmount\","
+			 "\"ph\":\"X\",\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 ","
+			 "\"pid\":%ld,\"tid\":%ld,"
+			 "\"args\":{\"trace\":%" PRIu64, 
+			 (first ? "" : ","), copy.name, copy.begin, 
+			 copy.duration, (long) pid, copy.tid, copy.trace_id);
+		if (copy.detail[0]) {
+			fprintf (file, ",\"detail\":");
+			PrintJSONString (file, copy.detail);
+		}
+		fprintf (file, "}}");
+		first = false;
+	}
+	fprintf (file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	char* const json = StringStream_GetSnapshot (ss, result_context, NULL);
+	talloc_free (ss);
+	return json;
+}
+
@@ -0,0 +1,94 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * Trace : timing of the requests, from FUSE operations to the devices.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/******************************************************************************
+ * @var Trace_Span
+ *
+ *	A span times a step of a request (e.g. a FUSE operation, a SOAP
+ *	action, a lock wait ...). Spans begun by a thread while another
+ *	span is open are its children : they share the identifier of the
+ *	outermost span (one identifier per FUSE operation).
+ *
+ *	The spans are recorded when they end, in a bounded in-memory 
+ *	buffer keeping the most recent ones, which can be exported in
+ *	the Chrome trace format (chrome://tracing, Perfetto ...).
+ *
+ *	All functions in this API are thread safe and lock-free.
+ *	The span itself is a local variable of the thread.
+ *
+ *****************************************************************************/
+
+typedef struct _Trace_Span {
+	const char*	name;	// static string
+	const char*	detail;	// copied when the span ends, or NULL
+	uint64_t	begin;	// microseconds
+	uint64_t	trace_id;
+} Trace_Span;
+
+
+/*****************************************************************************
+ * @brief 	Begins a span.
+ *
+ * @param span		the span to initialise
+ * @param name		the name of the step (shall be a static string)
+ * @param detail	additional information (e.g. the path or the 
+ *			object id), valid until Trace_End, or NULL
+ *****************************************************************************/
+void
+Trace_Begin (Trace_Span* span, const char* name, const char* detail);
+
+
+/*****************************************************************************
+ * @brief 	Ends a span, and records it.
+ *
+ * @return	the duration of the span, in microseconds
+ *****************************************************************************/
+uint64_t
+Trace_End (Trace_Span* span);
+
+
+/*****************************************************************************
+ * @brief 	Returns the recorded spans, in Chrome trace JSON format.
+ * 	  	The returned string should be freed using "talloc_free".
+ *****************************************************************************/
+char*
+Trace_GetChromeJSON (void* result_context);
+
+
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
+
+#endif // TRACE_H_INCLUDED
+
@@ -296,3 +296,52 @@ UpnpUtil_ResolveURL (void* talloc_context,
 	return talloc_strdup (talloc_context, resolved);
 }
 
+
+/******************************************************************************
+ * UpnpUtil_ReadBody
+ *****************************************************************************/
+int
+UpnpUtil_ReadBody (void* talloc_context, void* handle, 
+		   UpnpUtil_ReadFunction read, int contentLength,
+		   size_t max_size, int timeout, char** text)
+{
+	*text = NULL;
+	size_t n = 0;
+	size_t bufsize = ((contentLength > 0 && 
+			   (size_t) contentLength < max_size) ?
+			  contentLength + 1 : 8192);
+	char* buf = talloc_size (talloc_context, bufsize);
+	if (buf == NULL)
+		return UPNP_E_OUTOF_MEMORY; // ---------->
+
+	int rc = UPNP_E_SUCCESS;
+	while (true) {
+		if (n + 1 >= bufsize) {
+			if (bufsize >= max_size) {
+				rc = UPNP_E_BUFFER_TOO_SMALL;
+				break; // ---------->
+			}
+			bufsize *= 2;
+			char* const bigger = talloc_realloc_size 
+				(talloc_context, buf, bufsize);
+			if (bigger == NULL) {
+				rc = UPNP_E_OUTOF_MEMORY;
+				break; // ---------->
+			}
+			buf = bigger;
+		}
+		size_t read_size = bufsize - n - 1;
+		rc = read (handle, buf + n, &read_size, timeout);
+		if (rc != UPNP_E_SUCCESS || read_size == 0)
+			break; // ---------->
+		n += read_size;
+	}
+	if (rc != UPNP_E_SUCCESS) {
+		talloc_free (buf);
+	} else {
+		buf[n] = '\0';
+		*text = buf;
+	}
+	return rc;
+}
+
@@ -75,6 +75,35 @@ UpnpUtil_ResolveURL (void* talloc_context,
 		     const char* baseURL, const char* relURL);
 
 
+/******************************************************************************
+ * Function reading the body of an HTTP answer
+ * (e.g. "UpnpReadHttpGet" or "UpnpReadHttpResponse").
+ *****************************************************************************/
+typedef int (*UpnpUtil_ReadFunction) (void* handle, char* buf, 
+				      size_t* size, int timeout);
+
+
+/******************************************************************************
+ * Reads the whole body of an HTTP answer, into a nul-terminated string 
+ * (which should be freed using "talloc_free").
+ *
+ * @param talloc_context  parent context to allocate result, may be NULL
+ * @param handle	  the HTTP connection
+ * @param read		  the function reading from the connection
+ * @param contentLength	  the length announced by the server, if > 0
+ * @param max_size	  the maximum size of the body
+ * @param timeout	  timeout of each read, in seconds
+ * @param text		  set to the body if ok, else to NULL
+ * @param return   	  UPNP_E_SUCCESS, or an UPnP error code
+ *			  (UPNP_E_BUFFER_TOO_SMALL if the body is larger
+ *			  than max_size).
+ *****************************************************************************/
+int
+UpnpUtil_ReadBody (void* talloc_context, void* handle, 
+		   UpnpUtil_ReadFunction read, int contentLength,
+		   size_t max_size, int timeout, char** text);
+
+
 
 #ifdef __cplusplus
 }; // extern "C"
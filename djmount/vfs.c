@@ -31,12 +31,16 @@
 
 #include "didl_object.h"
 #include "file_buffer.h"
+#include "io_sched.h"
 #include "media_file.h"
 #include "talloc_util.h"
+#include "string_util.h"
 #include "log.h"
 #include "content_dir.h"
 #include "device_list.h"
 #include "xml_util.h"
+#include "trace.h"
+#include "metrics.h"
 
 
 
@@ -69,16 +73,40 @@ vfs_match_start_of_path (const char* path, const char* name)
 }
 
 
+/*****************************************************************************
+ * vfs_get_ino
+ *****************************************************************************/
+
+ino_t
+vfs_get_ino (ino_t const ino, const char* const dir_path, 
+	     const char* const name)
+{
+	if (ino)
+		return ino; // ---------->
+
+	// Same hash whether the file is listed in its directory, or browsed
+	uint64_t h = String_Hash64 (STRING_HASH64_INIT, NN(dir_path));
+	if (name) {
+		if (dir_path == NULL || strcmp (dir_path, "/") != 0)
+			h = String_Hash64 (h, "/");
+		h = String_Hash64 (h, name);
+	}
+	// 0 is not a valid inode number
+	return (h ? (ino_t) h : 1);
+}
+
+
 /*****************************************************************************
  * vfs_dir_begin
  *****************************************************************************/
 
 int
-vfs_dir_begin (register const VFS_Query* const q)
+vfs_dir_begin (ino_t const ino, register const VFS_Query* const q)
 {
 	int rc = 0;
 
 	if (q->stbuf) {
+		q->stbuf->st_ino   = vfs_get_ino (ino, q->path, NULL);
 		q->stbuf->st_mode  = S_IFDIR | 0555;
 		q->stbuf->st_nlink = 2;			
 		q->stbuf->st_size  = 512;
@@ -103,7 +131,8 @@ vfs_dir_begin (register const VFS_Query* const q)
  *****************************************************************************/
 
 int
-vfs_file_begin (int const d_type, register const VFS_Query* const q)
+vfs_file_begin (int const d_type, ino_t const ino, 
+		register const VFS_Query* const q)
 {
 	int rc = 0;
 
@@ -111,6 +140,7 @@ vfs_file_begin (int const d_type, register const VFS_Query* const q)
 		    (d_type == DT_LNK ? "SYMLINK" : "FILE"), q->path);    
 	
 	if (q->stbuf) {	
+		q->stbuf->st_ino   = vfs_get_ino (ino, q->path, NULL);
 		q->stbuf->st_mode  = DTTOIF(d_type) | 0444;     
 		q->stbuf->st_nlink = 1;
 		q->stbuf->st_size  = DEFAULT_SIZE; // to be computed latter
@@ -139,6 +169,50 @@ vfs_file_begin (int const d_type, register const VFS_Query* const q)
 }
 
 
+/*****************************************************************************
+ * vfs_entry_begin
+ *****************************************************************************/
+
+const VFS_Query*
+vfs_entry_begin (VFS_Entry* const e, const char* const name, int const d_type,
+		 ino_t const ino, register const VFS_Query* const q)
+{
+	*e = (VFS_Entry) {
+		.name   = name,
+		.d_type = d_type,
+	};
+	// Only compute the attributes, without waiting for unknown ones
+	e->query = (VFS_Query) {
+		.path        = q->path,
+		.stbuf       = &e->stbuf,
+		.stat_nowait = true,
+	};
+	e->stbuf.st_ino   = vfs_get_ino (ino, q->path, name);
+	e->stbuf.st_mode  = DTTOIF(d_type) | 0444;
+	e->stbuf.st_nlink = 1;
+	e->stbuf.st_size  = DEFAULT_SIZE; // to be computed latter
+	vfs_set_time (DEFAULT_TIME, &e->query);
+	return &e->query;
+}
+
+
+/*****************************************************************************
+ * vfs_entry_end
+ *****************************************************************************/
+
+int
+vfs_entry_end (VFS_Entry* const e, register const VFS_Query* const q)
+{
+	// Attributes not known yet : let the caller "stat" the entry
+	if (e->stbuf.st_size < 0)
+		return vfs_dir_add_entry (e->name, e->d_type, 
+					  e->stbuf.st_ino, q); // ------>
+
+	e->stbuf.st_blocks = (e->stbuf.st_size + 511) / 512;
+	return q->stat_filler (q->h, e->name, e->d_type, &e->stbuf);
+}
+
+
 /*****************************************************************************
  * vfs_file_set_string
  *****************************************************************************/
@@ -149,6 +223,11 @@ vfs_file_set_string (const char* const str, FileBuffer_StringAlloc alloc,
 		     register const VFS_Query* const q)
 {
 	if (q->file) {					
+		// The strings are allocated in the temporary pool of the
+		// request : copy them, rather than keeping the whole pool
+		// for the lifetime of the file.
+		if (alloc == FILE_BUFFER_STRING_STEAL)
+			alloc = FILE_BUFFER_STRING_COPY;
 		*(q->file) = FileBuffer_CreateFromString (q->talloc_context, 
 							  str, alloc);
 		if (*(q->file)) {
@@ -171,6 +250,8 @@ vfs_file_set_url (const char* const url, off_t size,
 		  const char* const location,
 		  register const VFS_Query* const q)
 {
+	if (size < 0 && url)
+		size = FileBuffer_ProbeSize (url, ! q->stat_nowait);
 	if (q->file) {							
 		*(q->file) = FileBuffer_CreateFromURL (q->talloc_context, 
 						       url, size);
@@ -183,7 +264,10 @@ vfs_file_set_url (const char* const url, off_t size,
 		q->stbuf->st_size = size;
 		Log_Printf (LOG_DEBUG, "FILE_SET_URL size = %" PRIdMAX,	
 			    (intmax_t) size);
-	} 
+	} else if (url && q->stbuf && q->stat_nowait &&
+		   FileBuffer_IsProbingSize ()) {
+		q->stbuf->st_size = -1; // still being probed
+	}
 }
 
 
@@ -242,6 +326,33 @@ BrowseDebug (VFS* const self, const char* const sub_path,
 			FILE_SET_STRING (str, FILE_BUFFER_STRING_STEAL);
 		} FILE_END;
 
+		FILE_BEGIN("io_sched") {
+			const char* const str = IOSched_GetStatusString
+				(tmp_ctx, "");
+			FILE_SET_STRING (str, FILE_BUFFER_STRING_STEAL);
+		} FILE_END;
+
+		FILE_BEGIN("log") {
+			unsigned long nb_queued = 0, nb_dropped = 0;
+			Log_GetCounters (&nb_queued, &nb_dropped);
+			const char* const str = talloc_asprintf 
+				(tmp_ctx, "Queued messages  = %lu\n"
+				 "Dropped messages = %lu\n",
+				 nb_queued, nb_dropped);
+			FILE_SET_STRING (str, FILE_BUFFER_STRING_STEAL);
+		} FILE_END;
+
+		FILE_BEGIN("trace.json") {
+			const char* const str = Trace_GetChromeJSON (tmp_ctx);
+			FILE_SET_STRING (str, FILE_BUFFER_STRING_STEAL);
+		} FILE_END;
+
+		FILE_BEGIN("metrics") {
+			const char* const str = 
+				Metrics_GetPrometheus (tmp_ctx);
+			FILE_SET_STRING (str, FILE_BUFFER_STRING_STEAL);
+		} FILE_END;
+
 		FILE_BEGIN("talloc_total") {
 			const char* const str = talloc_asprintf 
 				(tmp_ctx, "%" PRIdMAX " bytes\n",
@@ -285,12 +396,15 @@ VFS_Browse (VFS* const self, const VFS_Query* q)
 		return -EFAULT; // ---------->
 
 	Log_Printf (LOG_DEBUG, "fuse browse : looking for '%s' ...", q->path);
+	Trace_Span span;
+	Trace_Begin (&span, "vfs.browse", q->path);
 	
 	// Create a working context for temporary memory allocations
-	void* tmp_ctx = talloc_new (NULL);
+	// (directory listings make many small ones : use a larger pool)
+	void* tmp_ctx = talloc_new_tmp (NULL, 4 * TALLOC_TMP_POOL_SIZE);
 	
 	BROWSE_BEGIN(q->path, q) {
-		_DIR_BEGIN("", true) {
+		_DIR_BEGIN("", true, 0) {
 			VFS_BrowseFunction func = 
 				OBJECT_METHOD (self, browse_root);
 			if (func) {
@@ -324,6 +438,7 @@ VFS_Browse (VFS* const self, const VFS_Query* q)
 	// Delete all temporary storage
 	talloc_free (tmp_ctx);
 	tmp_ctx = NULL;
+	Trace_End (&span);
 	
 	// Adjust some fields
 	if (s.rc == 0 && q->stbuf) {
@@ -41,6 +41,19 @@ OBJECT_DECLARE_CLASS(VFS, Object);
 
 
 
+/*****************************************************************************
+ * @typedef	VFS_StatFiller
+ * @brief	function adding a directory entry, with its attributes.
+ *
+ *	Same as "fuse_dirfil_t", with the attributes which a "stat" of 
+ *	the entry would return (including the file type, in "st_mode").
+ *
+ *****************************************************************************/
+
+typedef int (*VFS_StatFiller) (void* h, const char* name, int type, 
+			       const struct stat* stbuf);
+
+
 /*****************************************************************************
  * @typedef	VFS_Query
  * @brief	query parameters for browse operations on the file system.
@@ -64,6 +77,13 @@ typedef struct _VFS_Query {
 	 * STAT 
 	 */
 	struct stat* stbuf; 
+
+	/*
+	 * If true, do not wait for the attributes which are not known
+	 * yet (e.g. the size of a remote file being probed) : st_size
+	 * is set to -1 instead.
+	 */
+	bool stat_nowait;
 	
 	/* 
 	 * GETDIR 
@@ -71,6 +91,14 @@ typedef struct _VFS_Query {
 	void* h; 
 	fuse_dirfil_t filler; 
 
+	/*
+	 * GETDIR with attributes : if set, the files and symlinks whose 
+	 * attributes are known are added with "stat_filler" instead of
+	 * "filler" (the attributes of sub-directories are never given,
+	 * because computing them would require listing them).
+	 */
+	VFS_StatFiller stat_filler;
+
 	/*
 	 * READ
 	 */
@@ -97,14 +97,23 @@ vfs_match_start_of_path (const char* path, const char* name);
  * Browse helpers
  *****************************************************************************/
 
+/*
+ * Inode number of a file : the one given to DIR_BEGIN_INO / FILE_BEGIN_INO 
+ * if not 0, else a hash of the path of the file.
+ */
+extern ino_t
+vfs_get_ino (ino_t const ino, const char* const dir_path, 
+	     const char* const name);
+
 extern int
-vfs_dir_begin (register const VFS_Query* const q);
+vfs_dir_begin (ino_t const ino, register const VFS_Query* const q);
 
 extern int
-vfs_file_begin (int const d_type, register const VFS_Query* const q);
+vfs_file_begin (int const d_type, ino_t const ino, 
+		register const VFS_Query* const q);
 
 static inline int
-vfs_dir_add_entry (const char* const name, int const d_type,
+vfs_dir_add_entry (const char* const name, int const d_type, ino_t const ino,
 		   register const VFS_Query* const q)
 {
 	int rc = 0;
@@ -113,11 +122,31 @@ vfs_dir_add_entry (const char* const name, int const d_type,
 		q->stbuf->st_nlink++;					
 	
 	if (q->filler) 
-		rc = q->filler (q->h, name, d_type, 0);		
+		rc = q->filler (q->h, name, d_type, 
+				vfs_get_ino (ino, q->path, name));
 	
 	return rc;
 }
 
+/*
+ * Entry of a directory listed with attributes ("stat_filler") : the 
+ * FILE_BEGIN ... FILE_END block of the entry is run with a query which
+ * computes the attributes of the entry only.
+ */
+typedef struct _VFS_Entry {
+	VFS_Query	query;
+	struct stat	stbuf;
+	const char*	name;
+	int		d_type;
+} VFS_Entry;
+
+extern const VFS_Query*
+vfs_entry_begin (VFS_Entry* const e, const char* const name, int const d_type,
+		 ino_t const ino, register const VFS_Query* const q);
+
+extern int
+vfs_entry_end (VFS_Entry* const e, register const VFS_Query* const q);
+
 extern void
 vfs_file_set_string (const char* const str, FileBuffer_StringAlloc alloc,
 		     const char* const location,
@@ -174,21 +203,24 @@ vfs_set_time (const time_t t, register const VFS_Query* const q);
 #define BROWSE_RESULT		_s
 
 
-#define _DIR_BEGIN(BASENAME,ALLOW_EMPTY)				\
+#define _DIR_BEGIN(BASENAME,ALLOW_EMPTY,INO)				\
 	if ((_p = BASENAME) && (*_p || ALLOW_EMPTY)) {			\
 		if (*_s.ptr == '\0') {					\
-			_s.rc = vfs_dir_add_entry (_p, DT_DIR, _q);	\
+			_s.rc = vfs_dir_add_entry (_p, DT_DIR, INO, _q); \
 			if (_s.rc) goto cleanup;			\
 		} else {						\
 			_p = vfs_match_start_of_path (_s.ptr, _p);	\
 			if (_p) {					\
 				_s.ptr = _p;				\
 				if (*_s.ptr == '\0') {			\
-					_s.rc = vfs_dir_begin (_q);	\
+					_s.rc = vfs_dir_begin (INO, _q); \
 					if (_s.rc) goto cleanup;	\
 				}		
 
-#define DIR_BEGIN(BASENAME)	_DIR_BEGIN(BASENAME,false)
+#define DIR_BEGIN(BASENAME)	_DIR_BEGIN(BASENAME,false,0)
+
+// Same as DIR_BEGIN, with a given inode number (not 0)
+#define DIR_BEGIN_INO(BASENAME,INO)	_DIR_BEGIN(BASENAME,false,INO)
 
 #define DIR_END							\
 				if (*_s.ptr != '\0')		\
@@ -198,10 +230,17 @@ vfs_set_time (const time_t t, register const VFS_Query* const q);
 	}
 	
 
-#define _FILE_BEGIN(BASENAME,D_TYPE)					\
+#define _FILE_BEGIN(BASENAME,D_TYPE,INO)				\
 	if ((_p = BASENAME) && *_p) {					\
+		VFS_Entry _e;						\
+		const VFS_Query* _eq = NULL;				\
 		if (*_s.ptr == '\0') {					\
-			_s.rc = vfs_dir_add_entry (_p, D_TYPE, _q);	\
+			if (_q->stat_filler)				\
+				_eq = vfs_entry_begin (&_e, _p, D_TYPE,	\
+						       INO, _q);	\
+			else						\
+				_s.rc = vfs_dir_add_entry (_p, D_TYPE,	\
+							   INO, _q);	\
 		} else {						\
 			_p = vfs_match_start_of_path (_s.ptr, _p);	\
 			if (_p) {					\
@@ -209,10 +248,20 @@ vfs_set_time (const time_t t, register const VFS_Query* const q);
 				if (*_s.ptr != '\0')			\
 					_s.rc = -ENOTDIR;		\
 				else					\
-					_s.rc = vfs_file_begin(D_TYPE,_q); \
-				if (_s.rc) goto cleanup;
+					_s.rc = vfs_file_begin (D_TYPE,	\
+								INO, _q); \
+				if (_s.rc) goto cleanup;		\
+				_eq = _q;				\
+			}						\
+		}							\
+		if (_eq) {						\
+			register const VFS_Query* const _q = _eq;	\
+			(void) _q; /* not used by all file bodies */
+
+#define FILE_BEGIN(BASENAME)	_FILE_BEGIN(BASENAME, DT_REG, 0)
 
-#define FILE_BEGIN(BASENAME)	_FILE_BEGIN(BASENAME, DT_REG)
+// Same as FILE_BEGIN, with a given inode number (not 0)
+#define FILE_BEGIN_INO(BASENAME,INO)	_FILE_BEGIN(BASENAME, DT_REG, INO)
 
 #define FILE_SET_STRING(CONTENT,STRALLOC)				\
 	vfs_file_set_string ((CONTENT), (STRALLOC), __location__, _q)
@@ -221,14 +270,17 @@ vfs_set_time (const time_t t, register const VFS_Query* const q);
 	vfs_file_set_url ((URL), (SIZE), __location__, _q)
 
 #define _FILE_END						\
-			} if (*_s.ptr == '\0') goto cleanup;	\
-		}						\
+		}							\
+		if (_eq == &_e.query)					\
+			_s.rc = vfs_entry_end (&_e, _q);		\
+		else if (_eq)						\
+			goto cleanup;					\
 	}
 
 #define FILE_END		_FILE_END
 
 
-#define SYMLINK_BEGIN(BASENAME)	_FILE_BEGIN(BASENAME, DT_LNK)
+#define SYMLINK_BEGIN(BASENAME)	_FILE_BEGIN(BASENAME, DT_LNK, 0)
 
 #define SYMLINK_SET_PATH(PATH)	vfs_symlink_set_path (PATH, _q)
 						
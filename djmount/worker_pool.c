@@ -0,0 +1,210 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * WorkerPool : a fixed set of threads executing queued jobs.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#	include <config.h>
+#endif
+
+#include "worker_pool.h"
+#include "talloc_util.h"
+#include "log.h"
+
+#include <errno.h>
+#include <string.h>
+#include <upnp/ithread.h>
+
+
+// Initial capacity of the job queue (grows if necessary)
+#define INITIAL_QUEUE_CAPACITY	64
+
+
+typedef struct _QueuedJob {
+	WorkerPool_Job	job;
+	void*		arg;
+} QueuedJob;
+
+
+struct _WorkerPool {
+	const char*	name;
+
+	ithread_mutex_t	mutex;
+	ithread_cond_t	cond;
+	bool		stopping;
+
+	// Circular queue of pending jobs
+	QueuedJob*	queue;
+	size_t		capacity;
+	size_t		head;
+	size_t		length;
+
+	size_t		nb_threads;
+	ithread_t*	threads;
+};
+
+
+/*****************************************************************************
+ * WorkerLoop
+ *****************************************************************************/
+static void*
+WorkerLoop (void* arg)
+{
+	WorkerPool* const pool = (WorkerPool*) arg;
+
+	ithread_mutex_lock (&pool->mutex);
+	while (true) {
+		while (pool->length == 0 && ! pool->stopping)
+			ithread_cond_wait (&pool->cond, &pool->mutex);
+		if (pool->length == 0)
+			break; // stopping, and queue is drained ---------->
+
+		const QueuedJob qj = pool->queue [pool->head];
+		pool->head = (pool->head + 1) % pool->capacity;
+		pool->length--;
+
+		ithread_mutex_unlock (&pool->mutex);
+		qj.job (qj.arg);
+		ithread_mutex_lock (&pool->mutex);
+	}
+	ithread_mutex_unlock (&pool->mutex);
+	return NULL;
+}
+
+
+/*****************************************************************************
+ * DestroyPool
+ *****************************************************************************/
+static int
+DestroyPool (WorkerPool* const pool)
+{
+	ithread_mutex_lock (&pool->mutex);
+	pool->stopping = true;
+	ithread_cond_broadcast (&pool->cond);
+	ithread_mutex_unlock (&pool->mutex);
+
+	size_t i;
+	for (i = 0; i < pool->nb_threads; i++)
+		ithread_join (pool->threads[i], NULL);
+
+	ithread_cond_destroy (&pool->cond);
+	ithread_mutex_destroy (&pool->mutex);
+	return 0; // ok -> deallocate memory
+}
+
+
+/*****************************************************************************
+ * WorkerPool_Create
+ *****************************************************************************/
+WorkerPool*
+WorkerPool_Create (void* talloc_context, const char* name,
+		   size_t nb_threads)
+{
+	if (nb_threads < 1)
+		return NULL; // ---------->
+
+	WorkerPool* const pool = talloc (talloc_context, WorkerPool);
+	if (pool == NULL)
+		return NULL; // ---------->
+
+	*pool = (struct _WorkerPool) {
+		.name       = talloc_strdup (pool, (name ? name : "")),
+		.stopping   = false,
+		.queue      = talloc_array (pool, QueuedJob,
+					    INITIAL_QUEUE_CAPACITY),
+		.capacity   = INITIAL_QUEUE_CAPACITY,
+		.head       = 0,
+		.length     = 0,
+		.nb_threads = 0,
+		.threads    = talloc_array (pool, ithread_t, nb_threads),
+	};
+	if (pool->queue == NULL || pool->threads == NULL) {
+		talloc_free (pool);
+		return NULL; // ---------->
+	}
+	ithread_mutex_init (&pool->mutex, NULL);
+	ithread_cond_init (&pool->cond, NULL);
+	talloc_set_destructor (pool, DestroyPool);
+
+	for (pool->nb_threads = 0; pool->nb_threads < nb_threads;
+	     pool->nb_threads++) {
+		int rc = ithread_create (pool->threads + pool->nb_threads,
+					 NULL, WorkerLoop, pool);
+		if (rc) {
+			Log_Printf (LOG_ERROR, "WorkerPool '%s' : can't create "
+				    "thread %lu : %s", pool->name,
+				    (unsigned long) pool->nb_threads,
+				    strerror (rc));
+			break; // ---------->
+		}
+	}
+	if (pool->nb_threads == 0) {
+		talloc_free (pool);
+		return NULL; // ---------->
+	}
+	Log_Printf (LOG_DEBUG, "WorkerPool '%s' : %lu threads started",
+		    pool->name, (unsigned long) pool->nb_threads);
+	return pool;
+}
+
+
+/*****************************************************************************
+ * WorkerPool_Submit
+ *****************************************************************************/
+int
+WorkerPool_Submit (WorkerPool* pool, WorkerPool_Job job, void* arg)
+{
+	if (pool == NULL || job == NULL)
+		return -EINVAL; // ---------->
+
+	int rc = 0;
+	ithread_mutex_lock (&pool->mutex);
+
+	if (pool->stopping) {
+		rc = -ESHUTDOWN;
+		goto cleanup; // ---------->
+	}
+	if (pool->length >= pool->capacity) {
+		// Grow the queue, and unwrap its content
+		const size_t capacity = pool->capacity * 2;
+		QueuedJob* const queue = talloc_array (pool, QueuedJob,
+						       capacity);
+		if (queue == NULL) {
+			rc = -ENOMEM;
+			goto cleanup; // ---------->
+		}
+		size_t i;
+		for (i = 0; i < pool->length; i++)
+			queue[i] = pool->queue [(pool->head + i) %
+						pool->capacity];
+		talloc_free (pool->queue);
+		pool->queue    = queue;
+		pool->capacity = capacity;
+		pool->head     = 0;
+	}
+	pool->queue [(pool->head + pool->length) % pool->capacity] =
+		(QueuedJob) { .job = job, .arg = arg };
+	pool->length++;
+	ithread_cond_signal (&pool->cond);
+
+cleanup:
+	ithread_mutex_unlock (&pool->mutex);
+	return rc;
+}
+
@@ -0,0 +1,90 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+/* $Id$
+ *
+ * WorkerPool : a fixed set of threads executing queued jobs.
+ * This file is part of djmount.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef WORKER_POOL_H_INCLUDED
+#define WORKER_POOL_H_INCLUDED
+
+#include <stddef.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/******************************************************************************
+ * @var WorkerPool
+ *
+ *	This opaque type encapsulates a fixed number of threads, which
+ *	execute the jobs submitted to the pool in FIFO order.
+ *	All functions in this API are thread safe (except destruction).
+ *
+ *	The pool is destroyed with "talloc_free" : the jobs already
+ *	submitted are executed, then the threads are stopped.
+ *
+ *****************************************************************************/
+
+typedef struct _WorkerPool WorkerPool;
+
+
+/******************************************************************************
+ * @var WorkerPool_Job
+ *
+ *	Function executed in a worker thread.
+ *	The job owns 'arg' (if it needs to be freed).
+ *
+ *****************************************************************************/
+
+typedef void (*WorkerPool_Job) (void* arg);
+
+
+/*****************************************************************************
+ * @brief 	Creates a new pool, and starts its threads.
+ *
+ * @param talloc_context	the talloc parent context
+ * @param name			name of the pool (for logs)
+ * @param nb_threads		number of worker threads (> 0)
+ * @return			the new pool, or NULL if error.
+ *****************************************************************************/
+WorkerPool*
+WorkerPool_Create (void* talloc_context, const char* name,
+		   size_t nb_threads);
+
+
+/*****************************************************************************
+ * @brief 	Queue a job for execution in one of the worker threads.
+ *
+ * @param pool		the WorkerPool object
+ * @param job		the function to execute
+ * @param arg		the argument given to the function
+ * @return		0 if ok, or < 0 if error (the job is not queued).
+ *****************************************************************************/
+int
+WorkerPool_Submit (WorkerPool* pool, WorkerPool_Job job, void* arg);
+
+
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
+
+#endif // WORKER_POOL_H_INCLUDED